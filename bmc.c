@@ -25,60 +25,68 @@
 #include "hexdump.h"
 #endif
 
-int ipmi_verbose = 0;
-
-static bool is_open = false;
-static char *ipmi_dev = NULL;
-static int ipmi_fd = -1;
-
-int
-ipmi_if_open(char *dev) {
-	if (is_open) {
-		PROM_WARN("IPMI device '%s' already open.", ipmi_dev);
-		return 0;
+struct ipmi_drv {
+	char *dev;
+	int fd;
+	bool warned;				// about bridged requests
+	char data[sizeof(((struct ipmi_rs *) 0)->data)];	// getmsg buffer
+};
+
+static ipmi_drv_t *
+ipmi_drv_open(char *dev) {
+	ipmi_drv_t *drv = malloc(sizeof(ipmi_drv_t));
+
+	if (drv == NULL) {
+		PROM_FATAL("Unable to allocate IPMI device handle.", "");
+		return NULL;
 	}
-	ipmi_dev = (dev == NULL) ? strdup("/dev/bmc") : strdup(dev);
-	PROM_INFO("Using IPMI device '%s' ...", ipmi_dev);
-	ipmi_fd = open(ipmi_dev, O_RDWR | O_NONBLOCK);
-	if (ipmi_fd < 0) {
-		PROM_FATAL("Unable to open '%s' in RW mode.", ipmi_dev);
-		free(ipmi_dev);
-		ipmi_dev = NULL;	
-		return 1;
+	drv->dev = (dev == NULL) ? strdup("/dev/bmc") : strdup(dev);
+	drv->warned = false;
+	PROM_INFO("Using IPMI device '%s' ...", drv->dev);
+	drv->fd = open(drv->dev, O_RDWR | O_NONBLOCK);
+	if (drv->fd < 0) {
+		PROM_FATAL("Unable to open '%s' in RW mode.", drv->dev);
+		free(drv->dev);
+		free(drv);
+		return NULL;
 	}
-	is_open = true;
 
-	return 0;
+	return drv;
 }
 
-void
-ipmi_if_close(void) {
-	if (is_open && ipmi_fd >= 0) {
-		PROM_DEBUG("Closing IPMI device '%s'.", ipmi_dev);
-		close(ipmi_fd);
-		free(ipmi_dev);
-		ipmi_dev = NULL;
-		ipmi_fd = -1;
+static void
+ipmi_drv_close(ipmi_drv_t *drv) {
+	if (drv == NULL)
+		return;
+	if (drv->fd >= 0) {
+		PROM_DEBUG("Closing IPMI device '%s'.", drv->dev);
+		close(drv->fd);
 	}
-	is_open = false;
+	free(drv->dev);
+	free(drv);
 }
 
+static int
+ipmi_drv_fd(ipmi_drv_t *drv) {
+	return drv == NULL ? -1 : drv->fd;
+}
+
+
 // If msg queue is full on send or empty on read, wait ms milliseconds and try
-// again. BMC stuff is not thread-safe, so one sleep_time for send & recv is ok.
+// again.
 #define WAIT_TIME_IN_MS 1
 static const struct timespec sleep_time =
 	{ .tv_sec = 0, .tv_nsec = WAIT_TIME_IN_MS * 1000000 };
 
-int
-ipmi_send(struct ipmi_rq *req) {
+static int
+ipmi_drv_send(ipmi_drv_t *drv, struct ipmi_rq *req, long msgid,
+	long timeout)
+{
 	struct strbuf sb;
 	int res = 0, maxtries;
 
-	static uint32_t curr_seq = 0;
-
-	if (req == NULL)
-		return -1;
-	if (! (is_open && ipmi_fd >= 0)) {
+	(void) timeout;		// bmc(4D) does not allow to tune its timeouts
+	if (drv == NULL || drv->fd < 0) {
 		PROM_FATAL("IPMI device not opened.", "");
 		return -2;
 	}
@@ -91,6 +99,15 @@ ipmi_send(struct ipmi_rq *req) {
 			hexdump(req->msg.data, req->msg.data_len, 1));
 #endif
 
+	// bmc(4D) talks to the BMC only and has no notion of IPMB addresses
+	if (req->addr != 0) {
+		if (!drv->warned)
+			PROM_WARN("bmc(4D) does not support bridged requests (addr=0x%02x)"
+				" - sensors of satellite controllers cannot be read.", req->addr);
+		drv->warned = true;
+		return -3;
+	}
+
 	int msgsz = offsetof(bmc_msg_t, msg) + sizeof(bmc_req_t);
 	if (req->msg.data_len > SEND_MAX_PAYLOAD_SIZE)
 		msgsz += (req->msg.data_len - SEND_MAX_PAYLOAD_SIZE);
@@ -98,9 +115,9 @@ ipmi_send(struct ipmi_rq *req) {
 	bmc_req_t *_req = (bmc_req_t *)&msg->msg[0];
 
 	msg->m_type = BMC_MSG_REQUEST;
-	msg->m_id = curr_seq++;
+	msg->m_id = msgid;
 	_req->fn = req->msg.netfn;
-	_req->lun = 0;
+	_req->lun = req->msg.lun;
 	_req->cmd = req->msg.cmd;
 	_req->datalength = req->msg.data_len;
 	memcpy(_req->data, req->msg.data, req->msg.data_len);
@@ -110,7 +127,7 @@ ipmi_send(struct ipmi_rq *req) {
 	maxtries = 2 * 1000 / WAIT_TIME_IN_MS;	// wait max. 2s
 
 	while (maxtries > 0) {
-		if (putmsg(ipmi_fd, NULL, &sb, 0) < 0) {
+		if (putmsg(drv->fd, NULL, &sb, 0) < 0) {
 			if ((errno == EAGAIN) && (maxtries > 0)) {
 #ifdef DEBUG_IPMI_IF
 				PROM_DEBUG("Message queue full - sleeping %d ms.",
@@ -125,9 +142,8 @@ ipmi_send(struct ipmi_rq *req) {
 				msg->m_id, req->msg.netfn, req->msg.cmd, str);
 			res = -3;
 		} else {
-			res = msg->m_id;
 #ifdef DEBUG_IPMI_IF
-			PROM_DEBUG("done. msgId: %d", res);
+			PROM_DEBUG("done. msgId: %d", msg->m_id);
 #endif
 		}
 		break;
@@ -141,41 +157,41 @@ ipmi_send(struct ipmi_rq *req) {
 }
 
 
-struct ipmi_rs *
-ipmi_recv(long msgid, long timeout) {
+static int
+ipmi_drv_recv(ipmi_drv_t *drv, struct ipmi_rs *rsp, long *msgid, long timeout)
+{
 	bmc_msg_t *msg;
 	int flags = 0, maxtries, rem;
+	struct strbuf sb;
 
-	static struct strbuf sb;
-	static struct ipmi_rs rsp;
-	static char data[sizeof(rsp.data)];
-
-	if (! (is_open && ipmi_fd >= 0)) {
+	if (drv == NULL || drv->fd < 0) {
 		PROM_FATAL("IPMI device not opened.", "");
-		return NULL;
+		return -2;
 	}
 
-	memset(&rsp, 0, sizeof (struct ipmi_rs));
-	sb.buf = data;
+	sb.buf = drv->data;
 	msg = (bmc_msg_t *)sb.buf;
-	sb.maxlen = sizeof(data);
+	sb.maxlen = sizeof(drv->data);
 
-	maxtries = ((timeout <= 0) ? 5: timeout) * 1000 / WAIT_TIME_IN_MS;
+	// timeout < 0: just a single try
+	maxtries = timeout < 0 ? 0 : timeout / WAIT_TIME_IN_MS;
 	rem = maxtries;
 
 again:
 	msg->m_type = 0;
-	while (maxtries > 0) {
-		if (getmsg(ipmi_fd, NULL, &sb, &flags) >= 0)
+	while (true) {
+		if (getmsg(drv->fd, NULL, &sb, &flags) >= 0)
 			break;
 		if ((errno == EAGAIN) && (maxtries > 0)) {
 			nanosleep(&sleep_time, NULL);
 			maxtries--;
 			continue;
 		}
+		if (errno == EAGAIN)
+			return 0;
 		char *str = strerror(errno);
-		PROM_WARN("Fetching data for request %d failed: %s", msgid, str);
-		return NULL;
+		PROM_WARN("Fetching a response failed: %s", str);
+		return -1;
 	}
 	if (ipmi_verbose > 1)
 		PROM_DEBUG("Slept %d times for %d ms", rem - maxtries, WAIT_TIME_IN_MS);
@@ -183,32 +199,40 @@ again:
 	bmc_rsp_t *bmc_res;
 	if (msg->m_type == BMC_MSG_ERROR) {
 		char *str = strerror(msg->msg[0]);
-		PROM_WARN("Error for request %d: %s", msgid, str);
-		return NULL;
+		PROM_WARN("Error for request %d: %s", msg->m_id, str);
+		*msgid = msg->m_id;
+		rsp->ccode = 0xFF;		// unspecified error
+		rsp->data_len = 0;
+		return 1;
 	} else if (msg->m_type != BMC_MSG_RESPONSE) {
 		PROM_WARN("Unexpected msg type 0x%02x - message %d ignored.",
 			msg->m_type, msg->m_id);
-		return NULL;
-	}
-	if (msgid != msg->m_id) {
-		PROM_WARN("Oooops, fetched an unexpected message: %d != %d - %s.",
-			msg->m_id, msgid, (maxtries > 0) ? "retrying" : "giving up");
 		if (maxtries > 0)
 			goto again;
-		else
-			return NULL;
+		return 0;
 	}
 
 	// de-couple response from the running OS
 	bmc_res = (bmc_rsp_t *)&msg->msg[0];
 #ifdef DEBUG_IPMI_IF
-	PROM_DEBUG("Raw response (1 + %d bytes):\n%s\n", bmc_res->datalength,
+	PROM_DEBUG("Raw response %d (1 + %d bytes):\n%s\n", msg->m_id,
+		bmc_res->datalength,
 		hexdump((const uint8_t *) bmc_res->data, bmc_res->datalength, 1));
 #endif
-	rsp.ccode = bmc_res->ccode;
-	rsp.data_len = bmc_res->datalength;
-	if (rsp.data_len > 0)
-		memcpy(rsp.data, bmc_res->data, rsp.data_len);
+	*msgid = msg->m_id;
+	rsp->ccode = bmc_res->ccode;
+	rsp->data_len = bmc_res->datalength;
+	if (rsp->data_len > 0)
+		memcpy(rsp->data, bmc_res->data, rsp->data_len);
 
-	return &rsp;
+	return 1;
 }
+
+const ipmi_drv_ops_t ipmi_drv_os = {
+	.prefix = "",
+	.open = ipmi_drv_open,
+	.close = ipmi_drv_close,
+	.send = ipmi_drv_send,
+	.recv = ipmi_drv_recv,
+	.fd = ipmi_drv_fd
+};
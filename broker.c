@@ -0,0 +1,315 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file broker.c
+ * Local IPMI request broker (see broker.h). It runs in the main thread, which
+ * would otherwise just pause(2). Client requests get submitted via
+ * ipmi_submit() and the event loop of the device context gets run in short
+ * slices, each one holding the lock, so that scrapes get delayed by at most
+ * one slice. While a scrape is running, its ipmi_recv() calls complete
+ * pending broker requests as well.
+ */
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "broker.h"
+
+#define BROKER_CLIENTS_MAX	16		// max. number of connected clients
+#define BROKER_PENDING_MAX	32		// max. requests in progress per client
+#define BROKER_SLICE		20		// ms to run the event loop per round
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL		0
+#endif
+
+typedef struct client {
+	int fd;
+	bool dead;				// EOF or error, closed when nothing is pending
+	int pending;			// requests in progress
+	size_t have;			// bytes in buf
+	uint8_t buf[sizeof(broker_rq_t) + IPMI_RQ_DATA_MAX];
+} client_t;
+
+struct broker {
+	char *path;
+	int fd;
+	ipmi_ctx_t **ctx;
+	pthread_mutex_t *lock;
+	int pending;			// requests in progress of all clients
+	client_t *client[BROKER_CLIENTS_MAX];
+};
+
+// a request in progress
+typedef struct job {
+	broker_t *b;
+	client_t *c;
+	uint32_t tag;
+	uint8_t netfn;
+	uint8_t cmd;
+} job_t;
+
+static void
+reply(client_t *c, uint32_t tag, uint8_t netfn, uint8_t cmd, uint8_t status,
+	struct ipmi_rs *rsp)
+{
+	uint8_t buf[sizeof(broker_rs_t) + sizeof(rsp->data)];
+	broker_rs_t *rs = (broker_rs_t *) buf;
+	size_t len;
+
+	if (c->dead)
+		return;
+	rs->tag = tag;
+	rs->netfn = netfn;
+	rs->cmd = cmd;
+	rs->status = status;
+	rs->ccode = (rsp == NULL) ? 0 : rsp->ccode;
+	rs->len = (rsp == NULL || rsp->data_len < 0) ? 0 : rsp->data_len;
+	if (rs->len > 0)
+		memcpy(buf + sizeof(broker_rs_t), rsp->data, rs->len);
+	len = sizeof(broker_rs_t) + rs->len;
+	// a client, which does not read its responses, gets dropped
+	if (send(c->fd, buf, len, MSG_NOSIGNAL) != (ssize_t) len) {
+		if (errno == EPIPE || errno == ECONNRESET) {
+			PROM_DEBUG("Broker client %d gone.", c->fd);
+		} else {
+			PROM_WARN("Broker client %d does not read. Dropped.", c->fd);
+		}
+		c->dead = true;
+	}
+}
+
+// completion callback, invoked with the lock held
+static void
+done(long msgid, struct ipmi_rs *rsp, void *arg) {
+	job_t *j = arg;
+
+	(void) msgid;
+	reply(j->c, j->tag, j->netfn, j->cmd,
+		rsp == NULL ? BROKER_FAILED : BROKER_OK, rsp);
+	j->c->pending--;
+	j->b->pending--;
+	free(j);
+}
+
+static void
+submit(broker_t *b, client_t *c, broker_rq_t *rq, uint8_t *data) {
+	struct ipmi_rq req;
+	job_t *j = malloc(sizeof(job_t));
+
+	if (j == NULL) {
+		reply(c, rq->tag, rq->netfn, rq->cmd, BROKER_FAILED, NULL);
+		return;
+	}
+	j->b = b;
+	j->c = c;
+	j->tag = rq->tag;
+	j->netfn = rq->netfn;
+	j->cmd = rq->cmd;
+	req.msg.netfn = rq->netfn;
+	req.addr = rq->addr;
+	req.channel = rq->lun >> 4;
+	req.msg.lun = rq->lun & 3;
+	req.msg.cmd = rq->cmd;
+	req.msg.data_len = rq->len;
+	req.msg.data = data;
+	pthread_mutex_lock(b->lock);
+	if (*(b->ctx) == NULL
+		|| ipmi_submit(*(b->ctx), &req, rq->timeout, done, j) < 0)
+	{
+		reply(c, rq->tag, rq->netfn, rq->cmd, BROKER_FAILED, NULL);
+		free(j);
+	} else {
+		c->pending++;
+		b->pending++;
+	}
+	pthread_mutex_unlock(b->lock);
+}
+
+// read from the given client and submit all complete requests received.
+// The lock protects the state shared with the completion callbacks.
+static void
+serve(broker_t *b, client_t *c) {
+	broker_rq_t rq;
+	ssize_t n;
+	size_t len;
+
+	n = recv(c->fd, c->buf + c->have, sizeof(c->buf) - c->have, 0);
+	if (n <= 0) {
+		if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+			pthread_mutex_lock(b->lock);
+			c->dead = true;
+			pthread_mutex_unlock(b->lock);
+		}
+		return;
+	}
+	c->have += n;
+	while (c->have >= sizeof(broker_rq_t)) {
+		memcpy(&rq, c->buf, sizeof(rq));
+		if (rq.len > IPMI_RQ_DATA_MAX || rq.netfn > 0x3F
+			|| (rq.lun & 0x0C) != 0)
+		{
+			pthread_mutex_lock(b->lock);
+			reply(c, rq.tag, rq.netfn, rq.cmd, BROKER_INVALID, NULL);
+			c->dead = true;
+			pthread_mutex_unlock(b->lock);
+			return;
+		}
+		len = sizeof(broker_rq_t) + rq.len;
+		if (c->have < len)
+			break;
+		submit(b, c, &rq, c->buf + sizeof(broker_rq_t));
+		c->have -= len;
+		memmove(c->buf, c->buf + len, c->have);
+	}
+}
+
+static void
+accept_client(broker_t *b) {
+	int fd, i;
+
+	if ((fd = accept(b->fd, NULL, NULL)) < 0)
+		return;
+	for (i = 0; i < BROKER_CLIENTS_MAX && b->client[i] != NULL; i++)
+		;
+	if (i == BROKER_CLIENTS_MAX || (b->client[i] = calloc(1, sizeof(client_t)))
+		== NULL)
+	{
+		PROM_WARN("Too many broker clients. Connection refused.", "");
+		close(fd);
+		return;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	b->client[i]->fd = fd;
+	PROM_DEBUG("Broker client %d connected.", fd);
+}
+
+broker_t *
+broker_open(const char *path, ipmi_ctx_t **ctx, pthread_mutex_t *lock) {
+	struct sockaddr_un addr;
+	struct stat st;
+	broker_t *b;
+
+	if (path == NULL || strlen(path) >= sizeof(addr.sun_path)) {
+		PROM_FATAL("Invalid broker socket path '%s'.", path ? path : "");
+		return NULL;
+	}
+	if ((b = calloc(1, sizeof(broker_t))) == NULL
+		|| (b->path = strdup(path)) == NULL)
+	{
+		PROM_FATAL("Unable to allocate broker.", "");
+		free(b);
+		return NULL;
+	}
+	b->ctx = ctx;
+	b->lock = lock;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if ((b->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+		|| bind(b->fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+		|| chmod(path, 0660) != 0
+		|| listen(b->fd, BROKER_CLIENTS_MAX) != 0)
+	{
+		PROM_FATAL("Unable to create broker socket '%s': %s", path,
+			strerror(errno));
+		if (b->fd >= 0)
+			close(b->fd);
+		free(b->path);
+		free(b);
+		return NULL;
+	}
+	fcntl(b->fd, F_SETFD, FD_CLOEXEC);
+	PROM_INFO("IPMI broker listening on '%s'.", path);
+	return b;
+}
+
+void
+broker_run(broker_t *b) {
+	struct pollfd pfd[BROKER_CLIENTS_MAX + 1];
+	client_t *idx[BROKER_CLIENTS_MAX + 1];
+	int i, n, pending;
+
+	for (;;) {
+		// drop disconnected clients, once their requests are done
+		pthread_mutex_lock(b->lock);
+		for (i = 0; i < BROKER_CLIENTS_MAX; i++) {
+			client_t *c = b->client[i];
+			if (c != NULL && c->dead && c->pending == 0) {
+				PROM_DEBUG("Broker client %d disconnected.", c->fd);
+				close(c->fd);
+				free(c);
+				b->client[i] = NULL;
+			}
+		}
+		n = 0;
+		pfd[n].fd = b->fd;
+		pfd[n++].events = POLLIN;
+		for (i = 0; i < BROKER_CLIENTS_MAX; i++) {
+			client_t *c = b->client[i];
+			// no reading while too busy: lets the client block
+			if (c == NULL || c->dead || c->pending >= BROKER_PENDING_MAX)
+				continue;
+			idx[n] = c;
+			pfd[n].fd = c->fd;
+			pfd[n++].events = POLLIN;
+		}
+		pending = b->pending;
+		pthread_mutex_unlock(b->lock);
+
+		if (poll(pfd, n, pending > 0 ? 1 : -1) < 0) {
+			if (errno == EINTR)
+				return;
+			PROM_ERROR("Broker poll failed: %s", strerror(errno));
+			return;
+		}
+		if (pfd[0].revents & POLLIN)
+			accept_client(b);
+		for (i = 1; i < n; i++) {
+			if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+				serve(b, idx[i]);
+		}
+		pthread_mutex_lock(b->lock);
+		if (b->pending > 0 && *(b->ctx) != NULL)
+			ipmi_dispatch(*(b->ctx), BROKER_SLICE);
+		pthread_mutex_unlock(b->lock);
+	}
+}
+
+void
+broker_close(broker_t *b) {
+	int i;
+
+	if (b == NULL)
+		return;
+	for (i = 0; i < BROKER_CLIENTS_MAX; i++) {
+		if (b->client[i] != NULL) {
+			close(b->client[i]->fd);
+			free(b->client[i]);
+		}
+	}
+	close(b->fd);
+	unlink(b->path);
+	free(b->path);
+	free(b);
+}
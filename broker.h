@@ -0,0 +1,104 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file broker.h
+ * Local IPMI request broker. Other tools on the same host may send raw IPMI
+ * requests to ipmimex via a Unix stream socket instead of opening the BMC
+ * themselves. The requests get submitted to the device context used for
+ * scraping and thus share its window, priority classes and rate limit, so
+ * that all users of the BMC cooperate instead of fighting over it.
+ *
+ * Wire format (all numbers in host byte order): a client sends any number of
+ * requests, each a \c broker_rq_t immediately followed by \c len data bytes.
+ * For each request the broker sends a \c broker_rs_t immediately followed by
+ * \c len response data bytes (w/o completion code). Responses may arrive in
+ * another order than the requests have been sent, the \c tag chosen by the
+ * client identifies the request a response belongs to. Requests with an
+ * \c addr get bridged by the BMC to the satellite controller with this
+ * address on the given channel.
+ */
+
+#ifndef IPMIMEX_BROKER_H
+#define IPMIMEX_BROKER_H
+
+#include <pthread.h>
+#include <inttypes.h>
+
+#include "mach.h"
+#include "ipmi_if.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BROKER_OK			0	// response received, see ccode
+#define BROKER_FAILED		1	// request failed or timed out
+#define BROKER_INVALID		2	// malformed request
+
+#pragma pack(push,1)
+
+typedef struct broker_rq {
+	uint32_t tag;			// returned as is in the response
+	uint8_t netfn;
+	uint8_t lun;			// [7:4] channel if addr != 0, [1:0] LUN
+	uint8_t cmd;
+	uint8_t addr;			// IPMB slave address to bridge to, 0 .. BMC
+	uint16_t timeout;		// ms to wait for the answer, 0 .. adaptive
+	uint16_t len;			// number of data bytes following
+} PACKED broker_rq_t;
+
+typedef struct broker_rs {
+	uint32_t tag;
+	uint8_t netfn;
+	uint8_t cmd;
+	uint8_t ccode;			// completion code, valid if status is BROKER_OK
+	uint8_t status;			// BROKER_OK, BROKER_FAILED or BROKER_INVALID
+	uint16_t len;			// number of data bytes following
+} PACKED broker_rs_t;
+
+#pragma pack(pop)
+
+/** @brief	Opaque handle of a broker. */
+typedef struct broker broker_t;
+
+/**
+ * @brief	Create the Unix socket for the broker. A stale socket with the
+ *	same name gets removed before.
+ * @param path	The path of the socket to create.
+ * @param ctx	Where the context of the device to use can be found. The
+ *	context may change (e.g. get re-opened) or be \c NULL, as long as the
+ *	given \c lock is held.
+ * @param lock	The lock, which protects the context.
+ * @return \c NULL on error, the broker handle otherwise.
+ */
+broker_t *broker_open(const char *path, ipmi_ctx_t **ctx,
+	pthread_mutex_t *lock);
+
+/**
+ * @brief	Accept clients and serve their requests. Like pause(2) it returns
+ *	only, if a signal has been caught.
+ * @param b	The broker to run.
+ */
+void broker_run(broker_t *b);
+
+/**
+ * @brief	Disconnect all clients, remove the socket and free the handle.
+ *	Must be called after the device context has been closed.
+ *	Ignored if \c b is \c NULL.
+ */
+void broker_close(broker_t *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// IPMIMEX_BROKER_H
@@ -31,12 +31,24 @@ extern "C" {
 
 typedef struct scan_cfg {
 	char *bmc;
+	char *label;			// value of the device label, NULL .. none
+	char *capture;
+	char *sdr_cache;		// file to persist the SDRs, NULL .. none
+	char *fru_cache;		// file to persist the FRU data, NULL .. none
+	char *sel_cursor;		// file to persist the SEL cursor, NULL .. none
 	bool drop_no_read;
 	bool ignore_disabled_flag;
 	bool no_state;
 	bool no_thresholds;
 	bool no_ipmi;
 	bool no_dcmi;
+	bool no_fru;
+	bool no_sel;
+	int window;
+	long tmo_fast;
+	long tmo_slow;
+	double rate;
+	int burst;
 	regex_t *exc_metrics;
 	regex_t *exc_sensors;
 	regex_t *inc_metrics;
@@ -66,6 +78,42 @@ typedef struct scan_cfg {
 #define IPMIMEXM_DCMI_PSAMPLE_D "DCMI sample period for min, max and average power in seconds."
 #define IPMIMEXM_DCMI_PSAMPLE_T "gauge"
 #define IPMIMEXM_DCMI_PSAMPLE_N "ipmimex_dcmi_power_sample_seconds"
+#define IPMIMEXM_BREAKER_D "State of the circuit breaker of sensors, which could not be read several times in a row (0 .. closed, 1 .. half-open, 2 .. open)."
+#define IPMIMEXM_BREAKER_T "gauge"
+#define IPMIMEXM_BREAKER_N "ipmimex_sensor_breaker"
+
+#define IPMIMEXM_STALE_D "Age of the IPMI and DCMI metrics in seconds. A value > 0 indicates, that the BMC does not answer and the last known values got emitted."
+#define IPMIMEXM_STALE_T "gauge"
+#define IPMIMEXM_STALE_N "ipmimex_stale_seconds"
+
+#define IPMIMEXM_THROTTLED_CMDS_D "Number of IPMI commands, which had to wait because of the rate limit."
+#define IPMIMEXM_THROTTLED_CMDS_T "counter"
+#define IPMIMEXM_THROTTLED_CMDS_N "ipmimex_throttled_commands_total"
+
+#define IPMIMEXM_THROTTLED_TIME_D "Total time IPMI commands had to wait because of the rate limit in seconds."
+#define IPMIMEXM_THROTTLED_TIME_T "counter"
+#define IPMIMEXM_THROTTLED_TIME_N "ipmimex_throttled_seconds_total"
+
+#define IPMIMEXM_SDR_CHECK_REQS_D "Number of IPMI requests the last check for SDR repository changes needed."
+#define IPMIMEXM_SDR_CHECK_REQS_T "gauge"
+#define IPMIMEXM_SDR_CHECK_REQS_N "ipmimex_sdr_check_requests"
+
+#define IPMIMEXM_SDR_CHECK_TIME_D "Time the last check for SDR repository changes took in seconds."
+#define IPMIMEXM_SDR_CHECK_TIME_T "gauge"
+#define IPMIMEXM_SDR_CHECK_TIME_N "ipmimex_sdr_check_seconds"
+
+#define IPMIMEXM_FRU_D "FRU inventory information of the BMC and its satellites."
+#define IPMIMEXM_FRU_T "gauge"
+#define IPMIMEXM_FRU_N "ipmimex_fru_info"
+
+#define IPMIMEXM_SEL_EVENTS_D "Number of system events logged in the SEL."
+#define IPMIMEXM_SEL_EVENTS_T "counter"
+#define IPMIMEXM_SEL_EVENTS_N "ipmimex_sel_events_total"
+
+#define IPMIMEXM_SEL_ENTRIES_D "Number of entries in the SEL."
+#define IPMIMEXM_SEL_ENTRIES_T "gauge"
+#define IPMIMEXM_SEL_ENTRIES_N "ipmimex_sel_entries"
+
 /*
 #define IPMIMEXM_XXX_D "short description."
 #define IPMIMEXM_XXX_T "gauge"
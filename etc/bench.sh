@@ -0,0 +1,22 @@
+#!/bin/bash
+# Measure the time ipmimex needs to discover, filter and expose the 5000
+# sensors described by ipmimex-bench.sim in one-shot mode.
+# Usage: bench.sh [path/to/ipmimex [runs]]
+
+IPMIMEX=${1:-./ipmimex}
+RUNS=${2:-5}
+SIM="$(cd "${0%/*}" && pwd)/ipmimex-bench.sim"
+TIMEFORMAT='%3R s real, %3U s user, %3S s sys'
+
+if [[ ! -x ${IPMIMEX} ]]; then
+	echo "${IPMIMEX} not found. Run 'make' first." >&2
+	exit 1
+fi
+N=$(${IPMIMEX} -b sim:${SIM} 2>/dev/null | grep -c '^ipmimex_sensor_breaker{')
+if (( N != 5000 )); then
+	echo "Expected 5000 sensors, got ${N}." >&2
+	exit 2
+fi
+for (( i = 1; i <= RUNS; i++ )); do
+	time ${IPMIMEX} -b sim:${SIM} >/dev/null 2>&1
+done
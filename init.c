@@ -10,6 +10,7 @@
  */
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <prom.h>
 
@@ -18,18 +19,52 @@
 #include "ipmi_if.h"
 #include "ipmi_sdr.h"
 #include "ipmi_sdr_convert.h"
+#include "ipmi_sdr_store.h"
+#include "ipmi_fru.h"
+#include "ipmi_sel.h"
 
 #include "prom_ipmi.h"
 
-static uint8_t started = 0;
-
 #define WAIT4REPO_SLOT	10			// seconds
 #define MAX_WAIT4REPO	300			// seconds
+#define HANG_FAILS		8			// failed requests in a row indicating a hang
+#define REOPEN_BACKOFF	5			// seconds
+#define REOPEN_BACKOFF_MAX	300		// seconds
+#define YIELD_PAUSE		1000000		// ns to let others grab the device lock
+#define SEL_BATCH		256			// SEL records to read before storing the cursor
 
 static char *versionProm = NULL;	// version string emitted via /metrics
 static char *versionHR = NULL;		// version string emitted to stdout/stderr
-static char *bmcVersion = NULL;
-static bool bmc_version_done = false;
+
+// All prom unit names seen so far. There are just a few distinct ones, so
+// sensors share them instead of having a copy each. Never freed.
+typedef struct unit_name {
+	struct unit_name *next;
+	char name[];
+} unit_name_t;
+
+static unit_name_t *units = NULL;
+static pthread_mutex_t units_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the shared prom unit name of the given unit, NULL if out of memory
+static const char *
+unit_intern(unit_t *u) {
+	const char *name = unit2prom(u);
+	unit_name_t *e;
+
+	pthread_mutex_lock(&units_lock);
+	for (e = units; e != NULL && strcmp(e->name, name) != 0; e = e->next)
+		;
+	if (e == NULL && (e = malloc(sizeof(unit_name_t) + strlen(name) + 1))
+		!= NULL)
+	{
+		strcpy(e->name, name);
+		e->next = units;
+		units = e;
+	}
+	pthread_mutex_unlock(&units_lock);
+	return e == NULL ? NULL : e->name;
+}
 
 static int
 cmp_sensor(const void *p1, const void *p2) {
@@ -38,17 +73,31 @@ cmp_sensor(const void *p1, const void *p2) {
 	int d = a->category - b->category;
 	if (d !=0)
 		return d;
-	d = strcmp(a->prom.unit, b->prom.unit);
+	// unit names are shared, so equal ones have the same address
+	d = a->prom.unit == b->prom.unit ? 0 : strcmp(a->prom.unit, b->prom.unit);
 	if (d != 0)
 		return d;
 	return strcmp(a->prom.name, b->prom.name);
 }
 
+// true if the given sensors get exposed via the same metric
+static bool
+same_metric(sensor_t *a, sensor_t *b) {
+	const char *ca, *cb;
+
+	if (a->prom.unit != b->prom.unit)
+		return false;
+	if (a->category == b->category)
+		return true;
+	ca = category2prom(a->category);
+	cb = category2prom(b->category);
+	return ca == cb || (ca != NULL && cb != NULL && strcmp(ca, cb) == 0);
+}
+
 static sensor_t *
 sort_sensors(sensor_t *list, size_t sz) {
-	size_t n;
-	int len;
-	char buf[64];	// metric name buffer - should be more than sufficient
+	size_t n, len;
+	char *name;
 
 	if (list == NULL)
 		return NULL;
@@ -61,22 +110,39 @@ sort_sensors(sensor_t *list, size_t sz) {
 	e = list;
 	n = 0;
 	while (e != NULL) {
+		if (n == sz)
+			break;
 		sa[n] = e;
 
-		strcpy(buf, e->name);
-		len = strlen(buf);
-		if ((e->category == 1) && ((strcmp(buf + len - 5, " Temp") == 0)
-			|| (strcmp(buf + len - 5, "_TEMP") == 0)))
+		// just enough to sort prom output like. The prom name is either the
+		// sensor name itself or a shortened copy stored behind it.
+		e->prom.name = e->name;
+		len = strlen(e->name);
+		if ((e->category == 1) && len >= 5
+			&& ((strcmp(e->name + len - 5, " Temp") == 0)
+			|| (strcmp(e->name + len - 5, "_TEMP") == 0)))
 		{
-			buf[len-5] = '\0';
+			if ((name = realloc(e->name, 2 * len - 3)) == NULL) {
+				perror("sort sensors: ");
+				free(sa);
+				return NULL;
+			}
+			e->name = name;
+			e->prom.name = name + len + 1;
+			memcpy(e->prom.name, name, len - 5);
+			e->prom.name[len - 5] = '\0';
+		}
+		if ((e->prom.unit = unit_intern(&(e->unit))) == NULL) {
+			perror("sort sensors: ");
+			free(sa);
+			return NULL;
 		}
-		// just enough to sort prom output like
-		e->prom.name = strdup(buf);
-		e->prom.unit = strdup(unit2prom(&(e->unit)));
 
 		e = e->next;
 		n++;
 	}
+	if (e != NULL)
+		n++;
 	if (sz != n) {
 		PROM_FATAL("Software bug: sz != c (%ld != %ld)", sz, n);
 		free(sa);
@@ -92,28 +158,121 @@ sort_sensors(sensor_t *list, size_t sz) {
 	return e;
 }
 
+// merge the given lists, both sorted by cmp_sensor()
+static sensor_t *
+merge_sensors(sensor_t *a, sensor_t *b) {
+	sensor_t *head = NULL, **p = &head;
+
+	while (a != NULL && b != NULL) {
+		if (cmp_sensor(&a, &b) <= 0) {
+			*p = a;
+			a = a->next;
+		} else {
+			*p = b;
+			b = b->next;
+		}
+		p = &((*p)->next);
+	}
+	*p = (a != NULL) ? a : b;
+	return head;
+}
+
+// true if the given answer of Get Sensor Thresholds tells, what to render
+#define THR_KNOWN(_t, _cc)	((_t) != NULL || (_cc) == SDR_CC_SENSOR_NOT_FOUND \
+	|| (_cc) == SDR_CC_ILLEGAL_CMD)
+
+// (Re-)render the threshold metrics of the given sensor from the given answer
+// of Get Sensor Thresholds. Returns true if they changed.
+static bool
+render_thresholds(sensor_t *e, sdr_thresholds_t *t, uint8_t cc,
+	const char *label)
+{
+	char buf[176];		// 8+1+32+1+20+5+20+20+16+1 + 42 = 166
+	char tbuf[4096];	// 6*(166 + 27 + 317) = 3060
+	int len = 0;
+
+	if (e->thr_cc == cc && (cc != 0 || memcmp(&(e->thr), t, sizeof(*t)) == 0))
+		return false;
+	free(e->prom.mname_threshold);
+	free(e->it_thresholds);
+	e->prom.mname_threshold = e->it_thresholds = NULL;
+	e->thr_cc = cc;
+	if (t == NULL) {
+		memset(&(e->thr), 0, sizeof(e->thr));
+		return true;
+	}
+	memcpy(&(e->thr), t, sizeof(e->thr));
+	sprintf(buf, IPMIMEXM_IPMI_N "_%s_threshold_%s{%ssensor=\"%s\",bounds=",
+		category2prom(e->category), e->prom.unit, label, e->prom.name);
+
+#define TADD(_b, _s)	if (t->readable._b ## _ ## _s) { \
+	len += (SDR_UNIT_FMT_IS_DISCRETE(e->unit.analog_fmt)) \
+	? sprintf(tbuf + len, "%s\"" #_b "\",state=\"" #_s "\"} %d\n", buf, \
+		t->_b ## _ ## _s) \
+	: sprintf(tbuf + len, "%s\"" #_b "\",state=\"" #_s "\"} %g\n", buf, \
+		sdr_convert_value(t->_b ## _ ## _s, e->unit.analog_fmt, e->factors)); \
+}
+	TADD(lower, nr);
+	TADD(lower, cr);
+	TADD(lower, nc);
+	TADD(upper, nc);
+	TADD(upper, cr);
+	TADD(upper, nr);
+	if (len > 0) {
+		e->prom.mname_threshold = strdup(tbuf);
+		e->it_thresholds =
+			thresholds2ipmitool_str(t, e->unit.analog_fmt, e->factors);
+	}
+	return true;
+}
+
 #define MMATCH(_x)	(cfg->_x && (regexec(cfg->_x, buf, 0,NULL,0) == 0))
 #define SMATCH(_x)	(cfg->_x && (regexec(cfg->_x, e->prom.name, 0,NULL,0) == 0))
 
+// a copy of the concatenation of the given strings
+static char *
+join(const char *a, size_t alen, const char *b, size_t blen) {
+	char *s = malloc(alen + blen + 1);
+
+	if (s != NULL) {
+		memcpy(s, a, alen);
+		memcpy(s + alen, b, blen + 1);
+	}
+	return s;
+}
+
 static sensor_t *
-drop_unneeded(sensor_t *head, scan_cfg_t *cfg, uint32_t *sensors) {
+drop_unneeded(ipmi_ctx_t *ctx, sensor_t *head, scan_cfg_t *cfg,
+	uint32_t *sensors)
+{
 	if (head == NULL)
 		return NULL;
 
 	sensor_t *e = head, *first = NULL, *last = NULL, *tmp;
-	char buf[128];		// 8+1+32+1+20+5+20+20+16+1 = 124
-	char tbuf[4096];	// 6*(124 + 27 + 317) = 2808
-	int len, ulen;
-	uint8_t cc;
+	sensor_t *prev = NULL;	// the last one kept, its metric name is in buf
+	char buf[176];		// 8+1+32+1+20+5+20+20+16+1 + 42 = 166
+	char sbuf[176];		// same prefix, but "state" instead of the unit
+	char lbuf[48], nbuf[256];
+	const char *label = device_label(cfg->label, true, lbuf);
+	int len = 0, slen = 0, nlen;
+	bool mexc = false, minc = false;
+	uint8_t cc = 0xFF;
+	struct ipmi_rs rsp;
 
 	while (e != NULL) {
-		len = sprintf(buf, IPMIMEXM_IPMI_N "_%s_%s",
-			category2prom(e->category), e->prom.unit);
-		if ((MMATCH(exc_metrics) || SMATCH(exc_sensors))
-			&& !(MMATCH(inc_metrics) || SMATCH(inc_sensors)))
+		// the list is sorted, so the metric name changes per group, only
+		if (prev == NULL || !same_metric(prev, e)) {
+			len = sprintf(buf, IPMIMEXM_IPMI_N "_%s_%s",
+				category2prom(e->category), e->prom.unit);
+			slen = sprintf(sbuf, IPMIMEXM_IPMI_N "_%s_state",
+				category2prom(e->category));
+			mexc = MMATCH(exc_metrics);
+			minc = MMATCH(inc_metrics);
+		}
+		if ((mexc || SMATCH(exc_sensors)) && !(minc || SMATCH(inc_sensors)))
 		{
 			PROM_INFO("Dropping sensor '%s' (0x%02x): excluded via -x or -X.",
-				e->prom.name, e->sensor_num);
+				e->prom.name, e->key.sensor_num);
 			tmp = e->next;
 			if (last != NULL)
 				last->next = tmp;
@@ -125,57 +284,37 @@ drop_unneeded(sensor_t *head, scan_cfg_t *cfg, uint32_t *sensors) {
 		}
 		if (first == NULL)
 			first = e;
-		last = e;
-		ulen = len - strlen(e->prom.unit);
-		sprintf(buf + len, "{sensor=\"%s\"}", e->prom.name);
-		e->prom.mname_reading = strdup(buf);
-
-		if (!cfg->no_state) {
-			sprintf(buf + ulen, "state{sensor=\"%s\"}", e->prom.name);
-			e->prom.mname_state = strdup(buf);
-		}
+		last = prev = e;
+		nlen = snprintf(nbuf, sizeof(nbuf), "{%ssensor=\"%s\"}", label,
+			e->prom.name);
+		if (nlen >= (int) sizeof(nbuf))
+			nlen = sizeof(nbuf) - 1;
+		e->prom.mname_reading = join(buf, len, nbuf, nlen);
+		if (!cfg->no_state)
+			e->prom.mname_state = join(sbuf, slen, nbuf, nlen);
 
+		// thresholds not yet known get loaded later via load_thresholds()
 		sdr_thresholds_t *t = cfg->no_thresholds
 			? NULL
-			: get_thresholds(e->sensor_num, &cc);
-		if (t != NULL && cc == 0) {
-			sprintf(buf + ulen, "threshold_%s{sensor=\"%s\",bounds=",
-				e->prom.unit, e->prom.name);
-			len = 0;
-
-#define TADD(_b, _s)	if (t->readable._b ## _ ## _s) { \
-	len += (SDR_UNIT_FMT_IS_DISCRETE(e->unit.analog_fmt)) \
-	? sprintf(tbuf + len, "%s\"" #_b "\",state=\"" #_s "\"} %d\n", buf, \
-		t->_b ## _ ## _s) \
-	: sprintf(tbuf + len, "%s\"" #_b "\",state=\"" #_s "\"} %g\n", buf, \
-		sdr_convert_value(t->_b ## _ ## _s, e->unit.analog_fmt, e->factors)); \
-}
-			TADD(lower, nr);
-			TADD(lower, cr);
-			TADD(lower, nc);
-			TADD(upper, nc);
-			TADD(upper, cr);
-			TADD(upper, nr);
-			if (len > 0) {
-				e->prom.mname_threshold = strdup(tbuf);
-				e->it_thresholds =
-					thresholds2ipmitool_str(t, e->unit.analog_fmt, e->factors);
-			}
-		}
+			: peek_thresholds(ctx, &rsp, &(e->key), &cc);
+		if (THR_KNOWN(t, cc))
+			render_thresholds(e, t, cc, label);
 		e = e->next;
 	}
 	return first;
 }
 
 static uint8_t
-get_current_bmc_info(void) {
+get_current_bmc_info(device_t *dev) {
 	int max_tries;
 	uint8_t cc;
-	char buf[256];
+	struct ipmi_rs rsp;
+	char buf[256], lbuf[48];
+	ipmi_ctx_t *ctx = dev->ctx;
 
 	max_tries = MAX_WAIT4REPO/WAIT4REPO_SLOT;
 	while (max_tries > 0) {
-		ipmi_bmc_info_t *bmc = get_bmc_info(&cc);
+		ipmi_bmc_info_t *bmc = get_bmc_info(ctx, &rsp, &cc);
 		if (SDR_REPO_TMP_NA(cc)) {
 			PROM_INFO("BMC temporarily not available. Sleeping %d seconds ...",
 				WAIT4REPO_SLOT);
@@ -192,30 +331,44 @@ get_current_bmc_info(void) {
 			PROM_ERROR("BMC does not support SDR sensor device commands.", "");
 			return 2;
 		}
-		sprintf(buf, IPMIMEXM_VERS_N "{name=\"bmc\",value=\"%d.%d\"} 1\n",
+		sprintf(buf, IPMIMEXM_VERS_N "{%sname=\"bmc\",value=\"%d.%d\"} 1\n",
+			device_label(dev->cfg.label, true, lbuf),
 			bmc->fw_rev_major, bmc->fw_rev_minor);
-		if (bmcVersion != NULL)
-			free(bmcVersion);
-		bmcVersion = strdup(buf);
+		free(dev->bmc_version);
+		dev->bmc_version = strdup(buf);
 		break;
 	}
 	return max_tries == 0 ? 3 : 0;
 }
 
 sensor_t *
-get_sensor_list(scan_cfg_t *cfg, uint32_t *sensors) {
+get_sensor_list(ipmi_ctx_t *ctx, scan_cfg_t *cfg, uint32_t *sensors,
+	sdr_stamp_t *stamp, sdr_image_t *img)
+{
 	int max_tries;
 	uint8_t cc;
+	bool cached = false;
 
 	if (cfg->no_ipmi)
 		return NULL;
 
 	sensor_t *slist = NULL, *tlist;
+	if (cfg->sdr_cache != NULL && sdr_store_load(ctx, cfg->sdr_cache, img) == 0)
+	{
+		slist = sdr_image2sensors(ctx, img, sensors, cfg->ignore_disabled_flag,
+			cfg->drop_no_read);
+		PROM_INFO("%d potential sensors found.", *sensors);
+		// the key of the cache matched the current state of the repo
+		*stamp = img->stamp;
+		cached = true;
+		goto sort;
+	}
 	max_tries = MAX_WAIT4REPO/WAIT4REPO_SLOT;
 	while (max_tries > 0) {
 		*sensors = 0;
-		slist = scan_sdr_repo(sensors, cfg->ignore_disabled_flag,
-			cfg->drop_no_read, &cc);
+		// thresholds get loaded after start (see load_thresholds())
+		slist = scan_sdr_repo(ctx, sensors, cfg->ignore_disabled_flag,
+			cfg->drop_no_read, &cc, img);
 		if (SDR_REPO_TMP_NA(cc)) {
 			free_sensor(slist);
 			slist = NULL;
@@ -227,6 +380,8 @@ get_sensor_list(scan_cfg_t *cfg, uint32_t *sensors) {
 		}
 		if (cc == 0) {
 			PROM_INFO("%d potential sensors found.", *sensors);
+			if (img->stamp.valid)
+				*stamp = img->stamp;
 			break;
 		} else {
 			PROM_FATAL("Scanning the SDR repository failed. No sensors.", "");
@@ -235,19 +390,28 @@ get_sensor_list(scan_cfg_t *cfg, uint32_t *sensors) {
 	}
 	if (max_tries == 0) {
 		*sensors = 0;
+		sdr_image_free(img);
 		return NULL;
 	}
 
+sort:
+	if (*sensors == 0)
+		goto error;
 	tlist = sort_sensors(slist, *sensors);
 	if (tlist != NULL) {
 		slist = tlist;
-		tlist = drop_unneeded(slist, cfg, sensors);
-		if (tlist != NULL)
+		tlist = drop_unneeded(ctx, slist, cfg, sensors);
+		if (tlist != NULL) {
+			if (!cached && cfg->sdr_cache != NULL)
+				sdr_store_save(ctx, cfg->sdr_cache, img,
+					cfg->no_thresholds ? NULL : tlist);
 			return tlist;
+		}
 		PROM_WARN("No sensors to monitor.", "");
 	}
 
 error:
+	sdr_image_free(img);
 	free_sensor(slist);
 	slist = NULL;
 	*sensors = 0;
@@ -266,14 +430,11 @@ gen_help(sensor_t *list) {
 
 	sensor_t *s = list, *last = NULL;
 	char buf[256];
-	size_t len;
 	const char *u;
 	char *t;
 
 	while (s != NULL) {
-		if (last == NULL
-			|| strncmp(last->prom.mname_reading,s->prom.mname_reading,len) != 0)
-		{
+		if (last == NULL || !same_metric(last, s)) {
 			u = (s->it_unit) ? s->it_unit : sdr_unit2str(&(s->unit));
 			t = strchr(s->prom.mname_reading, '{');
 			*t = '\0';
@@ -282,97 +443,567 @@ gen_help(sensor_t *list) {
 				s->prom.mname_reading, IPMIMEXM_IPMI_T);
 			*t = '{';
 			s->prom.note = strdup(buf);
-			len = t - s->prom.mname_reading + 1;
 			last = s;
 		}
 		s = s->next;
 	}
 }
 
-sensor_t *
-start(scan_cfg_t *cfg, bool compact, uint32_t *sensors) {
-	uint8_t cc;
+static ipmi_ctx_t *
+open_device(scan_cfg_t *cfg) {
+	ipmi_ctx_t *ctx = ipmi_if_open(cfg->bmc);
 
-	*sensors = 0;
-	if (started)
+	if (ctx == NULL)
 		return NULL;
+	ipmi_if_window(ctx, cfg->window);
+	if (cfg->tmo_fast > 0 || cfg->tmo_slow > 0)
+		ipmi_if_timeouts(ctx, cfg->tmo_fast, cfg->tmo_slow);
+	if (cfg->rate > 0)
+		ipmi_if_rate(ctx, cfg->rate, cfg->burst);
+	if (cfg->capture != NULL)
+		ipmi_if_capture(ctx, cfg->capture);
+	return ctx;
+}
+
+uint32_t
+start(device_t *dev, bool compact) {
+	uint8_t cc;
+	ipmi_ctx_t *ctx;
+	struct ipmi_rs rsp;
+	scan_cfg_t *cfg = &(dev->cfg);
+	sensor_t *slist;
+	uint32_t sensors = 0;
+
+	if (dev->ctx != NULL)
+		return 0;
 
+	dev->sensors = 0;
 	if (cfg->no_ipmi && cfg->no_dcmi)
-		return NULL;
+		return 0;
 
 	PROM_INFO("Checking BMC (%s) ...",
 		cfg->bmc == NULL ? "default path" : cfg->bmc);
-	if (ipmi_if_open(cfg->bmc) != 0)
-		return NULL;
+	if ((ctx = open_device(cfg)) == NULL)
+		return 0;
+	dev->ctx = ctx;
 
-	cc = get_current_bmc_info();
+	cc = get_current_bmc_info(dev);
 	if (cc == 2) {
 		cfg->no_ipmi = true;
 	} else if (cc == 3) {
-		ipmi_if_close();
-		return NULL;
+		goto fail;
 	}
 
-	sensor_t *slist = get_sensor_list(cfg, sensors);
-	if (*sensors == 0)
+	slist = get_sensor_list(ctx, cfg, &sensors, &(dev->stamp), &(dev->img));
+	if (sensors == 0)
 		cfg->no_ipmi = true;
 	else if (!compact)
 		gen_help(slist);
 
 	if (!cfg->no_dcmi) {
-		get_power(&cc);
+		get_power(ctx, &rsp, &cc);
 		if (cc == SDR_CC_INVALID_CMD)
 			cfg->no_dcmi = true;
 	}
 	if (cfg->no_ipmi && cfg->no_dcmi) {
-		ipmi_if_close();
-		return NULL;
+		free_sensor(slist);
+		goto fail;
 	}
 
 	//show_ipmitool_sensors(slist, NULL, true);
 	if (!cfg->no_dcmi)
-		(*sensors)++;
+		sensors++;
+
+	PROM_INFO("IPMI stack initialized. All sensors to monitor: %d", sensors);
+	dev->sensor_list = slist;
+	dev->sensors = sensors;
+	return sensors;
 
-	PROM_INFO("IPMI stack initialized. All sensors to monitor: %d", *sensors);
-	started = 1;
-	return slist;
+fail:
+	sdr_cache_flush(ctx);
+	ipmi_if_close(ctx);
+	dev->ctx = NULL;
+	return 0;
 }
 
 void
-stop(sensor_t *list) {
-	ipmi_if_close();
-	free_sensor(list);
-	list = NULL;
-	free(versionHR);
-	versionHR = NULL;
-	free(versionProm);
-	versionProm = NULL;
-	free(bmcVersion);
-	bmcVersion = NULL;
-	bmc_version_done = false;
+stop(device_t *dev) {
+	if (dev->ctx != NULL)
+		sdr_cache_flush(dev->ctx);
+	ipmi_if_close(dev->ctx);
+	dev->ctx = NULL;
+	free_sensor(dev->sensor_list);
+	dev->sensor_list = NULL;
+	dev->sensors = 0;
+	dev->stamp.valid = false;
+	dev->reload = false;
+	sdr_image_free(&(dev->img));
+	free(dev->bmc_version);
+	dev->bmc_version = NULL;
+	free(dev->fru_info);
+	dev->fru_info = NULL;
+	fru_free(dev->fru);
+	dev->fru = NULL;
+	dev->fru_stamp.valid = false;
+	free(dev->sel_info);
+	dev->sel_info = NULL;
 	PROM_DEBUG("IPMI stack has been properly shutdown", "");
-	started = 0;
+}
+
+uint32_t
+reload(device_t *dev, bool compact) {
+	scan_cfg_t *cfg = &(dev->cfg);
+	sensor_t *kept = dev->sensor_list, *fresh, *tlist, *s;
+	uint32_t n = 0, sensors = 0;
+	uint8_t cc;
+
+	fresh = sdr_repo_update(dev->ctx, &(dev->img), &kept, &n,
+		cfg->ignore_disabled_flag, cfg->drop_no_read, &cc);
+	if (cc != 0) {
+		// keep serving the current list: if the BMC hangs, supervise() acts
+		PROM_WARN("Updating the sensor list failed (0x%02x). Retrying on next "
+			"check.", cc);
+		dev->reload = true;
+		return dev->sensors;
+	}
+	dev->reload = false;
+	dev->sensor_list = kept;
+	tlist = (n == 0) ? NULL : sort_sensors(fresh, n);
+	if (tlist == NULL) {
+		free_sensor(fresh);
+		fresh = NULL;
+		n = 0;
+	} else {
+		fresh = drop_unneeded(dev->ctx, tlist, cfg, &n);
+	}
+	// thresholds of new sensors get stored once loaded via load_thresholds()
+	if (cfg->sdr_cache != NULL)
+		sdr_store_save(dev->ctx, cfg->sdr_cache, &(dev->img),
+			cfg->no_thresholds ? NULL : kept);
+
+	for (s = kept; s != NULL; s = s->next) {
+		sensors++;
+		free(s->prom.note);
+		s->prom.note = NULL;
+	}
+	dev->sensor_list = merge_sensors(kept, fresh);
+	sensors += n;
+	if (sensors == 0)
+		cfg->no_ipmi = true;
+	else if (!compact)
+		gen_help(dev->sensor_list);
+	dev->stamp = dev->img.stamp;
+	if (!cfg->no_dcmi)
+		sensors++;
+	dev->sensors = sensors;
+	PROM_INFO("Sensor list updated (%d new). All sensors to monitor: %d", n,
+		sensors);
+	return sensors;
+}
+
+// let scrapes waiting for the device lock use the device in the meantime
+static void
+yield_device(void *arg) {
+	device_t *dev = arg;
+	struct timespec ts = { 0, YIELD_PAUSE };
+
+	pthread_mutex_unlock(&(dev->lock));
+	nanosleep(&ts, NULL);
+	pthread_mutex_lock(&(dev->lock));
+}
+
+// let long running jobs yield the device to scrapes
+static void
+background_begin(device_t *dev) {
+	dev->checking = true;
+	ipmi_set_yield(dev->ctx, yield_device, dev);
+}
+
+static void
+background_end(device_t *dev) {
+	ipmi_set_yield(dev->ctx, NULL, NULL);
+	dev->checking = false;
+}
+
+void
+check_sdrs(device_t *dev, bool compact) {
+	sdr_check_t check;
+	sdr_stamp_t stamp;
+
+	if (dev->ctx == NULL || dev->cfg.no_ipmi || dev->sv.hung)
+		return;
+	// scrapes read the cost of the last check, so update it when done
+	check = dev->check;
+	stamp = dev->img.stamp;
+	background_begin(dev);
+	if (dev->reload) {
+		PROM_INFO("Retrying the update of the sensor list ...", "");
+		reload(dev, compact);
+	} else if (sdrs_changed(dev->ctx, &(dev->img), &(dev->stamp), &check)) {
+		PROM_INFO("SDR repo changed. Reloading ...", "");
+		reload(dev, compact);
+	} else if (dev->cfg.sdr_cache != NULL && dev->img.stamp.valid
+		&& (stamp.last_add != dev->img.stamp.last_add
+			|| stamp.last_del != dev->img.stamp.last_del))
+	{
+		// only the timestamps moved: otherwise the cache would be stale
+		sdr_store_save(dev->ctx, dev->cfg.sdr_cache, &(dev->img),
+			dev->sensor_list);
+	}
+	background_end(dev);
+	dev->check = check;
+}
+
+uint32_t
+load_thresholds(device_t *dev) {
+	struct ipmi_rs rsp;
+	sdr_thresholds_t *t;
+	sensor_t *s;
+	char lbuf[48];
+	const char *label = device_label(dev->cfg.label, true, lbuf);
+	uint32_t n = 0;
+	uint8_t cc;
+
+	if (dev->ctx == NULL || dev->cfg.no_ipmi || dev->cfg.no_thresholds
+		|| dev->sv.hung)
+	{
+		return 0;
+	}
+	for (s = dev->sensor_list; s != NULL && s->thr_cc != 0xFF; s = s->next)
+		;
+	if (s == NULL)
+		return 0;
+	background_begin(dev);
+	sdr_thresholds_load(dev->ctx, dev->sensor_list);
+	background_end(dev);
+	for (s = dev->sensor_list; s != NULL; s = s->next) {
+		if (s->thr_cc != 0xFF)
+			continue;
+		t = peek_thresholds(dev->ctx, &rsp, &(s->key), &cc);
+		if (!THR_KNOWN(t, cc))
+			continue;		// try again next time
+		render_thresholds(s, t, cc, label);
+		n++;
+	}
+	if (n == 0)
+		return 0;
+	PROM_INFO("Thresholds of %d sensors loaded.", n);
+	if (dev->cfg.sdr_cache != NULL)
+		sdr_store_save(dev->ctx, dev->cfg.sdr_cache, &(dev->img),
+			dev->sensor_list);
+	return n;
+}
+
+void
+refresh_thresholds(device_t *dev) {
+	struct ipmi_rs rsp;
+	sdr_thresholds_t *t;
+	sensor_t *s;
+	char lbuf[48];
+	uint32_t i;
+	uint8_t cc;
+
+	if (dev->ctx == NULL || dev->cfg.no_ipmi || dev->cfg.no_thresholds
+		|| dev->sv.hung)
+	{
+		return;
+	}
+	for (i = 0, s = dev->sensor_list; s != NULL && i < dev->thr_next; i++)
+		s = s->next;
+	if (s == NULL) {
+		s = dev->sensor_list;
+		i = 0;
+	}
+	dev->thr_next = i + 1;
+	// not yet loaded ones are left to load_thresholds()
+	if (s == NULL || s->thr_cc == 0xFF)
+		return;
+	sdr_thresholds_forget(dev->ctx, &(s->key));
+	t = get_thresholds(dev->ctx, &rsp, &(s->key), &cc);
+	if (!THR_KNOWN(t, cc))
+		return;				// keep the last known ones
+	if (!render_thresholds(s, t, cc, device_label(dev->cfg.label, true, lbuf)))
+		return;
+	PROM_INFO("Thresholds of sensor '%s' (0x%02x) changed.", s->name,
+		s->key.sensor_num);
+	if (dev->cfg.sdr_cache != NULL)
+		sdr_store_save(dev->ctx, dev->cfg.sdr_cache, &(dev->img),
+			dev->sensor_list);
+}
+
+// append name="value" to the given string builder, value escaped as needed
+static void
+add_label(psb_t *sb, const char *name, const char *value) {
+	const char *s;
+
+	psb_add_str(sb, name);
+	psb_add_str(sb, "=\"");
+	for (s = value; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\') {
+			psb_add_char(sb, '\\');
+			psb_add_char(sb, *s);
+		} else if (*s == '\n') {
+			psb_add_str(sb, "\\n");
+		} else if ((unsigned char) *s >= ' ') {
+			psb_add_char(sb, *s);
+		}
+	}
+	psb_add_char(sb, '"');
+}
+
+// Render the inventory metrics of the given FRU devices. Returns NULL if there
+// is nothing to emit.
+static char *
+render_fru(fru_t *list, const char *label) {
+	psb_t *sb;
+	fru_t *f;
+	char *res = NULL, buf[8];
+	int i;
+
+	if ((sb = psb_new()) == NULL)
+		return NULL;
+	for (f = list; f != NULL; f = f->next) {
+		if (f->data == NULL)
+			continue;
+		psb_add_str(sb, IPMIMEXM_FRU_N "{");
+		psb_add_str(sb, label);
+		add_label(sb, "fru", f->name == NULL ? "" : f->name);
+		snprintf(buf, sizeof(buf), "%d", f->fru_id);
+		psb_add_char(sb, ',');
+		add_label(sb, "fru_id", buf);
+		for (i = 0; i < FRU_FIELDS; i++) {
+			if (f->field[i] == NULL)
+				continue;
+			psb_add_char(sb, ',');
+			add_label(sb, fru_field2str(i), f->field[i]);
+		}
+		psb_add_str(sb, "} 1\n");
+	}
+	if (psb_len(sb) > 0)
+		res = psb_dump(sb);
+	psb_destroy(sb);
+	return res;
+}
+
+uint32_t
+load_fru(device_t *dev) {
+	scan_cfg_t *cfg = &(dev->cfg);
+	sdr_stamp_t stamp = dev->img.stamp;
+	fru_t *list;
+	char lbuf[48];
+	uint32_t n, count;
+
+	if (dev->ctx == NULL || cfg->no_ipmi || cfg->no_fru || dev->sv.hung
+		|| !stamp.valid)
+	{
+		return 0;
+	}
+	if (dev->fru_stamp.valid && dev->fru_stamp.fingerprint == stamp.fingerprint)
+	{
+		if (dev->fru_stamp.last_add == stamp.last_add
+			&& dev->fru_stamp.last_del == stamp.last_del)
+		{
+			return 0;
+		}
+		// only the repo timestamps moved: same FRUs, but re-key the cache
+		if (dev->fru != NULL && cfg->fru_cache != NULL)
+			fru_store_save(dev->ctx, cfg->fru_cache, dev->fru, &stamp);
+		dev->fru_stamp = stamp;
+		return 0;
+	}
+	list = fru_locate(dev->ctx, &(dev->img), &count);
+	if (count > 0 && cfg->fru_cache != NULL)
+		fru_store_load(dev->ctx, cfg->fru_cache, list);
+	background_begin(dev);
+	n = fru_read(dev->ctx, list);
+	background_end(dev);
+	if (n > 0 && cfg->fru_cache != NULL)
+		fru_store_save(dev->ctx, cfg->fru_cache, list, &stamp);
+	free(dev->fru_info);
+	dev->fru_info = render_fru(list, device_label(cfg->label, true, lbuf));
+	dev->fru_stamp = stamp;
+	if (count > 0) {
+		PROM_INFO("Inventory of %d FRU devices loaded (%d read from BMC).",
+			count, n);
+	}
+	fru_free(dev->fru);
+	dev->fru = list;
+	return n;
+}
+
+// Render the event counters of the given SEL. Returns NULL if there is
+// nothing to emit.
+static char *
+render_sel(sel_t *sel, const char *label) {
+	sel_counter_t *c;
+	const char *s;
+	psb_t *sb;
+	char *res = NULL, buf[32];
+	uint16_t i;
+
+	if ((sb = psb_new()) == NULL)
+		return NULL;
+	for (i = 0; i < sel->counters; i++) {
+		c = &(sel->counter[i]);
+		psb_add_str(sb, IPMIMEXM_SEL_EVENTS_N "{");
+		psb_add_str(sb, label);
+		// OEM types would collapse into a single name
+		s = (c->sensor_type < 0xC0) ? category2prom(c->sensor_type) : NULL;
+		if (s == NULL) {
+			sprintf(buf, "0x%02x", c->sensor_type);
+			s = buf;
+		}
+		add_label(sb, "sensor_type", s);
+		sprintf(buf, "0x%02x", c->event_type);
+		psb_add_char(sb, ',');
+		add_label(sb, "event_type", buf);
+		s = sel_event2str(c->sensor_type, c->event_type, c->offset & 0x0F);
+		if (s == NULL) {
+			sprintf(buf, "offset_%d", c->offset & 0x0F);
+			s = buf;
+		}
+		psb_add_char(sb, ',');
+		add_label(sb, "event", s);
+		psb_add_char(sb, ',');
+		add_label(sb, "direction",
+			(c->offset & 0x80) ? "deassertion" : "assertion");
+		sprintf(buf, "} %u\n", c->count);
+		psb_add_str(sb, buf);
+	}
+	if (psb_len(sb) > 0)
+		res = psb_dump(sb);
+	psb_destroy(sb);
+	return res;
+}
+
+uint32_t
+load_sel(device_t *dev) {
+	scan_cfg_t *cfg = &(dev->cfg);
+	sel_t *sel = &(dev->sel);
+	ipmi_bmc_info_t *bmc;
+	struct ipmi_rs rsp;
+	char lbuf[48];
+	uint32_t n, total = 0;
+	uint8_t cc;
+	bool more;
+
+	if (dev->ctx == NULL || cfg->no_ipmi || cfg->no_sel || dev->sv.hung)
+		return 0;
+	if (!sel->loaded) {
+		bmc = get_bmc_info(dev->ctx, &rsp, &cc);
+		if (bmc == NULL || cc != 0)
+			return 0;
+		if (!bmc->supports_sel) {
+			PROM_INFO("BMC has no SEL. Skipping SEL metrics.", "");
+			cfg->no_sel = true;
+			return 0;
+		}
+		sel->loaded = true;
+		if (cfg->sel_cursor != NULL)
+			sel_store_load(dev->ctx, cfg->sel_cursor, sel);
+	}
+	background_begin(dev);
+	do {
+		n = sel_read(dev->ctx, sel, SEL_BATCH, &more);
+		if (n > 0 && cfg->sel_cursor != NULL)
+			sel_store_save(dev->ctx, cfg->sel_cursor, sel);
+		total += n;
+	} while (more);
+	background_end(dev);
+	if (total > 0 || dev->sel_info == NULL) {
+		free(dev->sel_info);
+		dev->sel_info = render_sel(sel, device_label(cfg->label, true, lbuf));
+	}
+	if (total > 0) {
+		PROM_INFO("%d SEL records read (%d event counters).", total,
+			sel->counters);
+	}
+	return total;
+}
+
+bool
+supervise(device_t *dev) {
+	ipmi_bmc_info_t *bmc;
+	struct ipmi_rs rsp;
+	uint8_t cc;
+	long now;
+	supervisor_t *sv = &(dev->sv);
+
+	if (!sv->hung) {
+		if (ipmi_if_failures(dev->ctx) < HANG_FAILS)
+			return true;
+		PROM_WARN("BMC does not answer anymore (%d requests failed in a row). "
+			"Closing the device.", ipmi_if_failures(dev->ctx));
+		sdr_cache_flush(dev->ctx);
+		ipmi_if_close(dev->ctx);
+		dev->ctx = NULL;
+		sv->hung = true;
+		sv->backoff = REOPEN_BACKOFF;
+		sv->retry = now_s() + sv->backoff;
+		return false;
+	}
+	now = now_s();
+	if (now < sv->retry)
+		return false;
+
+	PROM_INFO("Trying to re-open the BMC device ...", "");
+	if ((dev->ctx = open_device(&(dev->cfg))) != NULL) {
+		bmc = get_bmc_info(dev->ctx, &rsp, &cc);
+		if (bmc != NULL && cc == 0) {
+			PROM_INFO("BMC is back (firmware %d.%d).",
+				bmc->fw_rev_major, bmc->fw_rev_minor);
+			sv->hung = false;
+			return true;
+		}
+		sdr_cache_flush(dev->ctx);
+		ipmi_if_close(dev->ctx);
+		dev->ctx = NULL;
+	}
+	sv->backoff *= 2;
+	if (sv->backoff > REOPEN_BACKOFF_MAX)
+		sv->backoff = REOPEN_BACKOFF_MAX;
+	sv->retry = now_s() + sv->backoff;
+	PROM_WARN("BMC still not usable. Next try in %d s.", sv->backoff);
+	return false;
+}
+
+void
+supervise_cache(device_t *dev, psb_t *sb, size_t start, bool fresh,
+	bool compact)
+{
+	char buf[128], lbuf[48];
+	char *s;
+	long now = now_s();
+	supervisor_t *sv = &(dev->sv);
+
+	if (fresh) {
+		s = strdup(psb_str(sb) + start);
+		if (s != NULL) {
+			free(sv->cache);
+			sv->cache = s;
+			sv->cached = now;
+		}
+	} else {
+		psb_truncate(sb, start);
+		if (sv->cache != NULL)
+			psb_add_str(sb, sv->cache);
+	}
+	if (sv->cached == 0)
+		return;
+	if (!compact)
+		addPromInfo(IPMIMEXM_STALE);
+	sprintf(buf, IPMIMEXM_STALE_N "%s %ld\n",
+		device_label(dev->cfg.label, false, lbuf),
+		fresh ? 0 : now - sv->cached);
+	psb_add_str(sb, buf);
 }
 
 char *
 getVersions(psb_t *sbp, bool compact) {
 	psb_t *sbi = NULL, *sb = NULL;
 
-	if (versionProm != NULL) {
-		if (!bmc_version_done && bmcVersion != NULL) {
-			size_t n = strlen(versionProm), m = strlen(bmcVersion);
-			char *t, *s = malloc(sizeof(char) * (n + m) + 1);
-			if (s != NULL) {
-				strcpy(s, versionProm);
-				strcpy(s + n, bmcVersion);
-				t = versionProm;
-				versionProm = s;
-				free(t);
-				bmc_version_done = true;
-			}
-		}
+	if (versionProm != NULL)
 		goto end;
-	}
 
 	sbi = psb_new();
 	sb = psb_new();
@@ -404,3 +1035,11 @@ end:
 	}
 	return versionHR;
 }
+
+void
+freeVersions(void) {
+	free(versionHR);
+	versionHR = NULL;
+	free(versionProm);
+	versionProm = NULL;
+}
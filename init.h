@@ -17,33 +17,162 @@
 #ifndef IPMIMEX_INIT_H
 #define IPMIMEX_INIT_H
 
+#include <pthread.h>
+
 #include "common.h"
+#include "ipmi_if.h"
+#include "ipmi_fru.h"
+#include "ipmi_sdr.h"
+#include "ipmi_sel.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** @brief State of the BMC supervisor. */
+typedef struct supervisor {
+	bool hung;		// device closed, waiting for the BMC to come back
+	int backoff;	// seconds to wait between re-open attempts
+	long retry;		// monotonic time in s of the next re-open attempt
+	long cached;	// monotonic time in s when the cache got updated
+	char *cache;	// the metrics of the last successful scrape
+} supervisor_t;
+
+/** @brief A monitored BMC. */
+typedef struct device {
+	scan_cfg_t cfg;			// the SDR scan configuration of this device
+	ipmi_ctx_t *ctx;		// NULL if not opened
+	sensor_t *sensor_list;
+	uint32_t sensors;		// number of sensors to query, 0 .. not started
+	sdr_stamp_t stamp;		// state of the SDR repo the sensor list is from
+	supervisor_t sv;
+	char *bmc_version;		// version metric of the BMC
+	sdr_image_t img;		// the SDRs the sensor list has been built from
+	sdr_check_t check;		// cost of the last SDR repo change check
+	bool checking;			// background job in progress, ctx must stay open
+	bool reload;			// sensor list update failed, retry on next check
+	uint32_t thr_next;		// index of the sensor refresh_thresholds() does next
+	char *fru_info;			// FRU inventory metrics, NULL .. none
+	fru_t *fru;				// the FRU devices fru_info has been rendered from
+	sdr_stamp_t fru_stamp;	// state of the SDR repo the FRU inventory is from
+	sel_t sel;				// SEL cursor and event counters, kept on restart
+	char *sel_info;			// SEL event metrics, NULL .. none
+	pthread_mutex_t lock;	// serializes the use of ctx
+} device_t;
+
 /**
- * @brief Initialize IPMI stack.
- * @param cfg	The SDR scan configuration to use.
+ * @brief Initialize IPMI stack for the given device, i.e. open the device
+ *	and build its sensor list.
+ * @param dev	The device to initialize. Its \c cfg needs to be set.
  * @param compact	If \c true, no HELP/TYPE comments get generated and thus
  *	will not be emitted in a client response.
- * @param sensors	Set to the number of sensors which need to be queried on
- *	client requests.
- * @return \c NULL on error, the sensor list otherwise.
+ * @return The number of sensors which need to be queried on client requests.
+ *	\c 0 on error.
+ */
+uint32_t start(device_t *dev, bool compact);
+
+/**
+ * @brief Shutdown the IPMI stack of the given device, i.e. close the device
+ *	and release its sensor list.
+ * @param dev	The device to shutdown.
+ */
+void stop(device_t *dev);
+
+/**
+ * @brief Update the sensor list of the given device after its SDR repository
+ *	changed. Sensors of unchanged SDRs get kept as they are, only the SDRs of
+ *	new or changed ones get read and their sensors set up. The device stays
+ *	open. If the update fails, the current sensor list stays in use and the
+ *	update gets retried on the next \c check_sdrs() call.
+ * @param dev	The started device to update.
+ * @param compact	See \c start().
+ * @return The number of sensors which need to be queried on client requests.
+ */
+uint32_t reload(device_t *dev, bool compact);
+
+/**
+ * @brief Check, whether the SDR repository of the given device changed, and
+ *	if so, update its sensor list via \c reload(). Must be called with the
+ *	lock of the device held. While waiting for the BMC the lock gets released
+ *	temporarily, so that scrapes can be answered using the current sensor
+ *	list until the new one is complete.
+ * @param dev	The started device to check.
+ * @param compact	See \c start().
+ */
+void check_sdrs(device_t *dev, bool compact);
+
+/**
+ * @brief Load the thresholds of all sensors of the given device, which are
+ *	not yet known, e.g. because the device just got started or its sensor list
+ *	updated, and render their threshold metrics. Must be called with the lock
+ *	of the device held, which gets released temporarily like in
+ *	\c check_sdrs(). If an SDR cache is configured, it gets updated.
+ * @param dev	The started device to use.
+ * @return The number of sensors whose thresholds got loaded.
+ */
+uint32_t load_thresholds(device_t *dev);
+
+/**
+ * @brief Ask the BMC for the current thresholds of the next sensor of the
+ *	given device (round robin), and re-render its threshold metrics if they
+ *	changed. Must be called with the lock of the device held.
+ * @param dev	The started device to use.
+ */
+void refresh_thresholds(device_t *dev);
+
+/**
+ * @brief Load the FRU inventory of the given device and render its metrics,
+ *	if not yet done for the current state of its SDR repository. The FRU data
+ *	get taken from the FRU cache, if configured and still valid, otherwise
+ *	read from the BMC, which may take a while. So it gets done like
+ *	\c load_thresholds() and the same rules apply.
+ * @param dev	The started device to use.
+ * @return The number of FRU devices read from the BMC.
  */
-sensor_t *start(scan_cfg_t *cfg, bool compact, uint32_t *sensors);
+uint32_t load_fru(device_t *dev);
 
 /**
- * @brief Shutdown the IPMI stack and cleanup any allocated resources (and
- *	prepare for exit).
- * @param list	The list of sensors to release.
- * @return \c 0 on success, a number > 0 otherwise.
+ * @brief Read the records added to the SEL of the given device since the last
+ *	call, count their events and render the related metrics. On the first
+ *	call the cursor and counters get restored from the SEL cursor file, if
+ *	configured, so that only records added since the last run need to be
+ *	read. The cursor file gets updated after each batch of records read. The
+ *	same rules as for \c load_thresholds() apply.
+ * @param dev	The started device to use.
+ * @return The number of SEL records read.
  */
-void stop(sensor_t *list);
+uint32_t load_sel(device_t *dev);
+
+/**
+ * @brief Check, whether the BMC is usable. If too many requests failed in a
+ *	row, the device gets closed and the BMC gets marked as hung. While hung,
+ *	re-opening the device and validating the BMC via \c get_bmc_info() gets
+ *	tried with an exponential backoff, so the device does not get hammered.
+ * @param dev	The device to check. Its context gets updated if the device
+ *	got closed or re-opened.
+ * @return \c true if the BMC can be queried, \c false otherwise.
+ */
+bool supervise(device_t *dev);
+
+/**
+ * @brief Update the cache of the supervisor with the metrics appended to the
+ *	given string builder, or replace them by the cached ones, if the BMC is
+ *	not usable. Finally the age of the metrics gets appended.
+ * @param dev	The device the metrics belong to.
+ * @param sb	The string builder containing the metrics.
+ * @param start	Offset of the IPMI related metrics within \c sb.
+ * @param fresh	If \c true, the metrics are fresh and replace the cache.
+ *	Otherwise the metrics get replaced by the cached ones.
+ * @param compact	If \c true, no HELP/TYPE comments get emitted.
+ */
+void supervise_cache(device_t *dev, psb_t *sb, size_t start, bool fresh,
+	bool compact);
 
 char *getVersions(psb_t *report, bool compact);
 
+/** @brief Release the version strings generated by \c getVersions(). */
+void freeVersions(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,396 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_cap.c
+ * Capture writer and replay backend. The writer gets fed by ipmi_if.c with
+ * each request handed over to the device and each response received. The
+ * replay backend (device path "replay:file[@speedup]") answers requests with
+ * the responses found in the capture file, after the time the device needed
+ * to answer the original request divided by the given speedup (default: 1).
+ *
+ * A request gets matched against the captured requests in this order: the
+ * first one not yet replayed with the same netfn, cmd and data, any one with
+ * the same netfn, cmd and data (so that e.g. a capture of a single scrape can
+ * be replayed forever), the first one not yet replayed with the same netfn
+ * and cmd. In all cases the target (bridge address, channel and LUN) must
+ * match as well. If there is none, the request gets answered with 0xC1 (invalid
+ * command). Captured requests without a response never get answered.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+
+#include "common.h"
+#include "ipmi_if.h"
+#include "ipmi_sdr.h"
+#include "ipmi_cap.h"
+#include "ipmi_vdrv.h"
+
+#define CAP_FLUSH_MS	1000		// max. time records stay in the buffer
+#define CAP_PAIR_MAX	4096		// max. records to look ahead for a response
+
+struct ipmi_cap {
+	FILE *f;
+	long flushed;					// CLOCK_MONOTONIC ms of the last flush
+};
+
+// check the header of the given capture file. Returns its format version, if
+// it is in the range oldest .. IPMI_CAP_VERSION, 0 otherwise.
+static int
+check_hdr(FILE *f, const char *path, int oldest) {
+	ipmi_cap_hdr_t hdr;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1
+		|| memcmp(hdr.magic, IPMI_CAP_MAGIC, sizeof(IPMI_CAP_MAGIC)) != 0)
+	{
+		PROM_ERROR("'%s' is not an IPMI capture file.", path);
+		return 0;
+	}
+	if (hdr.bom != IPMI_CAP_BOM) {
+		PROM_ERROR("'%s' has been recorded on a host with another byte order.",
+			path);
+		return 0;
+	}
+	if (hdr.version < oldest || hdr.version > IPMI_CAP_VERSION) {
+		PROM_ERROR("'%s': unsupported capture format version %d.", path,
+			hdr.version);
+		return 0;
+	}
+	return hdr.version;
+}
+
+ipmi_cap_t *
+ipmi_cap_open(const char *path) {
+	ipmi_cap_hdr_t hdr;
+	ipmi_cap_t *cap;
+	FILE *f;
+
+	if (path == NULL || *path == '\0')
+		return NULL;
+	if ((f = fopen(path, "a+b")) == NULL) {
+		PROM_ERROR("Unable to open capture file '%s': %s", path,
+			strerror(errno));
+		return NULL;
+	}
+	if (fseek(f, 0, SEEK_END) != 0 || ftell(f) < 0) {
+		PROM_ERROR("Unable to seek in capture file '%s': %s", path,
+			strerror(errno));
+		fclose(f);
+		return NULL;
+	}
+	if (ftell(f) == 0) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, IPMI_CAP_MAGIC, sizeof(IPMI_CAP_MAGIC));
+		hdr.bom = IPMI_CAP_BOM;
+		hdr.version = IPMI_CAP_VERSION;
+		if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+			PROM_ERROR("Unable to write to '%s': %s", path, strerror(errno));
+			fclose(f);
+			return NULL;
+		}
+	} else {
+		rewind(f);
+		if (check_hdr(f, path, IPMI_CAP_VERSION) == 0) {
+			fclose(f);
+			return NULL;
+		}
+		// in append mode writes go to the end anyway
+	}
+	if ((cap = malloc(sizeof(ipmi_cap_t))) == NULL) {
+		fclose(f);
+		return NULL;
+	}
+	cap->f = f;
+	cap->flushed = now_ms();
+	PROM_INFO("Capturing IPMI traffic to '%s'.", path);
+	return cap;
+}
+
+void
+ipmi_cap_close(ipmi_cap_t *cap) {
+	if (cap == NULL)
+		return;
+	fclose(cap->f);
+	free(cap);
+}
+
+void
+ipmi_cap_write(ipmi_cap_t *cap, uint8_t type, long msgid,
+	const struct ipmi_rq *req, uint8_t ccode, const uint8_t *data, int len)
+{
+	ipmi_cap_rec_t rec;
+	struct timespec ts;
+	long now;
+
+	if (cap == NULL)
+		return;
+	if (len < 0 || data == NULL)
+		len = 0;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec.usec = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	rec.msgid = msgid;
+	rec.type = type;
+	rec.netfn = req->msg.netfn;
+	rec.cmd = req->msg.cmd;
+	rec.ccode = ccode;
+	rec.len = len;
+	rec.addr = req->addr;
+	rec.chan_lun = (req->addr == 0 ? 0 : req->channel << 4) | req->msg.lun;
+	if (fwrite(&rec, sizeof(rec), 1, cap->f) != 1
+		|| (len > 0 && fwrite(data, len, 1, cap->f) != 1))
+	{
+		PROM_WARN("Writing capture record failed: %s", strerror(errno));
+		clearerr(cap->f);
+		return;
+	}
+	now = now_ms();
+	if (now - cap->flushed >= CAP_FLUSH_MS) {
+		fflush(cap->f);
+		cap->flushed = now;
+	}
+}
+
+/* replay backend */
+
+typedef struct cap_rec {
+	ipmi_cap_rec_t rec;
+	uint8_t *data;
+	long rsp;						// index of the response, -1 .. none
+	bool replayed;
+	size_t next_cmd;				// index + 1 of the next request w/ same cmd
+} cap_rec_t;
+
+struct ipmi_drv {
+	cap_rec_t *rec;
+	size_t recs;
+	size_t by_cmd[256];				// index + 1 of the 1st request w/ this cmd
+	double speedup;					// 0 .. answer immediately
+	vdrv_rsp_t *pending;			// answers sorted by due time
+};
+
+static void ipmi_drv_close(ipmi_drv_t *drv);
+
+static int
+load(ipmi_drv_t *drv, const char *path) {
+	ipmi_cap_rec_t rec;
+	cap_rec_t *r;
+	size_t sz = 0, i, k, max, rlen = sizeof(rec);
+	FILE *f;
+	int res = 0, version;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		PROM_FATAL("Unable to open '%s': %s", path, strerror(errno));
+		return 1;
+	}
+	if ((version = check_hdr(f, path, 1)) == 0) {
+		fclose(f);
+		return 1;
+	}
+	// version 1 records have no target, i.e. all requests went to the BMC
+	memset(&rec, 0, sizeof(rec));
+	if (version == 1)
+		rlen = offsetof(ipmi_cap_rec_t, addr);
+	while (fread(&rec, rlen, 1, f) == 1) {
+		if (drv->recs == sz) {
+			r = realloc(drv->rec, (sz + 1024) * sizeof(cap_rec_t));
+			if (r == NULL) {
+				res = 1;
+				break;
+			}
+			drv->rec = r;
+			sz += 1024;
+		}
+		r = &(drv->rec[drv->recs]);
+		r->rec = rec;
+		r->rsp = -1;
+		r->replayed = false;
+		r->next_cmd = 0;
+		r->data = NULL;
+		if (rec.len > 0) {
+			if ((r->data = malloc(rec.len)) == NULL
+				|| fread(r->data, rec.len, 1, f) != 1)
+			{
+				free(r->data);
+				PROM_WARN("%s: truncated record #%zu ignored.", path, drv->recs);
+				break;
+			}
+		}
+		drv->recs++;
+	}
+	fclose(f);
+	if (res != 0) {
+		PROM_FATAL("Unable to allocate memory for '%s'.", path);
+		return 1;
+	}
+	// pair requests and responses, and chain requests with the same cmd in
+	// capture order
+	for (i = drv->recs; i-- > 0; ) {
+		if (drv->rec[i].rec.type != IPMI_CAP_REQ)
+			continue;
+		drv->rec[i].next_cmd = drv->by_cmd[drv->rec[i].rec.cmd];
+		drv->by_cmd[drv->rec[i].rec.cmd] = i + 1;
+		max = i + CAP_PAIR_MAX < drv->recs ? i + CAP_PAIR_MAX : drv->recs;
+		for (k = i + 1; k < max; k++) {
+			if (drv->rec[k].rec.type == IPMI_CAP_RSP
+				&& drv->rec[k].rec.msgid == drv->rec[i].rec.msgid)
+			{
+				drv->rec[i].rsp = k;
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+static ipmi_drv_t *
+ipmi_drv_open(char *dev) {
+	ipmi_drv_t *drv;
+	char *path, *s, *e;
+
+	if (dev == NULL || *dev == '\0') {
+		PROM_FATAL("No capture file given.", "");
+		return NULL;
+	}
+	drv = calloc(1, sizeof(ipmi_drv_t));
+	path = strdup(dev);
+	if (drv == NULL || path == NULL) {
+		PROM_FATAL("Unable to allocate replay handle.", "");
+		free(drv);
+		free(path);
+		return NULL;
+	}
+	drv->speedup = 1;
+	if ((s = strrchr(path, '@')) != NULL) {
+		double v = strtod(s + 1, &e);
+		if (e != s + 1 && *e == '\0' && v >= 0) {
+			drv->speedup = v;
+			*s = '\0';
+		}
+	}
+	PROM_INFO("Replaying '%s' (speedup %g) ...", path, drv->speedup);
+	if (load(drv, path) != 0) {
+		free(path);
+		ipmi_drv_close(drv);
+		return NULL;
+	}
+	PROM_INFO("%zu capture records loaded.", drv->recs);
+	free(path);
+	return drv;
+}
+
+static void
+ipmi_drv_close(ipmi_drv_t *drv) {
+	size_t i;
+
+	if (drv == NULL)
+		return;
+	vdrv_flush(&(drv->pending));
+	for (i = 0; i < drv->recs; i++)
+		free(drv->rec[i].data);
+	free(drv->rec);
+	free(drv);
+}
+
+static bool
+same_req(cap_rec_t *r, struct ipmi_rq *req, bool data) {
+	uint8_t chan_lun = (req->addr == 0 ? 0 : req->channel << 4) | req->msg.lun;
+
+	if (r->rec.type != IPMI_CAP_REQ || r->rec.netfn != req->msg.netfn
+		|| r->rec.cmd != req->msg.cmd || r->rec.addr != req->addr
+		|| r->rec.chan_lun != chan_lun)
+	{
+		return false;
+	}
+	if (!data)
+		return true;
+	return r->rec.len == req->msg.data_len
+		&& (r->rec.len == 0 || memcmp(r->data, req->msg.data, r->rec.len) == 0);
+}
+
+// find the captured request to replay for the given request
+static cap_rec_t *
+find_req(ipmi_drv_t *drv, struct ipmi_rq *req) {
+	cap_rec_t *any = NULL, *cmd = NULL;
+	size_t i;
+
+	for (i = drv->by_cmd[req->msg.cmd]; i != 0; i = drv->rec[i - 1].next_cmd) {
+		cap_rec_t *r = &(drv->rec[i - 1]);
+		if (same_req(r, req, true)) {
+			if (!r->replayed)
+				return r;
+			if (any == NULL)
+				any = r;
+		} else if (cmd == NULL && !r->replayed && same_req(r, req, false)) {
+			cmd = r;
+		}
+	}
+	return any != NULL ? any : cmd;
+}
+
+static int
+ipmi_drv_send(ipmi_drv_t *drv, struct ipmi_rq *req, long msgid,
+	long timeout)
+{
+	vdrv_rsp_t *a;
+	cap_rec_t *r, *rsp;
+	long delay = 0;
+
+	(void) timeout;		// answers get due as recorded
+	if (drv == NULL)
+		return -2;
+	a = malloc(sizeof(vdrv_rsp_t));
+	if (a == NULL)
+		return -3;
+	a->msgid = msgid;
+	a->rs.data_len = 0;
+	r = find_req(drv, req);
+	if (r == NULL) {
+		a->rs.ccode = SDR_CC_INVALID_CMD;
+	} else {
+		r->replayed = true;
+		if (r->rsp < 0) {
+			free(a);		// the device did not answer
+			return 0;
+		}
+		rsp = &(drv->rec[r->rsp]);
+		a->rs.ccode = rsp->rec.ccode;
+		a->rs.data_len = rsp->rec.len > sizeof(a->rs.data)
+			? sizeof(a->rs.data) : rsp->rec.len;
+		if (a->rs.data_len > 0)
+			memcpy(a->rs.data, rsp->data, a->rs.data_len);
+		if (drv->speedup > 0 && rsp->rec.usec > r->rec.usec)
+			delay = (rsp->rec.usec - r->rec.usec) / 1000 / drv->speedup;
+	}
+	a->due = now_ms() + delay;
+	vdrv_queue(&(drv->pending), a);
+	return 0;
+}
+
+static int
+ipmi_drv_recv(ipmi_drv_t *drv, struct ipmi_rs *rsp, long *msgid, long timeout)
+{
+	if (drv == NULL)
+		return -2;
+	return vdrv_recv(&(drv->pending), rsp, msgid, timeout);
+}
+
+const ipmi_drv_ops_t ipmi_drv_replay = {
+	.prefix = "replay:",
+	.open = ipmi_drv_open,
+	.close = ipmi_drv_close,
+	.send = ipmi_drv_send,
+	.recv = ipmi_drv_recv,
+	.fd = vdrv_fd
+};
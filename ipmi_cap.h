@@ -0,0 +1,101 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_cap.h
+ * Binary capture format for IPMI traffic and the related replay backend.
+ *
+ * A capture file starts with a \c ipmi_cap_hdr_t followed by records. Each
+ * record is a \c ipmi_cap_rec_t immediately followed by \c len data bytes
+ * (request data or response data w/o completion code). All numbers are
+ * stored in the byte order of the recording host, which is indicated by the
+ * \c bom field of the header. Requests and responses belong together, if
+ * their \c msgid matches and the response follows the request. Version 1
+ * records lack the target fields (all requests went to the BMC). They can
+ * still be replayed, but new records get appended to version 2 files, only.
+ */
+#ifndef IPMIMEX_IPMI_CAP_H
+#define IPMIMEX_IPMI_CAP_H
+
+#include <inttypes.h>
+#include "mach.h"
+#include "ipmi_if.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IPMI_CAP_MAGIC		"IPMICAP"
+#define IPMI_CAP_VERSION	2
+#define IPMI_CAP_BOM		0x0102
+
+#define IPMI_CAP_REQ		1		// request handed over to the device
+#define IPMI_CAP_RSP		2		// response received from the device
+
+#pragma pack(push,1)
+
+typedef struct ipmi_cap_hdr {
+	char magic[8];			// IPMI_CAP_MAGIC incl. '\0'
+	uint16_t bom;			// IPMI_CAP_BOM in the byte order of the recorder
+	uint16_t version;		// IPMI_CAP_VERSION
+	uint32_t __reserved;
+} PACKED ipmi_cap_hdr_t;
+
+typedef struct ipmi_cap_rec {
+	uint64_t usec;			// CLOCK_REALTIME in µs
+	uint32_t msgid;			// ID of the request
+	uint8_t type;			// IPMI_CAP_REQ or IPMI_CAP_RSP
+	uint8_t netfn;
+	uint8_t cmd;
+	uint8_t ccode;			// completion code, 0 for requests
+	uint16_t len;			// number of data bytes following
+	// since version 2
+	uint8_t addr;			// IPMB slave address of the target, 0 .. BMC
+	uint8_t chan_lun;		// [7:4] channel if addr != 0, [1:0] LUN
+} PACKED ipmi_cap_rec_t;
+
+#pragma pack(pop)
+
+/** @brief	Opaque handle of an opened capture file. */
+typedef struct ipmi_cap ipmi_cap_t;
+
+/**
+ * @brief	Open the given capture file for writing. If it already contains
+ *	records, new records get appended.
+ * @param path	The path of the file to write.
+ * @return \c NULL on error, the capture handle otherwise.
+ */
+ipmi_cap_t *ipmi_cap_open(const char *path);
+
+/**
+ * @brief	Flush all pending records, close the capture file and free the
+ *	handle. Ignored if \c cap is \c NULL.
+ */
+void ipmi_cap_close(ipmi_cap_t *cap);
+
+/**
+ * @brief	Append a record to the given capture file.
+ * @param cap	The capture handle to use.
+ * @param type	\c IPMI_CAP_REQ or \c IPMI_CAP_RSP .
+ * @param msgid	The ID of the request.
+ * @param req	The request or the request the response belongs to.
+ * @param ccode	The completion code of the response, \c 0 for requests.
+ * @param data	The data to store.
+ * @param len	The number of data bytes to store.
+ */
+void ipmi_cap_write(ipmi_cap_t *cap, uint8_t type, long msgid,
+	const struct ipmi_rq *req, uint8_t ccode, const uint8_t *data, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// IPMIMEX_IPMI_CAP_H
@@ -0,0 +1,509 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_fru.c
+ * FRU inventory (see ipmi_fru.h). Many BMCs answer Read FRU Data requests
+ * for up to 200+ bytes, so instead of asking for a fixed 16 or 32 bytes per
+ * request like most tools do, the chunk size starts big and gets halved
+ * whenever a request gets rejected as too big. Satellites get asked for small
+ * chunks right away, because bridged requests need to fit into an IPMB
+ * message.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "ipmi_if.h"
+#include "ipmi_sdr.h"
+#include "ipmi_sdr_convert.h"
+#include "ipmi_store.h"
+#include "ipmi_sdr_store.h"
+#include "ipmi_fru.h"
+
+#define NETFN_STORAGE	0xA
+
+// FRU commands, table G-1
+#define CMD_GET_FRU_INFO	0x10	// 34.1
+#define CMD_READ_FRU_DATA	0x11	// 34.2
+
+#define FRU_CHUNK_MAX	0xF0		// bytes to ask for per Read FRU Data first
+#define FRU_CHUNK_IPMB	0x10		// the same for bridged requests
+#define FRU_CHUNK_MIN	8			// the smallest chunk size to try
+#define FRU_HDR_SZ		8			// common header
+
+// completion codes of requests asking for too many bytes
+#define TOO_BIG(_cc) \
+	((_cc) == 0xC7 || (_cc) == 0xC8 || (_cc) == SDR_CC_BUFFER_TOO_SMALL)
+
+static const char *field_name[] = {
+	"chassis_part",				// FRU_CHASSIS_PART
+	"chassis_serial",
+	"board_manufacturer",		// FRU_BOARD_MANUFACTURER
+	"board_product",
+	"board_serial",
+	"board_part",
+	"product_manufacturer",		// FRU_PRODUCT_MANUFACTURER
+	"product_name",
+	"product_part",
+	"product_version",
+	"product_serial",
+	"product_asset_tag",
+};
+
+// The info areas of interest by their index in the common header. skip is
+// the number of bytes preceding the 1st type/length encoded field.
+static const struct {
+	const char *name;
+	uint8_t skip;
+	fru_field_t first;
+	fru_field_t last;
+} area[] = {
+	{ "chassis", 3, FRU_CHASSIS_PART, FRU_CHASSIS_SERIAL },				// 2
+	{ "board", 6, FRU_BOARD_MANUFACTURER, FRU_BOARD_PART },				// 3
+	{ "product", 3, FRU_PRODUCT_MANUFACTURER, FRU_PRODUCT_ASSET_TAG },	// 4
+};
+
+const char *
+fru_field2str(fru_field_t field) {
+	return (field < ARRAY_SIZE(field_name)) ? field_name[field] : NULL;
+}
+
+uint8_t
+fru_checksum(const uint8_t *data, size_t len) {
+	uint8_t sum = 0;
+
+	while (len-- > 0)
+		sum += *data++;
+	return sum;
+}
+
+// decode the given type/length encoded field (FRU spec, 13). Binary data get
+// shown as hex string. Leading and trailing blanks get dropped.
+static char *
+fru_str(const uint8_t *raw, uint8_t len, uint8_t type) {
+	char *s, *b, *e;
+	uint8_t i;
+
+	if (len == 0)
+		return NULL;
+	if (type == 0) {
+		if ((s = malloc(2 * len + 1)) == NULL)
+			return NULL;
+		for (i = 0; i < len; i++)
+			sprintf(s + 2 * i, "%02x", raw[i]);
+	} else if ((s = sdr_str2utf8(raw, len, type)) == NULL) {
+		return NULL;
+	}
+	for (e = s + strlen(s); e > s && e[-1] == ' '; e--)
+		;
+	*e = '\0';
+	for (b = s; *b == ' '; b++)
+		;
+	if (*b == '\0') {
+		free(s);
+		return NULL;
+	}
+	if (b != s)
+		memmove(s, b, e - b + 1);
+	return s;
+}
+
+static void
+fru_clear(fru_t *f) {
+	int i;
+
+	for (i = 0; i < FRU_FIELDS; i++) {
+		free(f->field[i]);
+		f->field[i] = NULL;
+	}
+}
+
+// decode the fields of interest from the data of the given FRU
+static void
+fru_parse(fru_t *f) {
+	const uint8_t *d = f->data;
+	uint32_t o, p, end, alen, i, k;
+	uint8_t tl;
+
+	fru_clear(f);
+	if (f->len < FRU_HDR_SZ || (d[0] & 0x0F) != 1
+		|| fru_checksum(d, FRU_HDR_SZ) != 0)
+	{
+		PROM_WARN("FRU '%s': invalid common header.", f->name);
+		return;
+	}
+	for (i = 0; i < ARRAY_SIZE(area); i++) {
+		o = d[i + 2] * 8;
+		if (o == 0)
+			continue;
+		alen = (o + 2 <= f->len) ? d[o + 1] * 8 : 0;
+		if (alen <= area[i].skip || o + alen > f->len) {
+			PROM_WARN("FRU '%s': %s info area truncated.", f->name,
+				area[i].name);
+			continue;
+		}
+		if (fru_checksum(d + o, alen) != 0) {
+			PROM_WARN("FRU '%s': %s info area has an invalid checksum.",
+				f->name, area[i].name);
+			continue;
+		}
+		// the last byte is the checksum
+		end = o + alen - 1;
+		for (p = o + area[i].skip, k = area[i].first; p < end; k++) {
+			tl = d[p++];
+			if (tl == 0xC1)
+				break;				// end of fields
+			if (p + (tl & 0x3F) > end)
+				break;
+			if (k <= area[i].last)
+				f->field[k] = fru_str(d + p, tl & 0x3F, tl >> 6);
+			p += tl & 0x3F;
+		}
+	}
+}
+
+fru_t *
+fru_locate(ipmi_ctx_t *ctx, sdr_image_t *img, uint32_t *count) {
+	sdr_fru_locator_t loc;
+	struct ipmi_rs rsp;
+	ipmi_bmc_info_t *bmc;
+	fru_t *head = NULL, *last = NULL, *f;
+	size_t off, len, nlen;
+	char buf[32];
+	uint8_t cc;
+
+	*count = 0;
+	for (off = 0; img->data != NULL && off < img->len; off += len) {
+		len = img->data[off++];
+		if (len <= offsetof(sdr_fru_locator_t, name)
+			|| img->data[off + 3] != SDR_TYPE_FRU_LOCATOR)
+		{
+			continue;
+		}
+		memset(&loc, 0, sizeof(loc));
+		memcpy(&loc, img->data + off, len > sizeof(loc) ? sizeof(loc) : len);
+		if (!loc.is_logical) {
+			PROM_DEBUG("Skipping non-intelligent FRU device 0x%02x.",
+				loc.fru_id);
+			continue;
+		}
+		if ((f = calloc(1, sizeof(fru_t))) == NULL)
+			break;
+		f->fru_id = loc.fru_id;
+		f->addr = loc.access_addr & 0xFE;
+		f->channel = loc.channel;
+		f->lun = loc.lun;
+		if (f->addr == IPMI_BMC_SA && f->channel == 0)
+			f->addr = 0;
+		nlen = len - offsetof(sdr_fru_locator_t, name) - 1;
+		if (nlen > loc.name.len)
+			nlen = loc.name.len;
+		f->name = sdr_str2utf8(loc.name.raw, nlen, loc.name.fmt);
+		if (f->name == NULL || f->name[0] == '\0') {
+			free(f->name);
+			sprintf(buf, "FRU %d", f->fru_id);
+			f->name = strdup(buf);
+		}
+		if (last == NULL)
+			head = f;
+		else
+			last->next = f;
+		last = f;
+		(*count)++;
+	}
+	// FRU device 0 of the BMC is implied (IPMI v2, 34)
+	for (f = head; f != NULL && (f->addr != 0 || f->fru_id != 0); f = f->next)
+		;
+	if (f != NULL)
+		return head;
+	bmc = get_bmc_info(ctx, &rsp, &cc);
+	if (bmc == NULL || cc != 0 || !bmc->supports_fru)
+		return head;
+	if ((f = calloc(1, sizeof(fru_t))) != NULL) {
+		f->name = strdup("Builtin FRU Device");
+		f->next = head;
+		head = f;
+		(*count)++;
+	}
+	return head;
+}
+
+static void
+fru_request(struct ipmi_rq *req, uint8_t cmd, const fru_t *f, uint8_t *data,
+	uint8_t len)
+{
+	req->addr = f->addr;
+	req->channel = f->channel;
+	req->msg.netfn = NETFN_STORAGE;
+	req->msg.cmd = cmd;
+	req->msg.lun = f->lun;
+	req->msg.data = data;
+	req->msg.data_len = len;
+}
+
+// Read the data of the given FRU, which follow the ones already read, until
+// at least end bytes are available. size is the size of its inventory area,
+// words tells, whether it gets accessed by words.
+static uint8_t
+fru_fill(ipmi_ctx_t *ctx, fru_t *f, uint32_t end, uint32_t size, bool words,
+	uint8_t *max)
+{
+	struct ipmi_rq req;
+	struct ipmi_rs rsp;
+	uint8_t rq[4], cc, shift = words ? 1 : 0;
+	uint32_t n, off;
+
+	if (end > size)
+		end = size;
+	while (f->len < end) {
+		n = size - f->len;
+		if (n > *max)
+			n = *max;
+		off = f->len >> shift;
+		rq[0] = f->fru_id;
+		rq[1] = off & 0xFF;
+		rq[2] = off >> 8;
+		rq[3] = (n >> shift) == 0 ? 1 : n >> shift;
+		fru_request(&req, CMD_READ_FRU_DATA, f, rq, sizeof(rq));
+		cc = sdr_call(ctx, &req, &rsp);
+		if (TOO_BIG(cc) && *max / 2 >= FRU_CHUNK_MIN) {
+			*max /= 2;
+			PROM_INFO("Reading FRU data in chunks of %d bytes.", *max);
+			continue;
+		}
+		if (cc != 0)
+			return cc;
+		n = (rsp.data_len > 0) ? (uint32_t) rsp.data[0] << shift : 0;
+		if (n > (uint32_t) rsp.data_len - 1)
+			n = rsp.data_len - 1;
+		if (n == 0)
+			return 0xFF;			// no progress
+		if (n > size - f->len)
+			n = size - f->len;
+		memcpy(f->data + f->len, rsp.data + 1, n);
+		f->len += n;
+		ipmi_yield(ctx);
+	}
+	return 0;
+}
+
+// read the common header and the info areas of interest of the given FRU
+static uint8_t
+fru_read_one(ipmi_ctx_t *ctx, fru_t *f, uint8_t *max) {
+	struct ipmi_rq req;
+	struct ipmi_rs rsp;
+	uint32_t size, o, i;
+	uint8_t rq[1], cc;
+	bool words;
+
+	rq[0] = f->fru_id;
+	fru_request(&req, CMD_GET_FRU_INFO, f, rq, sizeof(rq));
+	if ((cc = sdr_call(ctx, &req, &rsp)) != 0)
+		return cc;
+	if (rsp.data_len < 3)
+		return 0xFF;
+	size = rsp.data[0] | (rsp.data[1] << 8);
+	words = rsp.data[2] & 1;
+	if (size < FRU_HDR_SZ)
+		return SDR_CC_SENSOR_NOT_FOUND;
+	if ((f->data = malloc(size)) == NULL)
+		return 0xFF;
+	f->len = 0;
+	if ((cc = fru_fill(ctx, f, FRU_HDR_SZ, size, words, max)) != 0)
+		return cc;
+	if (fru_checksum(f->data, FRU_HDR_SZ) != 0)
+		return 0;					// garbage: let fru_parse() complain
+	for (i = 0; i < ARRAY_SIZE(area); i++) {
+		o = f->data[i + 2] * 8;
+		if (o == 0)
+			continue;
+		// the 2nd byte of an area tells its length
+		if ((cc = fru_fill(ctx, f, o + 2, size, words, max)) != 0)
+			return cc;
+		if (o + 2 > f->len)
+			continue;
+		cc = fru_fill(ctx, f, o + f->data[o + 1] * 8, size, words, max);
+		if (cc != 0)
+			return cc;
+	}
+	return 0;
+}
+
+uint32_t
+fru_read(ipmi_ctx_t *ctx, fru_t *list) {
+	uint8_t max[2] = { FRU_CHUNK_MAX, FRU_CHUNK_IPMB }, cc;
+	uint32_t n = 0;
+	fru_t *f;
+
+	for (f = list; f != NULL; f = f->next) {
+		if (f->data != NULL)
+			continue;
+		cc = fru_read_one(ctx, f, &(max[f->addr != 0]));
+		if (cc != 0) {
+			if (cc == SDR_CC_SENSOR_NOT_FOUND) {
+				PROM_INFO("FRU '%s' (%d) not present.", f->name, f->fru_id);
+			} else {
+				PROM_WARN("Reading FRU '%s' (%d) failed with: %s", f->name,
+					f->fru_id, ipmi_cc2str(cc));
+			}
+			free(f->data);
+			f->data = NULL;
+			f->len = 0;
+			continue;
+		}
+		fru_parse(f);
+		n++;
+	}
+	return n;
+}
+
+void
+fru_free(fru_t *list) {
+	fru_t *f;
+
+	while ((f = list) != NULL) {
+		list = f->next;
+		fru_clear(f);
+		free(f->name);
+		free(f->data);
+		free(f);
+	}
+}
+
+static bool
+same_fru(const fru_t *f, const fru_store_rec_t *rec) {
+	return f->fru_id == rec->fru_id && f->addr == rec->addr
+		&& f->channel == rec->channel && f->lun == rec->lun;
+}
+
+int
+fru_store_load(ipmi_ctx_t *ctx, const char *path, fru_t *list) {
+	fru_store_hdr_t hdr;
+	fru_store_rec_t rec;
+	sdr_store_key_t key;
+	uint8_t *data = NULL;
+	fru_t *fru;
+	size_t off;
+	uint32_t i, n = 0;
+	FILE *f;
+	int res = 1;
+
+	f = store_open(path, "FRU cache", &hdr, sizeof(hdr), FRU_STORE_MAGIC,
+		FRU_STORE_VERSION);
+	if (f == NULL)
+		return 1;
+	if (sdr_store_key(ctx, &key) != 0) {
+		PROM_WARN("Unable to validate FRU cache '%s'.", path);
+		goto end;
+	}
+	if (memcmp(&(hdr.key), &key, sizeof(sdr_store_key_t)) != 0) {
+		PROM_INFO("FRU cache '%s' is stale.", path);
+		goto end;
+	}
+	data = store_read(f, path, "FRU cache", hdr.len, hdr.checksum);
+	if (data == NULL)
+		goto end;
+	for (i = 0, off = 0; i < hdr.frus; i++) {
+		if (off + sizeof(rec) <= hdr.len) {
+			memcpy(&rec, data + off, sizeof(rec));
+			off += sizeof(rec) + rec.len;
+		} else {
+			off = hdr.len + 1;
+		}
+		if (off > hdr.len) {
+			PROM_WARN("Ignoring FRU cache '%s': invalid record.", path);
+			goto end;
+		}
+	}
+
+	for (i = 0, off = 0; i < hdr.frus; i++) {
+		memcpy(&rec, data + off, sizeof(rec));
+		off += sizeof(rec);
+		for (fru = list; fru != NULL; fru = fru->next) {
+			if (fru->data == NULL && same_fru(fru, &rec))
+				break;
+		}
+		if (fru != NULL && (fru->data = malloc(rec.len + 1)) != NULL) {
+			memcpy(fru->data, data + off, rec.len);
+			fru->len = rec.len;
+			fru_parse(fru);
+			n++;
+		}
+		off += rec.len;
+	}
+	PROM_INFO("Using FRU cache '%s' (%d FRUs).", path, n);
+	res = 0;
+
+end:
+	free(data);
+	fclose(f);
+	return res;
+}
+
+int
+fru_store_save(ipmi_ctx_t *ctx, const char *path, fru_t *list,
+	sdr_stamp_t *stamp)
+{
+	fru_store_hdr_t hdr;
+	fru_store_rec_t rec;
+	struct iovec iov;
+	uint8_t *data = NULL;
+	fru_t *fru;
+	size_t len = 0;
+	int res = 1;
+
+	if (!stamp->valid)
+		return 1;
+	store_hdr_init(&hdr, sizeof(hdr), FRU_STORE_MAGIC, FRU_STORE_VERSION);
+	// the cached repo info might be from the start of the reading
+	sdr_repo_info_forget(ctx);
+	if (sdr_store_key(ctx, &(hdr.key)) != 0
+		|| hdr.key.last_add != stamp->last_add
+		|| hdr.key.last_del != stamp->last_del)
+	{
+		PROM_INFO("SDR repo changed while reading FRUs. Cache not written.",
+			"");
+		return 1;
+	}
+	for (fru = list; fru != NULL; fru = fru->next) {
+		if (fru->data != NULL)
+			len += sizeof(rec) + fru->len;
+	}
+	if (len > UINT32_MAX || (data = malloc(len + 1)) == NULL)
+		return 1;
+	len = 0;
+	for (fru = list; fru != NULL; fru = fru->next) {
+		if (fru->data == NULL)
+			continue;
+		rec.fru_id = fru->fru_id;
+		rec.addr = fru->addr;
+		rec.channel = fru->channel;
+		rec.lun = fru->lun;
+		rec.len = fru->len;
+		memcpy(data + len, &rec, sizeof(rec));
+		memcpy(data + len + sizeof(rec), fru->data, fru->len);
+		len += sizeof(rec) + fru->len;
+		hdr.frus++;
+	}
+	hdr.len = len;
+	hdr.checksum = sdr_hash(SDR_HASH_INIT, data, len);
+	iov.iov_base = data;
+	iov.iov_len = len;
+	if (store_write(path, "FRU cache", &hdr, sizeof(hdr), &iov, 1) == 0) {
+		PROM_INFO("FRU cache '%s' written (%d FRUs).", path, hdr.frus);
+		res = 0;
+	}
+	free(data);
+	return res;
+}
@@ -0,0 +1,215 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_fru.h
+ * FRU inventory. The FRU devices get discovered using the FRU Device Locator
+ * SDRs of the SDR image (plus the FRU device 0 of the BMC, which is implied,
+ * if the BMC reports FRU inventory support), and their chassis, board and
+ * product info areas get read via Read FRU Data in chunks as large as the
+ * BMC accepts.
+ *
+ * Because reading FRU data is slow, the data read get stored in a file and
+ * used on the next start instead, as long as the key of the SDR cache (BMC
+ * identity and repo state, see \c sdr_store_key()) did not change. The file
+ * starts with a \c fru_store_hdr_t followed by \c frus \c fru_store_rec_t
+ * entries, each one followed by the \c len bytes of FRU data it announces.
+ * All numbers are stored in the byte order of the writing host, which is
+ * indicated by the \c bom field of the header.
+ */
+#ifndef IPMIMEX_IPMI_FRU_H
+#define IPMIMEX_IPMI_FRU_H
+
+#include <inttypes.h>
+#include "mach.h"
+#include "ipmi_if.h"
+#include "ipmi_sdr.h"
+#include "ipmi_sdr_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SDR_TYPE_FRU_LOCATOR	0x11
+
+#define FRU_STORE_MAGIC		"IPMIFRU"
+#define FRU_STORE_VERSION	1
+
+#pragma pack(push,1)
+
+/** @brief IPMI v2, table 43-7, FRU Device Locator Record. (43.8) */
+typedef struct sdr_fru_locator {
+	// SENSOR RECORD HEADER (1:5)
+	uint16_t id;				// (1:2) SDR ID
+	uint8_t version;			// (3) SDR version (51h == 2.0)
+	uint8_t type;				// (4) SDR_TYPE_FRU_LOCATOR
+	uint8_t size;				// (5) SDR size in bytes w/o the header
+
+	// RECORD KEY BYTES (6:9)
+	uint8_t access_addr;		// (6) [7:1] slave address of the controller
+	uint8_t fru_id;				// (7) FRU device ID, if logical
+	BITFIELD4(					// (8)
+		is_logical:1,			//	- [7] logical FRU device
+		__reserved:2,			//	- [6:5]
+		lun:2,					//	- [4:3] access LUN
+		bus:3					//	- [2:0] private bus ID
+	);
+	BITFIELD2(					// (9)
+		channel:4,				//	- [7:4] channel number
+		__reserved2:4			//	- [3:0]
+	);
+
+	// RECORD BODY BYTES (10:32)
+	uint8_t __reserved3;		// (10)
+	uint8_t dev_type;			// (11) device type - see table 43-12
+	uint8_t dev_modifier;		// (12)
+	uint8_t entity_id;			// (13) FRU entity ID
+	uint8_t entity_instance;	// (14)
+	uint8_t oem;				// (15)
+	struct {
+		BITFIELD3(				// (16) ID name format and length
+			fmt:2,				//	- [7:6] {unicode,BCD+,6b-ASCII,8b-latin1}
+			__reserved4:1,		//	- [5]
+			len:5				//	- [4:0] raw length in bytes
+		);
+		uint8_t raw[16];		// (17:32) device ID string bytes
+	} PACKED name;
+} PACKED sdr_fru_locator_t;
+
+typedef struct fru_store_hdr {
+	store_id_t id;				// FRU_STORE_MAGIC, FRU_STORE_VERSION
+	sdr_store_key_t key;		// the cache is valid for this state, only
+	uint16_t frus;				// number of FRU records following
+	uint16_t __reserved;
+	uint32_t len;				// number of bytes following the header
+	uint32_t checksum;			// FNV-1a of all bytes following the header
+} PACKED fru_store_hdr_t;
+
+typedef struct fru_store_rec {
+	uint8_t fru_id;				// the FRU device ...
+	uint8_t addr;				// ... and its controller (see fru_t)
+	uint8_t channel;
+	uint8_t lun;
+	uint16_t len;				// number of FRU data bytes following
+} PACKED fru_store_rec_t;
+
+#pragma pack(pop)
+
+/**
+ * @brief	The FRU inventory fields of interest. Within an area they are in
+ *	the order defined by the Platform Management FRU Information Storage
+ *	Definition v1.0, sections 10 .. 12.
+ */
+typedef enum fru_field {
+	FRU_CHASSIS_PART = 0,
+	FRU_CHASSIS_SERIAL,
+	FRU_BOARD_MANUFACTURER,
+	FRU_BOARD_PRODUCT,
+	FRU_BOARD_SERIAL,
+	FRU_BOARD_PART,
+	FRU_PRODUCT_MANUFACTURER,
+	FRU_PRODUCT_NAME,
+	FRU_PRODUCT_PART,
+	FRU_PRODUCT_VERSION,
+	FRU_PRODUCT_SERIAL,
+	FRU_PRODUCT_ASSET_TAG,
+	FRU_FIELDS
+} fru_field_t;
+
+/** @brief A logical FRU device. */
+typedef struct fru {
+	char *name;					// device ID string of its locator
+	uint8_t fru_id;				// FRU device ID
+	uint8_t addr;				// IPMB address of the controller, 0 .. BMC
+	uint8_t channel;
+	uint8_t lun;
+	uint16_t len;				// number of valid bytes in data
+	uint8_t *data;				// FRU data as read, NULL .. not yet read
+	char *field[FRU_FIELDS];	// decoded fields, NULL .. n/a
+	struct fru *next;
+} fru_t;
+
+/**
+ * @brief	Get the label name of the given FRU field.
+ * @param field	The field in question.
+ * @return \c NULL if unknown, the name otherwise.
+ */
+const char *fru_field2str(fru_field_t field);
+
+/**
+ * @brief	Get the 8-bit sum of the given bytes. The bytes of a FRU header
+ *	or area incl. its checksum byte sum up to \c 0 (FRU spec, 8 .. 11).
+ * @param data	The bytes to sum up.
+ * @param len	The number of bytes to sum up.
+ * @return The sum modulo 256.
+ */
+uint8_t fru_checksum(const uint8_t *data, size_t len);
+
+/**
+ * @brief	Create the list of logical FRU devices announced by the FRU Device
+ *	Locator SDRs of the given image. If the BMC reports FRU inventory support,
+ *	its FRU device 0 gets prepended, if not already announced. Their data are
+ *	not yet read.
+ * @param ctx	The context of the IPMI device the SDRs belong to.
+ * @param img	The SDRs to use.
+ * @param count	Where to store the number of FRU devices found.
+ * @return \c NULL if there are no FRU devices, the head of the list otherwise.
+ */
+fru_t *fru_locate(ipmi_ctx_t *ctx, sdr_image_t *img, uint32_t *count);
+
+/**
+ * @brief	Read the data of all FRU devices in the given list, which are not
+ *	yet read, and decode their fields. Only the common header and the chassis,
+ *	board and product info areas get read. Requests for more bytes than the
+ *	BMC or satellite accepts get repeated with a smaller chunk size, which is
+ *	used for all following requests.
+ * @param ctx	The context of the IPMI device to use.
+ * @param list	The FRU devices to read.
+ * @return The number of FRU devices read.
+ */
+uint32_t fru_read(ipmi_ctx_t *ctx, fru_t *list);
+
+/**
+ * @brief	Release the given FRU list incl. all its members.
+ * @param list	The list to free.
+ */
+void fru_free(fru_t *list);
+
+/**
+ * @brief	Set the data of the FRU devices in the given list, which are not
+ *	yet read, to the ones stored in the given file and decode their fields,
+ *	if the file is still valid for the given BMC.
+ * @param ctx	The context of the IPMI device to validate against.
+ * @param path	The path of the file to load.
+ * @param list	The FRU devices to update.
+ * @return \c 0 on success, a number > 0 if the file does not exist, is
+ *	invalid or stale.
+ */
+int fru_store_load(ipmi_ctx_t *ctx, const char *path, fru_t *list);
+
+/**
+ * @brief	Store the data of all read FRU devices in the given list to the
+ *	given file. The file gets replaced atomically.
+ * @param ctx	The context of the IPMI device the FRU devices belong to.
+ * @param path	The path of the file to write.
+ * @param list	The FRU devices to store.
+ * @param stamp	The state of the SDR repo the list has been created from.
+ *	If the repo changed in the meantime, nothing gets written.
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+int fru_store_save(ipmi_ctx_t *ctx, const char *path, fru_t *list,
+	sdr_stamp_t *stamp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// IPMIMEX_IPMI_FRU_H
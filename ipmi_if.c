@@ -0,0 +1,1082 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_if.c
+ * OS independent part of the IPMI transport: keeps up to window requests in
+ * flight, queues the rest and demultiplexes responses by message ID. Unless
+ * set explicitly, the window gets adjusted like TCP's congestion window (slow
+ * start, AIMD) using timeouts, busy completion codes and queueing delay as
+ * congestion signals. Answers
+ * for requests submitted with a completion callback get dispatched by a small
+ * event loop, which uses epoll and a timerfd for the deadlines on Linux.
+ * Requests bridged to satellite controllers get queued per channel and kept
+ * in flight besides the window, so they neither stall nor throttle the
+ * requests answered by the BMC itself.
+ */
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "common.h"
+#include "ipmi_if.h"
+#include "ipmi_cap.h"
+
+int ipmi_verbose = 0;
+
+// backends selectable via a device path prefix, the OS driver is the default
+static const ipmi_drv_ops_t *backends[] = {
+	&ipmi_drv_sim,
+	&ipmi_drv_replay,
+	&ipmi_drv_os
+};
+
+#define DEMUX_SZ		512			// must be a power of 2
+#define FREE_MAX		64			// max. number of jobs kept for reuse
+#define LAT_SZ			16			// max. number of command types tracked
+#define LAT_WARMUP		4			// samples needed to trust the estimate
+#define TMO_MIN			250			// ms, lower bound of adaptive timeouts
+#define LAT_QUEUED		4			// latency > LAT_QUEUED * min: congestion
+#define LAT_BRIDGED		0x8000		// latency key flag of bridged requests
+#define LATE_TTL		60000		// ms to wait for a late response
+#define NETFN_SE		0x4			// sensor readings, factors, thresholds
+#define NETFN_STORAGE	0xA			// SDR, SEL and FRU commands: slow
+#define NETFN_DCGRP		0x2C		// DCMI commands
+#define CMD_GET_SENSOR_FACTORS	0x23
+#define CMD_GET_SENSOR_READING	0x2D
+
+#define BRIDGED(_j)		((_j)->req.addr != 0)
+
+typedef enum {
+	JOB_QUEUED = 0,		// waiting for a free slot in the window
+	JOB_SENT,			// in flight
+	JOB_DONE,			// response received, but not yet fetched
+	JOB_FAILED,			// send failed, or no memory for the response
+	JOB_ABANDONED,		// timed out while queued, released when dequeued
+	JOB_LATE			// timed out in flight, waiting for the late response
+} job_state_t;
+
+typedef struct job {
+	long msgid;
+	job_state_t state;
+	ipmi_prio_t prio;
+	long timeout;			// ms, 0 .. adaptive
+	long sent;				// CLOCK_MONOTONIC ms
+	long deadline;			// CLOCK_MONOTONIC ms, set when sent
+	long throttled;			// CLOCK_MONOTONIC ms, when it had to wait for a token
+	ipmi_cb_t cb;			// NULL for jobs fetched via ipmi_recv()
+	void *arg;
+	struct ipmi_rq req;
+	uint8_t data[IPMI_RQ_DATA_MAX];
+	struct ipmi_rs *rsp;	// answer of a job w/o callback until fetched
+	struct job *next;		// send queue or free list
+	struct job *hnext;		// demux table chain
+	struct job *fnext;		// flight list
+} job_t;
+
+// latency statistics of a command type
+typedef struct lat {
+	bool used;
+	uint16_t key;			// netfn << 8 | cmd [| LAT_BRIDGED]
+	int samples;
+	double avg;				// EWMA of the latency in ms
+	double dev;				// EWMA of the mean deviation from avg in ms
+	double min;				// min. latency seen in ms
+} lat_t;
+
+struct ipmi_ctx {
+	const ipmi_drv_ops_t *ops;
+	ipmi_drv_t *drv;
+	int curr_seq;
+	int window;
+	bool autowin;			// adjust the window automatically
+	double cwnd;			// congestion window
+	double ssthresh;		// slow start threshold
+	long cut;				// CLOCK_MONOTONIC ms of the last window reduction
+	int inflight;
+	int async;				// number of pending jobs with a callback
+	int late;				// number of jobs in state JOB_LATE
+	job_t *demux[DEMUX_SZ];
+	job_t *flight;			// jobs in state JOB_SENT or JOB_LATE
+	job_t *qhead[IPMI_PRIO_MAX];	// send queue per priority class
+	job_t *qtail[IPMI_PRIO_MAX];
+	job_t *bqhead[IPMI_CHANNELS][IPMI_PRIO_MAX];	// bridged jobs per channel
+	job_t *bqtail[IPMI_CHANNELS][IPMI_PRIO_MAX];
+	int bridged[IPMI_CHANNELS];		// bridged jobs in flight per channel
+	int busy[IPMI_PRIO_MAX];		// jobs queued or in flight per class
+	job_t *free;
+	int nfree;				// number of jobs in the free list
+	int epfd;				// epoll instance watching the device and tfd
+	int tfd;				// timerfd for the earliest async deadline
+	long timer;				// deadline tfd is armed for, 0 .. disarmed
+	long tmo_fast;			// max. timeout for ordinary commands
+	long tmo_slow;			// max. timeout for storage commands
+	int fails;				// number of requests failed in a row
+	double rate;			// max. commands per second, 0 .. unlimited
+	double burst;			// max. number of tokens in the bucket
+	double tokens;			// commands which may be sent right now
+	long refilled;			// CLOCK_MONOTONIC ms of the last refill
+	unsigned long throttled_cmds;	// commands which had to wait for a token
+	unsigned long throttled_ms;		// total time commands had to wait
+	ipmi_cap_t *cap;		// capture file, NULL .. not capturing
+	ipmi_yield_t yield;		// see ipmi_set_yield()
+	void *yield_arg;
+	lat_t lat[LAT_SZ];
+};
+
+long
+now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long
+now_s(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static job_t *
+demux_find(ipmi_ctx_t *ctx, long msgid) {
+	job_t *j = ctx->demux[msgid & (DEMUX_SZ - 1)];
+
+	while (j != NULL && j->msgid != msgid)
+		j = j->hnext;
+	return j;
+}
+
+static void
+demux_add(ipmi_ctx_t *ctx, job_t *j) {
+	job_t **head = &(ctx->demux[j->msgid & (DEMUX_SZ - 1)]);
+
+	j->hnext = *head;
+	*head = j;
+}
+
+// Jobs in flight get tracked in a separate list, so that looking for expired
+// ones costs O(window) and not O(queued jobs).
+static void
+flight_add(ipmi_ctx_t *ctx, job_t *j) {
+	j->fnext = ctx->flight;
+	ctx->flight = j;
+}
+
+static void
+flight_del(ipmi_ctx_t *ctx, job_t *j) {
+	job_t **p = &(ctx->flight);
+
+	while (*p != NULL && *p != j)
+		p = &((*p)->fnext);
+	if (*p != NULL)
+		*p = j->fnext;
+	j->fnext = NULL;
+}
+
+// remove the job from the demux table and put it on the free list
+static void
+job_release(ipmi_ctx_t *ctx, job_t *j) {
+	job_t **p = &(ctx->demux[j->msgid & (DEMUX_SZ - 1)]);
+
+	if (j->state == JOB_SENT || j->state == JOB_LATE)
+		flight_del(ctx, j);
+
+	while (*p != NULL && *p != j)
+		p = &((*p)->hnext);
+	if (*p != NULL)
+		*p = j->hnext;
+	j->hnext = NULL;
+	free(j->rsp);
+	j->rsp = NULL;
+	// keep memory bounded after a burst of thousands of requests
+	if (ctx->nfree == FREE_MAX) {
+		free(j);
+		return;
+	}
+	j->next = ctx->free;
+	ctx->free = j;
+	ctx->nfree++;
+}
+
+static job_t *
+job_new(ipmi_ctx_t *ctx) {
+	job_t *j = ctx->free;
+
+	if (j != NULL) {
+		ctx->free = j->next;
+		ctx->nfree--;
+	} else {
+		j = malloc(sizeof(job_t));
+		if (j == NULL)
+			return NULL;
+	}
+	memset(j, 0, offsetof(job_t, rsp));
+	j->rsp = NULL;
+	j->next = j->hnext = j->fnext = NULL;
+	return j;
+}
+
+// latency statistics of the command type of the given request. Bridged
+// requests get tracked separately, because satellites are usually much slower
+// than the BMC.
+static lat_t *
+lat_get(ipmi_ctx_t *ctx, struct ipmi_rq *req) {
+	uint16_t key = (req->msg.netfn << 8) | req->msg.cmd
+		| (req->addr != 0 ? LAT_BRIDGED : 0);
+	size_t i;
+
+	for (i = 0; i < LAT_SZ; i++) {
+		if (!ctx->lat[i].used) {
+			ctx->lat[i].used = true;
+			ctx->lat[i].key = key;
+			return &(ctx->lat[i]);
+		}
+		if (ctx->lat[i].key == key)
+			return &(ctx->lat[i]);
+	}
+	return NULL;
+}
+
+// feed the latency of the given answered job into its command type stats.
+// Returns true if the latency indicates, that requests pile up in the BMC.
+static bool
+lat_update(ipmi_ctx_t *ctx, job_t *j) {
+	lat_t *l = lat_get(ctx, &(j->req));
+	double d, sample = now_ms() - j->sent;
+
+	if (l == NULL)
+		return false;
+	if (l->samples == 0 || sample < l->min)
+		l->min = sample;
+	if (l->samples == 0) {
+		l->avg = sample;
+		l->dev = sample / 2;
+	} else {
+		// same gains as TCP's RTT estimator (RFC 6298)
+		d = sample - l->avg;
+		l->avg += d / 8;
+		l->dev += ((d < 0 ? -d : d) - l->dev) / 4;
+	}
+	l->samples++;
+	return l->samples > LAT_WARMUP && sample > LAT_QUEUED * l->min + 5;
+}
+
+// congestion: halve the window, but at most once per round trip, i.e. only
+// for requests sent after the last reduction
+static void
+aimd_cut(ipmi_ctx_t *ctx, job_t *j) {
+	if (!ctx->autowin || j->sent < ctx->cut)
+		return;
+	ctx->ssthresh = ctx->cwnd / 2 < 1 ? 1 : ctx->cwnd / 2;
+	ctx->cwnd = ctx->ssthresh;
+	ctx->window = ctx->cwnd;
+	ctx->cut = now_ms();
+	PROM_DEBUG("Window reduced to %d.", ctx->window);
+}
+
+// request answered in time: grow the window, if it limited the throughput
+static void
+aimd_grow(ipmi_ctx_t *ctx) {
+	int p, old = ctx->window;
+
+	if (!ctx->autowin || ctx->inflight + 1 < ctx->window)
+		return;
+	for (p = 0; p < IPMI_PRIO_MAX && ctx->qhead[p] == NULL; p++)
+		;
+	if (p == IPMI_PRIO_MAX)
+		return;		// no more requests than slots
+	ctx->cwnd += (ctx->cwnd < ctx->ssthresh) ? 1 : 1 / ctx->cwnd;
+	if (ctx->cwnd > IPMI_WINDOW_MAX)
+		ctx->cwnd = IPMI_WINDOW_MAX;
+	ctx->window = ctx->cwnd;
+	if (ctx->window != old)
+		PROM_DEBUG("Window increased to %d.", ctx->window);
+}
+
+// completion codes indicating an overloaded BMC or OS driver
+static bool
+is_busy(uint8_t cc) {
+	return cc == 0xC0		// node busy
+		|| cc == 0xC3		// timeout while processing the command
+		|| cc == 0xCE		// response could not be provided
+		|| cc == 0xFF;		// unspecified, e.g. kernel message queue full
+}
+
+// the upper bound of the timeout of the given request's class
+static long
+class_timeout(ipmi_ctx_t *ctx, struct ipmi_rq *req) {
+	return (req->msg.netfn == NETFN_STORAGE) ? ctx->tmo_slow : ctx->tmo_fast;
+}
+
+// the adaptive timeout for the given request
+static long
+lat_timeout(ipmi_ctx_t *ctx, struct ipmi_rq *req) {
+	long t, max = class_timeout(ctx, req);
+	lat_t *l = lat_get(ctx, req);
+
+	if (l == NULL || l->samples < LAT_WARMUP)
+		return max;
+	t = l->avg + 4 * l->dev;
+	if (t < TMO_MIN)
+		t = TMO_MIN;
+	return t > max ? max : t;
+}
+
+// the priority class of the given request
+static ipmi_prio_t
+prio_of(struct ipmi_rq *req) {
+	if (req->msg.netfn == NETFN_SE && (req->msg.cmd == CMD_GET_SENSOR_READING
+		|| req->msg.cmd == CMD_GET_SENSOR_FACTORS))
+	{
+		return IPMI_PRIO_READING;
+	}
+	if (req->msg.netfn == NETFN_DCGRP)
+		return IPMI_PRIO_POWER;
+	return IPMI_PRIO_BACKGROUND;
+}
+
+// true if the given job may be sent right now, i.e. there is a free slot in
+// the window (or for bridged jobs on its channel), no job of the same class is
+// waiting for it and all higher classes are idle
+static bool
+may_send(ipmi_ctx_t *ctx, job_t *j) {
+	int p, ch = j->req.channel;
+
+	if (BRIDGED(j)) {
+		if (ctx->bridged[ch] >= IPMI_BRIDGE_WINDOW
+			|| ctx->bqhead[ch][j->prio] != NULL)
+		{
+			return false;
+		}
+	} else if (ctx->inflight >= ctx->window || ctx->qhead[j->prio] != NULL) {
+		return false;
+	}
+	for (p = 0; p < (int) j->prio; p++) {
+		if (ctx->busy[p] > 0)
+			return false;
+	}
+	return true;
+}
+
+// refill the token bucket and take a token for the given job, if available
+static bool
+take_token(ipmi_ctx_t *ctx, job_t *j) {
+	long now;
+
+	if (ctx->rate <= 0)
+		return true;
+	now = now_ms();
+	ctx->tokens += (now - ctx->refilled) * ctx->rate / 1000;
+	if (ctx->tokens > ctx->burst)
+		ctx->tokens = ctx->burst;
+	ctx->refilled = now;
+	if (ctx->tokens >= 1) {
+		ctx->tokens--;
+		return true;
+	}
+	if (j->throttled == 0) {
+		j->throttled = now;
+		ctx->throttled_cmds++;
+	}
+	return false;
+}
+
+// true if there is a queued job, which could be sent if a token is available
+static bool
+sendable(ipmi_ctx_t *ctx) {
+	int p, ch;
+
+	for (p = 0; p < IPMI_PRIO_MAX; p++) {
+		if (ctx->qhead[p] != NULL && ctx->inflight < ctx->window)
+			return true;
+		for (ch = 0; ch < IPMI_CHANNELS; ch++) {
+			if (ctx->bqhead[ch][p] != NULL
+				&& ctx->bridged[ch] < IPMI_BRIDGE_WINDOW)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// CLOCK_MONOTONIC ms when the next token gets available, LONG_MAX if there is
+// no need to wait for it
+static long
+token_time(ipmi_ctx_t *ctx) {
+	if (ctx->rate <= 0 || ctx->tokens >= 1 || !sendable(ctx))
+		return LONG_MAX;
+	return ctx->refilled + (long) ((1 - ctx->tokens) * 1000 / ctx->rate) + 1;
+}
+
+static int
+job_send(ipmi_ctx_t *ctx, job_t *j) {
+	if (j->throttled != 0)
+		ctx->throttled_ms += now_ms() - j->throttled;
+	if (ctx->ops->send(ctx->drv, &(j->req), j->msgid,
+		j->timeout > 0 ? j->timeout : class_timeout(ctx, &(j->req))) < 0)
+	{
+		j->state = JOB_FAILED;
+		ctx->busy[j->prio]--;
+		if (!BRIDGED(j))
+			ctx->fails++;
+		return -3;
+	}
+	ipmi_cap_write(ctx->cap, IPMI_CAP_REQ, j->msgid, &(j->req), 0,
+		j->req.msg.data, j->req.msg.data_len);
+	j->state = JOB_SENT;
+	flight_add(ctx, j);
+	j->sent = now_ms();
+	j->deadline = j->sent
+		+ (j->timeout > 0 ? j->timeout : lat_timeout(ctx, &(j->req)));
+	if (BRIDGED(j))
+		ctx->bridged[j->req.channel]++;
+	else
+		ctx->inflight++;
+	return 0;
+}
+
+// put the given job at the end of its send queue
+static void
+job_queue(ipmi_ctx_t *ctx, job_t *j) {
+	job_t **head = BRIDGED(j)
+		? &(ctx->bqhead[j->req.channel][j->prio]) : &(ctx->qhead[j->prio]);
+	job_t **tail = BRIDGED(j)
+		? &(ctx->bqtail[j->req.channel][j->prio]) : &(ctx->qtail[j->prio]);
+
+	j->state = JOB_QUEUED;
+	if (*tail == NULL)
+		*head = j;
+	else
+		(*tail)->next = j;
+	*tail = j;
+}
+
+// give up on the given job. A job in flight frees its slot in the window, so
+// that a single hanging request does not stall all others. A satellite not
+// answering says nothing about the BMC, so it does not shrink the window.
+static void
+job_abandon(ipmi_ctx_t *ctx, job_t *j) {
+	if (j->state == JOB_SENT) {
+		if (BRIDGED(j)) {
+			ctx->bridged[j->req.channel]--;
+		} else {
+			aimd_cut(ctx, j);
+			ctx->fails++;
+			ctx->inflight--;
+		}
+		ctx->busy[j->prio]--;
+		ctx->late++;
+		j->state = JOB_LATE;
+		j->deadline = now_ms() + LATE_TTL;
+	} else if (j->state == JOB_QUEUED) {
+		ctx->busy[j->prio]--;
+		j->state = JOB_ABANDONED;
+	} else {
+		job_release(ctx, j);
+	}
+}
+
+// remove the 1st job from the given queue and send it. Returns true if its
+// callback got invoked, because sending failed.
+static bool
+job_dequeue(ipmi_ctx_t *ctx, job_t **head, job_t **tail) {
+	job_t *j = *head;
+	ipmi_cb_t cb;
+	void *arg;
+	long id;
+
+	*head = j->next;
+	if (*head == NULL)
+		*tail = NULL;
+	j->next = NULL;
+	if (j->state == JOB_ABANDONED) {
+		job_release(ctx, j);	// timed out while waiting in the queue
+		return false;
+	}
+	if (job_send(ctx, j) == 0 || j->cb == NULL)
+		return false;
+	cb = j->cb;
+	arg = j->arg;
+	id = j->msgid;
+	ctx->async--;
+	job_release(ctx, j);
+	cb(id, NULL, arg);
+	return true;
+}
+
+// move queued requests into the window as long as there are free slots.
+// Requests of a lower class get sent only, if all higher classes are idle.
+static void
+flush_queue(ipmi_ctx_t *ctx) {
+	job_t *j;
+	int p, ch;
+
+again:
+	for (p = 0; p < IPMI_PRIO_MAX; p++) {
+		for (ch = 0; ch < IPMI_CHANNELS; ch++) {
+			while (ctx->bqhead[ch][p] != NULL
+				&& ctx->bridged[ch] < IPMI_BRIDGE_WINDOW)
+			{
+				j = ctx->bqhead[ch][p];
+				if (j->state != JOB_ABANDONED && !take_token(ctx, j))
+					return;
+				if (job_dequeue(ctx, &(ctx->bqhead[ch][p]),
+					&(ctx->bqtail[ch][p])))
+				{
+					goto again;		// the callback may have queued new requests
+				}
+			}
+		}
+		while (ctx->qhead[p] != NULL && ctx->inflight < ctx->window) {
+			j = ctx->qhead[p];
+			if (j->state != JOB_ABANDONED && !take_token(ctx, j))
+				return;
+			if (job_dequeue(ctx, &(ctx->qhead[p]), &(ctx->qtail[p])))
+				goto again;
+		}
+		if (ctx->busy[p] > 0)
+			break;
+	}
+}
+
+// earliest deadline of all async jobs in flight or the time when the next
+// token for a throttled job gets available, LONG_MAX if there is none
+static long
+next_deadline(ipmi_ctx_t *ctx) {
+	job_t *j;
+	long t = token_time(ctx);
+
+	if (ctx->async == 0)
+		return t;
+	for (j = ctx->flight; j != NULL; j = j->fnext) {
+		if (j->cb != NULL && j->state == JOB_SENT && j->deadline < t)
+			t = j->deadline;
+	}
+	return t;
+}
+
+// invoke the callback of all async jobs in flight whose deadline is <= now
+// with NULL and drop late jobs, which did not get an answer in time
+static void
+expire(ipmi_ctx_t *ctx, long now) {
+	job_t *j;
+	ipmi_cb_t cb;
+
+again:
+	if (ctx->async == 0 && ctx->late == 0)
+		return;
+	for (j = ctx->flight; j != NULL; j = j->fnext) {
+		if (j->deadline > now)
+			continue;
+		if (j->state == JOB_LATE) {
+			PROM_DEBUG("Giving up on request %ld.", j->msgid);
+			ctx->late--;
+			job_release(ctx, j);
+			goto again;
+		}
+		if (j->cb == NULL || j->state != JOB_SENT)
+			continue;
+		PROM_WARN("Timeout for request %ld (%ld ms).",
+			j->msgid, now - j->sent);
+		job_abandon(ctx, j);
+		cb = j->cb;
+		j->cb = NULL;
+		ctx->async--;
+		cb(j->msgid, NULL, j->arg);
+		goto again;		// the callback may have changed the list
+	}
+}
+
+// hand over the response for the request with the given id to its job
+static void
+route(ipmi_ctx_t *ctx, long id, struct ipmi_rs *rsp) {
+	job_t *k = demux_find(ctx, id);
+	ipmi_cb_t cb;
+	void *arg;
+	bool congested;
+
+	if (ctx->cap != NULL && k != NULL)
+		ipmi_cap_write(ctx->cap, IPMI_CAP_RSP, id, &(k->req), rsp->ccode,
+			rsp->data, rsp->data_len);
+	if (k == NULL) {
+		PROM_DEBUG("Dropping response for unknown request %ld.", id);
+		return;
+	}
+	ctx->fails = 0;		// the BMC is alive
+	if (k->state == JOB_LATE) {
+		// still a valid sample - lets the timeout grow, if the BMC is slow
+		lat_update(ctx, k);
+		PROM_DEBUG("Dropping late response for request %ld (%ld ms).",
+			id, now_ms() - k->sent);
+		ctx->late--;
+		job_release(ctx, k);
+		return;
+	}
+	if (k->state != JOB_SENT) {
+		PROM_WARN("Oooops, got a response for request %ld not in flight.", id);
+		return;
+	}
+	congested = lat_update(ctx, k);
+	ctx->busy[k->prio]--;
+	if (BRIDGED(k)) {
+		// the window is about the BMC, not its satellites
+		ctx->bridged[k->req.channel]--;
+	} else {
+		ctx->inflight--;
+		if (congested || is_busy(rsp->ccode))
+			aimd_cut(ctx, k);
+		else
+			aimd_grow(ctx);
+	}
+	if (k->cb == NULL) {
+		flight_del(ctx, k);
+		// most jobs have a callback, so only these need a response buffer
+		if ((k->rsp = malloc(sizeof(struct ipmi_rs))) == NULL) {
+			k->state = JOB_FAILED;
+			return;
+		}
+		memcpy(k->rsp, rsp, sizeof(struct ipmi_rs));
+		k->state = JOB_DONE;
+		return;
+	}
+	cb = k->cb;
+	arg = k->arg;
+	ctx->async--;
+	job_release(ctx, k);
+	cb(id, rsp, arg);
+}
+
+#ifdef __linux
+static void
+events_close(ipmi_ctx_t *ctx) {
+	if (ctx->tfd >= 0)
+		close(ctx->tfd);
+	if (ctx->epfd >= 0)
+		close(ctx->epfd);
+	ctx->tfd = ctx->epfd = -1;
+	ctx->timer = 0;
+}
+
+static void
+events_open(ipmi_ctx_t *ctx) {
+	struct epoll_event ev;
+	int fd = ctx->ops->fd(ctx->drv);
+
+	if (fd < 0)
+		return;
+	ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+	ctx->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (ctx->epfd < 0 || ctx->tfd < 0)
+		goto fail;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		goto fail;
+	ev.data.fd = ctx->tfd;
+	if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, ctx->tfd, &ev) < 0)
+		goto fail;
+	return;
+
+fail:
+	PROM_WARN("Unable to setup the event loop (%s) - using polling instead.",
+		strerror(errno));
+	events_close(ctx);
+}
+
+// (re-)arm the timer for the earliest async deadline
+static void
+timer_arm(ipmi_ctx_t *ctx) {
+	struct itimerspec its;
+	long t = next_deadline(ctx);
+
+	if (t == LONG_MAX)
+		t = 0;
+	if (t == ctx->timer)
+		return;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = t / 1000;
+	its.it_value.tv_nsec = (t % 1000) * 1000000;
+	if (timerfd_settime(ctx->tfd, TFD_TIMER_ABSTIME, &its, NULL) == 0)
+		ctx->timer = t;
+}
+
+// wait up to wait ms for events and process them
+static int
+pump_epoll(ipmi_ctx_t *ctx, long wait) {
+	struct epoll_event ev[2];
+	struct ipmi_rs buf;
+	uint64_t ticks;
+	long id;
+	int i, n, res;
+
+	timer_arm(ctx);
+	do {
+		n = epoll_wait(ctx->epfd, ev, 2, wait > INT_MAX ? INT_MAX : wait);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		PROM_WARN("Waiting for events failed: %s", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (ev[i].data.fd == ctx->tfd) {
+			if (read(ctx->tfd, &ticks, sizeof(ticks)) > 0)
+				ctx->timer = 0;
+			expire(ctx, now_ms());
+			continue;
+		}
+		// drain all responses available
+		while ((res = ctx->ops->recv(ctx->drv, &buf, &id, -1)) > 0)
+			route(ctx, id, &buf);
+		if (res < 0)
+			return res;
+	}
+	return n;
+}
+#else
+static void events_open(ipmi_ctx_t *ctx) { (void) ctx; }
+static void events_close(ipmi_ctx_t *ctx) { (void) ctx; }
+#endif
+
+// wait up to wait ms for a response or deadline and process it
+static int
+pump(ipmi_ctx_t *ctx, long wait) {
+	struct ipmi_rs buf;
+	long id;
+	int res;
+
+#ifdef __linux
+	if (ctx->epfd >= 0)
+		return pump_epoll(ctx, wait);
+#endif
+	res = ctx->ops->recv(ctx->drv, &buf, &id, wait);
+	if (res > 0)
+		route(ctx, id, &buf);
+	expire(ctx, now_ms());
+	return res;
+}
+
+ipmi_ctx_t *
+ipmi_if_open(char *dev) {
+	ipmi_ctx_t *ctx = calloc(1, sizeof(ipmi_ctx_t));
+	size_t i, len;
+
+	if (ctx == NULL) {
+		PROM_FATAL("Unable to allocate IPMI context.", "");
+		return NULL;
+	}
+	for (i = 0; i < ARRAY_SIZE(backends); i++) {
+		len = strlen(backends[i]->prefix);
+		if (dev == NULL ? len == 0 : strncmp(dev, backends[i]->prefix, len) == 0)
+			break;
+	}
+	ctx->ops = backends[i];
+	if ((ctx->drv = ctx->ops->open(dev == NULL ? NULL : dev + len)) == NULL) {
+		free(ctx);
+		return NULL;
+	}
+	ctx->autowin = true;
+	ctx->cwnd = ctx->window = 1;
+	ctx->ssthresh = IPMI_WINDOW_DFLT;
+	ctx->epfd = ctx->tfd = -1;
+	ipmi_if_timeouts(ctx, IPMI_TMO_FAST_DFLT, IPMI_TMO_SLOW_DFLT);
+	events_open(ctx);
+	return ctx;
+}
+
+void
+ipmi_if_close(ipmi_ctx_t *ctx) {
+	job_t *j, *n;
+	size_t i;
+
+	if (ctx == NULL)
+		return;
+	// let the submitters know, that their requests are gone
+	for (i = 0; i < DEMUX_SZ; i++) {
+		for (j = ctx->demux[i]; j != NULL; j = j->hnext) {
+			if (j->cb != NULL
+				&& (j->state == JOB_QUEUED || j->state == JOB_SENT))
+			{
+				ipmi_cb_t cb = j->cb;
+				j->cb = NULL;
+				cb(j->msgid, NULL, j->arg);
+			}
+		}
+	}
+	events_close(ctx);
+	ipmi_cap_close(ctx->cap);
+	ctx->ops->close(ctx->drv);
+	for (i = 0; i < DEMUX_SZ; i++) {
+		for (j = ctx->demux[i]; j != NULL; j = n) {
+			n = j->hnext;
+			free(j->rsp);
+			free(j);
+		}
+	}
+	for (j = ctx->free; j != NULL; j = n) {
+		n = j->next;
+		free(j);
+	}
+	free(ctx);
+}
+
+int
+ipmi_if_window(ipmi_ctx_t *ctx, int n) {
+	if (n > IPMI_WINDOW_MAX)
+		n = IPMI_WINDOW_MAX;
+	if (n > 0) {
+		ctx->window = ctx->cwnd = n;
+		ctx->autowin = false;
+	}
+	return ctx->window;
+}
+
+void
+ipmi_if_rate(ipmi_ctx_t *ctx, double rate, int burst) {
+	ctx->rate = rate > 0 ? rate : 0;
+	ctx->burst = burst > 0 ? burst : 1;
+	ctx->tokens = ctx->burst;
+	ctx->refilled = now_ms();
+	if (ctx->rate > 0)
+		PROM_DEBUG("Max. %g commands/s, burst %d", ctx->rate, burst);
+}
+
+void
+ipmi_if_throttled(ipmi_ctx_t *ctx, unsigned long *cmds, unsigned long *ms) {
+	*cmds = ctx == NULL ? 0 : ctx->throttled_cmds;
+	*ms = ctx == NULL ? 0 : ctx->throttled_ms;
+}
+
+int
+ipmi_if_failures(ipmi_ctx_t *ctx) {
+	return ctx == NULL ? 0 : ctx->fails;
+}
+
+int
+ipmi_if_capture(ipmi_ctx_t *ctx, const char *path) {
+	ipmi_cap_close(ctx->cap);
+	ctx->cap = NULL;
+	if (path == NULL)
+		return 0;
+	ctx->cap = ipmi_cap_open(path);
+	return ctx->cap == NULL ? 1 : 0;
+}
+
+void
+ipmi_if_timeouts(ipmi_ctx_t *ctx, long fast, long slow) {
+	if (fast > 0)
+		ctx->tmo_fast = fast < TMO_MIN ? TMO_MIN : fast;
+	if (slow > 0)
+		ctx->tmo_slow = slow < TMO_MIN ? TMO_MIN : slow;
+	PROM_DEBUG("Max. timeouts: %ld ms, storage %ld ms", ctx->tmo_fast,
+		ctx->tmo_slow);
+}
+
+static long
+enqueue(ipmi_ctx_t *ctx, struct ipmi_rq *req, long timeout, ipmi_cb_t cb,
+	void *arg)
+{
+	job_t *j;
+
+	if (req == NULL)
+		return -1;
+	if (ctx == NULL) {
+		PROM_WARN("IPMI device not opened.", "");
+		return -2;
+	}
+	if (req->msg.data_len > IPMI_RQ_DATA_MAX) {
+		PROM_WARN("Request data too long (%d > %d).",
+			req->msg.data_len, IPMI_RQ_DATA_MAX);
+		return -1;
+	}
+	if (req->addr != 0 && req->channel >= IPMI_CHANNELS) {
+		PROM_WARN("Invalid channel %d.", req->channel);
+		return -1;
+	}
+	if ((j = job_new(ctx)) == NULL) {
+		PROM_WARN("Unable to allocate a request slot.", "");
+		return -1;
+	}
+	j->req = *req;
+	j->req.msg.data = j->data;
+	if (req->msg.data_len > 0)
+		memcpy(j->data, req->msg.data, req->msg.data_len);
+	j->msgid = ctx->curr_seq++;
+	if (ctx->curr_seq < 0)
+		ctx->curr_seq = 0;
+	j->cb = cb;
+	j->arg = arg;
+	j->timeout = timeout > 0 ? timeout : 0;
+	j->prio = prio_of(&(j->req));
+	demux_add(ctx, j);
+
+	ctx->busy[j->prio]++;
+	if (may_send(ctx, j) && take_token(ctx, j)) {
+		if (job_send(ctx, j) < 0) {
+			job_release(ctx, j);
+			return -3;
+		}
+	} else {
+		job_queue(ctx, j);
+	}
+	if (cb != NULL)
+		ctx->async++;
+	return j->msgid;
+}
+
+int
+ipmi_send(ipmi_ctx_t *ctx, struct ipmi_rq *req) {
+	return enqueue(ctx, req, 0, NULL, NULL);
+}
+
+long
+ipmi_submit(ipmi_ctx_t *ctx, struct ipmi_rq *req, long timeout, ipmi_cb_t cb,
+	void *arg)
+{
+	if (cb == NULL) {
+		PROM_WARN("No completion callback given.", "");
+		return -1;
+	}
+	return enqueue(ctx, req, timeout, cb, arg);
+}
+
+// the number of async jobs to wait for: all if prio is IPMI_PRIO_MAX, the ones
+// queued or in flight of the given and all higher classes otherwise
+static int
+waiting(ipmi_ctx_t *ctx, ipmi_prio_t prio) {
+	int p, n = 0;
+
+	if (prio == IPMI_PRIO_MAX || ctx->async == 0)
+		return ctx->async;
+	for (p = 0; p <= (int) prio; p++)
+		n += ctx->busy[p];
+	return n;
+}
+
+static int
+dispatch(ipmi_ctx_t *ctx, long timeout, ipmi_prio_t prio) {
+	long now, left, deadline;
+
+	if (ctx == NULL)
+		return 0;
+	deadline = timeout > 0 ? now_ms() + timeout : LONG_MAX;
+	while (waiting(ctx, prio) > 0) {
+		flush_queue(ctx);
+		now = now_ms();
+		if (now >= deadline)
+			break;
+		// jobs in flight have a deadline, queued ones wait for a free slot
+		left = next_deadline(ctx);
+		if (left == LONG_MAX)
+			left = now + ctx->tmo_slow;
+		if (left > deadline)
+			left = deadline;
+		left -= now;
+		if (pump(ctx, left < 0 ? 0 : left) < 0) {
+			expire(ctx, LONG_MAX);	// device is broken - fail all
+			break;
+		}
+	}
+	flush_queue(ctx);
+	return ctx->async;
+}
+
+int
+ipmi_dispatch(ipmi_ctx_t *ctx, long timeout) {
+	return dispatch(ctx, timeout, IPMI_PRIO_MAX);
+}
+
+int
+ipmi_dispatch_prio(ipmi_ctx_t *ctx, long timeout, ipmi_prio_t prio) {
+	return dispatch(ctx, timeout, prio);
+}
+
+void
+ipmi_set_yield(ipmi_ctx_t *ctx, ipmi_yield_t fn, void *arg) {
+	if (ctx == NULL)
+		return;
+	ctx->yield = fn;
+	ctx->yield_arg = arg;
+}
+
+void
+ipmi_yield(ipmi_ctx_t *ctx) {
+	if (ctx != NULL && ctx->yield != NULL)
+		ctx->yield(ctx->yield_arg);
+}
+
+struct ipmi_rs *
+ipmi_recv(ipmi_ctx_t *ctx, long msgid, long timeout, struct ipmi_rs *rsp) {
+	job_t *j;
+	long now, limit, qlimit, deadline, wake;
+
+	if (ctx == NULL || rsp == NULL) {
+		PROM_FATAL("IPMI device not opened.", "");
+		return NULL;
+	}
+	j = demux_find(ctx, msgid);
+	if (j == NULL || j->cb != NULL
+		|| (j->state != JOB_QUEUED && j->state != JOB_SENT
+			&& j->state != JOB_DONE && j->state != JOB_FAILED))
+	{
+		PROM_WARN("No pending request with ID %ld.", msgid);
+		return NULL;
+	}
+	now = now_ms();
+	limit = timeout > 0 ? now + timeout : 0;
+	qlimit = now + ctx->tmo_slow;	// max. time to wait for a free slot
+
+	while (j->state == JOB_QUEUED || j->state == JOB_SENT) {
+		flush_queue(ctx);
+		now = now_ms();
+		if (limit > 0)
+			deadline = limit;
+		else if (j->state == JOB_SENT)
+			deadline = j->deadline;
+		else
+			deadline = qlimit;
+		if (deadline <= now) {
+			PROM_WARN("Timeout for request %ld.", msgid);
+			job_abandon(ctx, j);
+			return NULL;
+		}
+		wake = token_time(ctx);
+		if (wake > deadline)
+			wake = deadline;
+		if (pump(ctx, wake > now ? wake - now : 0) < 0) {
+			job_abandon(ctx, j);
+			return NULL;
+		}
+	}
+
+	if (j->state == JOB_FAILED) {
+		job_release(ctx, j);
+		flush_queue(ctx);
+		return NULL;
+	}
+	memcpy(rsp, j->rsp, sizeof(struct ipmi_rs));
+	job_release(ctx, j);
+	flush_queue(ctx);
+	return rsp;
+}
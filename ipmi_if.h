@@ -12,11 +12,28 @@
 /**
  * @file ipmi_if.h
  * IPMI interface related definitions.
- * @note	The interface has **no** multi-threading in mind because the BMCs
- *			itself as well as the related OS driver are single threaded, too.
- *			So make sure to call one function after another and be aware, that
- *			a function may change the underlying buffer of a received message
- *			returned in a previous call.
+ * @note	All state of an opened IPMI device is kept in its context returned
+ *			by \c ipmi_if_open(), so several devices may be used at the same
+ *			time. However, a context must not be used by more than one thread
+ *			at a time, because the BMCs itself as well as the related OS
+ *			driver are single threaded, too.
+ *			Requests may be pipelined: up to \c ipmi_if_window()
+ *			requests are kept in flight, all others get queued in the order
+ *			they have been sent. Responses are matched to their requests by
+ *			message ID, so they can be fetched in any order.
+ *			Queued requests get scheduled by priority class (see
+ *			\c ipmi_prio_t), so background work never delays a scrape.
+ *			Requests bridged to satellite controllers do not occupy the
+ *			window, but up to \c IPMI_BRIDGE_WINDOW per channel get kept in
+ *			flight concurrently, so that slow satellites do not stall requests
+ *			answered by the BMC itself.
+ *			Unless a timeout gets given explicitly, it gets derived from the
+ *			latency observed for the same type of command (EWMA of latency
+ *			+ 4 * mean deviation), so a hanging request fails fast, but the
+ *			timeout grows if the BMC gets slow.
+ *			Alternatively requests can be submitted together with a completion
+ *			callback via \c ipmi_submit(), which gets invoked by the event loop
+ *			run by \c ipmi_dispatch() (on Linux epoll(7) and timerfd(2) based).
  */
 
 #ifndef IPMIMEX_IF_H
@@ -28,12 +45,36 @@
 extern "C" {
 #endif
 
+/** @brief Max. number of requests, which can be kept in flight. */
+#define IPMI_WINDOW_MAX		32
+/** @brief Max. number of requests bridged to satellite controllers on the
+ * same channel, which can be kept in flight in addition to the window. */
+#define IPMI_BRIDGE_WINDOW	2
+/** @brief Number of IPMB channels (IPMI v2, 6.3). */
+#define IPMI_CHANNELS		16
+/** @brief The IPMB slave address of the BMC (IPMI v2, 5.1). */
+#define IPMI_BMC_SA			0x20
+/** @brief Slow start threshold of the automatically adjusted window. */
+#define IPMI_WINDOW_DFLT	4
+/** @brief Max. number of data bytes of a request. */
+#define IPMI_RQ_DATA_MAX	256
+/** @brief Default upper bound of the adaptive timeout in ms. */
+#define IPMI_TMO_FAST_DFLT	3000
+/** @brief Default upper bound of the adaptive timeout in ms for storage
+ * commands (SDR, SEL, FRU), which are usually much slower. */
+#define IPMI_TMO_SLOW_DFLT	15000
+
 extern int ipmi_verbose;
 
 /**
- * @brief	IPMI message to send to the OS driver.
+ * @brief	IPMI message to send to the OS driver. If \c addr is \c 0, it gets
+ *	sent to the BMC via the system interface, otherwise the BMC bridges it to
+ *	the satellite controller with the given IPMB slave address on the given
+ *	channel (e.g. a PSU or the ME/Node Manager).
  */
 struct ipmi_rq {
+	uint8_t addr;		// IPMB (8-bit) slave address of the target, 0 .. BMC
+	uint8_t channel;	// channel the target is attached to, if addr != 0
 	struct {
 		uint8_t netfn:6;
 		uint8_t lun:2;
@@ -57,44 +98,303 @@ struct ipmi_rs {
 	int data_len;
 };
 
+/**
+ * @brief	Priority classes of requests. The class gets derived from the
+ *		command: sensor readings and factors needed to answer a scrape come
+ *		first, DCMI power readings second, everything else (thresholds, SDR,
+ *		SEL, FRU, device info, ...) is background work. Requests of a lower
+ *		class get sent only, if no request of a higher class is queued or in
+ *		flight.
+ */
+typedef enum ipmi_prio {
+	IPMI_PRIO_READING = 0,
+	IPMI_PRIO_POWER,
+	IPMI_PRIO_BACKGROUND,
+	IPMI_PRIO_MAX
+} ipmi_prio_t;
+
+/**
+ * @brief	Get the time of the monotonic clock.
+ * @return The number of milliseconds since an arbitrary, fixed point in time.
+ */
+long now_ms(void);
+
+/**
+ * @brief	Get the time of the monotonic clock.
+ * @return The number of seconds since an arbitrary, fixed point in time.
+ */
+long now_s(void);
+
+/** @brief	Opaque transport context of an opened IPMI device. */
+typedef struct ipmi_ctx ipmi_ctx_t;
+
+/** @brief	Opaque handle of the OS specific backend driver. */
+typedef struct ipmi_drv ipmi_drv_t;
+
 /**
  * @brief	Open the given IPMI device \c dev so that it can be used with
- *		\c ipmi_send() and \c ipmi_recv(), otherwise such calls will fail.
+ *		\c ipmi_send() and \c ipmi_recv() using the returned context.
  *		When done, one should call \c ipmi_if_close() to close the related
  *		device and free related resources.
  * @param dev	The device to open. If \c NULL the default device (Linux
- *		\c /dev/ipmi0 and Solaris \c /dev/bmc) will be used instead.
- * @return \c 0 on success, a value \c != \c 0 otherwise.
+ *		\c /dev/ipmi0 and Solaris \c /dev/bmc) will be used instead. If it
+ *		starts with \c sim: the BMC simulator gets used instead of the OS
+ *		driver, with the remaining part as path of its description file.
+ * @return \c NULL on error, the context of the opened device otherwise.
+ */
+ipmi_ctx_t *ipmi_if_open(char *dev);
+
+/**
+ * @brief	Close the IPMI device of the given context and free the context
+ *		incl. all pending requests. Callbacks of requests submitted via
+ *		\c ipmi_submit() and not yet completed get invoked with \c NULL
+ *		before and must not use the context anymore. Ignored if \c ctx is
+ *		\c NULL.
+ */
+void ipmi_if_close(ipmi_ctx_t *ctx);
+
+/**
+ * @brief	Set the max. number of requests to keep in flight. Per default
+ *		the window starts with 1 and gets adjusted automatically: it grows
+ *		while requests get answered in time and gets halved on timeouts,
+ *		busy completion codes or rising latency (AIMD).
+ * @param ctx	The context to change.
+ * @param n	The new window size. Values \c > \c IPMI_WINDOW_MAX get capped,
+ *		values \c <= \c 0 leave the current setting as is. Setting a window
+ *		size disables its automatic adjustment.
+ * @return The window size in use.
+ */
+int ipmi_if_window(ipmi_ctx_t *ctx, int n);
+
+/**
+ * @brief	Set the upper bounds of the adaptive timeouts. Requests the OS
+ *		driver forwards to a satellite controller get the bound of their class
+ *		as retry budget, so that the driver gives up in time, too.
+ * @param ctx	The context to change.
+ * @param fast	Max. number of milliseconds to wait for the answer of an
+ *		ordinary command like a sensor or power reading. Values \c <= \c 0
+ *		leave the current setting as is.
+ * @param slow	Max. number of milliseconds to wait for the answer of a storage
+ *		command like Get SDR. Values \c <= \c 0 leave the current setting
+ *		as is.
  */
-int ipmi_if_open(char *dev);
+void ipmi_if_timeouts(ipmi_ctx_t *ctx, long fast, long slow);
 
 /**
- * @brief	Close the already opened IPMI device. Ignored if the related device
- *		got closed previously.
+ * @brief	Limit the number of commands sent to the BMC using a token bucket.
+ *		Requests exceeding the limit stay queued until a token is available.
+ * @param ctx	The context to change.
+ * @param rate	Max. number of commands per second. Values \c <= \c 0 disable
+ *		the limit.
+ * @param burst	Max. number of commands, which may be sent at once after the
+ *		BMC has been idle for a while. Values \c <= \c 0 are treated as \c 1.
  */
-void ipmi_if_close(void);
+void ipmi_if_rate(ipmi_ctx_t *ctx, double rate, int burst);
+
+/**
+ * @brief	Get the throttling statistics of the given context.
+ * @param ctx	The context to query.
+ * @param cmds	Set to the number of commands, which had to wait for a token.
+ * @param ms	Set to the total number of milliseconds commands had to wait
+ *		for a token.
+ */
+void ipmi_if_throttled(ipmi_ctx_t *ctx, unsigned long *cmds, unsigned long *ms);
+
+/**
+ * @brief	Get the number of requests, which failed in a row, i.e. could not
+ *		be sent or did not get an answer in time. Any answer received from
+ *		the device resets it to \c 0.
+ * @param ctx	The context to query.
+ * @return The number of consecutive failures.
+ */
+int ipmi_if_failures(ipmi_ctx_t *ctx);
+
+/**
+ * @brief	Record all requests handed over to the device and all responses
+ *		received from it to the given capture file (see ipmi_cap.h). The
+ *		capture file can be replayed later using the device path
+ *		\c replay:file .
+ * @param ctx	The context to capture.
+ * @param path	The path of the capture file. If it already exists, new
+ *		records get appended. \c NULL stops capturing.
+ * @return \c 0 on success, a value \c != \c 0 otherwise.
+ */
+int ipmi_if_capture(ipmi_ctx_t *ctx, const char *path);
 
 /**
  * @brief	Send the given IPMI request to the already opened IPMI device.
+ *		If the window of requests in flight is already full, the request gets
+ *		queued and sent as soon as a slot becomes available (i.e. a response
+ *		for another request got received). The request data get copied, so
+ *		the caller may re-use the given \c req immediately.
+ * @param ctx	The context of the device to use.
  * @param req	The request to send.
  * @returns	On success the id of the message sent, which is always \c >= \c 0,
  *	a value \c < \c 0 otherwise.
  */
-int ipmi_send(struct ipmi_rq *req);
+int ipmi_send(ipmi_ctx_t *ctx, struct ipmi_rq *req);
 
 /**
  * @brief Fetch the answer for the IPMI request with the given \c msgid.
+ *		Answers for other requests received in the meantime get kept, until
+ *		they get fetched by calling this function with the related ID.
+ * @param ctx	The context used to send the request.
  * @param msgid	  Fetch the answer for the IMPI request with the given \c msgid.
- *		If no IPMI request with such an ID has been sent before, this function
- *		will keep fetching answers 'til it finds one with the given \c msgid,
- *		which probably means, it will hit the timeout.
- * @param timeout	Max. number of seconds to wait for an answer. A value
- *		\c <= \c 0 gets replaced by the internal default.
- * @return \c NULL on error, timeout or no received data, a pointer to the
- *		buffer of the retrieved data otherwise. NOTE that the buffer gets
- *		overwritten by the next call of this function.
- */
-struct ipmi_rs *ipmi_recv(long msgid, long timeout);
+ *		If no IPMI request with such an ID has been sent before, or its answer
+ *		has already been fetched, this function returns immediately.
+ * @param timeout	Max. number of milliseconds to wait for an answer. If
+ *		\c <= \c 0 the adaptive timeout for the related command gets used.
+ * @param rsp	Where to store the answer.
+ * @return \c NULL on error, timeout or no received data, \c rsp otherwise.
+ */
+struct ipmi_rs *ipmi_recv(ipmi_ctx_t *ctx, long msgid, long timeout,
+	struct ipmi_rs *rsp);
+
+/**
+ * @brief	Completion callback for requests submitted via \c ipmi_submit().
+ * @param msgid	The ID of the completed request.
+ * @param rsp	The response received or \c NULL, if the request timed out or
+ *		failed otherwise. The buffer is valid for the time of the call, only.
+ * @param arg	The argument passed to \c ipmi_submit().
+ */
+typedef void (*ipmi_cb_t)(long msgid, struct ipmi_rs *rsp, void *arg);
+
+/**
+ * @brief	Send the given IPMI request like \c ipmi_send(), but instead of
+ *		fetching the answer via \c ipmi_recv() the given callback gets invoked
+ *		as soon as the answer got received or the deadline has been reached.
+ *		Callbacks run from within \c ipmi_dispatch() or \c ipmi_recv() and may
+ *		submit new requests, but must not call \c ipmi_recv() or
+ *		\c ipmi_dispatch() themselves.
+ * @param ctx	The context of the device to use.
+ * @param req	The request to send.
+ * @param timeout	Max. number of milliseconds to wait for an answer, once
+ *		the request has been sent. If \c <= \c 0 the adaptive timeout for the
+ *		related command gets used.
+ * @param cb	The callback to invoke on completion. Must not be \c NULL.
+ * @param arg	Passed as is to the callback.
+ * @returns	On success the id of the message sent, which is always \c >= \c 0,
+ *	a value \c < \c 0 otherwise. In the latter case the callback gets never
+ *	invoked.
+ */
+long ipmi_submit(ipmi_ctx_t *ctx, struct ipmi_rq *req, long timeout,
+	ipmi_cb_t cb, void *arg);
+
+/**
+ * @brief	Run the event loop of the given context until all requests
+ *		submitted via \c ipmi_submit() got completed or the given timeout has
+ *		been reached.
+ * @param ctx	The context of the device to use.
+ * @param timeout	Max. number of milliseconds to run. A value \c <= \c 0
+ *		means no limit, i.e. return if all callbacks have been invoked.
+ * @return	The number of submitted requests still waiting for completion.
+ */
+int ipmi_dispatch(ipmi_ctx_t *ctx, long timeout);
+
+/**
+ * @brief	Run the event loop of the given context like \c ipmi_dispatch(),
+ *		but return as soon as all requests of the given and all higher
+ *		priority classes got completed. So a scrape does not need to wait for
+ *		background work still in progress.
+ * @param ctx	The context of the device to use.
+ * @param timeout	Max. number of milliseconds to run. A value \c <= \c 0
+ *		means no limit.
+ * @param prio	The lowest priority class to wait for.
+ * @return	The number of submitted requests still waiting for completion.
+ */
+int ipmi_dispatch_prio(ipmi_ctx_t *ctx, long timeout, ipmi_prio_t prio);
+
+/**
+ * @brief	Hook to let others use the device in the middle of a long running
+ *		job. See \c ipmi_set_yield().
+ * @param arg	The argument passed to \c ipmi_set_yield().
+ */
+typedef void (*ipmi_yield_t)(void *arg);
+
+/**
+ * @brief	Set the hook to invoke via \c ipmi_yield(). The transport itself
+ *		never calls it: long running jobs like walking the SDR repository call
+ *		\c ipmi_yield() between two event loop slices, whenever it is safe for
+ *		others to use the device, e.g. to release and re-acquire the lock
+ *		serializing access to it.
+ * @param ctx	The context of the device to use.
+ * @param fn	The hook to set. \c NULL removes the current one.
+ * @param arg	Passed as is to the hook.
+ */
+void ipmi_set_yield(ipmi_ctx_t *ctx, ipmi_yield_t fn, void *arg);
+
+/**
+ * @brief	Invoke the hook set via \c ipmi_set_yield(), if any.
+ * @param ctx	The context of the device to use.
+ */
+void ipmi_yield(ipmi_ctx_t *ctx);
+
+/**
+ * @brief	Backend driver interface. The transport (ipmi_if.c) talks to the
+ *	device via the operations of the backend picked by \c ipmi_if_open(),
+ *	only.
+ */
+typedef struct ipmi_drv_ops {
+	/** @brief	Prefix of the device path selecting this backend. */
+	const char *prefix;
+
+	/**
+	 * @brief	Open the given IPMI device. See \c ipmi_if_open().
+	 * @return \c NULL on error, the handle of the opened device otherwise.
+	 */
+	ipmi_drv_t *(*open)(char *dev);
+
+	/**
+	 * @brief	Close the IPMI device opened via \c open() and free the
+	 *	handle.
+	 */
+	void (*close)(ipmi_drv_t *drv);
+
+	/**
+	 * @brief	Hand over the given request to the device.
+	 * @param drv	The handle of the device to use.
+	 * @param req	The request to send.
+	 * @param msgid	The ID to tag the request with.
+	 * @param timeout	Max. number of milliseconds the caller waits for the
+	 *	answer. The device may use it to time its own retries of requests it
+	 *	forwards to other controllers, so that it gives up before the caller.
+	 * @return \c 0 on success, a value \c < \c 0 otherwise.
+	 */
+	int (*send)(ipmi_drv_t *drv, struct ipmi_rq *req, long msgid,
+		long timeout);
+
+	/**
+	 * @brief	Fetch the next response available from the device, no matter,
+	 *	to which request it belongs.
+	 * @param drv	The handle of the device to use.
+	 * @param rsp	Where to store the response.
+	 * @param msgid	Where to store the ID of the request the response belongs
+	 *	to.
+	 * @param timeout	Max. number of milliseconds to wait for a response. If
+	 *	\c < \c 0 do not wait at all, because the caller already knows, that
+	 *	the device is readable (see \c fd()).
+	 * @return \c 1 if a response has been stored, \c 0 on timeout, a value
+	 *	\c < \c 0 on error.
+	 */
+	int (*recv)(ipmi_drv_t *drv, struct ipmi_rs *rsp, long *msgid,
+		long timeout);
+
+	/**
+	 * @brief	Get the file descriptor of the opened IPMI device, which
+	 *	becomes readable, when a response is available.
+	 * @return \c -1 if not available, the file descriptor otherwise.
+	 */
+	int (*fd)(ipmi_drv_t *drv);
+} ipmi_drv_ops_t;
+
+/** @brief	The OS specific backend (see IF_DEV in the Makefile). */
+extern const ipmi_drv_ops_t ipmi_drv_os;
+
+/** @brief	The BMC simulator backend (see sim.c). */
+extern const ipmi_drv_ops_t ipmi_drv_sim;
+
+/** @brief	The capture replay backend (see ipmi_cap.c). */
+extern const ipmi_drv_ops_t ipmi_drv_replay;
 
 #ifdef __cplusplus
 }
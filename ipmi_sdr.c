@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <prom_string_builder.h>
 #include <prom_log.h>
@@ -28,7 +29,9 @@
 #define NETFN_DCGRP		0x2C		// Group Extension
 
 #define CMD(_a, _b, _c, _d)	\
-	static struct ipmi_rq _a; \
+	struct ipmi_rq _a; \
+	_a.addr = 0; \
+	_a.channel = 0; \
 	_a.msg.cmd = _b; \
 	_a.msg.netfn = _c; \
 	_a.msg.lun = 0; \
@@ -48,25 +51,249 @@
 #define CMD_GET_SENSOR_READING(m,r)		CMD(m, 0x2D,NETFN_SE, r)		// 35.14
 
 #define SEND(_a, _b, _c, _d, ...)	\
-	if ((_b = ipmi_send(&_a)) < 0) { \
+	if ((_b = ipmi_send(ctx, &_a)) < 0) { \
 		if (_b == -3) \
 			PROM_WARN(_d, __VA_ARGS__); \
 		return _c; \
 	}
 
 #define RECV(_a, _b, _c, _d, _e, ...)	\
-	struct ipmi_rs *_a = ipmi_recv(_b, 0); \
-	if (_a == NULL) { \
+	if (ipmi_recv(ctx, _b, 0, _a) == NULL) { \
 		PROM_WARN(_e, __VA_ARGS__); \
 		return _c; \
 	} \
 	if (_d) \
 		*(_d) = _a->ccode;
 
+// Response cache for commands returning data, which rarely change. Entries
+// are keyed by device context, target, netfn, cmd and request data.
+#define CACHE_SZ		64			// hash buckets, must be a power of 2
+#define CACHE_RQ_MAX	8			// max. request data bytes of cacheable cmds
+#define TTL_BMC_INFO	300			// s
+#define TTL_REPO_INFO	30			// s, max. delay of SDR change detection
+#define TTL_THRESHOLDS	300			// s
+#define TTL_DCMI_NA		3600		// s to remember an unsupported DCMI cmd
+
+typedef struct cache_entry {
+	ipmi_ctx_t *ctx;
+	uint16_t key;					// netfn << 8 | cmd
+	uint8_t addr;					// target of the request
+	uint8_t channel;
+	uint8_t lun;
+	uint8_t rq_len;
+	uint8_t rq[CACHE_RQ_MAX];
+	long expires;					// CLOCK_MONOTONIC s
+	uint8_t ccode;
+	int data_len;
+	struct cache_entry *next;
+	uint8_t data[];
+} cache_entry_t;
+
+static cache_entry_t *cache[CACHE_SZ];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int
+cache_hash(ipmi_ctx_t *ctx, struct ipmi_rq *req) {
+	unsigned int h = ((uintptr_t) ctx >> 4) ^ (req->msg.netfn << 8)
+		^ req->msg.cmd ^ (req->addr << 4);
+	int i;
+
+	for (i = 0; i < req->msg.data_len; i++)
+		h = h * 31 + req->msg.data[i];
+	return h & (CACHE_SZ - 1);
+}
+
+static bool
+cache_match(cache_entry_t *e, ipmi_ctx_t *ctx, struct ipmi_rq *req) {
+	return e->ctx == ctx && e->key == ((req->msg.netfn << 8) | req->msg.cmd)
+		&& e->addr == req->addr && e->channel == req->channel
+		&& e->lun == req->msg.lun && e->rq_len == req->msg.data_len
+		&& memcmp(e->rq, req->msg.data, e->rq_len) == 0;
+}
+
+// copy the cached response for the given request into rsp. Returns NULL if
+// there is none or it has been expired.
+static struct ipmi_rs *
+cache_get(ipmi_ctx_t *ctx, struct ipmi_rq *req, struct ipmi_rs *rsp,
+	uint8_t *cc)
+{
+	cache_entry_t *e;
+	struct ipmi_rs *res = NULL;
+
+	if (req->msg.data_len > CACHE_RQ_MAX)
+		return NULL;
+	pthread_mutex_lock(&cache_lock);
+	for (e = cache[cache_hash(ctx, req)]; e != NULL; e = e->next) {
+		if (!cache_match(e, ctx, req))
+			continue;
+		if (e->expires > now_s()) {
+			rsp->ccode = e->ccode;
+			rsp->data_len = e->data_len;
+			memcpy(rsp->data, e->data, e->data_len);
+			if (cc)
+				*cc = e->ccode;
+			res = rsp;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	if (res != NULL && ipmi_verbose > 1)
+		PROM_DEBUG("Cache hit for cmd 0x%02x:%02x", req->msg.netfn,
+			req->msg.cmd);
+	return res;
+}
+
+// store the given response for the given request for ttl seconds
+static void
+cache_put(ipmi_ctx_t *ctx, struct ipmi_rq *req, struct ipmi_rs *rsp, long ttl)
+{
+	cache_entry_t *e, **p;
+	size_t len = rsp->data_len < 0 ? 0 : rsp->data_len;
+
+	if (req->msg.data_len > CACHE_RQ_MAX || len > sizeof(rsp->data))
+		return;
+	pthread_mutex_lock(&cache_lock);
+	p = &(cache[cache_hash(ctx, req)]);
+	for (e = *p; e != NULL; p = &(e->next), e = e->next) {
+		if (cache_match(e, ctx, req)) {
+			*p = e->next;
+			free(e);
+			break;
+		}
+	}
+	if ((e = malloc(sizeof(cache_entry_t) + len)) != NULL) {
+		e->ctx = ctx;
+		e->key = (req->msg.netfn << 8) | req->msg.cmd;
+		e->addr = req->addr;
+		e->channel = req->channel;
+		e->lun = req->msg.lun;
+		e->rq_len = req->msg.data_len;
+		if (e->rq_len > 0)
+			memcpy(e->rq, req->msg.data, e->rq_len);
+		e->expires = now_s() + ttl;
+		e->ccode = rsp->ccode;
+		e->data_len = len;
+		memcpy(e->data, rsp->data, len);
+		e->next = cache[cache_hash(ctx, req)];
+		cache[cache_hash(ctx, req)] = e;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+// remove the cached response for the given request, if any
+static void
+cache_drop(ipmi_ctx_t *ctx, struct ipmi_rq *req) {
+	cache_entry_t *e, **p;
+
+	pthread_mutex_lock(&cache_lock);
+	p = &(cache[cache_hash(ctx, req)]);
+	for (e = *p; e != NULL; p = &(e->next), e = e->next) {
+		if (cache_match(e, ctx, req)) {
+			*p = e->next;
+			free(e);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+// Max. number of bytes to ask for per Get SDR command, learned per device
+// context: BMCs with small message buffers answer larger requests with
+// SDR_CC_BUFFER_TOO_SMALL, so records get read in chunks of this size. No
+// entry means, that whole records can be read at once. Protected by
+// cache_lock.
+#define SDR_CHUNK_MIN	8			// the smallest chunk size to try
+
+typedef struct sdr_chunk {
+	ipmi_ctx_t *ctx;
+	uint8_t max;
+	struct sdr_chunk *next;
+} sdr_chunk_t;
+
+static sdr_chunk_t *chunks = NULL;
+
+// the max. number of bytes to ask for per Get SDR command
+static uint8_t
+chunk_max(ipmi_ctx_t *ctx) {
+	sdr_chunk_t *c;
+	uint8_t max = 0xFF;
+
+	pthread_mutex_lock(&cache_lock);
+	for (c = chunks; c != NULL && c->ctx != ctx; c = c->next)
+		;
+	if (c != NULL)
+		max = c->max;
+	pthread_mutex_unlock(&cache_lock);
+	return max;
+}
+
+// A request for the given number of bytes got rejected as too big: halve the
+// chunk size. Returns false if it can't get any smaller.
+static bool
+chunk_shrink(ipmi_ctx_t *ctx, uint8_t rejected) {
+	sdr_chunk_t *c;
+	uint8_t max = (rejected == 0xFF ? 0x80 : rejected) / 2;
+	bool res = true;
+
+	pthread_mutex_lock(&cache_lock);
+	for (c = chunks; c != NULL && c->ctx != ctx; c = c->next)
+		;
+	if (c != NULL && c->max < rejected)
+		goto end;		// another request learned it already
+	if (max < SDR_CHUNK_MIN) {
+		res = false;
+		goto end;
+	}
+	if (c == NULL) {
+		if ((c = malloc(sizeof(sdr_chunk_t))) == NULL) {
+			res = false;
+			goto end;
+		}
+		c->ctx = ctx;
+		c->next = chunks;
+		chunks = c;
+	}
+	c->max = max;
+	PROM_INFO("Reading SDRs in chunks of %d bytes.", max);
+
+end:
+	pthread_mutex_unlock(&cache_lock);
+	return res;
+}
+
+void
+sdr_cache_flush(ipmi_ctx_t *ctx) {
+	cache_entry_t *e, **p;
+	sdr_chunk_t *c, **q;
+	int i;
+
+	pthread_mutex_lock(&cache_lock);
+	for (q = &chunks; (c = *q) != NULL; ) {
+		if (ctx == NULL || c->ctx == ctx) {
+			*q = c->next;
+			free(c);
+		} else {
+			q = &(c->next);
+		}
+	}
+	for (i = 0; i < CACHE_SZ; i++) {
+		p = &(cache[i]);
+		while ((e = *p) != NULL) {
+			if (ctx == NULL || e->ctx == ctx) {
+				*p = e->next;
+				free(e);
+			} else {
+				p = &(e->next);
+			}
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
 ipmi_bmc_info_t *
-get_bmc_info(uint8_t *cc) {
+get_bmc_info(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, uint8_t *cc) {
 	int msgId;
-	static ipmi_bmc_info_t bmc_info;
+	ipmi_bmc_info_t *bmc_info = (ipmi_bmc_info_t *) rsp->data;
 
 	if (ipmi_verbose > 1)
 		PROM_DEBUG("Getting BMC info.", "");
@@ -74,6 +301,8 @@ get_bmc_info(uint8_t *cc) {
 
 	if (cc)
 		*cc = 0xFF;
+	if (cache_get(ctx, &req, rsp, cc) != NULL)
+		return bmc_info;
 	SEND(req, msgId, NULL, "Failed to send BMC info request.", "");
 	RECV(rsp, msgId, NULL, cc, "Unable to get BMC info.", "");
 
@@ -81,31 +310,35 @@ get_bmc_info(uint8_t *cc) {
 		PROM_WARN("BMC info request failed with: %s", ipmi_cc2str(rsp->ccode));
 		return NULL;
 	}
-	if (bmc_info.update_in_progress) {
-		*cc = SDR_CC_FW_UPDATE_IN_PROGRESS;
+	if (bmc_info->update_in_progress) {
+		if (cc)
+			*cc = SDR_CC_FW_UPDATE_IN_PROGRESS;
 		return NULL;
 	}
-	memcpy(&bmc_info, rsp->data, sizeof (bmc_info));
+	cache_put(ctx, &req, rsp, TTL_BMC_INFO);
 
 	PROM_DEBUG("BMC %s Device SDRs",
-		bmc_info.provides_dev_sdrs ? "provides" : "does not provide");
+		bmc_info->provides_dev_sdrs ? "provides" : "does not provide");
 	PROM_DEBUG("BMC %s SDR repo device commands",
-		bmc_info.supports_sdr_repo ? "supports" : "does not support");
+		bmc_info->supports_sdr_repo ? "supports" : "does not support");
 	PROM_DEBUG("BMC %s SDR sensor device commands",
-		bmc_info.supports_sensor ? "supports" : "does not support");
+		bmc_info->supports_sensor ? "supports" : "does not support");
 
-	return &bmc_info;
+	return bmc_info;
 }
 
 sdr_repo_info_t *
-get_repo_info(uint8_t *cc) {
+get_repo_info(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, uint8_t *cc) {
 	int msgId;
+	sdr_repo_info_t *sdr_info = (sdr_repo_info_t *) rsp->data;
 
 	if (ipmi_verbose > 1)
 		PROM_DEBUG("Getting repo info.", "");
 	// This implementation is not interested in satellite MCs/Devs alias 
 	// Device SDRs, but in the BMC managed repo (LUN 0), only.
 	CMD_GET_SDR_INFO(req, cc);
+	if (cache_get(ctx, &req, rsp, cc) != NULL)
+		return sdr_info;
 	SEND(req, msgId, NULL, "Failed to send SDR repo info request.", "");
 	RECV(rsp, msgId, NULL, cc, "Failed to get SDR repo info.", "");
 	if (rsp->ccode != 0) {
@@ -113,22 +346,30 @@ get_repo_info(uint8_t *cc) {
 			ipmi_cc2str(rsp->ccode));
 		return NULL;
 	}
+	cache_put(ctx, &req, rsp, TTL_REPO_INFO);
 
-	static sdr_repo_info_t sdr_info;
-	memcpy(&sdr_info, rsp->data, sizeof (sdr_info));
 	// IPMIv1.0 == 0x01; IPMIv1.5 == 0x51 ; IPMIv2.0 == 0x02
-	if ((sdr_info.version != 0x51) && (sdr_info.version != 0x01)
-			&& (sdr_info.version != 0x02))
+	if ((sdr_info->version != 0x51) && (sdr_info->version != 0x01)
+			&& (sdr_info->version != 0x02))
 	{
-		PROM_WARN("Unknown SDR repository version 0x%02x", sdr_info.version);
+		PROM_WARN("Unknown SDR repository version 0x%02x", sdr_info->version);
 	}
-	PROM_DEBUG("SDR records   : %d", sdr_info.sdr_count);
-	return &sdr_info;
+	PROM_DEBUG("SDR records   : %d", sdr_info->sdr_count);
+	return sdr_info;
+}
+
+void
+sdr_repo_info_forget(ipmi_ctx_t *ctx) {
+	uint8_t *cc = NULL;
+
+	CMD_GET_SDR_INFO(req, cc);
+	cache_drop(ctx, &req);
 }
 
 uint16_t
-get_reservation(uint8_t *cc) {
+get_reservation(ipmi_ctx_t *ctx, uint8_t *cc) {
 	int msgId;
+	struct ipmi_rs buf, *rsp = &buf;
 	
 	if (ipmi_verbose > 1)
 		PROM_DEBUG("Getting repo reservation", "");
@@ -140,147 +381,121 @@ get_reservation(uint8_t *cc) {
 	return ((sdr_reservation_t *) rsp->data)->id;
 }
 
-/* keep track of reservation ID to use for GET SDR commands. */
-static uint16_t reservation_id = 0;
-
-sdr_full_t *
-get_sdr(uint16_t *record_id, uint8_t *len, uint8_t *cc) {
-	int msgId;
-	uint16_t rid = *record_id, res_count_try = 0;
-
-	if (ipmi_verbose > 1)
-		PROM_DEBUG("Getting SDR 0x%04x", *record_id);
-	if (record_id == NULL || len == NULL) {
-		PROM_FATAL("Software bug: recordId & len must be != NULL", "");
-		return NULL;
-	}
-	sdr_reservation_t sdr_reserv;
-	sdr_reserv.record_id = *record_id;
-	sdr_reserv.offset = 0;
-	sdr_reserv.len = *len;
-
-	CMD_GET_SDR(req, cc);
-
-	req.msg.data = (uint8_t *) &sdr_reserv;
-	req.msg.data_len = sizeof (sdr_reserv);
-
-again:
-	sdr_reserv.id = reservation_id;
-	
-	*record_id = 0;
-	*len = 0;
-
-	SEND(req, msgId, NULL, "Failed to send get request for SDR 0x%04x.", rid);
-	RECV(rsp, msgId, NULL, cc, "Failed to get SDR 0x%04x.", rid);
-
-	sdr_full_t *sdr = NULL;
-	if (rsp->data_len > 1) {
-		*len = rsp->data_len - 2;
-		// let's '\0' terminate so that name can be printed w/o copying before
-		(rsp->data)[rsp->data_len] = 0;
-		sdr = (sdr_full_t *) (rsp->data + 2);
-		if (*len >= 5) {
-			if (rid != sdr->id && rid != 0) {
-				PROM_WARN("ID of the SDR obtained is != requested ID."
-					"(0x%04x != 0x%04x). Adjusting SDR ID.", sdr->id, rid);
-				sdr->id = rid;
-			}
-		}
-		*record_id = *((uint16_t *) rsp->data);
-	} else {
-		msgId = 0;
+// Address the given request to the owner of the given sensor: the BMC's own
+// sensors get asked directly, the ones of satellite controllers (e.g. PSUs or
+// the ME) get bridged via IPMB.
+static void
+sensor_target(struct ipmi_rq *req, const sdr_key_t *key) {
+	req->msg.lun = key->lun;
+	if (key->is_id || ((key->owner_id & 0xFE) == IPMI_BMC_SA
+		&& key->channel == 0))
+	{
+		return;
 	}
+	req->addr = key->owner_id & 0xFE;
+	req->channel = key->channel;
+}
 
+// validate the answer of a Get Sensor Thresholds Command
+static sdr_thresholds_t *
+check_thresholds(struct ipmi_rs *rsp, uint8_t snum) {
 	if (rsp->ccode != 0) {
-#define SDR_MSG "Get SDR command failed with: %s"
-		if (rsp->ccode == SDR_CC_RESERVATION_CANCELED) {
-			PROM_DEBUG(SDR_MSG, ipmi_cc2str(rsp->ccode));
-			if (res_count_try > 0 && res_count_try < 4)
-				sleep(1);
-			if (res_count_try < 4) {
-				reservation_id = get_reservation(cc);
-				res_count_try++;
-				goto again;
-			}
-		} else {
-			PROM_WARN(SDR_MSG, ipmi_cc2str(rsp->ccode));
-		}
-#undef SDR_MSG
-		if (rsp->ccode == SDR_CC_BUFFER_TOO_SMALL) {
-			PROM_WARN("Very unusual today. Please report via %s", ISSUES_URL);
-			// keep and deliver partial message
-		} else {
-			return NULL;
+		// DELL likes to screw up its BMCs (junkware) ... 
+		if ((rsp->ccode != SDR_CC_SENSOR_NOT_FOUND)
+			&& (rsp->ccode != SDR_CC_ILLEGAL_CMD))
+		{
+			PROM_WARN("Get thresholds for sensor 0x%02x failed with: %s",
+				snum, ipmi_cc2str(rsp->ccode));
 		}
+		return NULL;
 	}
-	if (msgId == 0) {
-		// just in case the ccode check did not catch it
-		PROM_WARN("Got invalid response for SDR 0x%04 request.", rid);
+	if (rsp->data_len != sizeof(sdr_thresholds_t)) {
+		PROM_WARN("Got invalid thresholds for sensor 0x%02x.", snum);
 		return NULL;
 	}
 
-	if (ipmi_verbose) {
-		const char *s =
-			(ipmi_verbose > 1) ? hexdump((uint8_t *)sdr,*len + 1,1) : "";
-		if (*len > 48) {
-			PROM_DEBUG("\nGot SDR 0x%04x for sensor 0x%02x:\n"
-				"\tsize: %ld/%ld\n\ttype: 0x%02x\n"
-				"\tname: '%s', Len: %d, Fmt: %d\n%s",
-				rid, sdr->keys.sensor_num, *len, sdr->size + 5, sdr->type,
-				sdr->name.raw, sdr->name.len, sdr->name.fmt, s);
-		} else {
-			PROM_DEBUG("\nGot SDR 0x%04x for sensor 0x%02x (%ld bytes)\n%s",
-				rid, sdr->keys.sensor_num, *len, s);
-		}
-	}
-	return sdr;
+	return (sdr_thresholds_t *) rsp->data;
 }
 
 sdr_thresholds_t *
-get_thresholds(uint8_t snum, uint8_t *cc) {
+get_thresholds(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, const sdr_key_t *key,
+	uint8_t *cc)
+{
+	uint8_t snum = key->sensor_num;
 	int msgId;
 	
 	if (ipmi_verbose > 1)
 		PROM_DEBUG("Getting thresholds for sensor 0x%02x", snum);
 	CMD_GET_SENSOR_THRESHOLD(req, cc);
+	sensor_target(&req, key);
 	req.msg.data = &snum;
 	req.msg.data_len = sizeof(snum);
 	
-	SEND(req,msgId,NULL,"Failed to send thresholds cmd for sensor 0x%02x",snum);
-	RECV(rsp,msgId,NULL,cc,"Failed to get thresholds for sensor 0x%02x.", snum);
-
-	if (rsp->ccode != 0) {
-		// DELL likes to screw up its BMCs (junkware) ... 
-		if ((rsp->ccode != SDR_CC_SENSOR_NOT_FOUND)
-			&& (rsp->ccode != SDR_CC_ILLEGAL_CMD))
+	if (cache_get(ctx, &req, rsp, cc) == NULL) {
+		SEND(req, msgId, NULL,
+			"Failed to send thresholds cmd for sensor 0x%02x", snum);
+		RECV(rsp, msgId, NULL, cc,
+			"Failed to get thresholds for sensor 0x%02x.", snum);
+		// sensors without thresholds stay so as well
+		if (rsp->ccode == 0 || rsp->ccode == SDR_CC_SENSOR_NOT_FOUND
+			|| rsp->ccode == SDR_CC_ILLEGAL_CMD)
 		{
-			PROM_WARN("Get thresholds for sensor 0x%02x failed with: %s",
-				snum, ipmi_cc2str(rsp->ccode));
+			cache_put(ctx, &req, rsp, TTL_THRESHOLDS);
 		}
-		return NULL;
 	}
-	if (rsp->data_len != sizeof(sdr_thresholds_t)) {
-		PROM_WARN("Got invalid thresholds for sensor 0x%02x.", snum);
+	return check_thresholds(rsp, snum);
+}
+
+sdr_thresholds_t *
+peek_thresholds(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, const sdr_key_t *key,
+	uint8_t *cc)
+{
+	uint8_t snum = key->sensor_num;
+
+	CMD_GET_SENSOR_THRESHOLD(req, cc);
+	sensor_target(&req, key);
+	req.msg.data = &snum;
+	req.msg.data_len = sizeof(snum);
+
+	if (cache_get(ctx, &req, rsp, cc) == NULL)
 		return NULL;
-	}
+	return check_thresholds(rsp, snum);
+}
 
-	return (sdr_thresholds_t *) rsp->data;
+void
+sdr_thresholds_forget(ipmi_ctx_t *ctx, const sdr_key_t *key) {
+	uint8_t snum = key->sensor_num;
+	uint8_t *cc = NULL;
+
+	CMD_GET_SENSOR_THRESHOLD(req, cc);
+	sensor_target(&req, key);
+	req.msg.data = &snum;
+	req.msg.data_len = sizeof(snum);
+	cache_drop(ctx, &req);
 }
 
-sdr_reading_t *
-get_reading(uint8_t snum, char *name, uint8_t *cc) {
-	int msgId;
+void
+sdr_thresholds_preset(ipmi_ctx_t *ctx, const sdr_key_t *key, uint8_t ccode,
+	const sdr_thresholds_t *t)
+{
+	uint8_t snum = key->sensor_num;
+	struct ipmi_rs rsp;
+	uint8_t *cc = NULL;
 
-	if (ipmi_verbose > 1)
-		PROM_DEBUG("Getting value for sensor 0x%02x", snum);
-	CMD_GET_SENSOR_READING(req, cc);
+	CMD_GET_SENSOR_THRESHOLD(req, cc);
+	sensor_target(&req, key);
 	req.msg.data = &snum;
 	req.msg.data_len = sizeof(snum);
-	SEND(req,msgId,NULL,"Failed to send get value cmd for sensor 0x%02x (%s).",
-		snum, name);
-	RECV(rsp, msgId, NULL, cc, "Failed to get value for sensor 0x%02x (%s).",
-		snum, name);
+	rsp.ccode = ccode;
+	rsp.data_len = (ccode == 0) ? sizeof(sdr_thresholds_t) : 0;
+	if (ccode == 0)
+		memcpy(rsp.data, t, sizeof(sdr_thresholds_t));
+	cache_put(ctx, &req, &rsp, TTL_THRESHOLDS);
+}
 
+// validate the answer of a Get Sensor Reading Command
+static sdr_reading_t *
+check_reading(struct ipmi_rs *rsp, uint8_t snum, char *name, uint8_t *cc) {
 	if (rsp->ccode != 0) {
 		if (rsp->ccode == SDR_CC_SENSOR_NOT_FOUND) {
 			PROM_DEBUG("Sensor '%s' not found.", name);
@@ -299,7 +514,8 @@ get_reading(uint8_t snum, char *name, uint8_t *cc) {
 		} else {
 			// Gigabyte likes to send bogus answers for unconnected devices
 			if (((sdr_reading_t *) rsp->data)->unavailable) {
-				*cc = SDR_CC_SENSOR_NOT_FOUND;
+				if (cc)
+					*cc = SDR_CC_SENSOR_NOT_FOUND;
 				return NULL;
 			}
 			PROM_WARN("Reading the value of sensor 0x%02x (%s) failed"
@@ -316,14 +532,78 @@ get_reading(uint8_t snum, char *name, uint8_t *cc) {
 	return (sdr_reading_t *) rsp->data;
 }
 
+sdr_reading_t *
+get_reading(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, const sdr_key_t *key,
+	char *name, uint8_t *cc)
+{
+	uint8_t snum = key->sensor_num;
+	int msgId;
+
+	if (ipmi_verbose > 1)
+		PROM_DEBUG("Getting value for sensor 0x%02x", snum);
+	CMD_GET_SENSOR_READING(req, cc);
+	sensor_target(&req, key);
+	req.msg.data = &snum;
+	req.msg.data_len = sizeof(snum);
+	SEND(req,msgId,NULL,"Failed to send get value cmd for sensor 0x%02x (%s).",
+		snum, name);
+	RECV(rsp, msgId, NULL, cc, "Failed to get value for sensor 0x%02x (%s).",
+		snum, name);
+	return check_reading(rsp, snum, name, cc);
+}
+
+static void
+reading_done(long msgid, struct ipmi_rs *rsp, void *arg) {
+	sdr_reading_job_t *job = arg;
+	sdr_reading_t *r;
+
+	if (rsp == NULL) {
+		PROM_WARN("Failed to get value for sensor 0x%02x (%s), request %ld.",
+			job->key.sensor_num, job->name, msgid);
+		return;
+	}
+	job->cc = rsp->ccode;
+	r = check_reading(rsp, job->key.sensor_num, job->name, &(job->cc));
+	if (r == NULL)
+		return;
+	memcpy(&(job->reading), r, sizeof(sdr_reading_t));
+	job->valid = true;
+}
+
+int
+submit_reading(ipmi_ctx_t *ctx, sdr_reading_job_t *job) {
+	long msgId;
+	uint8_t *cc = &(job->cc);
+
+	if (ipmi_verbose > 1)
+		PROM_DEBUG("Submitting value request for sensor 0x%02x",
+			job->key.sensor_num);
+	job->valid = false;
+	CMD_GET_SENSOR_READING(req, cc);
+	sensor_target(&req, &(job->key));
+	req.msg.data = &(job->key.sensor_num);
+	req.msg.data_len = sizeof(job->key.sensor_num);
+	if ((msgId = ipmi_submit(ctx, &req, 0, reading_done, job)) < 0) {
+		if (msgId == -3)
+			PROM_WARN("Failed to send get value cmd for sensor 0x%02x (%s).",
+				job->key.sensor_num, job->name);
+		return 1;
+	}
+	return 0;
+}
+
 sdr_factors_t *
-get_factors(uint8_t snum, uint8_t reading, uint8_t *cc) {
+get_factors(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, const sdr_key_t *key,
+	uint8_t reading, uint8_t *cc)
+{
 	int msgId;
+	uint8_t snum = key->sensor_num;
 	uint8_t data[2] = { snum, reading };
 
 	if (ipmi_verbose > 1)
 		PROM_DEBUG("Getting value for sensor 0x%02x", snum);
 	CMD_GET_SENSOR_FACTORS(req, cc);
+	sensor_target(&req, key);
 	req.msg.data = data;
 	req.msg.data_len = sizeof(data);
 	SEND(req, msgId, NULL,
@@ -346,7 +626,7 @@ get_factors(uint8_t snum, uint8_t reading, uint8_t *cc) {
 }
 
 sdr_power_t *
-get_power(uint8_t *cc) {
+get_power(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, uint8_t *cc) {
 	uint8_t msg_data[4];
 	int msgId;
 
@@ -360,11 +640,15 @@ get_power(uint8_t *cc) {
 	req.msg.data = msg_data;
 	req.msg.data_len = 4;
 
+	// readings change, but a BMC without DCMI support stays so
+	if (cache_get(ctx, &req, rsp, cc) != NULL)
+		return NULL;
 	SEND(req, msgId, NULL, "Failed to send power reading request.", "");
 	RECV(rsp, msgId, NULL, cc, "Failed to get power reading.", "");
 
 	if (rsp->ccode != 0) {
 		if (rsp->ccode == SDR_CC_INVALID_CMD) {
+			cache_put(ctx, &req, rsp, TTL_DCMI_NA);
 			PROM_INFO("DCMI power reading is not supported by this BMC.", "");
 		} else {
 			PROM_WARN("Power reading request failed with: %s (0x%02x)",
@@ -388,8 +672,6 @@ free_sensor(sensor_t *sensor) {
 		free(scurr->factors);
 		free(scurr->it_unit);
 		free(scurr->it_thresholds);
-		free(scurr->prom.name);
-		free(scurr->prom.unit);
 		free(scurr->prom.mname_reading);
 		free(scurr->prom.mname_threshold);
 		free(scurr->prom.mname_state);
@@ -446,168 +728,1129 @@ thresholds2ipmitool_str(sdr_thresholds_t *t, uint8_t analog_fmt, factors_t *f) {
 	return strdup(buf);
 }
 
-sensor_t *
-scan_sdr_repo(uint32_t *count, bool ignore_disabled, bool drop_noread,
-	uint8_t *cc)
-{
-	sdr_full_t *sdr;
+// Create a sensor for the given SDR if it is eligible, i.e. a full sensor
+// record of a threshold based sensor providing non-discrete readings.
+static sensor_t *
+sdr2sensor(sdr_full_t *sdr, uint8_t len, bool ignore_disabled) {
+	sensor_t *snew;
 	char *sname;
 
-	uint8_t len = 0;
-	uint16_t recId = 0, scanned = 0;
-	sdr_repo_info_t *repo_info = get_repo_info(cc);
-	sensor_t *slist = NULL, *slast = NULL, *snew;
+	if (len < 48 || sdr->type != SDR_TYPE_FULL_SENSOR) {
+		PROM_DEBUG("SDR 0x%04x ignored (type 0x%02x).", sdr->id, sdr->type);
+		return NULL;
+	}
+	// check common properties
+	if (!SDR_IS_THRESHOLD_BASED(sdr->evt_type)) {
+		PROM_DEBUG("Non-threshold SDR of sensor '%s' (0x%02x) ignored.",
+			sdr->name.raw, sdr->keys.sensor_num);
+		return NULL;
+	}
+	if (SDR_UNIT_FMT_IS_DISCRETE(sdr->unit.analog_fmt)) {
+		// Paranoid? Actually evt_type check above should have kicked it.
+		PROM_DEBUG("Discrete unit SDR '%s' (0x%02x) ignored.",
+			sdr->name.raw, sdr->keys.sensor_num);
+		return NULL;
+	}
+	if (sdr->disabled) {
+		if (ignore_disabled) {
+			PROM_INFO("Ignoring 'disabled' flag of sensor '%s' (0x%02x).",
+				sdr->name.raw, sdr->keys.sensor_num);
+		} else {
+			PROM_INFO("Dropping sensor '%s' (0x%02x): disabled",
+				sdr->name.raw, sdr->keys.sensor_num);
+			return NULL;
+		}
+	}
 
-	*count = 0;
-	if (repo_info == NULL || *cc != 0)
+	sname = sdr_str2utf8(sdr->name.raw, sdr->name.len, sdr->name.fmt);
+	snew = (sensor_t *) malloc(sizeof(sensor_t));
+	if (snew == NULL) {
+		PROM_FATAL("Unable to allocate a sensor entry.", "");
+		free(sname);
 		return NULL;
-	if (repo_info->sdr_count == 0) {
-		PROM_WARN("SDR repository contains no SDRs.", "");
+	}
+	memset(snew, 0, sizeof(sensor_t));
+	snew->name = sname;
+	snew->record_id = sdr->id;
+	snew->key = sdr->keys;
+	snew->unit = sdr->unit;
+	snew->category = sdr->category;
+	snew->thr_cc = 0xFF;
+	snew->it_unit = strdup(sdr_unit2str(&(sdr->unit)));
+	// Wondering, who has ever seen it ...
+	if (SDR_LTYPE_IS_NON_LINEAR(sdr->factors.linearization)) {
+		PROM_WARN("Slow sensor '%s' (SDR %d) found.", snew->name, sdr->id);
+	} else {
+		snew->factors = sdr_factors2factors(&(sdr->factors));
+	}
+	return snew;
+}
+
+// append the given record to the given image
+static int
+sdr_image_add(sdr_image_t *img, const void *sdr, uint8_t len) {
+	uint8_t *d;
+	size_t sz;
+
+	if (img->len + len + 1 > img->size) {
+		sz = img->size == 0 ? 4096 : img->size * 2;
+		while (img->len + len + 1 > sz)
+			sz *= 2;
+		if ((d = realloc(img->data, sz)) == NULL)
+			return 1;
+		img->data = d;
+		img->size = sz;
+	}
+	img->data[img->len++] = len;
+	memcpy(img->data + img->len, sdr, len);
+	img->len += len;
+	img->records++;
+	return 0;
+}
+
+#define SDR_KEY_LEN		8			// header, owner ID, owner LUN, sensor number
+
+uint32_t
+sdr_hash(uint32_t h, const void *data, size_t len) {
+	const uint8_t *d = data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ d[i]) * 16777619U;
+	return h;
+}
+
+uint32_t
+sdr_image_fingerprint(sdr_image_t *img) {
+	uint32_t h = SDR_HASH_INIT;
+	size_t off;
+	uint8_t len;
+
+	for (off = 0; off < img->len; off += len) {
+		len = img->data[off++];
+		if (off + len > img->len)
+			break;
+		h = sdr_hash(h, img->data + off, len > SDR_KEY_LEN ? SDR_KEY_LEN : len);
+	}
+	return h;
+}
+
+void
+sdr_image_free(sdr_image_t *img) {
+	if (img == NULL)
+		return;
+	free(img->data);
+	memset(img, 0, sizeof(sdr_image_t));
+}
+
+// Probe the sensors of the given list concurrently and drop the ones not
+// populated/connected, or, if drop_noread is set, not readable right now.
+// Returns the new head of the list and adjusts count accordingly.
+static sensor_t *
+probe_sensors(ipmi_ctx_t *ctx, sensor_t *slist, uint32_t *count,
+	bool drop_noread)
+{
+	sensor_t *slast = NULL, *s, *next;
+	sdr_reading_job_t *job;
+	size_t n;
+
+	if (slist == NULL)
 		return NULL;
+	job = malloc(*count * sizeof(sdr_reading_job_t));
+	if (job == NULL) {
+		PROM_WARN("Unable to allocate reading jobs. Sensors not probed.", "");
+		return slist;
 	}
+	for (n = 0, s = slist; s != NULL; s = s->next, n++) {
+		job[n].key = s->key;
+		job[n].name = s->name;
+		job[n].cc = 0xFF;
+		job[n].valid = false;
+		submit_reading(ctx, &job[n]);
+	}
+	ipmi_dispatch(ctx, 0);
 
-	while (recId != 0xFFFF) {
-		len = 0xFF;
-		sdr = get_sdr(&recId, &len, cc);
-		scanned++;
-		if (*cc != 0)
-			return slist;
-		if (sdr == NULL || len < 6)
-			continue;
-		if (len < 48 || sdr->type != SDR_TYPE_FULL_SENSOR) {
-			PROM_DEBUG("SDR 0x%04x ignored (type 0x%02x).", sdr->id, sdr->type);
+	for (n = 0, s = slist; s != NULL; s = next, n++) {
+		next = s->next;
+		if (job[n].cc == SDR_CC_SENSOR_NOT_FOUND) {
+			PROM_INFO("Dropping sensor '%s' (0x%02x): probably "
+				"not populated/connected.", s->name, s->key.sensor_num);
+		} else if (drop_noread && job[n].cc == SDR_CC_CMD_TMP_UNSUPPORTED) {
+			PROM_INFO("Dropping sensor '%s' (0x%02x): no read.",
+				s->name, s->key.sensor_num);
+		} else {
+			if (slast == NULL)
+				slist = s;
+			else
+				slast->next = s;
+			slast = s;
 			continue;
 		}
-		sname = sdr_str2utf8(sdr->name.raw, sdr->name.len, sdr->name.fmt);
-		// check common properties
-		if (!SDR_IS_THRESHOLD_BASED(sdr->evt_type)) {
-			PROM_DEBUG("Non-threshold SDR of sensor '%s' (0x%02x) ignored.",
-				sdr->name.raw, sdr->keys.sensor_num);
-			free(sname);
-			continue;
+		if (slast == NULL)
+			slist = next;
+		else
+			slast->next = next;
+		s->next = NULL;
+		free_sensor(s);
+		(*count)--;
+	}
+	free(job);
+	return slist;
+}
+
+// The SDR repository gets walked with several Get SDR requests in flight:
+// as long as record IDs turn out to be sequential, the next SDR_PREFETCH IDs
+// get requested before the answer telling the actual next ID arrived.
+// Answers get consumed in chain order, only. Wrong guesses cost a request,
+// but no time.
+#define SDR_PREFETCH	4			// max. speculative Get SDR requests
+#define SDR_SLOTS		(SDR_PREFETCH + 2)
+#define SDR_DATA_MAX	255			// max. bytes of an SDR (len is a byte)
+#define SDR_SLICE		20			// ms to run the event loop between yields
+#define SDR_RESERVE_TRIES	4		// max. reservations in a row w/o progress
+#define SDR_RESERVE_PAUSE	100000000L	// ns to wait after the 2nd one
+
+typedef enum {
+	SLOT_FREE = 0,
+	SLOT_PENDING,					// request in flight
+	SLOT_DONE,						// answer received
+	SLOT_RETRY						// reservation got canceled
+} slot_state_t;
+
+struct sdr_walk;
+
+typedef struct sdr_slot {
+	struct sdr_walk *w;
+	slot_state_t state;
+	bool speculative;				// requested before its ID was known
+	uint16_t rid;					// requested record ID
+	uint16_t next;					// ID of the next record as answered
+	uint8_t want;					// bytes of the record to get, 0xFF .. all
+	uint8_t asked;					// bytes asked for by the pending request
+	uint8_t cc;
+	uint8_t len;					// bytes got so far
+	uint8_t data[SDR_DATA_MAX + 1];	// '\0' terminated
+} sdr_slot_t;
+
+typedef struct sdr_walk {
+	ipmi_ctx_t *ctx;
+	uint16_t reservation;
+	uint16_t expected;				// ID of the next record in chain order
+	bool sequential;				// last record ID + 1 == next record ID
+	bool done;
+	bool failed;
+	bool canceled;					// at least one answer was 0xC5
+	bool keys_only;					// get SDR_KEY_LEN bytes of each SDR, only
+	int tries;						// reservations obtained w/o progress
+	uint32_t answers;				// chunks received
+	uint32_t progress;				// answers when reserved last
+	uint8_t cc;						// if failed
+	bool ignore_disabled;
+	uint16_t scanned;
+	uint16_t sdr_count;				// number of SDRs announced by the repo
+	sdr_image_t *img;
+	sensor_t *slist;
+	sensor_t *slast;
+	uint32_t count;
+	sdr_slot_t slot[SDR_SLOTS];
+} sdr_walk_t;
+
+typedef struct thresholds_job {
+	ipmi_ctx_t *ctx;
+	sdr_key_t key;
+} thresholds_job_t;
+
+static void walk_advance(sdr_walk_t *w);
+
+// completion callback of a thresholds prefetch: just fill the cache, so that
+// the get_thresholds() call made later gets answered from there
+static void
+thresholds_done(long msgid, struct ipmi_rs *rsp, void *arg) {
+	thresholds_job_t *job = arg;
+	uint8_t *cc = NULL;
+
+	(void) msgid;
+	if (rsp != NULL && ((rsp->ccode == 0
+		&& rsp->data_len == sizeof(sdr_thresholds_t))
+		|| rsp->ccode == SDR_CC_SENSOR_NOT_FOUND
+		|| rsp->ccode == SDR_CC_ILLEGAL_CMD))
+	{
+		CMD_GET_SENSOR_THRESHOLD(req, cc);
+		sensor_target(&req, &(job->key));
+		req.msg.data = &(job->key.sensor_num);
+		req.msg.data_len = sizeof(job->key.sensor_num);
+		cache_put(job->ctx, &req, rsp, TTL_THRESHOLDS);
+	}
+	free(job);
+}
+
+static void
+prefetch_thresholds(ipmi_ctx_t *ctx, const sdr_key_t *key) {
+	thresholds_job_t *job;
+	struct ipmi_rs rsp;
+	uint8_t snum = key->sensor_num;
+	uint8_t *cc = NULL;
+
+	CMD_GET_SENSOR_THRESHOLD(req, cc);
+	sensor_target(&req, key);
+	req.msg.data = &snum;
+	req.msg.data_len = sizeof(snum);
+	if (cache_get(ctx, &req, &rsp, cc) != NULL)
+		return;
+	if ((job = malloc(sizeof(thresholds_job_t))) == NULL)
+		return;
+	job->ctx = ctx;
+	job->key = *key;
+	// no harm on failure: get_thresholds() asks again
+	if (ipmi_submit(ctx, &req, 0, thresholds_done, job) < 0)
+		free(job);
+}
+
+// the number of bytes of the record of the given slot to get in total
+static uint8_t
+slot_want(sdr_slot_t *slot) {
+	size_t total = SDR_DATA_MAX;
+
+	// header: ID (2), version (1), type (1), number of bytes following (1)
+	if (slot->len >= 5 && slot->data[4] + 5 < SDR_DATA_MAX)
+		total = slot->data[4] + 5;
+	return slot->want < total ? slot->want : total;
+}
+
+static void sdr_done(long msgid, struct ipmi_rs *rsp, void *arg);
+
+// Submit a Get SDR request for the next chunk of the record of the given
+// slot. Returns -1 if submitting failed, 0 otherwise.
+static int
+slot_request(sdr_slot_t *slot) {
+	sdr_reservation_t sdr_reserv;
+	uint8_t *cc = NULL, max = chunk_max(slot->w->ctx);
+
+	slot->state = SLOT_PENDING;
+	slot->asked = slot_want(slot) - slot->len;
+	if (slot->asked > max)
+		slot->asked = max;
+	sdr_reserv.id = slot->w->reservation;
+	sdr_reserv.record_id = slot->rid;
+	sdr_reserv.offset = slot->len;
+	// 0xFF: all available, i.e. the whole record if it starts at offset 0
+	sdr_reserv.len = slot->asked;
+	CMD_GET_SDR(req, cc);
+	req.msg.data = (uint8_t *) &sdr_reserv;
+	req.msg.data_len = sizeof(sdr_reserv);
+	if (ipmi_submit(slot->w->ctx, &req, 0, sdr_done, slot) < 0) {
+		slot->state = SLOT_FREE;
+		return -1;
+	}
+	return 0;
+}
+
+// Submit a Get SDR request for the first len bytes of the record of the
+// given slot. Returns -1 if submitting failed, 0 otherwise.
+static int
+slot_submit(sdr_slot_t *slot, uint8_t len) {
+	slot->want = len;
+	slot->len = 0;
+	slot->cc = 0;
+	memset(slot->data, 0, sizeof(slot->data));
+	return slot_request(slot);
+}
+
+static void
+sdr_done(long msgid, struct ipmi_rs *rsp, void *arg) {
+	sdr_slot_t *slot = arg;
+	sdr_walk_t *w = slot->w;
+	size_t n;
+
+	(void) msgid;
+	if (rsp != NULL && rsp->ccode == SDR_CC_RESERVATION_CANCELED) {
+		slot->state = SLOT_RETRY;
+		w->canceled = true;
+		return;
+	}
+	// too big for the BMC: ask again for a smaller chunk
+	if (rsp != NULL && rsp->ccode == SDR_CC_BUFFER_TOO_SMALL
+		&& chunk_shrink(w->ctx, slot->asked) && slot_request(slot) == 0)
+	{
+		return;
+	}
+	if (rsp == NULL) {
+		slot->cc = 0xFF;
+	} else if (rsp->data_len < 2) {
+		// just in case the ccode check would not catch it
+		slot->cc = rsp->ccode == 0 ? 0xFF : rsp->ccode;
+	} else {
+		slot->cc = rsp->ccode;
+		if (slot->len == 0)
+			memcpy(&(slot->next), rsp->data, 2);
+		n = rsp->data_len - 2;
+		if (n > (size_t) (SDR_DATA_MAX - slot->len))
+			n = SDR_DATA_MAX - slot->len;
+		memcpy(slot->data + slot->len, rsp->data + 2, n);
+		slot->len += n;
+		w->answers++;
+		// partial reads need the reservation, which the walk obtained
+		if (slot->cc == 0 && n > 0 && slot->len < slot_want(slot)
+			&& slot_request(slot) == 0)
+		{
+			return;
 		}
-		if (SDR_UNIT_FMT_IS_DISCRETE(sdr->unit.analog_fmt)) {
-			// Paranoid? Actually evt_type check above should have kicked it.
-			PROM_DEBUG("Discrete unit SDR '%s' (0x%02x) ignored.",
-				sdr->name.raw, sdr->keys.sensor_num);
-			free(sname);
-			continue;
+	}
+	slot->state = SLOT_DONE;
+	walk_advance(w);
+}
+
+// Submit a Get SDR request for the given record ID. Returns 1 if there is no
+// slot available right now, -1 if submitting failed.
+static int
+walk_submit(sdr_walk_t *w, uint16_t rid, bool speculative) {
+	sdr_slot_t *slot = NULL;
+	int i;
+
+	for (i = 0; i < SDR_SLOTS; i++) {
+		if (w->slot[i].state == SLOT_FREE) {
+			slot = &(w->slot[i]);
+			break;
 		}
-		if (sdr->disabled) {
-			if (ignore_disabled) {
-				PROM_INFO("Ignoring 'disabled' flag of sensor '%s' (0x%02x).",
-					sdr->name.raw, sdr->keys.sensor_num);
+		// guesses make room for the record needed next, only
+		if (!speculative && w->slot[i].state == SLOT_DONE
+			&& w->slot[i].rid != w->expected)
+		{
+			slot = &(w->slot[i]);
+		}
+	}
+	if (slot == NULL)
+		return 1;
+	if (ipmi_verbose > 1)
+		PROM_DEBUG("Getting SDR 0x%04x%s", rid,
+			speculative ? " (speculative)" : "");
+	slot->w = w;
+	slot->rid = rid;
+	slot->speculative = speculative;
+	return slot_submit(slot, w->keys_only ? SDR_KEY_LEN : 0xFF);
+}
+
+// process the given answer, i.e. the next record in chain order
+static void
+walk_consume(sdr_walk_t *w, sdr_slot_t *slot) {
+	sdr_full_t *sdr = (sdr_full_t *) slot->data;
+	sensor_t *snew;
+
+	w->scanned++;
+	if (slot->cc != 0) {
+		// SDR_CC_BUFFER_TOO_SMALL: keep and deliver partial message
+		PROM_WARN("Get SDR command failed with: %s", ipmi_cc2str(slot->cc));
+		PROM_WARN("Very unusual today. Please report via %s", ISSUES_URL);
+	}
+	if (slot->len >= 5 && slot->rid != 0 && sdr->id != slot->rid) {
+		PROM_WARN("ID of the SDR obtained is != requested ID."
+			"(0x%04x != 0x%04x). Adjusting SDR ID.", sdr->id, slot->rid);
+		sdr->id = slot->rid;
+	}
+	w->sequential = slot->len >= 5 && slot->next == sdr->id + 1;
+	if (ipmi_verbose > 1)
+		PROM_DEBUG("\nGot SDR 0x%04x (%d bytes)\n%s", sdr->id, slot->len,
+			hexdump(slot->data, slot->len, 1));
+	if (w->keys_only) {
+		if (slot->len >= 5 && sdr_image_add(w->img, sdr, slot->len))
+			w->img->stamp.valid = false;
+		return;
+	}
+	if (slot->len < 6)
+		return;
+	if (w->img != NULL && w->img->stamp.valid
+		&& sdr_image_add(w->img, sdr, slot->len))
+	{
+		w->img->stamp.valid = false;
+	}
+	if ((snew = sdr2sensor(sdr, slot->len, w->ignore_disabled)) == NULL)
+		return;
+	if (w->slast == NULL)
+		w->slist = snew;
+	else
+		w->slast->next = snew;
+	w->slast = snew;
+	w->count++;
+}
+
+// Consume all answers available in chain order and keep the pipeline filled.
+// Gets called after each answer, so it must not block.
+static void
+walk_advance(sdr_walk_t *w) {
+	sdr_slot_t *slot;
+	uint16_t rid;
+	int i, n;
+
+	while (!w->done && !w->failed && !w->canceled) {
+		slot = NULL;
+		for (i = 0; i < SDR_SLOTS; i++) {
+			if (w->slot[i].state != SLOT_FREE && w->slot[i].rid == w->expected)
+			{
+				slot = &(w->slot[i]);
+				break;
+			}
+		}
+		if (slot == NULL) {
+			// no slot means requests in flight: try again on the next answer
+			if (walk_submit(w, w->expected, false) < 0) {
+				PROM_WARN("Failed to send get request for SDR 0x%04x.",
+					w->expected);
+				w->failed = true;
+				return;
+			}
+			break;
+		}
+		if (slot->state != SLOT_DONE)
+			break;
+		if (slot->cc != 0 && slot->cc != SDR_CC_BUFFER_TOO_SMALL) {
+			slot->state = SLOT_FREE;
+			if (slot->speculative)
+				continue;		// guessed too early, so ask again
+			if (slot->cc == 0xFF) {
+				PROM_WARN("Failed to get SDR 0x%04x.", slot->rid);
 			} else {
-				PROM_INFO("Dropping sensor '%s' (0x%02x): disabled",
-					sdr->name.raw, sdr->keys.sensor_num);
-				free(sname);
-				continue;
+				PROM_WARN("Get SDR command failed with: %s",
+					ipmi_cc2str(slot->cc));
 			}
+			w->cc = slot->cc;
+			w->failed = true;
+			return;
+		}
+		walk_consume(w, slot);
+		slot->state = SLOT_FREE;
+		w->expected = slot->next;
+		if (w->expected == 0xFFFF) {
+			w->done = true;
+			return;
+		}
+		if (w->expected == 0) {
+			PROM_WARN("Got invalid next SDR ID 0. Scan stopped.", "");
+			w->done = true;
+			return;
+		}
+		if (!w->sequential) {
+			// drop all guesses made so far
+			for (i = 0; i < SDR_SLOTS; i++) {
+				if (w->slot[i].state == SLOT_DONE
+					&& w->slot[i].rid != w->expected)
+				{
+					w->slot[i].state = SLOT_FREE;
+				}
+			}
+		}
+	}
+	if (w->done || w->failed || w->canceled || !w->sequential)
+		return;
+	// prefetch the next IDs not requested yet, but not beyond the last SDR
+	for (n = 1; n <= SDR_PREFETCH && w->expected + n < 0xFFFF
+		&& w->scanned + n < w->sdr_count; n++)
+	{
+		rid = w->expected + n;
+		for (i = 0; i < SDR_SLOTS; i++) {
+			if (w->slot[i].state != SLOT_FREE && w->slot[i].rid == rid)
+				break;
 		}
+		if (i == SDR_SLOTS && walk_submit(w, rid, true) != 0)
+			break;
+	}
+}
+
+// The reservation got canceled: get a new one, and reset all slots waiting for
+// a retry, which start over at offset 0. As long as answers arrive in between,
+// this happens immediately. Otherwise the repo is probably being updated, so
+// give it some time. Returns false if the walk should be given up.
+static bool
+walk_reserve(sdr_walk_t *w) {
+	struct timespec ts = { 0, 0 };
+	uint8_t cc;
+	int i;
+
+	PROM_DEBUG("Get SDR command failed with: %s",
+		ipmi_cc2str(SDR_CC_RESERVATION_CANCELED));
+	if (w->answers != w->progress)
+		w->tries = 0;
+	if (w->tries == SDR_RESERVE_TRIES) {
+		w->cc = SDR_CC_RESERVATION_CANCELED;
+		w->failed = true;
+		return false;
+	}
+	if (w->tries > 0) {
+		ts.tv_nsec = SDR_RESERVE_PAUSE << (w->tries - 1);
+		nanosleep(&ts, NULL);
+	}
+	w->tries++;
+	w->progress = w->answers;
+	w->reservation = get_reservation(w->ctx, &cc);
+	w->canceled = false;
+	for (i = 0; i < SDR_SLOTS; i++) {
+		if (w->slot[i].state == SLOT_RETRY)
+			w->slot[i].state = SLOT_FREE;
+	}
+	return true;
+}
+
+// Run the event loop until all submitted requests got completed. Between
+// two slices others may use the device (see ipmi_set_yield()), so callers
+// must not touch anything shared before it returns.
+static void
+sdr_dispatch(ipmi_ctx_t *ctx) {
+	while (ipmi_dispatch(ctx, SDR_SLICE) > 0)
+		ipmi_yield(ctx);
+}
+
+typedef struct sdr_call {
+	struct ipmi_rs *rsp;			// where to store the answer
+	bool answered;
+	bool done;
+} sdr_call_t;
+
+static void
+call_done(long msgid, struct ipmi_rs *rsp, void *arg) {
+	sdr_call_t *call = arg;
 
-		snew = (sensor_t *) malloc(sizeof(sensor_t));
-	   	if (snew == NULL) {
-			PROM_FATAL("Unable to allocate a sensor entry.", "");
-			*cc = SDR_CC_OUT_OF_SPACE;
-			free(sname);
-			return slist;
+	(void) msgid;
+	if (rsp != NULL) {
+		memcpy(call->rsp, rsp, sizeof(struct ipmi_rs));
+		call->answered = true;
+	}
+	call->done = true;
+}
+
+uint8_t
+sdr_call(ipmi_ctx_t *ctx, struct ipmi_rq *req, struct ipmi_rs *rsp) {
+	sdr_call_t call = { rsp, false, false };
+
+	if (ipmi_submit(ctx, req, 0, call_done, &call) < 0)
+		return 0xFF;
+	while (!call.done && ipmi_dispatch(ctx, SDR_SLICE) > 0) {
+		if (!call.done)
+			ipmi_yield(ctx);
+	}
+	return call.answered ? rsp->ccode : 0xFF;
+}
+
+void
+sdr_thresholds_load(ipmi_ctx_t *ctx, sensor_t *list) {
+	sensor_t *s;
+
+	for (s = list; s != NULL; s = s->next) {
+		if (s->thr_cc == 0xFF)
+			prefetch_thresholds(ctx, &(s->key));
+	}
+	sdr_dispatch(ctx);
+}
+
+// walk the chain of records until its end or a failure
+static void
+walk_run(sdr_walk_t *w) {
+	uint8_t cc;
+
+	// one reservation for the whole walk, needed for partial reads only
+	if (w->reservation == 0)
+		w->reservation = get_reservation(w->ctx, &cc);
+	w->cc = 0xFF;
+	for (;;) {
+		walk_advance(w);
+		sdr_dispatch(w->ctx);
+		if (w->done || w->failed)
+			break;
+		if (w->canceled && !walk_reserve(w))
+			break;
+	}
+}
+
+sdr_full_t *
+get_sdr(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, uint16_t *reservation,
+	uint16_t *record_id, uint8_t *len, uint8_t *cc)
+{
+	sdr_walk_t w;
+	sdr_slot_t *slot = &(w.slot[0]);
+	sdr_full_t *sdr;
+	uint16_t rid;
+
+	if (record_id == NULL || len == NULL || reservation == NULL) {
+		PROM_FATAL("Software bug: recordId, len & reservation must be != NULL",
+			"");
+		return NULL;
+	}
+	rid = *record_id;
+	if (ipmi_verbose > 1)
+		PROM_DEBUG("Getting SDR 0x%04x", rid);
+	memset(&w, 0, sizeof(w));
+	w.ctx = ctx;
+	w.reservation = *reservation;
+	w.done = true;		// no chain to follow
+	slot->w = &w;
+	slot->rid = rid;
+	*record_id = 0;
+	for (;;) {
+		if (slot_submit(slot, *len) < 0) {
+			PROM_WARN("Failed to send get request for SDR 0x%04x.", rid);
+			*len = 0;
+			if (cc != NULL)
+				*cc = 0xFF;
+			return NULL;
 		}
-		memset(snew, 0, sizeof(sensor_t));
-		if (slist == NULL)
-			slist = snew;
-		snew->name = sname;
-		snew->record_id = sdr->id;
-		snew->owner_id = sdr->keys.owner_id;
-		snew->owner_lun = sdr->keys.owner_lun;
-		snew->sensor_num = sdr->keys.sensor_num;
-		snew->unit = sdr->unit;
-		snew->category = sdr->category;
-		snew->it_unit = strdup(sdr_unit2str(&(sdr->unit)));
-		// Wondering, who has ever seen it ...
-		if (SDR_LTYPE_IS_NON_LINEAR(sdr->factors.linearization)) {
-			PROM_WARN("Slow sensor '%s' (SDR %d) found.", snew->name, sdr->id);
+		while (slot->state == SLOT_PENDING && ipmi_dispatch(ctx, SDR_SLICE) > 0)
+			;
+		if (slot->state != SLOT_RETRY || !walk_reserve(&w))
+			break;
+	}
+	*reservation = w.reservation;
+	if (slot->state == SLOT_RETRY)
+		slot->cc = SDR_CC_RESERVATION_CANCELED;
+	if (cc != NULL)
+		*cc = slot->cc;
+	*len = slot->len;
+	rsp->ccode = slot->cc;
+	rsp->data_len = 2 + slot->len;
+	memcpy(rsp->data, &(slot->next), 2);
+	// let's '\0' terminate so that name can be printed w/o copying before
+	memcpy(rsp->data + 2, slot->data, slot->len + 1);
+	if (slot->state != SLOT_DONE || slot->len == 0
+		|| (slot->cc != 0 && slot->cc != SDR_CC_BUFFER_TOO_SMALL))
+	{
+		if (slot->cc == 0xFF || slot->cc == 0) {
+			// just in case the ccode check did not catch it
+			PROM_WARN("Got invalid response for SDR 0x%04x request.", rid);
 		} else {
-			snew->factors = sdr_factors2factors(&(sdr->factors));
+			PROM_WARN("Get SDR command failed with: %s", ipmi_cc2str(slot->cc));
 		}
+		return NULL;
+	}
+	if (slot->cc == SDR_CC_BUFFER_TOO_SMALL)
+		PROM_WARN("Got %d bytes of SDR 0x%04x, only.", slot->len, rid);
+	*record_id = slot->next;
+	sdr = (sdr_full_t *) (rsp->data + 2);
+	if (*len >= 5 && rid != sdr->id && rid != 0) {
+		PROM_WARN("ID of the SDR obtained is != requested ID."
+			"(0x%04x != 0x%04x). Adjusting SDR ID.", sdr->id, rid);
+		sdr->id = rid;
+	}
+	if (ipmi_verbose) {
+		const char *s =
+			(ipmi_verbose > 1) ? hexdump((uint8_t *)sdr,*len + 1,1) : "";
+		if (*len > 48) {
+			PROM_DEBUG("\nGot SDR 0x%04x for sensor 0x%02x:\n"
+				"\tsize: %d/%d\n\ttype: 0x%02x\n"
+				"\tname: '%s', Len: %d, Fmt: %d\n%s",
+				rid, sdr->keys.sensor_num, *len, sdr->size + 5, sdr->type,
+				sdr->name.raw, sdr->name.len, sdr->name.fmt, s);
+		} else {
+			PROM_DEBUG("\nGot SDR 0x%04x for sensor 0x%02x (%d bytes)\n%s",
+				rid, sdr->keys.sensor_num, *len, s);
+		}
+	}
+	return sdr;
+}
 
-		get_reading(snew->sensor_num, snew->name, cc);
-		if (*cc == SDR_CC_SENSOR_NOT_FOUND) {
-			PROM_INFO("Dropping sensor '%s' (0x%02x): probably "
-				"not populated/connected.", snew->name, snew->sensor_num);
-			free_sensor(snew);
-			if (snew == slist)
-				slist = NULL;
+sensor_t *
+scan_sdr_repo(ipmi_ctx_t *ctx, uint32_t *count, bool ignore_disabled,
+	bool drop_noread, uint8_t *cc, sdr_image_t *img)
+{
+	sdr_walk_t w;
+	struct ipmi_rs rsp;
+	sdr_repo_info_t *repo_info = get_repo_info(ctx, &rsp, cc);
+
+	*count = 0;
+	if (repo_info == NULL || *cc != 0)
+		return NULL;
+	if (img != NULL) {
+		sdr_image_free(img);
+		img->stamp.valid = true;
+		img->stamp.last_add = repo_info->last_add;
+		img->stamp.last_del = repo_info->last_del;
+		img->sdr_count = repo_info->sdr_count;
+	}
+	if (repo_info->sdr_count == 0) {
+		PROM_WARN("SDR repository contains no SDRs.", "");
+		return NULL;
+	}
+
+	memset(&w, 0, sizeof(w));
+	w.ctx = ctx;
+	w.ignore_disabled = ignore_disabled;
+	w.sdr_count = repo_info->sdr_count;
+	w.img = img;
+	walk_run(&w);
+	*count = w.count;
+	if (w.failed) {
+		*cc = w.cc;
+		// a partial image must not be persisted
+		if (img != NULL)
+			img->stamp.valid = false;
+		return w.slist;
+	}
+	if (img != NULL)
+		img->stamp.fingerprint = sdr_image_fingerprint(img);
+	// Readings get requested with a higher priority than SDRs, so probing
+	// while walking would stall the walk after each sensor. So do it at once.
+	w.slist = probe_sensors(ctx, w.slist, count, drop_noread);
+	PROM_DEBUG("Found %d of %d scanned SDRs eligible.", *count, w.scanned);
+	*cc = 0;
+
+	return w.slist;
+}
+
+sensor_t *
+sdr_image2sensors(ipmi_ctx_t *ctx, sdr_image_t *img, uint32_t *count,
+	bool ignore_disabled, bool drop_noread)
+{
+	sensor_t *slist = NULL, *slast = NULL, *snew;
+	sdr_full_t sdr;
+	size_t off;
+	uint8_t len;
+
+	*count = 0;
+	for (off = 0; off < img->len; off += len) {
+		len = img->data[off++];
+		if (off + len > img->len)
+			break;
+		// copy to get a properly aligned and padded record
+		memset(&sdr, 0, sizeof(sdr));
+		memcpy(&sdr, img->data + off, len > sizeof(sdr) ? sizeof(sdr) : len);
+		if ((snew = sdr2sensor(&sdr, len, ignore_disabled)) == NULL)
 			continue;
+		if (slast == NULL)
+			slist = snew;
+		else
+			slast->next = snew;
+		slast = snew;
+		(*count)++;
+	}
+	return probe_sensors(ctx, slist, count, drop_noread);
+}
+
+#define BIT_SET(_m, _i)		((_m)[(_i) >> 3] |= 1 << ((_i) & 7))
+#define BIT_ISSET(_m, _i)	((_m)[(_i) >> 3] & (1 << ((_i) & 7)))
+#define SDR_IDS				0x10000
+
+sensor_t *
+sdr_repo_update(ipmi_ctx_t *ctx, sdr_image_t *img, sensor_t **list,
+	uint32_t *count, bool ignore_disabled, bool drop_noread, uint8_t *cc)
+{
+	sdr_walk_t w;
+	sdr_image_t keys, nimg;
+	struct ipmi_rs rsp;
+	sdr_repo_info_t *repo_info;
+	sdr_full_t sdr;
+	sdr_slot_t *fetch = NULL, *slot;
+	sensor_t *s, *next, *slist = NULL, *slast = NULL, *kept = NULL;
+	uint32_t *idx = NULL;
+	uint8_t *have = NULL, *keep, *rec, *data;
+	uint16_t rid;
+	size_t off, i, n, changed = 0;
+	uint8_t len, dlen;
+	bool fresh;
+
+	*count = 0;
+	memset(&keys, 0, sizeof(keys));
+	memset(&nimg, 0, sizeof(nimg));
+	repo_info = get_repo_info(ctx, &rsp, cc);
+	if (repo_info == NULL || *cc != 0)
+		return NULL;
+	nimg.stamp.valid = keys.stamp.valid = true;
+	nimg.stamp.last_add = repo_info->last_add;
+	nimg.stamp.last_del = repo_info->last_del;
+	nimg.sdr_count = repo_info->sdr_count;
+
+	// 1st pass: get the keys of all SDRs
+	memset(&w, 0, sizeof(w));
+	w.ctx = ctx;
+	w.keys_only = true;
+	w.sdr_count = repo_info->sdr_count;
+	w.img = &keys;
+	if (w.sdr_count > 0)
+		walk_run(&w);
+	*cc = w.failed ? w.cc : 0xFF;
+	if (w.failed || !keys.stamp.valid)
+		goto fail;
+	nimg.stamp.fingerprint = sdr_image_fingerprint(&keys);
+	if (keys.records == img->records
+		&& nimg.stamp.fingerprint == sdr_image_fingerprint(img))
+	{
+		PROM_INFO("Keys of all %d SDRs unchanged.", keys.records);
+		img->stamp = nimg.stamp;
+		*cc = 0;
+		goto end;
+	}
+
+	// index the records of the current image by ID (offset + 1)
+	idx = calloc(SDR_IDS, sizeof(uint32_t));
+	have = calloc(2, SDR_IDS / 8);
+	fetch = malloc(keys.records * sizeof(sdr_slot_t) + 1);
+	if (idx == NULL || have == NULL || fetch == NULL) {
+		PROM_WARN("Unable to allocate SDR update buffers.", "");
+		goto fail;
+	}
+	keep = have + SDR_IDS / 8;
+	for (off = 0; off < img->len; off += len) {
+		len = img->data[off++];
+		if (off + len > img->len || len < 2)
+			break;
+		memcpy(&rid, img->data + off, 2);
+		idx[rid] = off + 1;
+	}
+	for (s = *list; s != NULL; s = s->next)
+		BIT_SET(have, s->record_id);
+
+	// 2nd pass: get all SDRs, which are new or whose keys changed, at once
+	for (off = 0; off < keys.len; off += len) {
+		len = keys.data[off++];
+		rec = keys.data + off;
+		memcpy(&rid, rec, 2);
+		if (idx[rid] != 0) {
+			data = img->data + idx[rid] - 1;
+			if (data[-1] == rec[4] + 5 && memcmp(data, rec, len) == 0)
+				continue;
 		}
-		if (drop_noread && *cc == SDR_CC_CMD_TMP_UNSUPPORTED) {
-			PROM_INFO("Dropping sensor '%s' (0x%02x): no read.",
-				snew->name, snew->sensor_num);
-			free_sensor(snew);
-			if (snew == slist)
-				slist = NULL;
-			continue;
+		slot = &(fetch[changed++]);
+		memset(slot, 0, sizeof(sdr_slot_t));
+		slot->w = &w;
+		slot->rid = rid;
+		if (slot_submit(slot, 0xFF) < 0)
+			goto fail;
+	}
+	for (;;) {
+		sdr_dispatch(ctx);
+		if (!w.canceled)
+			break;
+		if (!walk_reserve(&w))
+			goto fail;
+		for (i = 0; i < changed; i++) {
+			if (fetch[i].state == SLOT_RETRY && slot_submit(&fetch[i], 0xFF) < 0)
+				goto fail;
 		}
-		if (*cc != 0 && *cc != SDR_CC_CMD_TMP_UNSUPPORTED)
-			return slist;
+	}
 
-		if (slast != NULL)
-			slast->next = snew;
-		slast = snew;
+	// build the new image in chain order and the sensors of changed SDRs as
+	// well as of unchanged SDRs, which have no sensor yet (probe failed)
+	for (off = 0, n = 0; off < keys.len; off += len) {
+		len = keys.data[off++];
+		memcpy(&rid, keys.data + off, 2);
+		fresh = n < changed && fetch[n].rid == rid;
+		if (fresh) {
+			slot = &(fetch[n++]);
+			if (slot->cc != 0 && slot->cc != SDR_CC_BUFFER_TOO_SMALL) {
+				PROM_WARN("Get SDR 0x%04x failed with: %s", rid,
+					ipmi_cc2str(slot->cc));
+				*cc = slot->cc;
+				goto fail;
+			}
+			data = slot->data;
+			dlen = slot->len;
+			if (dlen >= 5 && ((sdr_full_t *) data)->id != rid) {
+				PROM_WARN("ID of the SDR obtained is != requested ID."
+					"(0x%04x != 0x%04x). Adjusting SDR ID.",
+					((sdr_full_t *) data)->id, rid);
+				((sdr_full_t *) data)->id = rid;
+			}
+		} else {
+			data = img->data + idx[rid] - 1;
+			dlen = data[-1];
+			if (BIT_ISSET(have, rid))
+				BIT_SET(keep, rid);
+		}
+		if (dlen < 6)
+			continue;
+		if (sdr_image_add(&nimg, data, dlen)) {
+			PROM_WARN("Unable to allocate SDR image.", "");
+			*cc = 0xFF;
+			goto fail;
+		}
+		if (!fresh && BIT_ISSET(keep, rid))
+			continue;
+		memset(&sdr, 0, sizeof(sdr));
+		memcpy(&sdr, data, dlen > sizeof(sdr) ? sizeof(sdr) : dlen);
+		if ((s = sdr2sensor(&sdr, dlen, ignore_disabled)) == NULL)
+			continue;
+		if (slast == NULL)
+			slist = s;
+		else
+			slast->next = s;
+		slast = s;
 		(*count)++;
 	}
-	PROM_DEBUG("Found %d of %d scanned SDRs eligible.", *count, scanned);
+
+	// keep the sensors of unchanged SDRs, only. From now on nobody else may
+	// use the device until the new sensor list is complete.
+	for (s = *list, slast = NULL; s != NULL; s = next) {
+		next = s->next;
+		s->next = NULL;
+		if (!BIT_ISSET(keep, s->record_id)) {
+			free_sensor(s);
+			continue;
+		}
+		if (slast == NULL)
+			kept = s;
+		else
+			slast->next = s;
+		slast = s;
+	}
+	*list = kept;
+	PROM_INFO("%zu of %d SDRs new or changed.", changed, nimg.records);
+	nimg.stamp.fingerprint = sdr_image_fingerprint(&nimg);
+	sdr_image_free(img);
+	*img = nimg;
+	slist = probe_sensors(ctx, slist, count, drop_noread);
 	*cc = 0;
+	goto end;
 
+fail:
+	// the current sensors and image stay as they are
+	sdr_image_free(&nimg);
+	free_sensor(slist);
+	slist = NULL;
+	*count = 0;
+	ipmi_dispatch(ctx, 0);
+
+end:
+	free(idx);
+	free(have);
+	free(fetch);
+	sdr_image_free(&keys);
 	return slist;
 }
 
-bool
-sdrs_changed(sensor_t *head) {
-	sensor_t *s = head;
-	sdr_full_t *sdr;
-	uint8_t cc = 0, len = 8;
-	uint16_t rid;
-	static uint32_t last_add = 0xFFFFFFFE, last_del = 0xFFFFFFFE, ladd, ldel;
-
-	sdr_repo_info_t *ri = get_repo_info(&cc);
+#define SDR_SAMPLES		4			// SDRs to read, if the repo timestamps moved
+
+// Get the record at the given position of the given image, its length and the
+// ID of the next record. Returns NULL if there is no such record.
+static uint8_t *
+sdr_image_rec(sdr_image_t *img, uint16_t pos, uint8_t *len, uint16_t *next) {
+	uint8_t *rec = NULL;
+	size_t off;
+	uint16_t n = 0;
+
+	*next = 0xFFFF;
+	for (off = 0; off < img->len; off += *len, n++) {
+		*len = img->data[off++];
+		if (off + *len > img->len)
+			break;
+		if (rec != NULL) {
+			memcpy(next, img->data + off, 2);
+			break;
+		}
+		if (n == pos)
+			rec = img->data + off;
+	}
+	if (rec != NULL)
+		*len = rec[-1];
+	return rec;
+}
 
+bool
+sdrs_changed(ipmi_ctx_t *ctx, sdr_image_t *img, sdr_stamp_t *stamp,
+	sdr_check_t *check)
+{
+	struct timespec t0, t1;
+	struct ipmi_rs rsp;
+	sdr_repo_info_t *ri;
+	sdr_walk_t w;
+	sdr_slot_t *slot;
+	uint8_t *rec, *cc = NULL, ccode, len;
+	uint16_t next[SDR_SAMPLES], i, n, step;
+	uint32_t ladd, ldel;
+	bool res = false;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	check->requests = 0;
+	CMD_GET_SDR_INFO(req, cc);
+	if (cache_get(ctx, &req, &rsp, cc) == NULL)
+		check->requests++;
+	ri = get_repo_info(ctx, &rsp, &ccode);
 	if (ri == NULL)
-		return false;	// can't say anything, so assume a temp error
+		goto end;		// can't say anything, so assume a temp error
 
 	PROM_DEBUG("Repo: last add: %d/%d   last del: %d/%d",
-		last_add, ri->last_add, last_del, ri->last_del);
+		stamp->last_add, ri->last_add, stamp->last_del, ri->last_del);
 
-	if (cc == 0 && head == NULL)
-		return true;
-	if (ri != NULL && last_add == ri->last_add && last_del == ri->last_del)
-		return false;
+	if (ccode == 0 && img->records == 0) {
+		res = true;
+		goto end;
+	}
+	if (stamp->valid && stamp->last_add == ri->last_add
+		&& stamp->last_del == ri->last_del)
+	{
+		goto end;
+	}
 	ladd = ri->last_add;
 	ldel = ri->last_del;
+	// thresholds et al. may have been changed as well (first call: just read)
+	if (stamp->valid)
+		sdr_cache_flush(ctx);
+	if (ri->sdr_count != img->sdr_count) {
+		PROM_INFO("Number of SDRs changed from %d to %d.", img->sdr_count,
+			ri->sdr_count);
+		res = true;
+		goto end;
+	}
 
-	while (s != NULL) {
-		rid = s->record_id;
-		sdr = get_sdr(&rid, &len, &cc);
-		if (sdr == NULL)
-			return true;
-		if (s->owner_id != sdr->keys.owner_id
-			|| s->owner_lun != sdr->keys.owner_lun
-			|| s->sensor_num != sdr->keys.sensor_num)
+	// check some samples spread over the whole repo
+	memset(&w, 0, sizeof(w));
+	w.ctx = ctx;
+	w.done = true;
+	n = img->records < SDR_SAMPLES ? img->records : SDR_SAMPLES;
+	step = img->records / n;
+	for (i = 0; i < n; i++) {
+		slot = &(w.slot[i]);
+		slot->w = &w;
+		rec = sdr_image_rec(img, (check->cursor + i * step) % img->records,
+			&len, &(next[i]));
+		if (rec == NULL) {
+			res = true;
+			break;
+		}
+		memcpy(&(slot->rid), rec, 2);
+		if (slot_submit(slot, SDR_KEY_LEN) == 0)
+			check->requests++;
+	}
+	sdr_dispatch(ctx);
+	for (i = 0; i < n && !res; i++) {
+		slot = &(w.slot[i]);
+		if (slot->state != SLOT_DONE || slot->cc == 0xFF)
+			goto end;	// try again next time
+		rec = sdr_image_rec(img, (check->cursor + i * step) % img->records,
+			&len, &(next[i]));
+		if (len > SDR_KEY_LEN)
+			len = SDR_KEY_LEN;
+		if (slot->len >= 5 && ((sdr_full_t *) slot->data)->id != slot->rid)
+			((sdr_full_t *) slot->data)->id = slot->rid;
+		if (slot->cc != 0 || slot->len != len || slot->next != next[i]
+			|| memcmp(slot->data, rec, len) != 0)
 		{
-			return true;
+			PROM_INFO("SDR 0x%04x changed.", slot->rid);
+			res = true;
 		}
-		s = s->next;
+	}
+	if (res)
+		goto end;
+	PROM_INFO("SDR repo timestamps moved, but sampled SDRs did not change.",
+		"");
+	check->cursor = (check->cursor + 1) % img->records;
+	stamp->valid = true;
+	stamp->last_add = ladd;
+	stamp->last_del = ldel;
+	// the image is still valid, but for the new state of the repo
+	if (img->stamp.valid) {
+		img->stamp.last_add = ladd;
+		img->stamp.last_del = ldel;
 	}
 
-	last_add = ladd;
-	last_del = ldel;
-	return  false;
+end:
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	check->usec = (t1.tv_sec - t0.tv_sec) * 1000000L
+		+ (t1.tv_nsec - t0.tv_nsec) / 1000;
+	return res;
 }
 
 void
-show_ipmitool_sensors(sensor_t *list, psb_t *sb, bool extended) {
+show_ipmitool_sensors(ipmi_ctx_t *ctx, sensor_t *list, psb_t *sb, bool extended)
+{
 	sdr_reading_t *r;
 	sdr_factors_t *f;
 	factors_t *rf;
+	struct ipmi_rs rsp, frsp;
 	uint8_t value, cc, tstate;
 	double real_val;
 	sensor_t *s = list;
@@ -631,33 +1874,34 @@ show_ipmitool_sensors(sensor_t *list, psb_t *sb, bool extended) {
 	psb_add_str(sb, "\n");
 
 	while (s != NULL) {
-		r = get_reading(s->sensor_num, s->name, &cc);
+		r = get_reading(ctx, &rsp, &(s->key), s->name, &cc);
 		if (r == NULL) {
 			PROM_DEBUG("No reading for sensor '%s' (%d).",
-				s->name, s->sensor_num);
+				s->name, s->key.sensor_num);
 			goto next;
 		}
 		if (r->unavailable || !r->scanning_enabled) {
 			PROM_DEBUG("Reading for sensor '%s' (%d).",
-				s->name, s->sensor_num,
+				s->name, s->key.sensor_num,
 				r->unavailable ? "unavailable" : "disabled");
 			goto next;
 		}
 		value = r->value;
 		tstate = r->state0 & 0x3F;
-		if (SDR_LTYPE_IS_NON_LINEAR(s->factors->linearization)) {
-			f = get_factors(s->sensor_num, value, &cc);
+		if (s->factors == NULL) {
+			f = get_factors(ctx, &frsp, &(s->key), value, &cc);
 			if (f == NULL)
 				goto next;
 			rf = sdr_factors2factors(f);
 			if (rf == NULL)
 				goto next;
+			real_val = sdr_convert_value(value, s->unit.analog_fmt, rf);
+			free(rf);
 		} else {
-			rf = s->factors;
+			real_val = sdr_convert_value(value, s->unit.analog_fmt, s->factors);
 		}
-		real_val = sdr_convert_value(value, s->unit.analog_fmt, rf);
 		if (extended) {
-			sprintf(buf, " %04x |  %02x  |", s->record_id, s->sensor_num);
+			sprintf(buf, " %04x |  %02x  |", s->record_id, s->key.sensor_num);
 			psb_add_str(sb, buf);
 		}
 		// since we do not support discrete values, state is always 'ok'.
@@ -667,10 +1911,10 @@ show_ipmitool_sensors(sensor_t *list, psb_t *sb, bool extended) {
 		psb_add_str(sb, buf);
 
 		if (s->it_thresholds == NULL) {
-			sdr_thresholds_t *t = get_thresholds(s->sensor_num, &cc);
+			sdr_thresholds_t *t = get_thresholds(ctx, &frsp, &(s->key), &cc);
 			if (t == NULL) {
 				PROM_INFO("Sensor '%s' (0x%02x) provides no thresholds.",
-					s->name, s->sensor_num);
+					s->name, s->key.sensor_num);
 			} else {
 				s->it_thresholds =
 					thresholds2ipmitool_str(t, s->unit.analog_fmt, s->factors);
@@ -692,7 +1936,7 @@ next:
 		s = s->next;
 	}
 
-	sdr_power_t *p = get_power(&cc);
+	sdr_power_t *p = get_power(ctx, &rsp, &cc);
 	if (p != NULL) {
 		psb_add_str(sb, "\n\n");
 		sprintf(buf, "\tInstantaneous power reading: %8d W\n\n", p->curr);
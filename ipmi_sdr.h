@@ -19,6 +19,7 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include "mach.h"
+#include "ipmi_if.h"
 
 #include <prom_string_builder.h>
 
@@ -193,6 +194,39 @@ typedef struct sdr_reading {
 	uint8_t state1;				// (5) assertion state for discrete sensors or 0
 } PACKED sdr_reading_t;
 
+/** @brief	IPMI v2, table 43-1, Full Sensor, byte (6:8): the record keys,
+ * which identify a sensor. Sensor numbers are unique per owner, only. */
+typedef struct sdr_key {
+	union {
+		uint8_t owner_id;	// (6) [0] i²c|system addr, [7:1] addr
+		struct {
+		BITFIELD2(
+			addr:7,			//	- [7:1] addr | SW id
+			is_id:1			//	- [0] system software ID, otherwise addr
+		);} PACKED;
+	};
+	union {
+		uint8_t owner_lun;	// (7) sensor owner lun
+		struct {
+		BITFIELD3(
+			channel:4,		//	- [7:4] channel number
+			__reserved1:2,	//	- [3:2]
+			lun:2			//	- [1:0] sensor owner lun. 0: SysSW is owner
+		);} PACKED;
+	};
+	uint8_t sensor_num;		// (8) unique sensor number
+} PACKED sdr_key_t;
+
+/** @brief	Book keeping of a Get Sensor Reading Command submitted via
+ * \c submit_reading(). */
+typedef struct sdr_reading_job {
+	sdr_key_t key;				// in: owner and number of the sensor
+	char *name;					// in: sensor name for diagnostic messages
+	uint8_t cc;					// out: command completion code, 0xFF if n/a
+	bool valid;					// out: true if reading got set
+	sdr_reading_t reading;		// out: the validated answer
+} sdr_reading_job_t;
+
 /** @brief	IPMI v2, table 43-1, Full Sensor, byte (6:23) is the common part
  * for all SDRs, byte(24:63) the specific part for a full SDR. (43.1) */
 typedef struct unit {
@@ -221,26 +255,7 @@ typedef struct sdr_full {
 	uint8_t size;			//	(5) SDR size in bytes w/o the header
 
 	// RECORD KEY BYTES (6:8)
-	struct {
-		union {
-			uint8_t owner_id;	// (6) [0] i²c|system addr, [7:1] addr
-			struct {
-			BITFIELD2(
-				addr:7,			//	- [7:1] addr | SW id
-				is_id:1			//	- [0] system software ID, otherwise addr
-			);} PACKED;
-		};
-		union {
-			uint8_t owner_lun;	// (7) sensor owner lun
-			struct {
-			BITFIELD3(
-				channel:4,		//	- [7:4] channel number
-				__reserved1:2,	//	- [3:2]
-				lun:2			//	- [1:0] sensor owner lun. 0: SysSW is owner
-			);} PACKED;
-		};
-		uint8_t sensor_num;		// (8) unique sensor number
-	} PACKED keys;
+	sdr_key_t keys;
 
 	// RECORD BODY BYTES (9:64)
 	struct {
@@ -370,65 +385,123 @@ typedef struct factors {
 } factors_t;
 
 typedef struct prom {
-	char *name;
-	char *unit;
+	char *name;				// points into the sensor name, not to be freed
+	const char *unit;		// shared, not to be freed
 	char *mname_reading;
 	char *mname_threshold;
 	char *mname_state;
 	char *note;
 } prom_t;
 
+/** @brief States of the circuit breaker guarding the readings of a sensor. */
+typedef enum breaker_state {
+	BREAKER_CLOSED = 0,		// sensor gets read on each scrape
+	BREAKER_HALF_OPEN,		// sensor gets read once to probe, whether it is back
+	BREAKER_OPEN			// sensor gets skipped until the backoff expired
+} breaker_state_t;
+
+/** @brief Failure state of a sensor. */
+typedef struct breaker {
+	breaker_state_t state;
+	uint16_t fails;			// number of consecutive failed reads
+	long retry;				// if open: monotonic time in s when to probe again
+} breaker_t;
+
 /** @brief Synthetic sensor record */
 typedef struct sensor {
 	char *name;			// sensor name (UTF-8)
 	uint16_t record_id;
-	uint8_t owner_id;
-	uint8_t owner_lun;
-	uint8_t sensor_num;
+	sdr_key_t key;		// owner and number of the sensor
 	unit_t unit;
 	uint8_t category;	// see full_sensor_t category - table 42-3 (42.2)
 	factors_t *factors;	// NULL indicates non-linear: need to fetch factors
 						// for each reading.
 	char *it_unit;
 	char *it_thresholds;	// ipmitool like formatted thresholds
+	sdr_thresholds_t thr;	// the thresholds formatted, if thr_cc is 0
+	uint8_t thr_cc;			// cc of Get Sensor Thresholds, 0xFF .. not loaded
 	prom_t prom;			// prom related names
+	breaker_t breaker;		// skip sensors, which fail all the time
 	struct sensor *next;
 } sensor_t;
 
 
 /**
  * @brief Get Device ID Command.
+ * @param ctx	The context of the IPMI device to use.
+ * @param rsp	The buffer to use for the response of the BMC.
  * @param cc		If not \c NULL, set to command completion code.
- * @return \c NULL on error, the pointer to the underlying buffer otherwise.
- *	The buffer gets silently overwritten on the next call of this function. 
+ * @return \c NULL on error, a pointer into the given \c rsp buffer otherwise.
  * @see	IPMI v2, 20.1
  */
-ipmi_bmc_info_t *get_bmc_info(uint8_t *cc);
+ipmi_bmc_info_t *get_bmc_info(ipmi_ctx_t *ctx, struct ipmi_rs *rsp,
+	uint8_t *cc);
 
 /**
  * @brief	Get SDR Repository Info Command.
+ * @param ctx	The context of the IPMI device to use.
+ * @param rsp	The buffer to use for the response of the BMC.
  * @param cc		If not \c NULL, set to command completion code.
- * @return \c NULL on error, the pointer to the underlying buffer otherwise.
- *	The buffer gets silently overwritten on the next call of this function. 
+ * @return \c NULL on error, a pointer into the given \c rsp buffer otherwise.
  * @see	IPMI v2, 33.9
  */
-sdr_repo_info_t *get_repo_info(uint8_t *cc);
+sdr_repo_info_t *get_repo_info(ipmi_ctx_t *ctx, struct ipmi_rs *rsp,
+	uint8_t *cc);
+
+/**
+ * @brief	Remove the answer of a Get SDR Repository Info Command from the
+ *	response cache, so that the next \c get_repo_info() asks the BMC again.
+ *	Needed to check, whether the repository changed within the last seconds.
+ * @param ctx	The context of the IPMI device the answer belongs to.
+ */
+void sdr_repo_info_forget(ipmi_ctx_t *ctx);
+
+/**
+ * @brief	Drop all cached responses of the given device. The answers of
+ *	\c get_bmc_info(), \c get_repo_info(), \c get_thresholds() and an
+ *	unsupported \c get_power() get cached for a while, so that callers may
+ *	use them repeatedly without bothering the BMC. The cache needs to be
+ *	flushed if the device gets closed or the SDR repository changed.
+ * @param ctx	The context of the IPMI device, whose responses should be
+ *	dropped. \c NULL drops the responses of all devices.
+ */
+void sdr_cache_flush(ipmi_ctx_t *ctx);
 
 /**
  * @brief Reserve SDR Repository Command.
+ * @param ctx	The context of the IPMI device to use.
  * @param cc		If not \c NULL, set to command completion code.
  * @return \c 0 on error, the obtained reservation ID otherwise.
  * @see	IPMI v2, 33.11 && 35.4
  */
-uint16_t get_reservation(uint8_t *cc);
+uint16_t get_reservation(ipmi_ctx_t *ctx, uint8_t *cc);
+
+/**
+ * @brief	Send the given request and wait for its answer. The event loop
+ *	runs in slices with \c ipmi_yield() in between, so that others may use
+ *	the device while a long running job waits for the BMC.
+ * @param ctx	The context of the IPMI device to use.
+ * @param req	The request to send.
+ * @param rsp	Where to store the answer.
+ * @return \c 0xFF if no answer got received, its completion code otherwise.
+ */
+uint8_t sdr_call(ipmi_ctx_t *ctx, struct ipmi_rq *req, struct ipmi_rs *rsp);
 
 /**
- * @brief Get SDR Command. This implementation always fetches from offset \c 0
- *	and thus no repo reservation is needed. However, if some buggy
- *	implementations like SUN ILOMs return a \c SDR_CC_RESERVATION_CANCELED
- *	command completion code, this function automatically requests a new ID
- *	and reuses it as needed.
+ * @brief Get SDR Command. The record gets fetched with a single request if
+ *	the BMC allows it. Otherwise, i.e. if it answers with
+ *	\c SDR_CC_BUFFER_TOO_SMALL, the record gets read in chunks of the largest
+ *	size the BMC accepts, which gets remembered per context. Reading at an
+ *	offset \c > \c 0 needs a repo reservation. If it gets canceled (or
+ *	some buggy implementations like SUN ILOMs return a
+ *	\c SDR_CC_RESERVATION_CANCELED completion code anyway), a new one gets
+ *	requested and the record fetched again.
  *
+ * @param ctx	The context of the IPMI device to use.
+ * @param rsp	The buffer to use for the response of the BMC.
+ * @param reservation	The reservation ID to use. Gets updated, if a new
+ *	reservation was needed. Callers walking the repo should init it with \c 0
+ *	and pass the same variable for all records to fetch.
  * @param record_id	The ID of the SDR to get. Use \c 0 to get the ID of the
  *	first avalable SDR. On success this gets replaced by the Id of the next
  *	available SDR. \c 0 means no valid response received, and \c 0xFFFF no more
@@ -439,63 +512,129 @@ uint16_t get_reservation(uint8_t *cc);
  * @return \c NULL on error or if the returned command completion is \c != \c 0
  *	\c && \c != \c SDR_CC_BUFFER_TOO_SMALL (the later can be detected if the
  *	passed \c len parameter got changed). Otherwise a pointer to the start of
- *	the received SDR. The buffer gets silently overwritten on the next ipmi
- *	request.
+ *	the received SDR within the given \c rsp buffer.
  * @see	IPMI v2, 33.12 && 35.4 
  */
-sdr_full_t *get_sdr(uint16_t *record_id, uint8_t *len, uint8_t *cc);
+sdr_full_t *get_sdr(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, uint16_t *reservation,
+	uint16_t *record_id, uint8_t *len, uint8_t *cc);
 
 /**
  * @brief Get Sensor Thresholds Command.
- * @param snum	The unique number of the related sensor (SDR byte 8).
+ * @param ctx	The context of the IPMI device to use.
+ * @param rsp	The buffer to use for the response of the BMC.
+ * @param key	The owner and number of the related sensor (SDR byte 6:8).
  * @param cc	If not \c NULL, it gets set to the completion code of the
  *	executed command. E.g. there might be an SDR for a fan sensor, but if the
  *	fan is not connected, the repo may return a \c SDR_CC_SENSOR_NOT_FOUND.
  *	In this case this function would silently return \c NULL, but the callee
  *	knows, its is intentional and not the result of an error. 
- * @return	\c NULL on error or if not available, a pointer to the buffered
- *	result otherwise.
- *	The buffer gets silently overwritten on the next ipmi request.
+ * @return	\c NULL on error or if not available, a pointer into the given
+ *	\c rsp buffer otherwise.
  * @see	IPMI v2, 35.9 
  */
-sdr_thresholds_t *get_thresholds(uint8_t snum, uint8_t *cc);
+sdr_thresholds_t *get_thresholds(ipmi_ctx_t *ctx, struct ipmi_rs *rsp,
+	const sdr_key_t *key, uint8_t *cc);
+
+/**
+ * @brief Same as \c get_thresholds() , but answered from the response cache
+ *	only, i.e. the BMC never gets asked.
+ * @param ctx	The context of the IPMI device to use.
+ * @param rsp	The buffer to use for the response.
+ * @param key	The owner and number of the related sensor (SDR byte 6:8).
+ * @param cc	See \c get_thresholds(). \c 0xFF if not cached.
+ * @return	\c NULL if not cached, on error or if not available, a pointer
+ *	into the given \c rsp buffer otherwise.
+ */
+sdr_thresholds_t *peek_thresholds(ipmi_ctx_t *ctx, struct ipmi_rs *rsp,
+	const sdr_key_t *key, uint8_t *cc);
 
 /**
- * @brief Get Sensor Reading Command.
- * @param snum	The unique number of the related sensor (SDR byte 8).
+ * @brief	Remove the answer of a Get Sensor Thresholds Command for the given
+ *	sensor from the response cache, so that the next \c get_thresholds()
+ *	asks the BMC again.
+ * @param ctx	The context of the IPMI device the answer belongs to.
+ * @param key	The owner and number of the related sensor (SDR byte 6:8).
+ */
+void sdr_thresholds_forget(ipmi_ctx_t *ctx, const sdr_key_t *key);
+
+/**
+ * @brief	Get the thresholds of all sensors of the given list, whose
+ *	thresholds are not yet loaded (\c thr_cc \c == \c 0xFF) and not in the
+ *	response cache, concurrently into the response cache. Yields the device
+ *	between event loop slices (see \c ipmi_set_yield()).
+ * @param ctx	The context of the IPMI device to use.
+ * @param list	The sensors to check.
+ */
+void sdr_thresholds_load(ipmi_ctx_t *ctx, sensor_t *list);
+
+/**
+ * @brief	Put the given answer of a Get Sensor Thresholds Command into the
+ *	response cache, so that the next \c get_thresholds() for the given sensor
+ *	does not need to bother the BMC. Used to restore persisted thresholds.
+ * @param ctx	The context of the IPMI device the answer belongs to.
+ * @param key	The owner and number of the related sensor (SDR byte 6:8).
+ * @param ccode	The completion code of the answer.
+ * @param t	The thresholds to store. Ignored if \c ccode \c != \c 0.
+ */
+void sdr_thresholds_preset(ipmi_ctx_t *ctx, const sdr_key_t *key,
+	uint8_t ccode, const sdr_thresholds_t *t);
+
+/**
+ * @brief Get Sensor Reading Command. Like all commands addressing a sensor
+ *	it gets bridged to the owner of the sensor, if this is a satellite
+ *	controller and not the BMC itself.
+ * @param ctx	The context of the IPMI device to use.
+ * @param rsp	The buffer to use for the response of the BMC.
+ * @param key	The owner and number of the related sensor (SDR byte 6:8).
  * qparam name	The name of the sensor to in diagnostic/debug messages.
  * @param cc		If not \c NULL, set to command completion code.
- * @return	\c NULL on error, a pointer to the buffered result otherwise.
- *	The buffer gets silently overwritten on the next ipmi request.
+ * @return	\c NULL on error, a pointer into the given \c rsp buffer otherwise.
+ * @see	IPMI v2, 35.14
+ */
+sdr_reading_t *get_reading(ipmi_ctx_t *ctx, struct ipmi_rs *rsp,
+	const sdr_key_t *key, char *name, uint8_t *cc);
+
+/**
+ * @brief Submit a Get Sensor Reading Command, but do not wait for the answer.
+ *	The answer gets validated and stored into the given job by the transport's
+ *	event loop, i.e. if \c ipmi_dispatch() gets called. This allows one to
+ *	read several sensors concurrently.
+ * @param ctx	The context of the IPMI device to use.
+ * @param job	The sensor to read and where to store the result. Must stay
+ *	valid until \c ipmi_dispatch() returns \c 0.
+ * @return	\c 0 if submitted, a value \c != \c 0 otherwise.
  * @see	IPMI v2, 35.14
  */
-sdr_reading_t *get_reading(uint8_t snum, char *name, uint8_t *cc);
+int submit_reading(ipmi_ctx_t *ctx, sdr_reading_job_t *job);
 
 /**
  * @brief Get Sensor Reading Factors Command.
- * @param snum	The unique number of the related sensor (SDR byte 8).
+ * @param ctx	The context of the IPMI device to use.
+ * @param rsp	The buffer to use for the response of the BMC.
+ * @param key	The owner and number of the related sensor (SDR byte 6:8).
  * @param reading	The current raw value of the sensor, which needs to be
  *	converted using the by this function returned factors.
  * @param cc	If not \c NULL, it gets set to the completion code of the
  *	executed command.
- * @return \c NULL on error or if not available, a pointer to the buffered
- *	result otherwise.
- *	The buffer gets silently overwritten on the next ipmi request.
+ * @return \c NULL on error or if not available, a pointer into the given
+ *	\c rsp buffer otherwise.
  * @see	IPMI v2, 35.5
  */
-sdr_factors_t *get_factors(uint8_t snum, uint8_t reading, uint8_t *cc);
+sdr_factors_t *get_factors(ipmi_ctx_t *ctx, struct ipmi_rs *rsp,
+	const sdr_key_t *key, uint8_t reading, uint8_t *cc);
 
 /**
  * @brief DCMI Get Power Reading Command.
+ * @param ctx	The context of the IPMI device to use.
+ * @param rsp	The buffer to use for the response of the BMC.
  * @param cc	If not \c NULL, set to command completion code. E.g. if it
  *	returns \c SDR_CC_INVALID_CMD you can be sure, that the BMC does not
  *	support this command and will never provide something useable.
  * @return \c NULL on error or if BMC does not support this command, a pointer
- *	to the buffered result otherwise.
- *	The buffer gets silently overwritten on the next ipmi request.
+ *	into the given \c rsp buffer otherwise.
  * @see DCMI v1.5, table 6-16, Get Power Reading Command. (6.6.1)
  */
-sdr_power_t *get_power(uint8_t *cc);
+sdr_power_t *get_power(ipmi_ctx_t *ctx, struct ipmi_rs *rsp, uint8_t *cc);
 
 /**
  * @brief Release all resources associated with the given sensor in a recurive
@@ -506,10 +645,36 @@ sdr_power_t *get_power(uint8_t *cc);
  */
 void free_sensor(sensor_t *sensor);
 
+/** @brief	The state of the SDR repository seen by \c sdrs_changed(). */
+typedef struct sdr_stamp {
+	bool valid;				// false until the first successful check
+	uint32_t last_add;		// most recent addition timestamp
+	uint32_t last_del;		// most recent erase timestamp
+	uint32_t fingerprint;	// of the record ID chain and keys of all SDRs
+} sdr_stamp_t;
+
+/** @brief	State and cost of the change checks done by \c sdrs_changed(). */
+typedef struct sdr_check {
+	uint16_t cursor;		// position of the first SDR to sample next time
+	uint16_t requests;		// IPMI requests sent by the last check
+	long usec;				// time the last check took in microseconds
+} sdr_check_t;
+
+/** @brief	Raw copy of all SDRs read from the repository. */
+typedef struct sdr_image {
+	sdr_stamp_t stamp;		// state of the repo, invalid if incomplete
+	uint16_t sdr_count;		// number of SDRs announced by the repo
+	uint16_t records;		// number of SDRs in data
+	size_t len;				// bytes used in data
+	size_t size;			// bytes allocated for data
+	uint8_t *data;			// records, each one prefixed by its length byte
+} sdr_image_t;
+
 /**
  * @brief Scan the SDR repository for **FULL** threshold based SDRs providing
  *	non-discrete readings, arrange sensors found in a list and finally return
  *	the head of the list.
+ * @param ctx	The context of the IPMI device to use.
  * @param count	The number of sensors in the returned list.
  * @param ignore_disabled	Some bogus firmware like DEll's iDRAC crap report
  *	sensors as disabled in the related SDR capabilities, but actually they are
@@ -521,18 +686,101 @@ void free_sensor(sensor_t *sensor);
  *	\c SDR_CC_CMD_TMP_UNSUPPORTED (like Sun ILOMs do for
  *	not-yet populated/connected devices), the related sensor gets dropped, i.e.
  *	does not appear in the returned sensor list.
+ * @param cc	Set to the completion code of the command, which failed, \c 0
+ *	on success.
+ * @param img	If not \c NULL, a copy of all SDRs read gets stored there.
+ *	Its stamp gets invalidated, if the scan did not complete.
+ */
+sensor_t *scan_sdr_repo(ipmi_ctx_t *ctx, uint32_t *count, bool ignore_disabled,
+	bool drop_noread, uint8_t *cc, sdr_image_t *img);
+
+/**
+ * @brief	Create the list of sensors from the SDRs of the given image the
+ *	same way \c scan_sdr_repo() does, but without reading the SDRs from the
+ *	BMC. The probes for dropping sensors get issued concurrently.
+ * @param ctx	The context of the IPMI device to use for probing.
+ * @param img	The SDRs to use.
+ * @param count	The number of sensors in the returned list.
+ * @param ignore_disabled	See \c scan_sdr_repo().
+ * @param drop_noread		See \c scan_sdr_repo().
+ * @return \c NULL if there are no eligible sensors, the head of the list
+ *	otherwise.
+ */
+sensor_t *sdr_image2sensors(ipmi_ctx_t *ctx, sdr_image_t *img, uint32_t *count,
+	bool ignore_disabled, bool drop_noread);
+
+/**
+ * @brief	Update the given SDR image and sensor list after the SDR repository
+ *	changed. Only the keys (header, owner and sensor number) of all SDRs get
+ *	read, and the whole SDR only if it is new or its keys differ from the ones
+ *	in the image. Sensors of removed or changed SDRs get dropped from the list.
+ * @param ctx	The context of the IPMI device to use.
+ * @param img	The SDRs the given sensor list has been built from. On success
+ *	replaced by the SDRs of the repository as is.
+ * @param list	The current sensor list. On success the sensors of unchanged
+ *	SDRs, only. Their order and content do not change.
+ * @param count	The number of sensors in the returned list.
+ * @param ignore_disabled	See \c scan_sdr_repo().
+ * @param drop_noread		See \c scan_sdr_repo().
+ * @param cc	Set to the completion code of the command, which failed, \c 0
+ *	on success. On failure image and list stay as they are.
+ * @return The list of new sensors, i.e. the ones of new or changed SDRs and
+ *	of unchanged SDRs, which are eligible but not in the given list.
+ */
+sensor_t *sdr_repo_update(ipmi_ctx_t *ctx, sdr_image_t *img, sensor_t **list,
+	uint32_t *count, bool ignore_disabled, bool drop_noread, uint8_t *cc);
+
+/**
+ * @brief	Compute the fingerprint of the given SDR image, i.e. a hash of the
+ *	keys of all its SDRs in chain order. The keys are the record header
+ *	(incl. the record ID) and the owner and number of the sensor, so that
+ *	the images of the same repository read completely or keys only (see
+ *	\c sdr_repo_update()) have the same fingerprint.
+ * @param img	The image to use.
+ * @return The fingerprint.
+ */
+uint32_t sdr_image_fingerprint(sdr_image_t *img);
+
+/** @brief	Initial value for \c sdr_hash(). */
+#define SDR_HASH_INIT	2166136261U
+
+/**
+ * @brief	Hash the given data using FNV-1a.
+ * @param h		\c SDR_HASH_INIT or the result of the previous call.
+ * @param data	The data to hash.
+ * @param len	The number of bytes of data.
+ * @return The updated hash value.
+ */
+uint32_t sdr_hash(uint32_t h, const void *data, size_t len);
+
+/**
+ * @brief	Release the data of the given SDR image and reset it.
+ * @param img	The image to reset. Ignored if \c NULL.
  */
-sensor_t *scan_sdr_repo(uint32_t *count, bool ignore_disabled, bool drop_noread, uint8_t *cc);
+void sdr_image_free(sdr_image_t *img);
 
 /**
  * @brief	Check whether the repo has been changed since last call of this
- *	function. 
- * @return \c false if all sensors within the given list still are still
- *	assigned to the same SDR, not new records have been added or got deleted.
- *	Otherwise \c true, i.e. one should create a new sensor list and drop the
- *	old one e.g. to avoid using wrong thresholds and convertion factors.
+ *	function. Usually this costs a Get SDR Repository Info request, only.
+ *	If its last add or delete timestamp moved (some BMCs update them without
+ *	changing anything), the number of SDRs gets compared, and the keys and
+ *	the ID of the next SDR of a few sample SDRs of the given image get read
+ *	and compared. The samples rotate from call to call. If they did not
+ *	change, the timestamps of the stamp of the given image get updated, so
+ *	that the image stays valid for the new state of the repo.
+ * @param ctx	The context of the IPMI device to use.
+ * @param img	The SDRs the current list of sensors has been built from.
+ * @param stamp	The state of the repo seen by the last call for this device.
+ *	Initialize it with zeros before the first call, or with the stamp of the
+ *	SDR image the sensor list has been built from.
+ * @param check	Where to record the cost of this check. Initialize it with
+ *	zeros before the first call.
+ * @return \c true if the repo has been changed, i.e. one should update the
+ *	sensor list e.g. via \c sdr_repo_update() to avoid using wrong thresholds
+ *	and convertion factors. \c false otherwise.
  */
-bool sdrs_changed(sensor_t *head);
+bool sdrs_changed(ipmi_ctx_t *ctx, sdr_image_t *img, sdr_stamp_t *stamp,
+	sdr_check_t *check);
 
 /**
  * @brief	Convert the given thresholds to a string using the ipmitool format.
@@ -554,6 +802,7 @@ char *thresholds2ipmitool_str(sdr_thresholds_t *t, uint8_t analog_fmt, factors_t
  * @brief Get the values of the given list of sensors, format them and related
  *	thresholds in '\c ipmitool \c sensor' format and store the result into the
  *	given string builder \c sb or print it out to stdout.
+ * @param ctx	The context of the IPMI device to use.
  * @param list	The list of sensors to query.
  * @param sb	The string builder to use to store the result. If \c NULL, the
  *	result gets pushed to \c stdout.
@@ -561,7 +810,8 @@ char *thresholds2ipmitool_str(sdr_thresholds_t *t, uint8_t analog_fmt, factors_t
  *	as column 0 and 1, and a threshold state column added to the default
  *	output.
  */
-void show_ipmitool_sensors(sensor_t *list, psb_t *sb, bool extended);
+void show_ipmitool_sensors(ipmi_ctx_t *ctx, sensor_t *list, psb_t *sb,
+	bool extended);
 
 #ifdef __cplusplus
 }
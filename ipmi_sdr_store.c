@@ -0,0 +1,163 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_sdr_store.c
+ * Persistent SDR cache (see ipmi_sdr_store.h). A cache file gets used only,
+ * if its key (BMC identity and repo state) matches the one reported by the
+ * BMC right now, so validating it costs one Get Device ID and one Get SDR
+ * Repository Info, both usually already answered from the response cache.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "ipmi_if.h"
+#include "ipmi_sdr.h"
+#include "ipmi_store.h"
+#include "ipmi_sdr_store.h"
+
+int
+sdr_store_key(ipmi_ctx_t *ctx, sdr_store_key_t *key) {
+	struct ipmi_rs rsp;
+	ipmi_bmc_info_t *bmc;
+	sdr_repo_info_t *ri;
+	uint8_t cc;
+
+	memset(key, 0, sizeof(sdr_store_key_t));
+	bmc = get_bmc_info(ctx, &rsp, &cc);
+	if (bmc == NULL || cc != 0)
+		return 1;
+	memcpy(key->manufacturer_id, bmc->manufacturer_id, 3);
+	memcpy(key->product_id, bmc->product_id, 2);
+	key->fw_rev_major = bmc->fw_rev_major;
+	key->fw_rev_minor = bmc->fw_rev_minor;
+	memcpy(key->aux_fw_rev, bmc->aux_fw_rev, 4);
+	ri = get_repo_info(ctx, &rsp, &cc);
+	if (ri == NULL || cc != 0)
+		return 1;
+	key->last_add = ri->last_add;
+	key->last_del = ri->last_del;
+	key->sdr_count = ri->sdr_count;
+	return 0;
+}
+
+int
+sdr_store_load(ipmi_ctx_t *ctx, const char *path, sdr_image_t *img) {
+	sdr_store_hdr_t hdr;
+	sdr_store_key_t key;
+	sdr_store_thr_t *thr;
+	uint8_t *data = NULL;
+	size_t tlen;
+	FILE *f;
+	int i, res = 1;
+
+	f = store_open(path, "SDR cache", &hdr, sizeof(hdr), SDR_STORE_MAGIC,
+		SDR_STORE_VERSION);
+	if (f == NULL)
+		return 1;
+	if (sdr_store_key(ctx, &key) != 0) {
+		PROM_WARN("Unable to validate SDR cache '%s'.", path);
+		goto end;
+	}
+	if (memcmp(&(hdr.key), &key, sizeof(sdr_store_key_t)) != 0) {
+		PROM_INFO("SDR cache '%s' is stale.", path);
+		goto end;
+	}
+	tlen = hdr.thresholds * sizeof(sdr_store_thr_t);
+	data = store_read(f, path, "SDR cache", hdr.len + tlen, hdr.checksum);
+	if (data == NULL)
+		goto end;
+
+	// the thresholds stay behind the SDRs, get overwritten on append
+	thr = (sdr_store_thr_t *) (data + hdr.len);
+	for (i = 0; i < hdr.thresholds; i++)
+		sdr_thresholds_preset(ctx, &(thr[i].key), thr[i].ccode,
+			&(thr[i].t));
+	sdr_image_free(img);
+	img->data = data;
+	img->len = hdr.len;
+	img->size = hdr.len + tlen;
+	img->records = hdr.records;
+	img->sdr_count = hdr.key.sdr_count;
+	img->stamp.valid = true;
+	img->stamp.last_add = hdr.key.last_add;
+	img->stamp.last_del = hdr.key.last_del;
+	img->stamp.fingerprint = sdr_image_fingerprint(img);
+	data = NULL;
+	PROM_INFO("Using SDR cache '%s' (%d SDRs, %d thresholds).", path,
+		hdr.records, hdr.thresholds);
+	res = 0;
+
+end:
+	free(data);
+	fclose(f);
+	return res;
+}
+
+int
+sdr_store_save(ipmi_ctx_t *ctx, const char *path, sdr_image_t *img,
+	sensor_t *list)
+{
+	sdr_store_hdr_t hdr;
+	sdr_store_thr_t *thr = NULL;
+	struct iovec data[2];
+	sensor_t *s;
+	size_t n = 0;
+	int res = 1;
+
+	if (!img->stamp.valid || img->len > UINT32_MAX)
+		return 1;
+	store_hdr_init(&hdr, sizeof(hdr), SDR_STORE_MAGIC, SDR_STORE_VERSION);
+	// the cached repo info might be from the start of the scan
+	sdr_repo_info_forget(ctx);
+	if (sdr_store_key(ctx, &(hdr.key)) != 0
+		|| hdr.key.last_add != img->stamp.last_add
+		|| hdr.key.last_del != img->stamp.last_del)
+	{
+		PROM_INFO("SDR repo changed while scanning. Cache not written.", "");
+		return 1;
+	}
+	for (s = list; s != NULL; s = s->next)
+		n++;
+	if (n > UINT16_MAX || (thr = malloc(n * sizeof(sdr_store_thr_t) + 1))
+		== NULL)
+	{
+		return 1;
+	}
+	n = 0;
+	for (s = list; s != NULL; s = s->next) {
+		if (s->thr_cc == 0xFF)
+			continue;
+		thr[n].key = s->key;
+		thr[n].ccode = s->thr_cc;
+		memcpy(&(thr[n].t), &(s->thr), sizeof(sdr_thresholds_t));
+		n++;
+	}
+	hdr.records = img->records;
+	hdr.len = img->len;
+	hdr.thresholds = n;
+	data[0].iov_base = img->data;
+	data[0].iov_len = img->len;
+	data[1].iov_base = thr;
+	data[1].iov_len = n * sizeof(sdr_store_thr_t);
+	hdr.checksum = sdr_hash(sdr_hash(SDR_HASH_INIT, data[0].iov_base,
+		data[0].iov_len), data[1].iov_base, data[1].iov_len);
+	if (store_write(path, "SDR cache", &hdr, sizeof(hdr), data, 2) == 0) {
+		PROM_INFO("SDR cache '%s' written (%d SDRs, %d thresholds).", path,
+			hdr.records, hdr.thresholds);
+		res = 0;
+	}
+	free(thr);
+	return res;
+}
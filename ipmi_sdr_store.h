@@ -0,0 +1,116 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_sdr_store.h
+ * Persistent SDR cache. Walking the SDR repository of a BMC may take a
+ * minute, so a copy of all SDRs and the thresholds of the monitored sensors
+ * get stored in a file, and used on the next start instead of walking the
+ * repository again, as long as the BMC (manufacturer, product, firmware) and
+ * the state of its repository (last add and last delete timestamp, number of
+ * records) did not change.
+ *
+ * The file starts with a \c sdr_store_hdr_t followed by \c len bytes of SDRs,
+ * each one prefixed by its length byte, followed by \c thresholds
+ * \c sdr_store_thr_t entries. All numbers are stored in the byte order of the
+ * writing host, which is indicated by the \c bom field of the header.
+ */
+#ifndef IPMIMEX_IPMI_SDR_STORE_H
+#define IPMIMEX_IPMI_SDR_STORE_H
+
+#include <inttypes.h>
+#include "mach.h"
+#include "ipmi_if.h"
+#include "ipmi_store.h"
+#include "ipmi_sdr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SDR_STORE_MAGIC		"IPMISDR"
+#define SDR_STORE_VERSION	2
+
+#pragma pack(push,1)
+
+/** @brief The identity of a BMC and the state of its SDR repository. */
+typedef struct sdr_store_key {
+	uint8_t manufacturer_id[3];	// as reported by Get Device ID
+	uint8_t product_id[2];
+	uint8_t fw_rev_major;
+	uint8_t fw_rev_minor;
+	uint8_t aux_fw_rev[4];
+	uint8_t __reserved;
+	uint32_t last_add;			// as reported by Get SDR Repository Info
+	uint32_t last_del;
+	uint16_t sdr_count;
+} PACKED sdr_store_key_t;
+
+typedef struct sdr_store_hdr {
+	store_id_t id;				// SDR_STORE_MAGIC, SDR_STORE_VERSION
+	sdr_store_key_t key;		// the cache is valid for this state, only
+	uint16_t records;			// number of SDRs stored
+	uint32_t len;				// number of SDR bytes following
+	uint16_t thresholds;		// number of threshold entries following
+	uint16_t __reserved2;
+	uint32_t checksum;			// FNV-1a of all bytes following the header
+} PACKED sdr_store_hdr_t;
+
+typedef struct sdr_store_thr {
+	sdr_key_t key;				// owner and number of the sensor
+	uint8_t ccode;				// completion code of Get Sensor Thresholds
+	sdr_thresholds_t t;			// valid if ccode is 0
+} PACKED sdr_store_thr_t;
+
+#pragma pack(pop)
+
+/**
+ * @brief	Get the key of the given BMC, i.e. its identity and the current
+ *	state of its SDR repository. Other caches, whose content depends on the
+ *	SDRs, may use it to get invalidated together with the SDR cache.
+ * @param ctx	The context of the IPMI device to ask.
+ * @param key	Where to store the key.
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+int sdr_store_key(ipmi_ctx_t *ctx, sdr_store_key_t *key);
+
+/**
+ * @brief	Load the SDR cache from the given file, if it is still valid for
+ *	the given BMC. Stored thresholds get put into the response cache, so that
+ *	subsequent \c get_thresholds() calls get answered from there.
+ * @param ctx	The context of the IPMI device to validate against.
+ * @param path	The path of the file to load.
+ * @param img	Where to store the SDRs. Its stamp gets set to the state of
+ *	the repo the SDRs belong to.
+ * @return \c 0 on success, a number > 0 if the file does not exist, is
+ *	invalid or stale.
+ */
+int sdr_store_load(ipmi_ctx_t *ctx, const char *path, sdr_image_t *img);
+
+/**
+ * @brief	Store the given SDRs and the thresholds of the given sensors to
+ *	the given file. The file gets replaced atomically.
+ * @param ctx	The context of the IPMI device the SDRs belong to.
+ * @param path	The path of the file to write.
+ * @param img	The SDRs to store. Ignored if its stamp is not valid.
+ * @param list	The sensors, whose thresholds should be stored. Sensors whose
+ *	thresholds are not loaded yet (\c thr_cc \c == \c 0xFF) get skipped.
+ *	\c NULL to store no thresholds.
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+int sdr_store_save(ipmi_ctx_t *ctx, const char *path, sdr_image_t *img,
+	sensor_t *list);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// IPMIMEX_IPMI_SDR_STORE_H
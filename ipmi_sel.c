@@ -0,0 +1,465 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_sel.c
+ * Incremental SEL reader (see ipmi_sel.h). Records get always fetched as a
+ * whole, which needs no SEL reservation. To find the records added since the
+ * last walk, the last record read gets fetched again for the ID of its
+ * successor, so a walk costs one request more than new records are
+ * available.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "ipmi_if.h"
+#include "ipmi_sdr.h"
+#include "ipmi_sdr_convert.h"
+#include "ipmi_sel.h"
+
+#define NETFN_STORAGE	0xA
+
+// SEL commands, table G-1
+#define CMD_GET_SEL_INFO	0x40	// 31.2
+#define CMD_GET_SEL_ENTRY	0x43	// 31.5
+
+#define SEL_FIRST		0x0000		// record ID of the first entry
+#define SEL_LAST		0xFFFF		// record ID of the last entry/none left
+
+#define COUNTER_KEY(_type, _evt, _off) \
+	(((uint32_t) (_type) << 16) | ((_evt) << 8) | (_off))
+
+// IPMI v2, table 42-2, generic event/reading type 01h (threshold)
+static const char *threshold_event[] = {
+	"lower_nc_going_low",
+	"lower_nc_going_high",
+	"lower_cr_going_low",
+	"lower_cr_going_high",
+	"lower_nr_going_low",
+	"lower_nr_going_high",
+	"upper_nc_going_low",
+	"upper_nc_going_high",
+	"upper_cr_going_low",
+	"upper_cr_going_high",
+	"upper_nr_going_low",
+	"upper_nr_going_high",
+};
+
+static const char *physical_security_event[] = {
+	"general_chassis_intrusion",
+	"drive_bay_intrusion",
+	"io_card_area_intrusion",
+	"processor_area_intrusion",
+	"lan_leash_lost",
+	"unauthorized_dock",
+	"fan_area_intrusion",
+};
+
+static const char *processor_event[] = {
+	"ierr",
+	"thermal_trip",
+	"frb1_bist_failure",
+	"frb2_hang_in_post",
+	"frb3_startup_failure",
+	"configuration_error",
+	"smbios_uncorrectable_cpu_error",
+	"presence",
+	"disabled",
+	"terminator_presence",
+	"throttled",
+	"machine_check_exception",
+	"correctable_machine_check_error",
+};
+
+static const char *power_supply_event[] = {
+	"presence",
+	"failure",
+	"predictive_failure",
+	"input_lost",
+	"input_lost_or_out_of_range",
+	"input_out_of_range",
+	"configuration_error",
+	"inactive",
+};
+
+static const char *power_unit_event[] = {
+	"power_off",
+	"power_cycle",
+	"240va_power_down",
+	"interlock_power_down",
+	"ac_lost",
+	"soft_power_control_failure",
+	"power_unit_failure",
+	"predictive_failure",
+};
+
+static const char *memory_event[] = {
+	"correctable_ecc",
+	"uncorrectable_ecc",
+	"parity",
+	"memory_scrub_failed",
+	"memory_device_disabled",
+	"correctable_ecc_logging_limit",
+	"presence",
+	"configuration_error",
+	"spare",
+	"throttled",
+	"critical_overtemperature",
+};
+
+static const char *drive_slot_event[] = {
+	"presence",
+	"fault",
+	"predictive_failure",
+	"hot_spare",
+	"consistency_check",
+	"in_critical_array",
+	"in_failed_array",
+	"rebuild",
+	"rebuild_aborted",
+};
+
+static const char *logging_disabled_event[] = {
+	"correctable_memory_error_logging_disabled",
+	"event_type_logging_disabled",
+	"log_area_cleared",
+	"all_event_logging_disabled",
+	"sel_full",
+	"sel_almost_full",
+	"correctable_mce_logging_disabled",
+};
+
+static const char *critical_interrupt_event[] = {
+	"front_panel_nmi",
+	"bus_timeout",
+	"io_channel_check_nmi",
+	"software_nmi",
+	"pci_perr",
+	"pci_serr",
+	"eisa_failsafe_timeout",
+	"bus_correctable_error",
+	"bus_uncorrectable_error",
+	"fatal_nmi",
+	"bus_fatal_error",
+	"bus_degraded",
+};
+
+// IPMI v2, table 42-3, sensor-specific offsets of the sensor types of interest
+static const struct {
+	uint8_t sensor_type;
+	uint8_t events;
+	const char **event;
+} specific_event[] = {
+	{ 0x05, ARRAY_SIZE(physical_security_event), physical_security_event },
+	{ 0x07, ARRAY_SIZE(processor_event), processor_event },
+	{ 0x08, ARRAY_SIZE(power_supply_event), power_supply_event },
+	{ 0x09, ARRAY_SIZE(power_unit_event), power_unit_event },
+	{ 0x0C, ARRAY_SIZE(memory_event), memory_event },
+	{ 0x0D, ARRAY_SIZE(drive_slot_event), drive_slot_event },
+	{ 0x10, ARRAY_SIZE(logging_disabled_event), logging_disabled_event },
+	{ 0x13, ARRAY_SIZE(critical_interrupt_event), critical_interrupt_event },
+};
+
+const char *
+sel_event2str(uint8_t sensor_type, uint8_t event_type, uint8_t offset) {
+	size_t i;
+
+	if (event_type == 0x01)
+		return (offset < ARRAY_SIZE(threshold_event))
+			? threshold_event[offset]
+			: NULL;
+	if (event_type != 0x6F)
+		return NULL;
+	for (i = 0; i < ARRAY_SIZE(specific_event); i++) {
+		if (specific_event[i].sensor_type == sensor_type)
+			return (offset < specific_event[i].events)
+				? specific_event[i].event[offset]
+				: NULL;
+	}
+	return NULL;
+}
+
+// send the given storage command and wait for its answer
+static uint8_t
+sel_cmd(ipmi_ctx_t *ctx, uint8_t cmd, uint8_t *data, uint8_t len,
+	struct ipmi_rs *rsp)
+{
+	struct ipmi_rq req;
+
+	memset(&req, 0, sizeof(req));
+	req.msg.netfn = NETFN_STORAGE;
+	req.msg.cmd = cmd;
+	req.msg.data = data;
+	req.msg.data_len = len;
+	return sdr_call(ctx, &req, rsp);
+}
+
+static uint8_t
+get_sel_info(ipmi_ctx_t *ctx, sel_info_t *info) {
+	struct ipmi_rs rsp;
+	uint8_t cc;
+
+	if ((cc = sel_cmd(ctx, CMD_GET_SEL_INFO, NULL, 0, &rsp)) != 0)
+		return cc;
+	if (rsp.data_len < (int) sizeof(sel_info_t))
+		return 0xFF;
+	memcpy(info, rsp.data, sizeof(sel_info_t));
+	return 0;
+}
+
+// fetch the whole record with the given ID. No reservation needed.
+static uint8_t
+get_sel_entry(ipmi_ctx_t *ctx, uint16_t id, uint16_t *next, sel_record_t *rec)
+{
+	struct ipmi_rs rsp;
+	uint8_t rq[6], cc;
+
+	rq[0] = rq[1] = 0;			// reservation ID
+	rq[2] = id & 0xFF;
+	rq[3] = id >> 8;
+	rq[4] = 0;					// offset
+	rq[5] = 0xFF;				// read the entire record
+	if ((cc = sel_cmd(ctx, CMD_GET_SEL_ENTRY, rq, sizeof(rq), &rsp)) != 0)
+		return cc;
+	if (rsp.data_len < (int) (2 + sizeof(sel_record_t)))
+		return 0xFF;
+	*next = rsp.data[0] | (rsp.data[1] << 8);
+	memcpy(rec, rsp.data + 2, sizeof(sel_record_t));
+	return 0;
+}
+
+// add n to the counter with the given key, create it if not yet available
+static void
+add_count(sel_t *sel, uint8_t type, uint8_t evt, uint8_t off, uint32_t n) {
+	uint32_t key = COUNTER_KEY(type, evt, off), k;
+	sel_counter_t *c;
+	size_t lo = 0, hi = sel->counters, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		c = &(sel->counter[mid]);
+		k = COUNTER_KEY(c->sensor_type, c->event_type, c->offset);
+		if (k == key) {
+			c->count += n;
+			return;
+		}
+		if (k < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (sel->counters == sel->size) {
+		if (sel->size == UINT16_MAX)
+			return;
+		k = sel->size == 0 ? 32 : 2 * sel->size;
+		if (k > UINT16_MAX)
+			k = UINT16_MAX;
+		c = realloc(sel->counter, k * sizeof(sel_counter_t));
+		if (c == NULL)
+			return;
+		sel->counter = c;
+		sel->size = k;
+	}
+	c = &(sel->counter[lo]);
+	memmove(c + 1, c, (sel->counters - lo) * sizeof(sel_counter_t));
+	memset(c, 0, sizeof(sel_counter_t));
+	c->sensor_type = type;
+	c->event_type = evt;
+	c->offset = off;
+	c->count = n;
+	sel->counters++;
+}
+
+// account the given record, if it is a new system event record
+static void
+count_record(sel_t *sel, const sel_record_t *rec) {
+	sel_cursor_t *c = &(sel->cursor);
+
+	if (rec->type >= SEL_RECORD_OEM)
+		return;
+	if (rec->timestamp > c->last_ts)
+		c->last_ts = rec->timestamp;
+	if (rec->type != SEL_RECORD_SYSTEM
+		|| (c->since != 0 && rec->timestamp <= c->since))
+	{
+		return;
+	}
+	add_count(sel, rec->sensor_type, rec->event_type,
+		(rec->deassertion << 7) | (rec->data[0] & 0x0F), 1);
+}
+
+uint32_t
+sel_read(ipmi_ctx_t *ctx, sel_t *sel, int max, bool *more) {
+	sel_cursor_t *c = &(sel->cursor);
+	sel_info_t info;
+	sel_record_t rec;
+	uint16_t id = SEL_FIRST, next;
+	uint32_t n = 0;
+	uint8_t cc;
+
+	*more = false;
+	if ((cc = get_sel_info(ctx, &info)) != 0) {
+		PROM_DEBUG("Get SEL Info failed: %s", ipmi_cc2str(cc));
+		return 0;
+	}
+	sel->entries = info.entries;
+	if (c->valid && c->last_add == info.last_add
+		&& c->last_del == info.last_del)
+	{
+		return 0;
+	}
+	if (!c->valid) {
+		c->since = 0;
+		c->last_id = 0;
+	} else if (c->last_del != info.last_del) {
+		// cleared or records deleted: re-read, but count new ones, only
+		c->since = c->last_ts;
+		c->last_id = 0;
+	} else if (c->last_id != 0) {
+		cc = get_sel_entry(ctx, c->last_id, &next, &rec);
+		if (cc == SDR_CC_SENSOR_NOT_FOUND) {
+			// overwritten, e.g. by a circular SEL
+			c->since = c->last_ts;
+			c->last_id = 0;
+		} else if (cc != 0) {
+			PROM_WARN("Reading SEL entry 0x%04x failed: %s", c->last_id,
+				ipmi_cc2str(cc));
+			return 0;
+		} else {
+			id = next;
+		}
+	}
+	c->valid = true;
+	c->last_del = info.last_del;
+	while (id != SEL_LAST) {
+		if (max > 0 && n >= (uint32_t) max) {
+			*more = true;
+			c->last_add = 0;	// not done yet
+			return n;
+		}
+		cc = get_sel_entry(ctx, id, &next, &rec);
+		if (cc == SDR_CC_SENSOR_NOT_FOUND && id == SEL_FIRST)
+			break;				// empty
+		if (cc != 0) {
+			PROM_WARN("Reading SEL entry 0x%04x failed: %s", id,
+				ipmi_cc2str(cc));
+			c->last_add = 0;
+			return n;
+		}
+		count_record(sel, &rec);
+		c->last_id = rec.id;
+		n++;
+		if (next == id)
+			break;				// buggy BMC, avoid an endless loop
+		id = next;
+		ipmi_yield(ctx);
+	}
+	c->last_add = info.last_add;
+	c->since = 0;
+	return n;
+}
+
+void
+sel_free(sel_t *sel) {
+	free(sel->counter);
+	memset(sel, 0, sizeof(sel_t));
+}
+
+// set the identity part of the given header to the one of the given BMC
+static int
+sel_store_key(ipmi_ctx_t *ctx, sel_store_hdr_t *hdr) {
+	struct ipmi_rs rsp;
+	ipmi_bmc_info_t *bmc;
+	uint8_t cc;
+
+	bmc = get_bmc_info(ctx, &rsp, &cc);
+	if (bmc == NULL || cc != 0)
+		return 1;
+	memcpy(hdr->manufacturer_id, bmc->manufacturer_id, 3);
+	memcpy(hdr->product_id, bmc->product_id, 2);
+	return 0;
+}
+
+int
+sel_store_load(ipmi_ctx_t *ctx, const char *path, sel_t *sel) {
+	sel_store_hdr_t hdr, key;
+	sel_counter_t *data = NULL;
+	uint32_t i;
+	FILE *f;
+	int res = 1;
+
+	f = store_open(path, "SEL cursor", &hdr, sizeof(hdr), SEL_STORE_MAGIC,
+		SEL_STORE_VERSION);
+	if (f == NULL)
+		return 1;
+	if (sel_store_key(ctx, &key) != 0) {
+		PROM_WARN("Unable to validate SEL cursor '%s'.", path);
+		goto end;
+	}
+	if (memcmp(hdr.manufacturer_id, key.manufacturer_id, 3) != 0
+		|| memcmp(hdr.product_id, key.product_id, 2) != 0)
+	{
+		PROM_INFO("Ignoring SEL cursor '%s': written for another BMC.", path);
+		goto end;
+	}
+	data = (sel_counter_t *) store_read(f, path, "SEL cursor",
+		hdr.counters * sizeof(sel_counter_t), hdr.checksum);
+	if (data == NULL)
+		goto end;
+
+	sel_free(sel);
+	sel->cursor.valid = true;
+	sel->cursor.last_id = hdr.last_id;
+	sel->cursor.last_ts = hdr.last_ts;
+	sel->cursor.since = hdr.since;
+	sel->cursor.last_add = hdr.last_add;
+	sel->cursor.last_del = hdr.last_del;
+	for (i = 0; i < hdr.counters; i++)
+		add_count(sel, data[i].sensor_type, data[i].event_type,
+			data[i].offset, data[i].count);
+	PROM_INFO("Using SEL cursor '%s' (record 0x%04x, %d counters).", path,
+		hdr.last_id, sel->counters);
+	res = 0;
+
+end:
+	free(data);
+	fclose(f);
+	return res;
+}
+
+int
+sel_store_save(ipmi_ctx_t *ctx, const char *path, sel_t *sel) {
+	sel_store_hdr_t hdr;
+	struct iovec iov;
+
+	if (!sel->cursor.valid)
+		return 1;
+	store_hdr_init(&hdr, sizeof(hdr), SEL_STORE_MAGIC, SEL_STORE_VERSION);
+	if (sel_store_key(ctx, &hdr) != 0)
+		return 1;
+	hdr.last_id = sel->cursor.last_id;
+	hdr.last_ts = sel->cursor.last_ts;
+	hdr.since = sel->cursor.since;
+	hdr.last_add = sel->cursor.last_add;
+	hdr.last_del = sel->cursor.last_del;
+	hdr.counters = sel->counters;
+	iov.iov_base = sel->counter;
+	iov.iov_len = sel->counters * sizeof(sel_counter_t);
+	hdr.checksum = sdr_hash(SDR_HASH_INIT, iov.iov_base, iov.iov_len);
+	if (store_write(path, "SEL cursor", &hdr, sizeof(hdr), &iov, 1) != 0)
+		return 1;
+	PROM_DEBUG("SEL cursor '%s' written (record 0x%04x).", path,
+		hdr.last_id);
+	return 0;
+}
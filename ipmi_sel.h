@@ -0,0 +1,184 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_sel.h
+ * Incremental System Event Log (SEL) reader. The system event records of
+ * the SEL get counted per sensor type, event/reading type, event offset and
+ * direction. A cursor remembers the ID of the last record read and the last
+ * add and erase timestamp of the SEL, so that only records added afterwards
+ * need to be read. If the SEL did not change, checking it costs a single
+ * Get SEL Info request.
+ *
+ * The cursor and the counters can be stored in a file, so that they survive
+ * a restart. The file starts with a \c sel_store_hdr_t followed by
+ * \c counters \c sel_counter_t entries. All numbers are stored in the byte
+ * order of the writing host, which is indicated by the \c bom field of the
+ * header.
+ */
+#ifndef IPMIMEX_IPMI_SEL_H
+#define IPMIMEX_IPMI_SEL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "mach.h"
+#include "ipmi_if.h"
+#include "ipmi_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SEL_STORE_MAGIC		"IPMISEL"
+#define SEL_STORE_VERSION	1
+
+#define SEL_RECORD_SYSTEM	0x02	// system event record
+#define SEL_RECORD_OEM_TS	0xC0	// 1st OEM record type with a timestamp
+#define SEL_RECORD_OEM		0xE0	// 1st OEM record type without timestamp
+
+#pragma pack(push,1)
+
+/** @brief IPMI v2, table 31-2, Get SEL Info response. (31.2) */
+typedef struct sel_info {
+	uint8_t version;			// (1) SEL version (51h == 2.0)
+	uint16_t entries;			// (2:3) number of log entries
+	uint16_t free;				// (4:5) free space in bytes
+	uint32_t last_add;			// (6:9) most recent addition timestamp
+	uint32_t last_del;			// (10:13) most recent erase timestamp
+	BITFIELD6(					// (14) operation support
+		overflow:1,				//	- [7] events dropped, SEL full
+		__reserved:3,			//	- [6:4]
+		delete_supported:1,		//	- [3] Delete SEL command
+		partial_add:1,			//	- [2] Partial Add SEL Entry command
+		reserve_supported:1,	//	- [1] Reserve SEL command
+		alloc_info:1			//	- [0] Get SEL Allocation Info command
+	);
+} PACKED sel_info_t;
+
+/** @brief IPMI v2, table 32-1, SEL Event Records. (32.1) */
+typedef struct sel_record {
+	uint16_t id;				// (1:2) record ID
+	uint8_t type;				// (3) record type
+	uint32_t timestamp;			// (4:7)
+	uint16_t generator;			// (8:9) generator ID
+	uint8_t evm_rev;			// (10) event message format (04h == 2.0)
+	uint8_t sensor_type;		// (11) see table 42-3
+	uint8_t sensor_num;			// (12)
+	BITFIELD2(					// (13) event dir and event/reading type
+		deassertion:1,			//	- [7] 0 .. assertion, 1 .. deassertion
+		event_type:7			//	- [6:0] see table 42-1
+	);
+	uint8_t data[3];			// (14:16) event data, [0] bit 3:0 .. offset
+} PACKED sel_record_t;
+
+/** @brief The number of events of a certain kind. */
+typedef struct sel_counter {
+	uint8_t sensor_type;		// see table 42-3
+	uint8_t event_type;			// event/reading type code, see table 42-1
+	uint8_t offset;				// [7] deassertion, [3:0] event offset
+	uint8_t __reserved;
+	uint32_t count;
+} PACKED sel_counter_t;
+
+typedef struct sel_store_hdr {
+	store_id_t id;				// SEL_STORE_MAGIC, SEL_STORE_VERSION
+	uint8_t manufacturer_id[3];	// of the BMC as reported by Get Device ID
+	uint8_t product_id[2];
+	uint8_t __reserved;
+	uint16_t last_id;			// the cursor, see sel_cursor_t
+	uint32_t last_ts;
+	uint32_t since;
+	uint32_t last_add;
+	uint32_t last_del;
+	uint16_t counters;			// number of counter entries following
+	uint16_t __reserved2;
+	uint32_t checksum;			// FNV-1a of all bytes following the header
+} PACKED sel_store_hdr_t;
+
+#pragma pack(pop)
+
+/** @brief Position of the SEL reader. */
+typedef struct sel_cursor {
+	bool valid;					// false .. nothing read yet
+	uint16_t last_id;			// ID of the last record read
+	uint32_t last_ts;			// latest timestamp of all records read
+	uint32_t since;				// if != 0, skip records not newer than this
+	uint32_t last_add;			// SEL timestamps, when the last walk ended
+	uint32_t last_del;
+} sel_cursor_t;
+
+/** @brief The SEL state of a BMC. */
+typedef struct sel {
+	sel_cursor_t cursor;
+	sel_counter_t *counter;		// sorted by sensor type, event type, offset
+	uint16_t counters;			// number of valid entries in counter
+	uint16_t size;				// number of entries allocated
+	uint16_t entries;			// number of SEL entries as last reported
+	bool loaded;				// store file already tried
+} sel_t;
+
+/**
+ * @brief	Read all records added to the SEL of the given BMC since the last
+ *	call and count their events. If the SEL got cleared or records got
+ *	deleted, the SEL gets read from its start again, but only records with a
+ *	timestamp newer than the ones already counted get counted.
+ * @param ctx	The context of the IPMI device to use.
+ * @param sel	The SEL state to update.
+ * @param max	Return after this many records have been read, so that the
+ *	caller may store the cursor. A value \c <= \c 0 means no limit.
+ * @param more	Set to \c true if there are more records to read.
+ * @return The number of records read.
+ */
+uint32_t sel_read(ipmi_ctx_t *ctx, sel_t *sel, int max, bool *more);
+
+/**
+ * @brief	Get a short name of the event with the given offset for the given
+ *	sensor and event/reading type, e.g. \c correctable_ecc .
+ * @param sensor_type	The sensor type code (table 42-3).
+ * @param event_type	The event/reading type code (table 42-1).
+ * @param offset	The event offset.
+ * @return \c NULL if unknown, the name otherwise.
+ */
+const char *sel_event2str(uint8_t sensor_type, uint8_t event_type,
+	uint8_t offset);
+
+/**
+ * @brief	Release all resources of the given SEL state and reset it.
+ * @param sel	The SEL state to reset.
+ */
+void sel_free(sel_t *sel);
+
+/**
+ * @brief	Set the cursor and the counters of the given SEL state to the ones
+ *	stored in the given file, if it has been written for the same kind of BMC.
+ * @param ctx	The context of the IPMI device to validate against.
+ * @param path	The path of the file to load.
+ * @param sel	The SEL state to update.
+ * @return \c 0 on success, a number > 0 if the file does not exist or is
+ *	invalid.
+ */
+int sel_store_load(ipmi_ctx_t *ctx, const char *path, sel_t *sel);
+
+/**
+ * @brief	Store the cursor and the counters of the given SEL state to the
+ *	given file. The file gets replaced atomically.
+ * @param ctx	The context of the IPMI device the SEL belongs to.
+ * @param path	The path of the file to write.
+ * @param sel	The SEL state to store.
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+int sel_store_save(ipmi_ctx_t *ctx, const char *path, sel_t *sel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// IPMIMEX_IPMI_SEL_H
@@ -0,0 +1,120 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_store.c
+ * Reading and writing store files (see ipmi_store.h).
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "common.h"
+#include "ipmi_sdr.h"
+#include "ipmi_store.h"
+
+void
+store_hdr_init(void *hdr, size_t len, const char *magic, uint16_t version) {
+	store_id_t *id = hdr;
+
+	memset(hdr, 0, len);
+	strncpy(id->magic, magic, sizeof(id->magic) - 1);
+	id->bom = STORE_BOM;
+	id->version = version;
+}
+
+FILE *
+store_open(const char *path, const char *what, void *hdr, size_t len,
+	const char *magic, uint16_t version)
+{
+	store_id_t *id = hdr;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		if (errno != ENOENT)
+			PROM_WARN("Unable to open %s '%s': %s", what, path,
+				strerror(errno));
+		return NULL;
+	}
+	if (fread(hdr, len, 1, f) != 1
+		|| strncmp(id->magic, magic, sizeof(id->magic)) != 0
+		|| id->bom != STORE_BOM || id->version != version)
+	{
+		PROM_WARN("Ignoring %s '%s': unsupported format.", what, path);
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+uint8_t *
+store_read(FILE *f, const char *path, const char *what, size_t len,
+	uint32_t checksum)
+{
+	uint8_t *data;
+
+	if ((data = malloc(len + 1)) == NULL) {
+		PROM_WARN("Unable to allocate %s buffer.", what);
+		return NULL;
+	}
+	if (fread(data, 1, len, f) != len) {
+		PROM_WARN("Ignoring %s '%s': truncated.", what, path);
+		goto fail;
+	}
+	if (sdr_hash(SDR_HASH_INIT, data, len) != checksum) {
+		PROM_WARN("Ignoring %s '%s': checksum mismatch.", what, path);
+		goto fail;
+	}
+	return data;
+
+fail:
+	free(data);
+	return NULL;
+}
+
+int
+store_write(const char *path, const char *what, const void *hdr, size_t len,
+	const struct iovec *data, int n)
+{
+	char *tmp;
+	FILE *f;
+	int i, ok, res = 1;
+
+	if ((tmp = malloc(strlen(path) + 5)) == NULL)
+		return 1;
+	sprintf(tmp, "%s.tmp", path);
+	if ((f = fopen(tmp, "w")) == NULL) {
+		PROM_WARN("Unable to create %s '%s': %s", what, tmp, strerror(errno));
+		goto end;
+	}
+	ok = fwrite(hdr, len, 1, f) == 1;
+	for (i = 0; ok && i < n; i++)
+		ok = fwrite(data[i].iov_base, 1, data[i].iov_len, f)
+			== data[i].iov_len;
+	if (!ok) {
+		PROM_WARN("Unable to write %s '%s': %s", what, tmp, strerror(errno));
+		fclose(f);
+		remove(tmp);
+		goto end;
+	}
+	if (fclose(f) != 0 || rename(tmp, path) != 0) {
+		PROM_WARN("Unable to write %s '%s': %s", what, path, strerror(errno));
+		remove(tmp);
+		goto end;
+	}
+	res = 0;
+
+end:
+	free(tmp);
+	return res;
+}
@@ -0,0 +1,100 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_store.h
+ * File handling shared by the persistent SDR, FRU and SEL stores. Each store
+ * file starts with a header, whose first member is a \c store_id_t, usually
+ * followed by the key the content is valid for, and a FNV-1a checksum of the
+ * data following the header. Files get replaced atomically.
+ */
+#ifndef IPMIMEX_IPMI_STORE_H
+#define IPMIMEX_IPMI_STORE_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include "mach.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STORE_BOM		0x0102
+
+#pragma pack(push,1)
+
+/** @brief The format of a store file. */
+typedef struct store_id {
+	char magic[8];				// the magic of the store incl. '\0'
+	uint16_t bom;				// STORE_BOM in the byte order of the writer
+	uint16_t version;			// the format version of the store
+} PACKED store_id_t;
+
+#pragma pack(pop)
+
+/**
+ * @brief	Zero out the given header and set its format.
+ * @param hdr		The header to initialize. Must start with a \c store_id_t.
+ * @param len		The size of the header in bytes.
+ * @param magic		The magic of the store (7 chars max.).
+ * @param version	The format version of the store.
+ */
+void store_hdr_init(void *hdr, size_t len, const char *magic,
+	uint16_t version);
+
+/**
+ * @brief	Open the given store file and read its header.
+ * @param path		The path of the file to open.
+ * @param what		What the store is about, used in log messages.
+ * @param hdr		Where to store the header. Must start with a \c store_id_t.
+ * @param len		The size of the header in bytes.
+ * @param magic		The magic the file must have.
+ * @param version	The format version the file must have.
+ * @return \c NULL if the file does not exist, is not readable or has
+ *	another format, the stream positioned right after the header otherwise.
+ */
+FILE *store_open(const char *path, const char *what, void *hdr, size_t len,
+	const char *magic, uint16_t version);
+
+/**
+ * @brief	Read the data following the header of a store file.
+ * @param f			The stream returned by \c store_open().
+ * @param path		The path of the file, used in log messages.
+ * @param what		What the store is about, used in log messages.
+ * @param len		The number of bytes to read.
+ * @param checksum	The FNV-1a checksum the data must have.
+ * @return \c NULL on error, a buffer of at least \c len \c + \c 1 bytes
+ *	containing the data otherwise. The caller needs to free it if no longer
+ *	needed.
+ */
+uint8_t *store_read(FILE *f, const char *path, const char *what, size_t len,
+	uint32_t checksum);
+
+/**
+ * @brief	Write the given header followed by the given data to a temporary
+ *	file, and rename it to the given path on success.
+ * @param path	The path of the file to write.
+ * @param what	What the store is about, used in log messages.
+ * @param hdr	The header to write.
+ * @param len	The size of the header in bytes.
+ * @param data	The data to write after the header.
+ * @param n		The number of entries in \c data.
+ * @return \c 0 on success, a number > 0 otherwise.
+ */
+int store_write(const char *path, const char *what, const void *hdr,
+	size_t len, const struct iovec *data, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// IPMIMEX_IPMI_STORE_H
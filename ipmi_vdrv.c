@@ -0,0 +1,73 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_vdrv.c
+ * Due time sorted answer queue of the BMC simulator and the replay backend.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+
+#include "ipmi_vdrv.h"
+
+void
+vdrv_queue(vdrv_rsp_t **queue, vdrv_rsp_t *r) {
+	vdrv_rsp_t **p;
+
+	for (p = queue; *p != NULL && (*p)->due <= r->due; p = &((*p)->next))
+		;
+	r->next = *p;
+	*p = r;
+}
+
+int
+vdrv_recv(vdrv_rsp_t **queue, struct ipmi_rs *rsp, long *msgid, long timeout)
+{
+	struct timespec ts;
+	vdrv_rsp_t *r = *queue;
+	long wait, now = now_ms();
+
+	if (r == NULL || r->due > now) {
+		if (timeout < 0)
+			return 0;
+		wait = (r == NULL || r->due - now > timeout) ? timeout : r->due - now;
+		ts.tv_sec = wait / 1000;
+		ts.tv_nsec = (wait % 1000) * 1000000;
+		while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+			;
+		if (r == NULL || r->due > now_ms())
+			return 0;
+	}
+	*queue = r->next;
+	*msgid = r->msgid;
+	memcpy(rsp, &(r->rs), sizeof(struct ipmi_rs));
+	free(r);
+	return 1;
+}
+
+void
+vdrv_flush(vdrv_rsp_t **queue) {
+	vdrv_rsp_t *r, *n;
+
+	for (r = *queue; r != NULL; r = n) {
+		n = r->next;
+		free(r);
+	}
+	*queue = NULL;
+}
+
+int
+vdrv_fd(ipmi_drv_t *drv) {
+	(void) drv;
+	return -1;
+}
@@ -0,0 +1,74 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file ipmi_vdrv.h
+ * Helpers for backends without a real device, i.e. the BMC simulator and the
+ * capture replay backend. Their answers get due at a computed time, so they
+ * get kept in a queue sorted by due time until fetched via \c vdrv_recv().
+ */
+#ifndef IPMIMEX_IPMI_VDRV_H
+#define IPMIMEX_IPMI_VDRV_H
+
+#include "ipmi_if.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief	An answer, which gets due at a certain time. */
+typedef struct vdrv_rsp {
+	long msgid;
+	long due;					// CLOCK_MONOTONIC ms when answered
+	struct ipmi_rs rs;
+	struct vdrv_rsp *next;
+} vdrv_rsp_t;
+
+/**
+ * @brief	Insert the given answer into the given queue. Answers due at the
+ *	same time stay in the order they got queued.
+ * @param queue	The head of the queue.
+ * @param r		The answer to insert. Gets freed by \c vdrv_recv() or
+ *	\c vdrv_flush().
+ */
+void vdrv_queue(vdrv_rsp_t **queue, vdrv_rsp_t *r);
+
+/**
+ * @brief	Fetch the next answer of the given queue, which is due. Same
+ *	semantics as the \c recv() operation of a backend.
+ * @param queue	The head of the queue.
+ * @param rsp	Where to store the response.
+ * @param msgid	Where to store the ID of the request the response belongs to.
+ * @param timeout	Max. number of milliseconds to wait for an answer to get
+ *	due. If \c < \c 0 do not wait at all.
+ * @return \c 1 if a response has been stored, \c 0 on timeout.
+ */
+int vdrv_recv(vdrv_rsp_t **queue, struct ipmi_rs *rsp, long *msgid,
+	long timeout);
+
+/**
+ * @brief	Free all answers of the given queue and empty it.
+ * @param queue	The head of the queue.
+ */
+void vdrv_flush(vdrv_rsp_t **queue);
+
+/**
+ * @brief	The \c fd() operation of a backend without a real device: answers
+ *	get due by time, so there is nothing to poll.
+ * @return \c -1 .
+ */
+int vdrv_fd(ipmi_drv_t *drv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// IPMIMEX_IPMI_VDRV_H
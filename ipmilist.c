@@ -43,6 +43,11 @@ main(int argc, char **argv) {
 	struct timespec start, end;
 	int max_tries;
 	sensor_t *slist = NULL;
+	sdr_stamp_t stamp = { .valid = false };
+	sdr_check_t check = { .cursor = 0 };
+	sdr_image_t img = { .len = 0 };
+	ipmi_ctx_t *ctx;
+	struct ipmi_rs rsp;
 	bool ignore_disabled_flag = false, extended = false, drop_noread = false;
 
 	while (1) {
@@ -81,12 +86,12 @@ main(int argc, char **argv) {
 		}
 	}
 
-	if ((res = ipmi_if_open(NULL)) != 0)
+	if ((ctx = ipmi_if_open(NULL)) == NULL)
 		return 99;
 
 	max_tries = MAX_WAIT4REPO/WAIT4REPO_SLOT;
 	while (max_tries > 0) {
-		ipmi_bmc_info_t *bmc = get_bmc_info(&cc);
+		ipmi_bmc_info_t *bmc = get_bmc_info(ctx, &rsp, &cc);
 		if (SDR_REPO_TMP_NA(cc)) {
 			sleep(WAIT4REPO_SLOT);
 			max_tries--;
@@ -111,7 +116,8 @@ main(int argc, char **argv) {
 	max_tries = MAX_WAIT4REPO/WAIT4REPO_SLOT;
 	while (max_tries > 0) {
 		clock_gettime(CLOCK_MONOTONIC, &start);
-		slist = scan_sdr_repo(&sensors, ignore_disabled_flag, drop_noread, &cc);
+		slist = scan_sdr_repo(ctx, &sensors, ignore_disabled_flag, drop_noread,
+			&cc, &img);
 		if (SDR_REPO_TMP_NA(cc)) {
 			free_sensor(slist);
 			slist = NULL;
@@ -133,7 +139,9 @@ main(int argc, char **argv) {
 		break;
 	}
 	clock_gettime(CLOCK_MONOTONIC, &start);
-	show_ipmitool_sensors(slist, NULL, extended);
+	// all at once, so that printing gets them from the response cache
+	sdr_thresholds_load(ctx, slist);
+	show_ipmitool_sensors(ctx, slist, NULL, extended);
 	r = clock_gettime(CLOCK_MONOTONIC, &end);
 	s = (r == 0) ? end.tv_sec - start.tv_sec : 0;
 	ns = (r == 0) ? end.tv_nsec - start.tv_nsec : 0;
@@ -141,18 +149,19 @@ main(int argc, char **argv) {
 	PROM_INFO("Getting/printing sensor values took %f seconds.", duration);
 
 	clock_gettime(CLOCK_MONOTONIC, &start);
-	if (!sdrs_changed(slist)) {
+	if (!sdrs_changed(ctx, &img, &stamp, &check)) {
 		r = clock_gettime(CLOCK_MONOTONIC, &end);
 		s = (r == 0) ? end.tv_sec - start.tv_sec : 0;
 		ns = (r == 0) ? end.tv_nsec - start.tv_nsec : 0;
 		duration = s + ns*1e-9;
-		PROM_INFO("SDR change check took %f seconds.", duration);
+		PROM_INFO("SDR change check took %f seconds (%d requests).", duration,
+			check.requests);
 	} else {
 		PROM_DEBUG("1+ SDR changed.", "");
 	}
 	// 2nd time should be shorter because no list scanning
 	clock_gettime(CLOCK_MONOTONIC, &start);
-	if (!sdrs_changed(slist)) {
+	if (!sdrs_changed(ctx, &img, &stamp, &check)) {
 		r = clock_gettime(CLOCK_MONOTONIC, &end);
 		s = (r == 0) ? end.tv_sec - start.tv_sec : 0;
 		ns = (r == 0) ? end.tv_nsec - start.tv_nsec : 0;
@@ -162,7 +171,8 @@ main(int argc, char **argv) {
 		PROM_DEBUG("1+ SDR changed.", "");
 	}
 end:
-	ipmi_if_close();
+	ipmi_if_close(ctx);
 	free_sensor(slist);
+	sdr_image_free(&img);
 	return res;
 }
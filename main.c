@@ -17,6 +17,8 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <regex.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include <prom.h>
 #include <microhttpd.h>
@@ -26,6 +28,7 @@
 #include "prom_ipmi.h"
 #include "ipmi_sdr.h"
 #include "ipmi_if.h"
+#include "broker.h"
 
 typedef enum {
 	SMF_EXIT_OK	= 0,
@@ -40,11 +43,21 @@ typedef enum {
 	SMF_EXIT_TEMP_TRANSIENT
 } SMF_EXIT_CODE;
 
+#define DEVICES_MAX		16		// max. number of BMCs to monitor
+#define LABEL_MAX		32		// max. length of a device label
+#define SDR_CHECK_DFLT	60		// s between two SDR repo checks
+#define THRESHOLD_TICK	10		// s between refreshing the thresholds of 2 sensors
+
 static struct option options[] = {
+	{"broker",				required_argument,	NULL, 'B'},
+	{"capture",				required_argument,	NULL, 'C'},
 	{"ignore-disabled-flag",no_argument,		NULL, 'D'},
+	{"sel-cursor",			required_argument,	NULL, 'E'},
+	{"fru-cache",			required_argument,	NULL, 'F'},
 	{"no-scrapetime",		no_argument,		NULL, 'L'},
 	{"drop-no-read",		no_argument,		NULL, 'N'},
 	{"no-powerstats",		no_argument,		NULL, 'P'},
+	{"sdr-cache",			required_argument,	NULL, 'R'},
 	{"no-scrapetime-all",	no_argument,		NULL, 'S'},
 	{"no-thresholds",		no_argument,		NULL, 'T'},
 	{"no-state",			no_argument,		NULL, 'U'},
@@ -54,12 +67,16 @@ static struct option options[] = {
 	{"daemon",				no_argument,		NULL, 'd'},
 	{"foreground",			no_argument,		NULL, 'f'},
 	{"help",				no_argument,		NULL, 'h'},
+	{"sdr-check",			required_argument,	NULL, 'k'},
 	{"logfile",				required_argument,	NULL, 'l'},
 	{"no-metrics",			required_argument,	NULL, 'n'},
 	{"overview",			no_argument,		NULL, 'o'},
 	{"port",				required_argument,	NULL, 'p'},
+	{"rate",				required_argument,	NULL, 'r'},
 	{"source",				required_argument,	NULL, 's'},
+	{"timeout",				required_argument,	NULL, 't'},
 	{"verbosity",			required_argument,	NULL, 'v'},
+	{"window",				required_argument,	NULL, 'w'},
 	{"exclude-metrics",		required_argument,	NULL, 'x'},
 	{"exclude-sensors",		required_argument,	NULL, 'X'},
 	{"include-metrics",		required_argument,	NULL, 'i'},
@@ -68,7 +85,7 @@ static struct option options[] = {
 };
 
 static const char *shortUsage = {
-	"[-DLNSVcdfho] [-b path] [-l file] [-s ip] [-p port] [-v DEBUG|INFO|WARN|ERROR|FATAL] [-x mregex] [-X sregex] [-i mregex] [-I sregex]"
+	"[-DLNSVcdfho] [-B socket] [-C file] [-E file] [-F file] [-R file] [-b [label=]path ...] [-k s] [-l file] [-s ip] [-p port] [-r num[:burst]] [-t ms[:ms]] [-v DEBUG|INFO|WARN|ERROR|FATAL] [-w num] [-x mregex] [-X sregex] [-i mregex] [-I sregex]"
 };
 
 static struct {
@@ -82,9 +99,13 @@ static struct {
 	bool ipv6;
 	int MHD_error;
 	char *logfile;
-	sensor_t *sensor_list;
+	device_t dev[DEVICES_MAX];
+	uint32_t devices;
+	char *broker_path;
+	broker_t *broker;
 	bool no_powerstats;
 	bool ipmitool;
+	uint32_t sdr_check;
 	scan_cfg_t scfg;
 } global = {
 	.promflags = PROM_PROCESS | PROM_SCRAPETIME | PROM_SCRAPETIME_ALL,
@@ -97,17 +118,32 @@ static struct {
 	.ipv6 = false,
 	.MHD_error = -1,
 	.logfile = NULL,
-	.sensor_list = NULL,
+	.devices = 0,
+	.broker_path = NULL,
+	.broker = NULL,
 	.no_powerstats = false,
 	.ipmitool = false,
+	.sdr_check = SDR_CHECK_DFLT,
 	.scfg = {
 		.bmc = NULL,
+		.label = NULL,
+		.capture = NULL,
+		.sdr_cache = NULL,
+		.fru_cache = NULL,
+		.sel_cursor = NULL,
 		.drop_no_read = false,
 		.ignore_disabled_flag = false,
 		.no_state = false,
 		.no_thresholds = false,
 		.no_ipmi = false,
 		.no_dcmi = false,
+		.no_fru = false,
+		.no_sel = false,
+		.window = 0,
+		.tmo_fast = 0,
+		.tmo_slow = 0,
+		.rate = 0,
+		.burst = 0,
 		.exc_metrics = NULL,
 		.exc_sensors = NULL,
 		.inc_metrics = NULL,
@@ -141,6 +177,10 @@ disableMetrics(char *skipList) {
 				global.scfg.no_dcmi = true;
 			else if (strcmp(s, "ipmi") == 0)
 				global.scfg.no_ipmi = true;
+			else if (strcmp(s, "fru") == 0)
+				global.scfg.no_fru = true;
+			else if (strcmp(s, "sel") == 0)
+				global.scfg.no_sel = true;
 			else {
 				PROM_WARN("Unknown metrics '%s'", s);
 				res++;
@@ -156,27 +196,466 @@ disableMetrics(char *skipList) {
 	return res;
 }
 
+// parse "ms[:ms]" into the max. timeouts for ordinary and storage commands
+static int
+parseTimeouts(const char *arg) {
+	long fast = 0, slow = 0;
+	char *e;
+
+	fast = strtol(arg, &e, 10);
+	if (e == arg || fast <= 0)
+		return 1;
+	if (*e == ':') {
+		arg = e + 1;
+		slow = strtol(arg, &e, 10);
+		if (e == arg || slow <= 0)
+			return 1;
+	}
+	if (*e != '\0')
+		return 1;
+	global.scfg.tmo_fast = fast;
+	global.scfg.tmo_slow = slow;
+	return 0;
+}
+
+// parse "num[:burst]" into the max. commands per second and burst size
+static int
+parseRate(const char *arg) {
+	double rate;
+	long burst = 0;
+	char *e;
+
+	rate = strtod(arg, &e);
+	if (e == arg || rate <= 0)
+		return 1;
+	if (*e == ':') {
+		arg = e + 1;
+		burst = strtol(arg, &e, 10);
+		if (e == arg || burst <= 0 || burst > 1000)
+			return 1;
+	}
+	if (*e != '\0')
+		return 1;
+	global.scfg.rate = rate;
+	global.scfg.burst = burst > 0 ? burst : ((rate < 1) ? 1 : rate);
+	return 0;
+}
+
 // Just in case, someone switches to MHD_USE_THREAD_PER_CONNECTION
 static _Thread_local psb_t *sb = NULL;
 
+// If more than one device gets monitored, each one gets its own worker thread,
+// so that all BMCs get queried in parallel. collect() starts a new round and
+// waits until all workers are done, then merges their output.
+static struct {
+	pthread_mutex_t round;	// serializes rounds
+	pthread_mutex_t lock;	// protects the members below
+	pthread_cond_t start;	// signals the begin of a new round
+	pthread_cond_t done;	// signals, that all workers are done
+	uint64_t gen;			// number of the current round
+	uint32_t pending;		// workers not yet done with the current round
+	bool quit;
+	bool compact;
+	bool http;
+	uint32_t threads;		// number of started workers
+	pthread_t tid[DEVICES_MAX];
+	psb_t *out[DEVICES_MAX + 1];	// [0] .. common, [n + 1] .. device n
+} workers = {
+	.round = PTHREAD_MUTEX_INITIALIZER,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.start = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.gen = 0,
+	.pending = 0,
+	.quit = false,
+	.threads = 0
+};
+
+// Append the metrics of the given device to out. If http is true, they are
+// for a HTTP client, so the BMC gets supervised and its version gets emitted.
+static void
+collect_device(device_t *dev, psb_t *out, bool compact, bool http) {
+	size_t sz;
+
+	pthread_mutex_lock(&(dev->lock));
+	if (http && global.versionInfo && dev->bmc_version != NULL)
+		psb_add_str(out, dev->bmc_version);
+	// rendered once per SDR repo state, so always available
+	if (!dev->cfg.no_fru)
+		collect_fru(dev->fru_info, out, compact);
+	if (!dev->cfg.no_sel)
+		collect_sel(dev->sel_info, dev->sel.cursor.valid
+			? dev->sel.entries : -1, out, compact, dev->cfg.label);
+	if (dev->cfg.no_ipmi && dev->cfg.no_dcmi)
+		goto unlock;
+	// in daemon mode serve the last known values if the BMC hangs. A running
+	// SDR check needs the device, so it gets supervised when done.
+	sz = (out == NULL) ? 0 : psb_len(out);
+	if (http && !dev->checking && !supervise(dev)) {
+		supervise_cache(dev, out, sz, false, compact);
+		goto unlock;
+	}
+	if (!dev->cfg.no_ipmi) {
+		collect_ipmi(dev->ctx, out, dev->sensor_list, compact,
+			dev->cfg.label);
+		collect_sdr_check(&(dev->check), out, compact, dev->cfg.label);
+	}
+	if (!dev->cfg.no_dcmi)
+		collect_dcmi(dev->ctx, out, compact, global.no_powerstats,
+			dev->cfg.label);
+	if (http)
+		supervise_cache(dev, out, sz, dev->checking || supervise(dev),
+			compact);
+	if (dev->cfg.rate > 0)
+		collect_throttled(dev->ctx, out, compact, dev->cfg.label);
+
+unlock:
+	pthread_mutex_unlock(&(dev->lock));
+}
+
+static void *
+device_worker(void *arg) {
+	device_t *dev = arg;
+	psb_t *out = workers.out[dev - global.dev + 1];
+	uint64_t seen = 0;
+	bool compact, http;
+
+	pthread_mutex_lock(&(workers.lock));
+	for (;;) {
+		while (!workers.quit && workers.gen == seen)
+			pthread_cond_wait(&(workers.start), &(workers.lock));
+		if (workers.quit)
+			break;
+		seen = workers.gen;
+		compact = workers.compact;
+		http = workers.http;
+		pthread_mutex_unlock(&(workers.lock));
+
+		psb_clear(out);
+		collect_device(dev, out, compact, http);
+
+		pthread_mutex_lock(&(workers.lock));
+		if (--workers.pending == 0)
+			pthread_cond_signal(&(workers.done));
+	}
+	pthread_mutex_unlock(&(workers.lock));
+	return NULL;
+}
+
+static int
+start_workers(void) {
+	uint32_t i;
+
+	for (i = 0; i <= global.devices; i++) {
+		if ((workers.out[i] = psb_new()) == NULL) {
+			PROM_FATAL("Unable to allocate output buffers.", "");
+			return 1;
+		}
+	}
+	for (i = 0; i < global.devices; i++) {
+		if (pthread_create(&(workers.tid[i]), NULL, device_worker,
+			&(global.dev[i])) != 0)
+		{
+			PROM_FATAL("Unable to create worker thread: %s", strerror(errno));
+			return 1;
+		}
+		workers.threads++;
+	}
+	return 0;
+}
+
+static void
+stop_workers(void) {
+	uint32_t i;
+
+	pthread_mutex_lock(&(workers.lock));
+	workers.quit = true;
+	pthread_cond_broadcast(&(workers.start));
+	pthread_mutex_unlock(&(workers.lock));
+	for (i = 0; i < workers.threads; i++)
+		pthread_join(workers.tid[i], NULL);
+	workers.threads = 0;
+	for (i = 0; i <= DEVICES_MAX; i++) {
+		psb_destroy(workers.out[i]);
+		workers.out[i] = NULL;
+	}
+}
+
+// In foreground and daemon mode each device gets its own checker thread,
+// which loads the thresholds of its sensors and its FRU inventory once the
+// daemon is serving and refreshes the thresholds one sensor per tick
+// afterwards. On each tick it also reads the SEL records added since the
+// last one. Every global.sdr_check
+// seconds it checks, whether the SDR repo changed, and updates the sensor
+// list if so. So scrapes never need to do it.
+static struct {
+	pthread_mutex_t lock;	// protects the members below
+	pthread_cond_t wake;	// signals quit
+	bool quit;
+	uint32_t threads;		// number of started checkers
+	pthread_t tid[DEVICES_MAX];
+} checkers = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.quit = false,
+	.threads = 0
+};
+
+static void *
+sdr_checker(void *arg) {
+	device_t *dev = arg;
+	struct timespec ts;
+	bool compact = global.promflags & PROM_COMPACT;
+	uint32_t tick = THRESHOLD_TICK;
+	long now, next_check = now_s() + global.sdr_check;
+
+	if (global.sdr_check > 0
+		&& (dev->cfg.no_thresholds || global.sdr_check < tick))
+	{
+		tick = global.sdr_check;
+	}
+	pthread_mutex_lock(&(checkers.lock));
+	for (;;) {
+		pthread_mutex_unlock(&(checkers.lock));
+
+		pthread_mutex_lock(&(dev->lock));
+		now = now_s();
+		if (global.sdr_check > 0 && now >= next_check) {
+			check_sdrs(dev, compact);
+			next_check = now + global.sdr_check;
+		}
+		if (load_thresholds(dev) == 0)
+			refresh_thresholds(dev);
+		load_fru(dev);
+		load_sel(dev);
+		pthread_mutex_unlock(&(dev->lock));
+
+		pthread_mutex_lock(&(checkers.lock));
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += tick;
+		while (!checkers.quit && pthread_cond_timedwait(&(checkers.wake),
+			&(checkers.lock), &ts) != ETIMEDOUT)
+		{
+			;
+		}
+		if (checkers.quit)
+			break;
+	}
+	pthread_mutex_unlock(&(checkers.lock));
+	return NULL;
+}
+
+static int
+start_checkers(void) {
+	uint32_t i;
+
+	for (i = 0; i < global.devices; i++) {
+		if (global.dev[i].cfg.no_ipmi || (global.sdr_check == 0
+			&& global.dev[i].cfg.no_thresholds && global.dev[i].cfg.no_fru
+			&& global.dev[i].cfg.no_sel))
+		{
+			continue;
+		}
+		if (pthread_create(&(checkers.tid[checkers.threads]), NULL,
+			sdr_checker, &(global.dev[i])) != 0)
+		{
+			PROM_FATAL("Unable to create SDR checker thread: %s",
+				strerror(errno));
+			return 1;
+		}
+		checkers.threads++;
+	}
+	return 0;
+}
+
+static void
+stop_checkers(void) {
+	uint32_t i;
+
+	pthread_mutex_lock(&(checkers.lock));
+	checkers.quit = true;
+	pthread_cond_broadcast(&(checkers.wake));
+	pthread_mutex_unlock(&(checkers.lock));
+	for (i = 0; i < checkers.threads; i++)
+		pthread_join(checkers.tid[i], NULL);
+	checkers.threads = 0;
+}
+
+typedef struct line {
+	const char *s;
+	uint32_t family;
+	uint32_t seq;		// position in the unmerged output
+	bool meta;			// HELP or TYPE comment
+} line_t;
+
+typedef struct family {
+	const char *name;
+	size_t len;
+	int owner;			// the output, which provides HELP and TYPE
+} family_t;
+
+static int
+cmp_line(const void *p1, const void *p2) {
+	const line_t *a = p1, *b = p2;
+
+	if (a->family != b->family)
+		return a->family < b->family ? -1 : 1;
+	if (a->meta != b->meta)
+		return a->meta ? -1 : 1;
+	return a->seq < b->seq ? -1 : (a->seq > b->seq);
+}
+
+// get the name of the metric family of the given line
+static const char *
+family_name(const char *s, size_t *len) {
+	size_t n;
+
+	if (s[0] == '#') {
+		// "# HELP name ..." or "# TYPE name ..."
+		for (n = 0; n < 2 && (s = strchr(s, ' ')) != NULL; n++)
+			s++;
+		if (s == NULL) {
+			*len = 0;
+			return "";
+		}
+	}
+	*len = strcspn(s, "{ ");
+	return s;
+}
+
+// Merge the given outputs into one, so that all samples of a metric family
+// follow its HELP and TYPE comments. Families keep the order of their first
+// appearance. Returns NULL on error.
+static char *
+merge_output(psb_t **out, uint32_t n) {
+	char *text[DEVICES_MAX + 1], *s, *e, *res = NULL;
+	const char *name;
+	line_t *line = NULL;
+	family_t *fam = NULL;
+	uint32_t i, k, lines = 0, fams = 0, f = 0;
+	size_t len;
+	psb_t *m;
+
+	memset(text, 0, sizeof(text));
+	for (i = 0; i < n; i++) {
+		if ((text[i] = psb_dump(out[i])) == NULL)
+			goto end;
+		for (s = text[i]; *s != '\0'; s++)
+			if (*s == '\n')
+				lines++;
+	}
+	line = malloc(sizeof(line_t) * (lines + 1));
+	fam = malloc(sizeof(family_t) * (lines + 1));
+	if (line == NULL || fam == NULL)
+		goto end;
+
+	lines = 0;
+	for (i = 0; i < n; i++) {
+		for (s = text[i]; *s != '\0'; s = e + 1) {
+			e = strchr(s, '\n');
+			if (e == NULL)
+				e = s + strlen(s) - 1;
+			else
+				*e = '\0';
+			if (*s == '\0')
+				continue;
+			name = family_name(s, &len);
+			// usually several lines in a row belong to the same family
+			if (f >= fams || fam[f].len != len
+				|| strncmp(fam[f].name, name, len) != 0)
+			{
+				for (f = 0; f < fams; f++) {
+					if (fam[f].len == len
+						&& strncmp(fam[f].name, name, len) == 0)
+					{
+						break;
+					}
+				}
+				if (f == fams) {
+					fam[f].name = name;
+					fam[f].len = len;
+					fam[f].owner = -1;
+					fams++;
+				}
+			}
+			if (s[0] == '#') {
+				if (fam[f].owner == -1)
+					fam[f].owner = i;
+				else if (fam[f].owner != (int) i)
+					continue;
+			}
+			line[lines].s = s;
+			line[lines].family = f;
+			line[lines].seq = lines;
+			line[lines].meta = s[0] == '#';
+			lines++;
+		}
+	}
+	qsort(line, lines, sizeof(line_t), cmp_line);
+
+	if ((m = psb_new()) == NULL)
+		goto end;
+	for (k = 0; k < lines; k++) {
+		if (line[k].meta && (k == 0 || line[k - 1].family != line[k].family))
+			psb_add_char(m, '\n');
+		psb_add_str(m, line[k].s);
+		psb_add_char(m, '\n');
+	}
+	res = psb_dump(m);
+	psb_destroy(m);
+
+end:
+	free(line);
+	free(fam);
+	for (i = 0; i < n; i++)
+		free(text[i]);
+	return res;
+}
+
+// collect the metrics of all devices in parallel
+static void
+collect_devices(bool compact) {
+	char *s;
+
+	pthread_mutex_lock(&(workers.round));
+	psb_clear(workers.out[0]);
+	if (global.versionInfo)
+		getVersions(sb == NULL ? NULL : workers.out[0], compact);
+
+	pthread_mutex_lock(&(workers.lock));
+	workers.compact = compact;
+	workers.http = sb != NULL;
+	workers.pending = global.devices;
+	workers.gen++;
+	pthread_cond_broadcast(&(workers.start));
+	while (workers.pending > 0)
+		pthread_cond_wait(&(workers.done), &(workers.lock));
+	pthread_mutex_unlock(&(workers.lock));
+
+	s = merge_output(workers.out, global.devices + 1);
+	if (s == NULL) {
+		PROM_ERROR("Unable to merge the metrics of all devices.", "");
+	} else if (sb == NULL) {
+		fputs(s, stdout);
+	} else {
+		psb_add_str(sb, s);
+	}
+	free(s);
+	pthread_mutex_unlock(&(workers.round));
+}
+
 static prom_map_t *
 collect(prom_collector_t *self) {
 	bool compact = global.promflags & PROM_COMPACT;
+
 	PROM_DEBUG("collector: %p  sb: %p", self, sb);
-	if (global.versionInfo)
-		getVersions(sb, compact);
-	if (!global.scfg.no_ipmi) {
-		if (sdrs_changed(global.sensor_list)) {
-			uint32_t n;
-			PROM_INFO("SDR repo changed. Reloading ...", "");
-			stop(global.sensor_list);
-			global.sensor_list =
-				start(&(global.scfg), global.promflags & PROM_COMPACT, &n);
-		}
-		collect_ipmi(sb, global.sensor_list);
+	if (global.devices > 1) {
+		collect_devices(compact);
+	} else {
+		if (global.versionInfo)
+			getVersions(sb, compact);
+		collect_device(&(global.dev[0]), sb, compact, sb != NULL);
 	}
-	if (!global.scfg.no_dcmi)
-		collect_dcmi(sb, global.promflags & PROM_COMPACT, global.no_powerstats);
 	if (sb != NULL && !compact)
 		psb_add_char(sb, '\n');
 	return NULL;
@@ -220,6 +699,7 @@ http_handler(void *cls, struct MHD_Connection *connection, const char *url,
 	static const char *labels[] = { "" };
 	static char *RESP[] = { NULL, NULL, NULL };
 	static int rlen[] = { 0, 0, 0 };
+	uint32_t i;
 
 	int ret;
 
@@ -261,7 +741,17 @@ http_handler(void *cls, struct MHD_Connection *connection, const char *url,
 		if (sb != NULL)
 			PROM_WARN("stringBuilder %p is already there =8-(", sb);
 		sb = psb_new();
-		show_ipmitool_sensors(global.sensor_list, sb, true);
+		for (i = 0; i < global.devices; i++) {
+			device_t *dev = &(global.dev[i]);
+			pthread_mutex_lock(&(dev->lock));
+			if (dev->cfg.label != NULL && global.devices > 1) {
+				psb_add_str(sb, i == 0 ? "[" : "\n[");
+				psb_add_str(sb, dev->cfg.label);
+				psb_add_str(sb, "]\n");
+			}
+			show_ipmitool_sensors(dev->ctx, dev->sensor_list, sb, true);
+			pthread_mutex_unlock(&(dev->lock));
+		}
 		body = psb_dump(sb);
 		len = psb_len(sb);
 		psb_destroy(sb);		// avoid mem leaks on thread exit
@@ -486,6 +976,139 @@ daemonize(void) {
 	return pfd[1];
 }
 
+static bool
+isLabel(const char *s, size_t len) {
+	size_t i;
+
+	if (len == 0 || len > LABEL_MAX)
+		return false;
+	for (i = 0; i < len; i++) {
+		if (!(isalnum((unsigned char) s[i]) || s[i] == '_' || s[i] == '.' || s[i] == '-'))
+			return false;
+	}
+	return true;
+}
+
+// parse "[label=]path" and add the related device
+static int
+addDevice(const char *arg) {
+	device_t *dev;
+	const char *p = strchr(arg, '=');
+	size_t len;
+
+	if (global.devices == DEVICES_MAX) {
+		fprintf(stderr, "Too many devices (max. %d).\n", DEVICES_MAX);
+		return 1;
+	}
+	dev = &(global.dev[global.devices]);
+	memset(dev, 0, sizeof(device_t));
+	if (p != NULL && isLabel(arg, p - arg)) {
+		len = p - arg;
+		if ((dev->cfg.label = malloc(len + 1)) == NULL) {
+			perror("device label: ");
+			return 1;
+		}
+		memcpy(dev->cfg.label, arg, len);
+		dev->cfg.label[len] = '\0';
+		arg = p + 1;
+	}
+	dev->cfg.bmc = strdup(arg);
+	global.devices++;
+	return 0;
+}
+
+// derive a label from the basename of the given device path w/o the transport
+// prefix and arguments
+static char *
+defaultLabel(const char *path) {
+	const char *s = strrchr(path, '/');
+	char *label;
+	size_t i;
+
+	if (s != NULL)
+		s++;
+	else if ((s = strchr(path, ':')) != NULL)
+		s++;
+	else
+		s = path;
+	if ((label = malloc(LABEL_MAX + 1)) == NULL)
+		return NULL;
+	for (i = 0; i < LABEL_MAX && s[i] != '\0' && s[i] != '@'; i++)
+		label[i] = isLabel(s + i, 1) ? s[i] : '_';
+	label[i] = '\0';
+	return label;
+}
+
+// get the path of the file to use for the device with the given label
+static char *
+devicePath(const char *path, const char *label) {
+	char *s;
+
+	if (path == NULL)
+		return NULL;
+	if (global.devices == 1 || label == NULL)
+		return strdup(path);
+	if ((s = malloc(strlen(path) + strlen(label) + 2)) != NULL)
+		sprintf(s, "%s.%s", path, label);
+	return s;
+}
+
+// Let each device inherit the global scan configuration. If more than one
+// device gets monitored, each one needs a unique label.
+static int
+setupDevices(void) {
+	device_t *dev;
+	char *bmc, *label;
+	uint32_t i, k;
+
+	if (global.devices == 0)
+		global.devices = 1;
+	for (i = 0; i < global.devices; i++) {
+		dev = &(global.dev[i]);
+		bmc = dev->cfg.bmc;
+		label = dev->cfg.label;
+		dev->cfg = global.scfg;
+		dev->cfg.bmc = bmc;
+		dev->cfg.label = label;
+		if (global.devices > 1 && label == NULL)
+			label = dev->cfg.label = defaultLabel(bmc);
+		dev->cfg.capture = devicePath(global.scfg.capture, label);
+		dev->cfg.sdr_cache = devicePath(global.scfg.sdr_cache, label);
+		dev->cfg.fru_cache = devicePath(global.scfg.fru_cache, label);
+		dev->cfg.sel_cursor = devicePath(global.scfg.sel_cursor, label);
+	}
+	if (global.devices == 1)
+		return 0;
+	for (i = 0; i < global.devices; i++) {
+		if (global.dev[i].cfg.label == NULL) {
+			fprintf(stderr, "Unable to allocate device label.\n");
+			return 1;
+		}
+		for (k = 0; k < i; k++) {
+			if (strcmp(global.dev[i].cfg.label, global.dev[k].cfg.label) == 0)
+			{
+				fprintf(stderr, "Duplicate device label '%s'. Use -b "
+					"label=path to make it unique.\n", global.dev[i].cfg.label);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void
+freeDevice(device_t *dev) {
+	free(dev->sv.cache);
+	free(dev->cfg.bmc);
+	free(dev->cfg.label);
+	free(dev->cfg.capture);
+	free(dev->cfg.sdr_cache);
+	free(dev->cfg.fru_cache);
+	free(dev->cfg.sel_cursor);
+	sel_free(&(dev->sel));
+	memset(dev, 0, sizeof(device_t));
+}
+
 static regex_t *
 get_regex(int *res, char *regex, const char *target) {
 	*res = 0;
@@ -524,7 +1147,7 @@ get_regex(int *res, char *regex, const char *target) {
 
 int
 main(int argc, char **argv) {
-	uint32_t n, mode = 0;	// 0 .. oneshot  1 .. foreground  2 .. daemon
+	uint32_t i, n, mode = 0;	// 0 .. oneshot  1 .. foreground  2 .. daemon
 	int err = 0, res, pfd = -1, status = 0;
 	struct in_addr inaddr;
 	struct in6_addr in6addr;
@@ -545,6 +1168,16 @@ main(int argc, char **argv) {
 			case 'D':
 				global.scfg.ignore_disabled_flag = true;
 				break;
+			case 'E':
+				if (global.scfg.sel_cursor)
+					free(global.scfg.sel_cursor);
+				global.scfg.sel_cursor = strdup(optarg);
+				break;
+			case 'F':
+				if (global.scfg.fru_cache)
+					free(global.scfg.fru_cache);
+				global.scfg.fru_cache = strdup(optarg);
+				break;
 			case 'L':
 				global.promflags &= ~PROM_SCRAPETIME;
 				break;
@@ -554,6 +1187,11 @@ main(int argc, char **argv) {
 			case 'P':
 				global.no_powerstats = true;
 				break;
+			case 'R':
+				if (global.scfg.sdr_cache)
+					free(global.scfg.sdr_cache);
+				global.scfg.sdr_cache = strdup(optarg);
+				break;
 			case 'S':
 				global.promflags &= ~PROM_SCRAPETIME_ALL;
 				break;
@@ -566,10 +1204,18 @@ main(int argc, char **argv) {
 			case 'V':
 				getVersions(NULL, 1);
 				return 0;
+			case 'B':
+				if (global.broker_path)
+					free(global.broker_path);
+				global.broker_path = strdup(optarg);
+				break;
+			case 'C':
+				if (global.scfg.capture)
+					free(global.scfg.capture);
+				global.scfg.capture = strdup(optarg);
+				break;
 			case 'b':
-				if (global.scfg.bmc)
-					free(global.scfg.bmc);
-				global.scfg.bmc = strdup(optarg);
+				err += addDevice(optarg);
 				break;
 			case 'c':
 				global.promflags |= PROM_COMPACT;
@@ -583,6 +1229,15 @@ main(int argc, char **argv) {
 			case 'h':
 				fprintf(stderr, "Usage: %s %s\n", argv[0], shortUsage);
 				return 0;
+			case 'k':
+				if (sscanf(optarg, "%u", &n) != 1) {
+					fprintf(stderr, "Invalid SDR check interval '%s'.\n",
+						optarg);
+					err++;
+				} else {
+					global.sdr_check = n;
+				}
+				break;
 			case 'l':
 				if (global.logfile != NULL)
 					free(global.logfile);
@@ -623,6 +1278,18 @@ main(int argc, char **argv) {
 					addr = NULL;
 				}
 				break;
+			case 'r':
+				if (parseRate(optarg) != 0) {
+					fprintf(stderr, "Invalid rate '%s'.\n", optarg);
+					err++;
+				}
+				break;
+			case 't':
+				if (parseTimeouts(optarg) != 0) {
+					fprintf(stderr, "Invalid timeout(s) '%s'.\n", optarg);
+					err++;
+				}
+				break;
 			case 'v':
 				n = prom_log_level_parse(optarg);
 				if (n == 0) {
@@ -633,6 +1300,17 @@ main(int argc, char **argv) {
 					prom_log_level(n);
 				}
 				break;
+			case 'w':
+				if ((sscanf(optarg, "%u", &n) != 1) || n == 0
+					|| n > IPMI_WINDOW_MAX)
+				{
+					fprintf(stderr, "Invalid window size '%s' (1..%d).\n",
+						optarg, IPMI_WINDOW_MAX);
+					err++;
+				} else {
+					global.scfg.window = n;
+				}
+				break;
 			case 'x':
 				if (exm)
 					free(exm);
@@ -673,7 +1351,7 @@ main(int argc, char **argv) {
 	free(ins);
 	err += res;
 
-	if (err)
+	if (err || setupDevices() != 0)
 		return SMF_EXIT_ERR_CONFIG;
 
 	if (global.logfile != NULL) {
@@ -690,8 +1368,28 @@ main(int argc, char **argv) {
 	if (mode == 2)
 		pfd = daemonize();
 
-	global.sensor_list =
-		start(&(global.scfg), global.promflags & PROM_COMPACT, &n);
+	// devices, which are not usable, get dropped
+	for (i = 0, n = 0; i < global.devices; i++) {
+		device_t *dev = &(global.dev[i]);
+		if (start(dev, global.promflags & PROM_COMPACT) == 0) {
+			PROM_WARN("BMC %s (%s) not usable - ignored.",
+				dev->cfg.label ? dev->cfg.label : "",
+				dev->cfg.bmc ? dev->cfg.bmc : "default path");
+			freeDevice(dev);
+			continue;
+		}
+		if (n != i) {
+			global.dev[n] = *dev;
+			memset(dev, 0, sizeof(device_t));
+		}
+		pthread_mutex_init(&(global.dev[n].lock), NULL);
+		n++;
+	}
+	global.devices = n;
+	if (n > 1 && start_workers() != 0)
+		n = 0;
+	if (n > 0 && mode != 0 && start_checkers() != 0)
+		n = 0;
 	if (n == 0) {
 		status = SMF_EXIT_TEMP_DISABLE;
 		if (mode == 2) {
@@ -707,18 +1405,33 @@ main(int argc, char **argv) {
 		fprintf(stderr, "%s", str);
 	if (strlen(str)) {
 		if (mode == 0) {
+			for (i = 0; i < global.devices; i++) {
+				pthread_mutex_lock(&(global.dev[i].lock));
+				load_thresholds(&(global.dev[i]));
+				load_fru(&(global.dev[i]));
+				load_sel(&(global.dev[i]));
+				pthread_mutex_unlock(&(global.dev[i].lock));
+			}
 			collect(NULL);
 			status = SMF_EXIT_OK;
 		} else if (setupProm() == 0) {
 			fputs("\n", stderr);
 			status = startHttpServer();
+			if (status == SMF_EXIT_OK && global.broker_path != NULL) {
+				global.broker = broker_open(global.broker_path,
+					&(global.dev[0].ctx), &(global.dev[0].lock));
+				if (global.broker == NULL)
+					status = SMF_EXIT_ERR_CONFIG;
+			}
 			// let the parent exit
 			if (mode == 2) {
 				(void) write(pfd, &status, sizeof (status));
 				(void) close(pfd);
 			}
 			// because libmicrohttpd does not expose blocking calls =8-((((
-			if (status == SMF_EXIT_OK)
+			if (status == SMF_EXIT_OK && global.broker != NULL)
+				broker_run(global.broker);
+			else if (status == SMF_EXIT_OK)
 				pause();
 		} else {
 			status = SMF_EXIT_ERR_OTHER;
@@ -738,8 +1451,20 @@ main(int argc, char **argv) {
 	// finally
 	psb_destroy(buf);
 	cleanupProm();
-	stop(global.sensor_list);
-	global.sensor_list = NULL;
+	stop_checkers();
+	stop_workers();
+	for (i = 0; i < global.devices; i++) {
+		stop(&(global.dev[i]));
+		pthread_mutex_destroy(&(global.dev[i].lock));
+		freeDevice(&(global.dev[i]));
+	}
+	freeVersions();
+	broker_close(global.broker);
+	free(global.broker_path);
+	free(global.scfg.capture);
+	free(global.scfg.sdr_cache);
+	free(global.scfg.fru_cache);
+	free(global.scfg.sel_cursor);
 	free(global.addr);
 	return status;
 }
@@ -30,71 +30,76 @@
 #include "hexdump.h"
 #endif
 
-int ipmi_verbose = 0;
+#define KRETRIES		1			// retries of bridged requests by the driver
 
-static bool is_open = false;
-static char *ipmi_dev = NULL;
-static int ipmi_fd = -1;
+struct ipmi_drv {
+	char *dev;
+	int fd;
+};
+
+static void ipmi_drv_close(ipmi_drv_t *drv);
 
-int
-ipmi_if_open(char *dev) {
-	if (is_open) {
-		PROM_WARN("IPMI device '%s' already open.", ipmi_dev);
-		return 0;
+static ipmi_drv_t *
+ipmi_drv_open(char *dev) {
+	unsigned int val;
+	ipmi_drv_t *drv = malloc(sizeof(ipmi_drv_t));
+
+	if (drv == NULL) {
+		PROM_FATAL("Unable to allocate IPMI device handle.", "");
+		return NULL;
 	}
-	ipmi_dev = (dev == NULL) ? strdup("/dev/ipmi0") : strdup(dev);
-	PROM_INFO("Using OpenIPMI device '%s' ...", ipmi_dev);
-	ipmi_fd = open(ipmi_dev, O_RDWR);
-	if (ipmi_fd < 0) {
-		PROM_FATAL("Unable to open '%s' in RW mode.", ipmi_dev);
-		free(ipmi_dev);
-		ipmi_dev = NULL;
-		return 1;
+	drv->dev = (dev == NULL) ? strdup("/dev/ipmi0") : strdup(dev);
+	PROM_INFO("Using OpenIPMI device '%s' ...", drv->dev);
+	drv->fd = open(drv->dev, O_RDWR);
+	if (drv->fd < 0) {
+		PROM_FATAL("Unable to open '%s' in RW mode.", drv->dev);
+		free(drv->dev);
+		free(drv);
+		return NULL;
 	}
-	is_open = true;
 
-	unsigned int val = false;
-	if (ioctl(ipmi_fd, IPMICTL_SET_GETS_EVENTS_CMD, &val) < 0) 
+	val = false;
+	if (ioctl(drv->fd, IPMICTL_SET_GETS_EVENTS_CMD, &val) < 0) 
 		PROM_WARN("Could not explicitly disable event receiver", "");
 
 	val = IPMI_BMC_SLAVE_ADDR;
-	if (ioctl(ipmi_fd, IPMICTL_SET_MY_ADDRESS_CMD, &val) < 0) {
+	if (ioctl(drv->fd, IPMICTL_SET_MY_ADDRESS_CMD, &val) < 0) {
 		PROM_FATAL("Unable to set my_addr to '0x%02x'.", val);
-		ipmi_if_close();
-		return 2;
+		ipmi_drv_close(drv);
+		return NULL;
 	}
 
-	return 0;
+	return drv;
 }
 
-void
-ipmi_if_close(void) {
-	if (is_open && ipmi_fd >= 0) {
-		PROM_INFO("Closing IPMI device '%s'.", ipmi_dev);
-		close(ipmi_fd);
-		free(ipmi_dev);
-		ipmi_dev = NULL;
-		ipmi_fd = -1;
+static void
+ipmi_drv_close(ipmi_drv_t *drv) {
+	if (drv == NULL)
+		return;
+	if (drv->fd >= 0) {
+		PROM_INFO("Closing IPMI device '%s'.", drv->dev);
+		close(drv->fd);
 	}
-	is_open = false;
+	free(drv->dev);
+	free(drv);
 }
 
-static struct ipmi_system_interface_addr bmc_addr = {
-	.addr_type = IPMI_SYSTEM_INTERFACE_ADDR_TYPE,
-	.channel = IPMI_BMC_CHANNEL,
-	.lun = 0
-};
-
-int
-ipmi_send(struct ipmi_rq *req) {
-	struct ipmi_req _req;
-
-	static int curr_seq = 0;
+static int
+ipmi_drv_fd(ipmi_drv_t *drv) {
+	return drv == NULL ? -1 : drv->fd;
+}
 
-	if (req == NULL)
-		return -1;
+static int
+ipmi_drv_send(ipmi_drv_t *drv, struct ipmi_rq *req, long msgid,
+	long timeout)
+{
+	struct ipmi_system_interface_addr bmc_addr;
+	struct ipmi_ipmb_addr ipmb_addr;
+	struct ipmi_req_settime st;
+	struct ipmi_req *_req = &(st.req);
+	int res;
 
-	if (! (is_open && ipmi_fd >= 0)) {
+	if (drv == NULL || drv->fd < 0) {
 		PROM_WARN("IPMI device not opened.", "");
 		return -2;
 	}
@@ -107,98 +112,131 @@ ipmi_send(struct ipmi_rq *req) {
 			hexdump(req->msg.data, req->msg.data_len, 1));
 #endif
 
-	memset(&_req, 0, sizeof(struct ipmi_req));
-
-	_req.addr = (unsigned char *)&bmc_addr;
-	_req.addr_len = sizeof(bmc_addr);
-	_req.msgid = curr_seq++;
-	if (curr_seq < 0)
-		curr_seq = 0;
-	_req.msg.data = req->msg.data;
-	_req.msg.data_len = req->msg.data_len;
-	_req.msg.netfn = req->msg.netfn;
-	_req.msg.cmd = req->msg.cmd;
-
-	if (ioctl(ipmi_fd, IPMICTL_SEND_COMMAND, &_req) < 0) {
+	memset(&st, 0, sizeof(st));
+
+	if (req->addr == 0) {
+		bmc_addr.addr_type = IPMI_SYSTEM_INTERFACE_ADDR_TYPE;
+		bmc_addr.channel = IPMI_BMC_CHANNEL;
+		bmc_addr.lun = req->msg.lun;
+		_req->addr = (unsigned char *)&bmc_addr;
+		_req->addr_len = sizeof(bmc_addr);
+	} else {
+		ipmb_addr.addr_type = IPMI_IPMB_ADDR_TYPE;
+		ipmb_addr.channel = req->channel;
+		ipmb_addr.slave_addr = req->addr;
+		ipmb_addr.lun = req->msg.lun;
+		_req->addr = (unsigned char *)&ipmb_addr;
+		_req->addr_len = sizeof(ipmb_addr);
+	}
+	_req->msgid = msgid;
+	_req->msg.data = req->msg.data;
+	_req->msg.data_len = req->msg.data_len;
+	_req->msg.netfn = req->msg.netfn;
+	_req->msg.cmd = req->msg.cmd;
+
+	if (req->addr == 0) {
+		// the driver applies retries to IPMB and LAN messages, only
+		res = ioctl(drv->fd, IPMICTL_SEND_COMMAND, _req);
+	} else {
+		// the driver wraps it into a Send Message cmd and retries it on its
+		// own: spread the caller's budget over all tries
+		st.retries = KRETRIES;
+		st.retry_time_ms = timeout / (KRETRIES + 1);
+		res = ioctl(drv->fd, IPMICTL_SEND_COMMAND_SETTIME, &st);
+	}
+	if (res < 0) {
 		char *str = strerror(errno);
-		PROM_WARN("Failed to send ipmi request %d (fn=0x%02x cmd=0x%02x): %s",
-			_req.msgid, req->msg.netfn, req->msg.cmd, str);
+		PROM_WARN("Failed to send ipmi request %ld (fn=0x%02x cmd=0x%02x "
+			"addr=0x%02x): %s", _req->msgid, req->msg.netfn, req->msg.cmd,
+			req->addr, str);
 		return -3;
 	}
 #ifdef DEBUG_IPMI_IF
-	PROM_DEBUG("done. msgId: %d", _req.msgid);
+	PROM_DEBUG("done. msgId: %ld", _req->msgid);
 #endif
 
-	return _req.msgid;
+	return 0;
 }
 
-struct ipmi_rs *
-ipmi_recv(long msgid, long timeout)  {
+static int
+ipmi_drv_recv(ipmi_drv_t *drv, struct ipmi_rs *rsp, long *msgid, long timeout)
+{
 	fd_set rfds;				// fd set to monitor
 	struct timeval tv;			// max time to wait
 	struct ipmi_addr addr;
 	struct ipmi_recv recv;
 	int res;
 
-	static struct ipmi_rs rsp;
-	
-	if (! (is_open && ipmi_fd >= 0)) {
+	if (drv == NULL || drv->fd < 0) {
 		PROM_FATAL("IPMI device not opened.", "");
-		return NULL;
+		return -2;
 	}
-	memset(&rsp, 0, sizeof (struct ipmi_rs));
-
-	FD_ZERO(&rfds);				// clear the set
-	FD_SET(ipmi_fd, &rfds);		// add ipmi_fd to the set
-	tv.tv_sec = timeout <= 0 ? 5 : timeout;
-	tv.tv_usec = 0;
-	recv.msgid = -1;
 
-	while (msgid != recv.msgid) {
+	// timeout < 0: caller polls the fd itself, so no need to wait
+	if (timeout >= 0) {
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
 		// wait 'til ready to read/timeout but ignore interrupts
 		do {
-			res = select(ipmi_fd + 1, &rfds, NULL, NULL, &tv);
+			FD_ZERO(&rfds);				// clear the set
+			FD_SET(drv->fd, &rfds);		// add the device fd to the set
+			res = select(drv->fd + 1, &rfds, NULL, NULL, &tv);
 		} while (res < 0 && errno == EINTR);
 		// any data available ?
 		if (res < 0) {
 			char *str = strerror(errno);
-			PROM_WARN("Error for request %d: %s", str);
-			return NULL;
+			PROM_WARN("Waiting for a response failed: %s", str);
+			return -1;
 		} else if (res == 0) {
-			PROM_WARN("Timeout for request %d.", msgid);
-			return NULL;
-		}
-		// get the data
-		recv.addr = (unsigned char *)&addr;
-		recv.addr_len = sizeof(addr);
-		recv.msg.data = rsp.data;
-		recv.msg.data_len = sizeof(rsp.data);
-		if (ioctl(ipmi_fd, IPMICTL_RECEIVE_MSG, &recv) < 0) {
-			char *str = strerror(errno);
-			PROM_WARN("Fetching data for request %d failed: %s", msgid, str);
-			// Actually this should not happen, because our buffer size is 1024
-			// bytes. Max. payload is limited by uint8 256 and any command
-			// specific data at the head of the payload are max. 32 bytes, even
-			// for OEM records.
-			if ((res == EMSGSIZE) && (msgid == recv.msgid))
-				break;
-			return NULL;
+			return 0;
 		}
-		if (msgid != recv.msgid) {
-			PROM_WARN("Oooops, fetched an unexpected message: %d != %d",
-				recv.msgid, msgid);
+	}
+
+	// get the data
+	recv.addr = (unsigned char *)&addr;
+	recv.addr_len = sizeof(addr);
+	recv.msg.data = rsp->data;
+	recv.msg.data_len = sizeof(rsp->data);
+	if (ioctl(drv->fd, IPMICTL_RECEIVE_MSG_TRUNC, &recv) < 0) {
+		char *str = strerror(errno);
+		// Actually this should not happen, because our buffer size is 1024
+		// bytes. Max. payload is limited by uint8 256 and any command
+		// specific data at the head of the payload are max. 32 bytes, even
+		// for OEM records. If it happens, keep the truncated message.
+		if (errno == EAGAIN)
+			return 0;			// nothing queued
+		if (errno != EMSGSIZE) {
+			PROM_WARN("Fetching a response failed: %s", str);
+			return -1;
 		}
+		PROM_WARN("Response for request %ld truncated: %s", recv.msgid, str);
 	}
+	*msgid = recv.msgid;
 
 	// de-couple response from the running OS
 #ifdef DEBUG_IPMI_IF
-	PROM_DEBUG("Raw response (1 + %d bytes):\n%s\n", recv.msg.data_len - 1,
+	PROM_DEBUG("Raw response %ld (1 + %d bytes):\n%s\n", recv.msgid,
+		recv.msg.data_len - 1,
 		hexdump(recv.msg.data + 1, recv.msg.data_len - 1, 1));
 #endif
-	rsp.ccode = recv.msg.data[0];
-	rsp.data_len = recv.msg.data_len - 1;	// 1st byte is the completion code
-	if (rsp.data_len > 0)
-		memmove(rsp.data, recv.msg.data + 1, rsp.data_len);
+	if (recv.msg.data_len < 1) {
+		rsp->ccode = 0xFF;		// unspecified error
+		rsp->data_len = 0;
+		return 1;
+	}
+	rsp->ccode = recv.msg.data[0];
+	rsp->data_len = recv.msg.data_len - 1;	// 1st byte is the completion code
+	if (rsp->data_len > 0)
+		memmove(rsp->data, recv.msg.data + 1, rsp->data_len);
 
-	return &rsp;
+	return 1;
 }
+
+const ipmi_drv_ops_t ipmi_drv_os = {
+	.prefix = "",
+	.open = ipmi_drv_open,
+	.close = ipmi_drv_close,
+	.send = ipmi_drv_send,
+	.recv = ipmi_drv_recv,
+	.fd = ipmi_drv_fd
+};
@@ -9,58 +9,155 @@
  * Copyright 2021 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <prom_string_builder.h>
 
 #include "common.h"
+#include "ipmi_if.h"
 #include "ipmi_sdr.h"
 #include "ipmi_sdr_convert.h"
 #include "prom_ipmi.h"
 
+#define BREAKER_TRIP 3			// consecutive failures, which open the breaker
+#define BREAKER_BACKOFF 15		// initial backoff in s
+#define BREAKER_BACKOFF_MAX 300	// max. backoff in s
+
+/**
+ * @brief Check, whether the given sensor should be read. If its breaker is
+ *	open and the backoff time has expired, the breaker gets switched to
+ *	half-open, i.e. the sensor gets read once to probe, whether it is back.
+ * @return \c true if the sensor should be read, \c false otherwise.
+ */
+static bool
+breaker_allows(sensor_t *s, long now) {
+	if (s->breaker.state == BREAKER_OPEN && now >= s->breaker.retry)
+		s->breaker.state = BREAKER_HALF_OPEN;
+	return s->breaker.state != BREAKER_OPEN;
+}
+
+/**
+ * @brief Record the outcome of a sensor read. A successful read closes the
+ *	breaker. BREAKER_TRIP failures in a row or a failed probe open it again,
+ *	and the backoff gets doubled with each failure up to BREAKER_BACKOFF_MAX.
+ */
+static void
+breaker_update(sensor_t *s, bool ok, long now) {
+	breaker_t *b = &(s->breaker);
+	long backoff;
+
+	if (ok) {
+		if (b->state != BREAKER_CLOSED)
+			PROM_INFO("Sensor '%s' (0x%02x) is back after %d failures.",
+				s->name, s->key.sensor_num, b->fails);
+		b->state = BREAKER_CLOSED;
+		b->fails = 0;
+		return;
+	}
+	if (b->fails < UINT16_MAX)
+		b->fails++;
+	if (b->state == BREAKER_CLOSED && b->fails < BREAKER_TRIP)
+		return;
+	backoff = BREAKER_BACKOFF_MAX;
+	if (b->fails - BREAKER_TRIP < 5)
+		backoff = BREAKER_BACKOFF << (b->fails - BREAKER_TRIP);
+	if (backoff > BREAKER_BACKOFF_MAX)
+		backoff = BREAKER_BACKOFF_MAX;
+	if (b->state == BREAKER_CLOSED)
+		PROM_WARN("Sensor '%s' (0x%02x) failed %d times in a row. Backing off.",
+			s->name, s->key.sensor_num, b->fails);
+	b->state = BREAKER_OPEN;
+	b->retry = now + backoff;
+}
+
+char *
+device_label(const char *label, bool more, char *buf) {
+	if (label == NULL)
+		buf[0] = '\0';
+	else
+		sprintf(buf, more ? "device=\"%.32s\"," : "{device=\"%.32s\"}",
+			label);
+	return buf;
+}
+
 void
-collect_ipmi(psb_t *sb, sensor_t *slist) {
+collect_ipmi(ipmi_ctx_t *ctx, psb_t *sb, sensor_t *slist, bool compact,
+	const char *label)
+{
 	sdr_reading_t *r;
 	sdr_factors_t *f;
+	struct ipmi_rs rsp;
 	factors_t *rf;
 	uint8_t value, cc, tstate;
 	double real_val;
-	char buf[512];
-	size_t sz;
-	bool free_sb = sb == NULL;
+	char buf[512], lbuf[48];
+	size_t sz, n;
+	sdr_reading_job_t *job;
+	bool free_sb = sb == NULL, ok;
 	sensor_t *s = slist;
+	long now = now_s();
 
 	if (slist == NULL)
 		return;
 
+	for (n = 0; s != NULL; s = s->next)
+		n++;
+	job = malloc(n * sizeof(sdr_reading_job_t));
+	if (job == NULL) {
+		perror("collect_ipmi: ");
+		return;
+	}
 	if (free_sb) {
 		sb = psb_new();
 		if (sb == NULL) {
 			perror("collect_ipmi: ");
+			free(job);
 			return;
 		}
 	}
 	sz = psb_len(sb);
 
-	while (s != NULL) {
+	// Submit all reading requests first, so that the transport is able to keep
+	// its window of requests in flight. The event loop stores the answers into
+	// the related job, so all we need to do is to wait until all are done.
+	// Background work still in progress (e.g. an SDR repo update) does not
+	// need to be waited for. Sensors with an open breaker are skipped.
+	for (n = 0, s = slist; s != NULL; s = s->next, n++) {
+		job[n].key = s->key;
+		job[n].name = s->name;
+		job[n].cc = 0xFF;
+		job[n].valid = false;
+		if (breaker_allows(s, now))
+			submit_reading(ctx, &job[n]);
+	}
+	ipmi_dispatch_prio(ctx, 0, IPMI_PRIO_READING);
+
+	for (n = 0, s = slist; s != NULL; s = s->next, n++) {
 		if (s->prom.note != NULL)
 			psb_add_str(sb, s->prom.note);
-		r = get_reading(s->sensor_num, s->name, &cc);
-		if (r == NULL || cc != 0 || r->unavailable || !r->scanning_enabled)
-			goto next;
+		if (s->breaker.state == BREAKER_OPEN)
+			continue;
+		r = &(job[n].reading);
+		rf = NULL;
+		ok = job[n].valid && job[n].cc == 0 && !r->unavailable
+			&& r->scanning_enabled;
+		if (ok && s->factors == NULL) {
+			f = get_factors(ctx, &rsp, &(s->key), r->value, &cc);
+			rf = (f == NULL) ? NULL : sdr_factors2factors(f);
+			ok = rf != NULL;
+		}
+		breaker_update(s, ok, now);
+		if (!ok)
+			continue;
 		value = r->value;
 		tstate = r->state0 & 0x3F;
-		if (SDR_LTYPE_IS_NON_LINEAR(s->factors->linearization)) {
-			f = get_factors(s->sensor_num, value, &cc);
-			if (f == NULL)
-				goto next;
-			rf = sdr_factors2factors(f);
-			if (rf == NULL)
-				goto next;
+		if (s->factors == NULL) {
+			real_val = sdr_convert_value(value, s->unit.analog_fmt, rf);
+			free(rf);
 		} else {
-			rf = s->factors;
+			real_val = sdr_convert_value(value, s->unit.analog_fmt, s->factors);
 		}
-		real_val = sdr_convert_value(value, s->unit.analog_fmt, rf);
 		psb_add_str(sb, s->prom.mname_reading);
 		sprintf(buf, s->prom.unit[0] == 'V' ? " %g\n" : " %g\n", real_val);
 		psb_add_str(sb, buf);
@@ -73,8 +170,16 @@ collect_ipmi(psb_t *sb, sensor_t *slist) {
 		}
 		if (s->prom.mname_threshold != NULL)
 			psb_add_str(sb, s->prom.mname_threshold);
-next:
-		s = s->next;
+	}
+	free(job);
+
+	// one series per sensor, so that they do not come and go with the state
+	if (!compact)
+		addPromInfo(IPMIMEXM_BREAKER);
+	for (s = slist; s != NULL; s = s->next) {
+		sprintf(buf, IPMIMEXM_BREAKER_N "{%ssensor=\"%s\"} %d\n",
+			device_label(label, true, lbuf), s->prom.name, s->breaker.state);
+		psb_add_str(sb, buf);
 	}
 
 	if (free_sb) {
@@ -85,9 +190,12 @@ next:
 }
 
 void
-collect_dcmi(psb_t *sb, bool compact, bool no_powerstats) {
+collect_dcmi(ipmi_ctx_t *ctx, psb_t *sb, bool compact, bool no_powerstats,
+	const char *label)
+{
 	uint8_t cc;
-	char buf[256];
+	struct ipmi_rs rsp;
+	char buf[256], lbuf[48];
 	size_t sz = 0;
 	bool free_sb = sb == NULL;
 
@@ -103,28 +211,30 @@ collect_dcmi(psb_t *sb, bool compact, bool no_powerstats) {
 	if (!compact)
 		addPromInfo(IPMIMEXM_DCMI_POWER);
 
-	sdr_power_t *p = get_power(&cc);
+	sdr_power_t *p = get_power(ctx, &rsp, &cc);
 	if (p == NULL || cc != 0)
 		return;
-	psb_add_str(sb, IPMIMEXM_DCMI_POWER_N "{value=\"now\"} ");
-	sprintf(buf, "%d\n", p->curr);
+	device_label(label, true, lbuf);
+	sprintf(buf, IPMIMEXM_DCMI_POWER_N "{%svalue=\"now\"} %d\n",
+		lbuf, p->curr);
 	psb_add_str(sb, buf);
 
 	if (!no_powerstats) {
-		psb_add_str(sb, IPMIMEXM_DCMI_POWER_N "{value=\"min\"} ");
-		sprintf(buf, "%d\n", p->min);
+		sprintf(buf, IPMIMEXM_DCMI_POWER_N "{%svalue=\"min\"} %d\n",
+			lbuf, p->min);
 		psb_add_str(sb, buf);
-		psb_add_str(sb, IPMIMEXM_DCMI_POWER_N "{value=\"max\"} ");
-		sprintf(buf, "%d\n", p->max);
+		sprintf(buf, IPMIMEXM_DCMI_POWER_N "{%svalue=\"max\"} %d\n",
+			lbuf, p->max);
 		psb_add_str(sb, buf);
-		psb_add_str(sb, IPMIMEXM_DCMI_POWER_N "{value=\"avg\"} ");
-		sprintf(buf, "%d\n", p->avg);
+		sprintf(buf, IPMIMEXM_DCMI_POWER_N "{%svalue=\"avg\"} %d\n",
+			lbuf, p->avg);
 		psb_add_str(sb, buf);
 
 		if (!compact)
 			addPromInfo(IPMIMEXM_DCMI_PSAMPLE);
 		psb_add_str(sb, IPMIMEXM_DCMI_PSAMPLE_N);
-		sprintf(buf, " %u\n", p->sample_time/1000);
+		sprintf(buf, "%s %u\n", device_label(label, false, lbuf),
+			p->sample_time/1000);
 		psb_add_str(sb, buf);
 	}
 
@@ -135,6 +245,118 @@ collect_dcmi(psb_t *sb, bool compact, bool no_powerstats) {
 	}
 }
 
+void
+collect_throttled(ipmi_ctx_t *ctx, psb_t *sb, bool compact, const char *label)
+{
+	unsigned long cmds, ms;
+	char buf[128], lbuf[48];
+	size_t sz = 0;
+	bool free_sb = sb == NULL;
+
+	if (ctx == NULL)
+		return;
+	if (free_sb) {
+		sb = psb_new();
+		if (sb == NULL) {
+			perror("collect_throttled: ");
+			return;
+		}
+		sz = psb_len(sb);
+	}
+
+	ipmi_if_throttled(ctx, &cmds, &ms);
+	if (!compact)
+		addPromInfo(IPMIMEXM_THROTTLED_CMDS);
+	device_label(label, false, lbuf);
+	sprintf(buf, IPMIMEXM_THROTTLED_CMDS_N "%s %lu\n", lbuf, cmds);
+	psb_add_str(sb, buf);
+	if (!compact)
+		addPromInfo(IPMIMEXM_THROTTLED_TIME);
+	sprintf(buf, IPMIMEXM_THROTTLED_TIME_N "%s %.3f\n", lbuf, ms / 1000.0);
+	psb_add_str(sb, buf);
+
+	if (free_sb) {
+		if (psb_len(sb) != sz)
+			fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+}
+
+void
+collect_sdr_check(sdr_check_t *check, psb_t *sb, bool compact,
+	const char *label)
+{
+	char buf[128], lbuf[48];
+	bool free_sb = sb == NULL;
+
+	if (free_sb && (sb = psb_new()) == NULL) {
+		perror("collect_sdr_check: ");
+		return;
+	}
+	if (!compact)
+		addPromInfo(IPMIMEXM_SDR_CHECK_REQS);
+	device_label(label, false, lbuf);
+	sprintf(buf, IPMIMEXM_SDR_CHECK_REQS_N "%s %d\n", lbuf, check->requests);
+	psb_add_str(sb, buf);
+	if (!compact)
+		addPromInfo(IPMIMEXM_SDR_CHECK_TIME);
+	sprintf(buf, IPMIMEXM_SDR_CHECK_TIME_N "%s %.6f\n", lbuf,
+		check->usec / 1000000.0);
+	psb_add_str(sb, buf);
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+}
+
+void
+collect_fru(const char *fru, psb_t *sb, bool compact) {
+	bool free_sb = sb == NULL;
+
+	if (fru == NULL)
+		return;
+	if (free_sb && (sb = psb_new()) == NULL) {
+		perror("collect_fru: ");
+		return;
+	}
+	if (!compact)
+		addPromInfo(IPMIMEXM_FRU);
+	psb_add_str(sb, fru);
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+}
+
+void
+collect_sel(const char *events, int entries, psb_t *sb, bool compact,
+	const char *label)
+{
+	char buf[128], lbuf[48];
+	bool free_sb = sb == NULL;
+
+	if (entries < 0)
+		return;
+	if (free_sb && (sb = psb_new()) == NULL) {
+		perror("collect_sel: ");
+		return;
+	}
+	if (!compact)
+		addPromInfo(IPMIMEXM_SEL_ENTRIES);
+	sprintf(buf, IPMIMEXM_SEL_ENTRIES_N "%s %d\n",
+		device_label(label, false, lbuf), entries);
+	psb_add_str(sb, buf);
+	if (events != NULL) {
+		if (!compact)
+			addPromInfo(IPMIMEXM_SEL_EVENTS);
+		psb_add_str(sb, events);
+	}
+	if (free_sb) {
+		fprintf(stdout, "\n%s", psb_str(sb));
+		psb_destroy(sb);
+	}
+}
+
 /**
  * @brief	Metric names. Keep in sync with IPMI v2, Table 42-3, Sensor Type
  *	Codes (42.2).
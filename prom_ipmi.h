@@ -20,8 +20,29 @@
 extern "C" {
 #endif
 
-void collect_ipmi(psb_t *sb, sensor_t *slist);
-void collect_dcmi(psb_t *sb, bool compact, bool sample);
+void collect_ipmi(ipmi_ctx_t *ctx, psb_t *sb, sensor_t *slist, bool compact,
+	const char *label);
+void collect_dcmi(ipmi_ctx_t *ctx, psb_t *sb, bool compact, bool sample,
+	const char *label);
+void collect_throttled(ipmi_ctx_t *ctx, psb_t *sb, bool compact,
+	const char *label);
+void collect_sdr_check(sdr_check_t *check, psb_t *sb, bool compact,
+	const char *label);
+void collect_fru(const char *fru, psb_t *sb, bool compact);
+void collect_sel(const char *events, int entries, psb_t *sb, bool compact,
+	const char *label);
+
+/**
+ * @brief Format the device label for use within the label set of a metric.
+ * @param label	The value of the device label. If \c NULL, no label gets
+ *	generated.
+ * @param more	If \c true, more labels follow, so the result is meant to be
+ *	inserted right after the opening brace of a label set. Otherwise a
+ *	complete label set gets generated.
+ * @param buf	Where to store the result. Needs to be at least 48 bytes.
+ * @return	\c buf, which contains an empty string, if \c label is \c NULL.
+ */
+char *device_label(const char *label, bool more, char *buf);
 
 /**
  * @brief Convert a Sensor Unit Type Code (SDR byte 13) into a human readable
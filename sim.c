@@ -0,0 +1,1133 @@
+/*
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License") 1.1!
+ * You may not use this file except in compliance with the License.
+ *
+ * See  https://spdx.org/licenses/CDDL-1.1.html  for the specific
+ * language governing permissions and limitations under the License.
+ *
+ * Copyright 2022 Jens Elkner (jel+ipmimex-src@cs.ovgu.de)
+ */
+
+/**
+ * @file sim.c
+ * In-process BMC simulator backend. It answers the commands used by ipmimex
+ * from a description file, so that ipmimex can be run and benchmarked
+ * without any IPMI hardware. Like a real BMC it processes one request after
+ * another: each request takes the configured latency (+/- jitter) and
+ * answers become available in the order they have been completed.
+ *
+ * Description file format (one statement per line, '#' starts a comment,
+ * numbers may be given in decimal or 0x-hex):
+ *
+ *   device major.minor [manufacturer_id [product_id]]
+ *   repo last_add last_del
+ *   latency {*|netfn:cmd} ms [jitter_ms]
+ *   power current [min max avg [sample_seconds]]
+ *   sensor num category unit raw M B Rexp name ...
+ *   sensors count num category unit raw M B Rexp name ...
+ *   thresholds num lnr lcr lnc unc ucr unr   ('-' for n/a, raw values)
+ *   fail num {cc|hang}
+ *   maxread bytes
+ *   owner addr [channel [lun]]
+ *   bridge addr channel ms [jitter_ms]
+ *   fru id name ...
+ *   fruinfo id field value ...
+ *   sel sensor_type event_type offset [count]
+ *   selerase timestamp
+ *
+ * unit is the IPMI base unit code (table 43-15) or one of C, F, K, V, A, W,
+ * J or rpm. SDRs get record IDs in the order of the sensor statements.
+ * sensors adds count sensors at once, named "name 1" .. "name count" and
+ * numbered num, num + 1, ..., e.g. to benchmark large repos. After number 255
+ * the numbering continues with 0 on the next LUN of the current owner, and
+ * after LUN 3 on LUN 0 of the next IPMB slave address (+ 2), so that no two
+ * sensors share the same key. The current owner stays as is.
+ * Without a power statement DCMI commands get answered with 0xC1 (invalid
+ * command). fail lets the reading of the given sensor fail with the given
+ * completion code, or never be answered (hang). maxread lets Get SDR
+ * requests for more than the given number of bytes fail with 0xCA (cannot
+ * return number of requested data bytes), like small BMCs do.
+ *
+ * owner sets the owner of the sensors defined by the following statements,
+ * i.e. the SDR owner ID (8-bit IPMB slave address), channel and LUN (default:
+ * 0x20 0 0, the BMC itself). The sensor numbers used by thresholds and fail
+ * refer to sensors of the current owner. Sensors of another owner are
+ * answered only, if the request got bridged to this owner. bridge sets the
+ * time a satellite controller needs to answer a request bridged to it. Like
+ * the BMC it processes one request after another, but independent of the BMC
+ * and other satellites.
+ *
+ * fru adds a logical FRU device with the given ID to the current owner and a
+ * FRU Device Locator SDR with the given name for it. The FRU device 0 of the
+ * BMC gets no SDR, because it is implied. fruinfo sets a field of the FRU
+ * device with the given ID of the current owner. field is one of the label
+ * names of ipmimex_fru_info, e.g. board_serial. maxread applies to Read FRU
+ * Data requests as well.
+ *
+ * sel appends count (default: 1) system event records with the given sensor
+ * type, event/reading type and event offset (| 0x80 for deassertion events)
+ * to the SEL. Records get IDs in the order of the sel statements and one
+ * timestamp per second starting after the one given by selerase, which sets
+ * the most recent erase timestamp of the SEL. So appending sel statements
+ * simulates new events, changing selerase a cleared SEL.
+ *
+ * Get SDR requests for an offset > 0 need the ID of the last reservation,
+ * which gets canceled by re-reading the description file.
+ *
+ * If the description file gets modified, it gets re-read on the next request,
+ * so that changes of the SDR repository can be simulated. Remember to change
+ * the repo statement as well.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "ipmi_if.h"
+#include "ipmi_sdr.h"
+#include "ipmi_fru.h"
+#include "ipmi_sel.h"
+#include "ipmi_vdrv.h"
+
+#define NETFN_SE		0x4
+#define NETFN_APP		0x6
+#define NETFN_STORAGE	0xA
+#define NETFN_DCGRP		0x2C
+
+#define SIM_HANG		0x100		// fail code: never answer
+#define SIM_LAT_MAX		32			// max. number of latency statements
+#define SIM_BRIDGE_MAX	16			// max. number of bridge statements
+#define SIM_FRU_MAX		16			// max. number of fru statements
+#define SIM_FRU_SZ		1024		// max. size of the data of a FRU device
+#define SIM_SEL_MAX		32			// max. number of sel statements
+#define SIM_SEL_TS		0x62000000	// timestamp of the 1st SEL record
+#define SIM_LINE_MAX	512
+
+typedef struct sim_sensor {
+	sdr_full_t sdr;
+	uint8_t sdr_len;			// bytes used in sdr incl. header
+	uint8_t raw;				// raw reading
+	int fail;					// 0 .. ok, SIM_HANG or completion code
+	sdr_thresholds_t thresholds;
+	size_t next_num;			// index + 1 of the next one with this number
+} sim_sensor_t;
+
+typedef struct sim_lat {
+	int key;					// netfn << 8 | cmd, -1 .. default
+	long ms;
+	long jitter;
+} sim_lat_t;
+
+typedef struct sim_bridge {
+	uint8_t addr;				// IPMB slave address of the satellite
+	uint8_t channel;
+	long ms;
+	long jitter;
+	long busy;					// CLOCK_MONOTONIC ms when it gets idle
+} sim_bridge_t;
+
+typedef struct sim_fru {
+	sdr_key_t owner;			// the controller, sensor_num is unused
+	uint8_t id;					// FRU device ID
+	char field[FRU_FIELDS][64];	// '\0' .. n/a
+	uint16_t len;				// bytes used in data, 0 .. not yet built
+	uint8_t data[SIM_FRU_SZ];
+} sim_fru_t;
+
+typedef struct sim_sel {
+	uint8_t sensor_type;
+	uint8_t event_type;
+	uint8_t offset;				// [7] deassertion, [3:0] event offset
+	uint16_t count;				// number of records
+} sim_sel_t;
+
+struct ipmi_drv {
+	char *path;
+	time_t mtime;				// of the description file when read
+	off_t size;
+	ipmi_bmc_info_t info;
+	sdr_repo_info_t repo;
+	bool has_power;
+	sdr_power_t power;
+	sim_sensor_t *sensor;
+	size_t sensors;
+	size_t sz;
+	size_t by_num[256];			// index + 1 of the 1st sensor with this number
+	sim_lat_t lat[SIM_LAT_MAX];
+	size_t lats;
+	sim_bridge_t bridge[SIM_BRIDGE_MAX];
+	size_t bridges;
+	sdr_key_t owner;			// of the sensors to add
+	sim_fru_t fru[SIM_FRU_MAX];
+	size_t frus;
+	sim_sel_t sel[SIM_SEL_MAX];
+	size_t sels;
+	uint32_t sel_entries;		// number of SEL records
+	uint32_t sel_erased;		// most recent erase timestamp, 0 .. never
+
+	uint8_t maxread;			// max. bytes per Get SDR, 0 .. no limit
+	uint16_t reservation;		// ID of the current SDR repo reservation
+	uint32_t seed;				// xorshift state for the jitter
+	long busy;					// CLOCK_MONOTONIC ms when the BMC gets idle
+	vdrv_rsp_t *pending;		// answers sorted by due time
+};
+
+static long
+num(const char *s, bool *ok) {
+	char *e;
+	long v;
+
+	if (s == NULL) {
+		*ok = false;
+		return 0;
+	}
+	v = strtol(s, &e, 0);
+	if (e == s || *e != '\0')
+		*ok = false;
+	return v;
+}
+
+static int
+unit_code(const char *s, bool *ok) {
+	static const char *name[] = { "", "C", "F", "K", "V", "A", "W", "J" };
+	size_t i;
+
+	if (s == NULL) {
+		*ok = false;
+		return 0;
+	}
+	for (i = 1; i < ARRAY_SIZE(name); i++) {
+		if (strcmp(s, name[i]) == 0)
+			return i;
+	}
+	if (strcasecmp(s, "rpm") == 0)
+		return 18;
+	return num(s, ok);
+}
+
+// the sensor with the given number owned by the given owner
+static sim_sensor_t *
+find_sensor(ipmi_drv_t *drv, const sdr_key_t *owner, uint8_t snum) {
+	size_t i;
+
+	for (i = drv->by_num[snum]; i != 0; i = drv->sensor[i - 1].next_num) {
+		sdr_key_t *k = &(drv->sensor[i - 1].sdr.keys);
+		if (k->owner_id == owner->owner_id && k->owner_lun == owner->owner_lun)
+			return &(drv->sensor[i - 1]);
+	}
+	return NULL;
+}
+
+// a new, zeroed SDR slot at the end of the repo. Not counted yet.
+static sim_sensor_t *
+new_sdr(ipmi_drv_t *drv) {
+	sim_sensor_t *s;
+	size_t len;
+
+	if (drv->sensors == drv->sz) {
+		len = drv->sz == 0 ? 64 : drv->sz * 2;
+		s = realloc(drv->sensor, len * sizeof(sim_sensor_t));
+		if (s == NULL)
+			return NULL;
+		drv->sensor = s;
+		drv->sz = len;
+	}
+	s = &(drv->sensor[drv->sensors]);
+	memset(s, 0, sizeof(sim_sensor_t));
+	return s;
+}
+
+static int
+add_sensor(ipmi_drv_t *drv, char **tok, char *name) {
+	sim_sensor_t *s;
+	sdr_full_t *sdr;
+	bool ok = true;
+	long snum = num(tok[1], &ok), cat = num(tok[2], &ok),
+		unit = unit_code(tok[3], &ok), raw = num(tok[4], &ok),
+		M = num(tok[5], &ok), B = num(tok[6], &ok), R = num(tok[7], &ok);
+	size_t len;
+
+	if (!ok || name == NULL || snum < 0 || snum > 255 || raw < 0 || raw > 255
+		|| M < -512 || M > 511 || B < -512 || B > 511 || R < -8 || R > 7)
+	{
+		return 1;
+	}
+	if ((s = new_sdr(drv)) == NULL)
+		return 1;
+	s->raw = raw;
+	sdr = &(s->sdr);
+	sdr->id = drv->sensors + 1;
+	sdr->version = 0x51;
+	sdr->type = SDR_TYPE_FULL_SENSOR;
+	sdr->keys = drv->owner;
+	sdr->keys.sensor_num = snum;
+	sdr->init_scanning = sdr->init_events = 1;
+	sdr->scanning_enabled = sdr->events_enabled = 1;
+	sdr->threshold_support = 1;
+	sdr->category = cat;
+	sdr->evt_type = 1;
+	sdr->unit.base = unit;
+	sdr->factors.M_ls = M & 0xFF;
+	sdr->factors.M_ms = (M >> 8) & 3;
+	sdr->factors.B_ls = B & 0xFF;
+	sdr->factors.B_ms = (B >> 8) & 3;
+	sdr->factors.R = R & 0xF;
+	sdr->sensor_max = 0xFF;
+	len = strlen(name);
+	if (len > sizeof(sdr->name.raw))
+		len = sizeof(sdr->name.raw);
+	sdr->name.fmt = 3;
+	sdr->name.len = len;
+	memcpy(sdr->name.raw, name, len);
+	s->sdr_len = offsetof(sdr_full_t, name) + 1 + len;
+	sdr->size = s->sdr_len - 5;
+	drv->sensors++;
+	if (drv->by_num[snum] == 0) {
+		drv->by_num[snum] = drv->sensors;
+	} else {
+		for (len = drv->by_num[snum]; drv->sensor[len - 1].next_num != 0;
+			len = drv->sensor[len - 1].next_num)
+			;
+		drv->sensor[len - 1].next_num = drv->sensors;
+	}
+	return 0;
+}
+
+// sensors count num category unit raw M B Rexp name ...
+static int
+add_sensors(ipmi_drv_t *drv, char **tok, char *rest) {
+	char *stok[8], *name, *last, nbuf[8], buf[SIM_LINE_MAX];
+	bool ok = true;
+	long count = num(tok[1], &ok), snum = num(tok[2], &ok), i, k, lun, addr;
+	sdr_key_t owner = drv->owner;
+	int res = 0;
+
+	if (!ok || count < 1 || count > 0xFFFE || snum < 0 || snum > 255
+		|| rest == NULL)
+	{
+		return 1;
+	}
+	stok[0] = tok[0];
+	stok[1] = nbuf;
+	memcpy(stok + 2, tok + 3, 5 * sizeof(char *));
+	stok[7] = strtok_r(rest, " \t", &last);
+	name = strtok_r(NULL, "\r\n", &last);
+	if (name == NULL)
+		return 1;
+	for (i = 0; i < count && res == 0; i++) {
+		// 256 sensors per LUN, 4 LUNs per controller
+		k = (owner.owner_lun & 0x3) + (snum + i) / 256;
+		lun = k & 0x3;
+		addr = owner.owner_id + 2 * (k >> 2);
+		if (addr > 0xFE) {
+			res = 1;
+			break;
+		}
+		drv->owner.owner_id = addr;
+		drv->owner.owner_lun = (owner.owner_lun & ~0x3) | lun;
+		sprintf(nbuf, "%ld", (snum + i) & 0xFF);
+		snprintf(buf, sizeof(buf), "%s %ld", name, i + 1);
+		res = add_sensor(drv, stok, buf);
+	}
+	drv->owner = owner;
+	return res;
+}
+
+// the logical FRU device with the given ID of the given controller
+static sim_fru_t *
+find_fru(ipmi_drv_t *drv, const sdr_key_t *owner, uint8_t id) {
+	size_t i;
+
+	for (i = 0; i < drv->frus; i++) {
+		sim_fru_t *f = &(drv->fru[i]);
+		if (f->id == id && f->owner.owner_id == owner->owner_id
+			&& f->owner.owner_lun == owner->owner_lun)
+		{
+			return f;
+		}
+	}
+	return NULL;
+}
+
+// fru id name
+static int
+add_fru(ipmi_drv_t *drv, char **tok, char *name) {
+	sdr_fru_locator_t *loc;
+	sim_sensor_t *s;
+	sim_fru_t *f;
+	bool ok = true;
+	long id = num(tok[1], &ok);
+	size_t len;
+
+	if (!ok || name == NULL || id < 0 || id > 0xFE
+		|| drv->frus == SIM_FRU_MAX || find_fru(drv, &(drv->owner), id))
+	{
+		return 1;
+	}
+	f = &(drv->fru[drv->frus++]);
+	memset(f, 0, sizeof(sim_fru_t));
+	f->owner = drv->owner;
+	f->id = id;
+	if (id == 0 && drv->owner.owner_id == IPMI_BMC_SA
+		&& drv->owner.owner_lun == 0)
+	{
+		return 0;
+	}
+	if ((s = new_sdr(drv)) == NULL)
+		return 1;
+	// the slot is big enough for any SDR
+	loc = (sdr_fru_locator_t *) &(s->sdr);
+	loc->id = drv->sensors + 1;
+	loc->version = 0x51;
+	loc->type = SDR_TYPE_FRU_LOCATOR;
+	loc->access_addr = drv->owner.owner_id;
+	loc->fru_id = id;
+	loc->is_logical = 1;
+	loc->lun = drv->owner.lun;
+	loc->channel = drv->owner.channel;
+	loc->dev_type = 0x10;		// FRU inventory device behind an MC
+	len = strlen(name);
+	if (len > sizeof(loc->name.raw))
+		len = sizeof(loc->name.raw);
+	loc->name.fmt = 3;
+	loc->name.len = len;
+	memcpy(loc->name.raw, name, len);
+	s->sdr_len = offsetof(sdr_fru_locator_t, name) + 1 + len;
+	loc->size = s->sdr_len - 5;
+	drv->sensors++;
+	return 0;
+}
+
+// fruinfo id field value
+static int
+set_fruinfo(ipmi_drv_t *drv, char **tok, char *value) {
+	sim_fru_t *f;
+	bool ok = true;
+	int i;
+
+	f = find_fru(drv, &(drv->owner), num(tok[1], &ok));
+	if (!ok || f == NULL || tok[2] == NULL || value == NULL
+		|| strlen(value) >= sizeof(f->field[0]))
+	{
+		return 1;
+	}
+	for (i = 0; i < FRU_FIELDS; i++) {
+		if (strcmp(tok[2], fru_field2str(i)) == 0) {
+			strcpy(f->field[i], value);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// sel sensor_type event_type offset [count]
+static int
+add_sel(ipmi_drv_t *drv, char **tok) {
+	sim_sel_t *e;
+	bool ok = true;
+	long type = num(tok[1], &ok), evt = num(tok[2], &ok),
+		off = num(tok[3], &ok), count = 1;
+
+	if (tok[4] != NULL)
+		count = num(tok[4], &ok);
+	if (!ok || drv->sels == SIM_SEL_MAX || type < 0 || type > 0xFF || evt < 0
+		|| evt > 0x7F || off < 0 || off > 0xFF || (off & 0x70) != 0
+		|| count < 1 || drv->sel_entries + count > 0xFFFE)
+	{
+		return 1;
+	}
+	e = &(drv->sel[drv->sels++]);
+	e->sensor_type = type;
+	e->event_type = evt;
+	e->offset = off;
+	e->count = count;
+	drv->sel_entries += count;
+	return 0;
+}
+
+// the timestamp of the SEL record with the given index
+static uint32_t
+sel_ts(ipmi_drv_t *drv, uint32_t idx) {
+	return (drv->sel_erased < SIM_SEL_TS ? SIM_SEL_TS : drv->sel_erased + 1)
+		+ idx;
+}
+
+// the SEL record with the given index
+static void
+get_sel_record(ipmi_drv_t *drv, uint32_t idx, sel_record_t *rec) {
+	sim_sel_t *e = drv->sel;
+	uint32_t n = idx;
+
+	while (n >= e->count) {
+		n -= e->count;
+		e++;
+	}
+	memset(rec, 0, sizeof(sel_record_t));
+	rec->id = idx + 1;
+	rec->type = SEL_RECORD_SYSTEM;
+	rec->timestamp = sel_ts(drv, idx);
+	rec->generator = IPMI_BMC_SA;
+	rec->evm_rev = 0x04;
+	rec->sensor_type = e->sensor_type;
+	rec->sensor_num = e - drv->sel + 1;
+	rec->deassertion = e->offset >> 7;
+	rec->event_type = e->event_type;
+	rec->data[0] = e->offset & 0x0F;
+	rec->data[1] = rec->data[2] = 0xFF;
+}
+
+// the tokens from index k on as one string, i.e. undo their splitting
+static char *
+rest_of(char **tok, int n, int k, char *name) {
+	int i;
+
+	if (k >= n)
+		return name;
+	for (i = k; i < n - 1; i++)
+		tok[i][strlen(tok[i])] = ' ';
+	if (name != NULL)
+		tok[n - 1][strlen(tok[n - 1])] = ' ';
+	return tok[k];
+}
+
+static int
+set_thresholds(ipmi_drv_t *drv, char **tok) {
+	// statement order: lnr lcr lnc unc ucr unr
+	static const uint8_t readable[6] = { 0x04, 0x02, 0x01, 0x08, 0x10, 0x20 };
+	sdr_thresholds_t *t;
+	sim_sensor_t *s;
+	bool ok = true;
+	long v;
+	int i;
+
+	s = find_sensor(drv, &(drv->owner), num(tok[1], &ok));
+	if (!ok || s == NULL)
+		return 1;
+	t = &(s->thresholds);
+	uint8_t *val[6] = { &(t->lower_nr), &(t->lower_cr), &(t->lower_nc),
+		&(t->upper_nc), &(t->upper_cr), &(t->upper_nr) };
+	uint8_t *sval[6] = { &(s->sdr.threshold.lower.nr),
+		&(s->sdr.threshold.lower.cr), &(s->sdr.threshold.lower.nc),
+		&(s->sdr.threshold.upper.nc), &(s->sdr.threshold.upper.cr),
+		&(s->sdr.threshold.upper.nr) };
+
+	t->readable.value = 0;
+	for (i = 0; i < 6; i++) {
+		if (tok[i + 2] == NULL)
+			return 1;
+		if (strcmp(tok[i + 2], "-") == 0)
+			continue;
+		v = num(tok[i + 2], &ok);
+		if (!ok || v < 0 || v > 255)
+			return 1;
+		*(val[i]) = *(sval[i]) = v;
+		t->readable.value |= readable[i];
+	}
+	s->sdr.mask.discrete = t->readable.value;
+	return 0;
+}
+
+static int
+parse_line(ipmi_drv_t *drv, char *line) {
+	char *tok[10], *name = NULL, *p, *last;
+	bool ok = true;
+	int n = 0;
+	long v;
+
+	if ((p = strchr(line, '#')) != NULL)
+		*p = '\0';
+	memset(tok, 0, sizeof(tok));
+	for (p = strtok_r(line, " \t\r\n", &last); p != NULL && n < 8;
+		p = strtok_r(NULL, " \t\r\n", &last))
+	{
+		tok[n++] = p;
+	}
+	if (n == 0)
+		return 0;
+	if (p != NULL) {
+		// sensor names may contain spaces: rest of the line
+		name = p;
+		p = strtok_r(NULL, "\r\n", &last);
+		if (p != NULL)
+			p[-1] = ' ';
+	}
+
+	if (strcmp(tok[0], "sensor") == 0)
+		return add_sensor(drv, tok, name);
+	if (strcmp(tok[0], "sensors") == 0)
+		return add_sensors(drv, tok, name);
+	if (strcmp(tok[0], "thresholds") == 0)
+		return set_thresholds(drv, tok);
+	if (strcmp(tok[0], "fail") == 0) {
+		sim_sensor_t *s = find_sensor(drv, &(drv->owner), num(tok[1], &ok));
+		if (!ok || s == NULL || tok[2] == NULL)
+			return 1;
+		s->fail = strcmp(tok[2], "hang") == 0 ? SIM_HANG : num(tok[2], &ok);
+		return ok ? 0 : 1;
+	}
+	if (strcmp(tok[0], "device") == 0) {
+		long major, minor = 0;
+		if (tok[1] == NULL)
+			return 1;
+		major = strtol(tok[1], &p, 10);
+		if (*p == '.')
+			minor = strtol(p + 1, &p, 16);
+		if (*p != '\0' || major < 0 || major > 127 || minor < 0 || minor > 255)
+			return 1;
+		drv->info.fw_rev_major = major;
+		drv->info.fw_rev_minor = minor;
+		if (tok[2] != NULL) {
+			v = num(tok[2], &ok);
+			drv->info.manufacturer_id[0] = v & 0xFF;
+			drv->info.manufacturer_id[1] = (v >> 8) & 0xFF;
+			drv->info.manufacturer_id[2] = (v >> 16) & 0x0F;
+		}
+		if (tok[3] != NULL) {
+			v = num(tok[3], &ok);
+			drv->info.product_id[0] = v & 0xFF;
+			drv->info.product_id[1] = (v >> 8) & 0xFF;
+		}
+		return ok ? 0 : 1;
+	}
+	if (strcmp(tok[0], "repo") == 0) {
+		drv->repo.last_add = num(tok[1], &ok);
+		drv->repo.last_del = num(tok[2], &ok);
+		return ok ? 0 : 1;
+	}
+	if (strcmp(tok[0], "latency") == 0) {
+		sim_lat_t *l;
+		if (drv->lats == SIM_LAT_MAX || tok[1] == NULL)
+			return 1;
+		l = &(drv->lat[drv->lats]);
+		if (strcmp(tok[1], "*") == 0) {
+			l->key = -1;
+		} else {
+			v = strtol(tok[1], &p, 0);
+			if (*p != ':')
+				return 1;
+			l->key = (v << 8) | (strtol(p + 1, &p, 0) & 0xFF);
+			if (*p != '\0')
+				return 1;
+		}
+		l->ms = num(tok[2], &ok);
+		l->jitter = tok[3] == NULL ? 0 : num(tok[3], &ok);
+		if (!ok || l->ms < 0 || l->jitter < 0)
+			return 1;
+		drv->lats++;
+		return 0;
+	}
+	if (strcmp(tok[0], "owner") == 0) {
+		long addr = num(tok[1], &ok), ch = 0, lun = 0;
+		if (tok[2] != NULL)
+			ch = num(tok[2], &ok);
+		if (tok[3] != NULL)
+			lun = num(tok[3], &ok);
+		if (!ok || addr < 0 || addr > 0xFF || ch < 0 || ch >= IPMI_CHANNELS
+			|| lun < 0 || lun > 3)
+		{
+			return 1;
+		}
+		drv->owner.owner_id = addr;
+		drv->owner.owner_lun = (ch << 4) | lun;
+		return 0;
+	}
+	if (strcmp(tok[0], "bridge") == 0) {
+		sim_bridge_t *b;
+		if (drv->bridges == SIM_BRIDGE_MAX)
+			return 1;
+		b = &(drv->bridge[drv->bridges]);
+		memset(b, 0, sizeof(sim_bridge_t));
+		v = num(tok[1], &ok);
+		b->addr = v;
+		if (!ok || v < 1 || v > 0xFF)
+			return 1;
+		v = num(tok[2], &ok);
+		b->channel = v;
+		b->ms = num(tok[3], &ok);
+		b->jitter = tok[4] == NULL ? 0 : num(tok[4], &ok);
+		if (!ok || v < 0 || v >= IPMI_CHANNELS || b->ms < 0 || b->jitter < 0)
+			return 1;
+		drv->bridges++;
+		return 0;
+	}
+	if (strcmp(tok[0], "fru") == 0)
+		return add_fru(drv, tok, rest_of(tok, n, 2, name));
+	if (strcmp(tok[0], "fruinfo") == 0)
+		return set_fruinfo(drv, tok, rest_of(tok, n, 3, name));
+	if (strcmp(tok[0], "sel") == 0)
+		return add_sel(drv, tok);
+	if (strcmp(tok[0], "selerase") == 0) {
+		drv->sel_erased = num(tok[1], &ok);
+		return ok ? 0 : 1;
+	}
+	if (strcmp(tok[0], "maxread") == 0) {
+		v = num(tok[1], &ok);
+		if (!ok || v < 1 || v > 0xFF)
+			return 1;
+		drv->maxread = v;
+		return 0;
+	}
+	if (strcmp(tok[0], "power") == 0) {
+		drv->power.grp_xid = 0xDC;
+		drv->power.curr = num(tok[1], &ok);
+		drv->power.min = tok[2] == NULL ? drv->power.curr : num(tok[2], &ok);
+		drv->power.max = tok[3] == NULL ? drv->power.curr : num(tok[3], &ok);
+		drv->power.avg = tok[4] == NULL ? drv->power.curr : num(tok[4], &ok);
+		drv->power.sample_time = 1000 * (tok[5] == NULL ? 1 : num(tok[5], &ok));
+		drv->power.state = 0x40;
+		drv->has_power = ok;
+		return ok ? 0 : 1;
+	}
+	return 1;
+}
+
+static void ipmi_drv_close(ipmi_drv_t *drv);
+
+// (re-)read the description file
+static int
+load(ipmi_drv_t *drv) {
+	char line[SIM_LINE_MAX];
+	struct stat st;
+	FILE *f;
+	int n = 0;
+
+	if ((f = fopen(drv->path, "r")) == NULL) {
+		PROM_FATAL("Unable to open '%s': %s", drv->path, strerror(errno));
+		return 1;
+	}
+	if (fstat(fileno(f), &st) == 0) {
+		drv->mtime = st.st_mtime;
+		drv->size = st.st_size;
+	}
+	drv->sensors = 0;
+	memset(drv->by_num, 0, sizeof(drv->by_num));
+	drv->lats = 0;
+	drv->bridges = 0;
+	drv->frus = 0;
+	drv->sels = 0;
+	drv->sel_entries = 0;
+	drv->sel_erased = 0;
+	memset(&(drv->owner), 0, sizeof(sdr_key_t));
+	drv->owner.owner_id = IPMI_BMC_SA;
+	drv->maxread = 0;
+	drv->reservation++;
+	drv->has_power = false;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		n++;
+		if (parse_line(drv, line) != 0) {
+			PROM_FATAL("%s:%d: invalid statement.", drv->path, n);
+			fclose(f);
+			return 1;
+		}
+	}
+	fclose(f);
+	drv->repo.sdr_count = drv->sensors;
+	drv->info.supports_fru = drv->frus > 0;
+	drv->info.supports_sel = drv->sels > 0 || drv->sel_erased != 0;
+	PROM_INFO("Simulating %zu sensors.", drv->sensors);
+	return 0;
+}
+
+// re-read the description file, if it has been modified
+static void
+reload(ipmi_drv_t *drv) {
+	struct stat st;
+
+	if (stat(drv->path, &st) != 0 || (st.st_mtime == drv->mtime
+		&& st.st_size == drv->size))
+	{
+		return;
+	}
+	PROM_INFO("Reloading simulator '%s' ...", drv->path);
+	if (load(drv) != 0)
+		PROM_WARN("Simulator '%s' is in an inconsistent state.", drv->path);
+}
+
+static ipmi_drv_t *
+ipmi_drv_open(char *dev) {
+	ipmi_drv_t *drv;
+
+	if (dev == NULL || *dev == '\0') {
+		PROM_FATAL("No simulator description file given.", "");
+		return NULL;
+	}
+	drv = calloc(1, sizeof(ipmi_drv_t));
+	if (drv == NULL) {
+		PROM_FATAL("Unable to allocate simulator handle.", "");
+		return NULL;
+	}
+	drv->path = strdup(dev);
+	drv->info.rev = 1;
+	drv->info.fw_rev_major = 1;
+	drv->info.ipmi_version = 0x02;
+	drv->info.supports_sensor = drv->info.supports_sdr_repo = 1;
+	drv->repo.version = 0x51;
+	drv->repo.last_add = 1;
+	drv->repo.supported_ops = 0x02;		// reserve SDR repo supported
+	drv->seed = 0x2545F491;
+
+	PROM_INFO("Using BMC simulator '%s' ...", dev);
+	if (drv->path == NULL || load(drv) != 0) {
+		ipmi_drv_close(drv);
+		return NULL;
+	}
+	return drv;
+}
+
+static void
+ipmi_drv_close(ipmi_drv_t *drv) {
+	if (drv == NULL)
+		return;
+	vdrv_flush(&(drv->pending));
+	free(drv->sensor);
+	free(drv->path);
+	free(drv);
+}
+
+// ms +/- a random value <= jitter
+static long
+jittered(ipmi_drv_t *drv, long ms, long jitter) {
+	if (jitter > 0) {
+		drv->seed ^= drv->seed << 13;
+		drv->seed ^= drv->seed >> 17;
+		drv->seed ^= drv->seed << 5;
+		ms += (long) (drv->seed % (2 * jitter + 1)) - jitter;
+	}
+	return ms < 0 ? 0 : ms;
+}
+
+// the time the BMC needs to answer the given request
+static long
+latency(ipmi_drv_t *drv, struct ipmi_rq *req) {
+	int key = (req->msg.netfn << 8) | req->msg.cmd;
+	sim_lat_t *l = NULL;
+	size_t i;
+
+	for (i = 0; i < drv->lats; i++) {
+		if (drv->lat[i].key == key) {
+			l = &(drv->lat[i]);
+			break;
+		}
+		if (drv->lat[i].key == -1)
+			l = &(drv->lat[i]);
+	}
+	return l == NULL ? 0 : jittered(drv, l->ms, l->jitter);
+}
+
+// the satellite the given request got bridged to, NULL if it is unknown or
+// the request is for the BMC
+static sim_bridge_t *
+find_bridge(ipmi_drv_t *drv, struct ipmi_rq *req) {
+	size_t i;
+
+	for (i = 0; req->addr != 0 && i < drv->bridges; i++) {
+		if (drv->bridge[i].addr == req->addr
+			&& drv->bridge[i].channel == req->channel)
+		{
+			return &(drv->bridge[i]);
+		}
+	}
+	return NULL;
+}
+
+// build the data of the given FRU device from its fields, i.e. the common
+// header followed by the chassis, board and product info area, if it has
+// any of their fields (FRU spec, 8 .. 12).
+static void
+build_fru(sim_fru_t *f) {
+	static const struct {
+		uint8_t skip;		// bytes preceding the 1st field
+		fru_field_t first;
+		fru_field_t last;
+	} area[] = {
+		{ 3, FRU_CHASSIS_PART, FRU_CHASSIS_SERIAL },
+		{ 6, FRU_BOARD_MANUFACTURER, FRU_BOARD_PART },
+		{ 3, FRU_PRODUCT_MANUFACTURER, FRU_PRODUCT_ASSET_TAG },
+	};
+	uint8_t *d = f->data;
+	size_t i, k, n, o, len = 8;
+
+	memset(d, 0, sizeof(f->data));
+	d[0] = 1;					// format version
+	for (i = 0; i < ARRAY_SIZE(area); i++) {
+		for (k = area[i].first; k <= area[i].last && f->field[k][0] == '\0';
+			k++)
+			;
+		if (k > area[i].last)
+			continue;
+		o = len;
+		d[o] = 1;
+		if (i == 0)
+			d[o + 2] = 0x17;	// rack mount chassis
+		len += area[i].skip;
+		for (k = area[i].first; k <= area[i].last; k++) {
+			n = strlen(f->field[k]);
+			d[len++] = 0xC0 | n;	// 8-bit ASCII + Latin 1
+			memcpy(d + len, f->field[k], n);
+			len += n;
+		}
+		d[len++] = 0xC1;		// end of fields
+		len = (len + 8) & ~7;	// incl. checksum, multiple of 8 bytes
+		d[o + 1] = (len - o) / 8;
+		d[len - 1] = -fru_checksum(d + o, len - o - 1);
+		d[i + 2] = o / 8;
+	}
+	d[7] = -fru_checksum(d, 7);
+	f->len = len;
+}
+
+// the target of the given request as sensor owner
+static void
+req_target(struct ipmi_rq *req, sdr_key_t *target) {
+	memset(target, 0, sizeof(sdr_key_t));
+	target->owner_id = req->addr == 0 ? IPMI_BMC_SA : req->addr;
+	target->owner_lun = (req->addr == 0 ? 0 : req->channel << 4)
+		| req->msg.lun;
+}
+
+// answer the given request. Returns false if it should not be answered at all.
+static bool
+answer(ipmi_drv_t *drv, struct ipmi_rq *req, struct ipmi_rs *rs) {
+	uint8_t *d = req->msg.data;
+	int n = req->msg.data_len;
+	sim_sensor_t *s;
+	sdr_key_t target;
+	size_t i;
+
+	rs->ccode = 0;
+	rs->data_len = 0;
+	switch ((req->msg.netfn << 8) | req->msg.cmd) {
+		case (NETFN_APP << 8) | 0x01:		// Get Device ID
+			memcpy(rs->data, &(drv->info), sizeof(ipmi_bmc_info_t));
+			rs->data_len = sizeof(ipmi_bmc_info_t);
+			return true;
+		case (NETFN_STORAGE << 8) | 0x20:	// Get SDR Repository Info
+			memcpy(rs->data, &(drv->repo), sizeof(sdr_repo_info_t));
+			rs->data_len = sizeof(sdr_repo_info_t);
+			return true;
+		case (NETFN_STORAGE << 8) | 0x22:	// Reserve SDR Repository
+			if (++drv->reservation == 0)
+				drv->reservation++;
+			memcpy(rs->data, &(drv->reservation), 2);
+			rs->data_len = 2;
+			return true;
+		case (NETFN_STORAGE << 8) | 0x23: {	// Get SDR
+			sdr_reservation_t r;
+			uint16_t next;
+			int len;
+
+			if (n < (int) sizeof(r)) {
+				rs->ccode = 0xC7;			// request data length invalid
+				return true;
+			}
+			memcpy(&r, d, sizeof(r));
+			if (r.offset > 0 && r.id != drv->reservation) {
+				rs->ccode = SDR_CC_RESERVATION_CANCELED;
+				return true;
+			}
+			i = (r.record_id == 0) ? 0 : r.record_id - 1;
+			if (i >= drv->sensors) {
+				rs->ccode = SDR_CC_SENSOR_NOT_FOUND;
+				return true;
+			}
+			s = &(drv->sensor[i]);
+			len = s->sdr_len - r.offset;
+			if (len < 0)
+				len = 0;
+			if (r.len != 0xFF && r.len < len)
+				len = r.len;
+			if (drv->maxread > 0 && len > drv->maxread) {
+				rs->ccode = SDR_CC_BUFFER_TOO_SMALL;
+				return true;
+			}
+			next = (i + 1 == drv->sensors) ? 0xFFFF : i + 2;
+			memcpy(rs->data, &next, 2);
+			memcpy(rs->data + 2, ((uint8_t *) &(s->sdr)) + r.offset, len);
+			rs->data_len = 2 + len;
+			return true;
+		}
+		case (NETFN_STORAGE << 8) | 0x10:	// Get FRU Inventory Area Info
+		case (NETFN_STORAGE << 8) | 0x11: {	// Read FRU Data
+			sim_fru_t *f;
+			int off, len;
+
+			if (n < (req->msg.cmd == 0x10 ? 1 : 4)) {
+				rs->ccode = 0xC7;
+				return true;
+			}
+			req_target(req, &target);
+			if ((f = find_fru(drv, &target, d[0])) == NULL) {
+				rs->ccode = SDR_CC_SENSOR_NOT_FOUND;
+				return true;
+			}
+			if (f->len == 0)
+				build_fru(f);
+			if (req->msg.cmd == 0x10) {
+				rs->data[0] = f->len & 0xFF;
+				rs->data[1] = f->len >> 8;
+				rs->data[2] = 0;		// accessed by bytes
+				rs->data_len = 3;
+				return true;
+			}
+			off = d[1] | (d[2] << 8);
+			if (off >= f->len) {
+				rs->ccode = 0xC9;		// parameter out of range
+				return true;
+			}
+			len = f->len - off;
+			if (d[3] < len)
+				len = d[3];
+			if (drv->maxread > 0 && len > drv->maxread) {
+				rs->ccode = SDR_CC_BUFFER_TOO_SMALL;
+				return true;
+			}
+			rs->data[0] = len;
+			memcpy(rs->data + 1, f->data + off, len);
+			rs->data_len = 1 + len;
+			return true;
+		}
+		case (NETFN_STORAGE << 8) | 0x40: {	// Get SEL Info
+			sel_info_t *info = (sel_info_t *) rs->data;
+			size_t room = (0xFFFE - drv->sel_entries) * sizeof(sel_record_t);
+
+			memset(info, 0, sizeof(sel_info_t));
+			info->version = 0x51;
+			info->entries = drv->sel_entries;
+			info->free = room > 0xFFFE ? 0xFFFE : room;
+			info->last_add = drv->sel_entries == 0
+				? 0xFFFFFFFF : sel_ts(drv, drv->sel_entries - 1);
+			info->last_del = drv->sel_erased == 0
+				? 0xFFFFFFFF : drv->sel_erased;
+			rs->data_len = sizeof(sel_info_t);
+			return true;
+		}
+		case (NETFN_STORAGE << 8) | 0x43: {	// Get SEL Entry
+			sel_record_t rec;
+			uint32_t id;
+			uint16_t next;
+
+			if (n < 6) {
+				rs->ccode = 0xC7;
+				return true;
+			}
+			id = d[2] | (d[3] << 8);
+			if (id == 0xFFFF)
+				id = drv->sel_entries;
+			else if (id == 0)
+				id = 1;
+			if (id == 0 || id > drv->sel_entries) {
+				rs->ccode = SDR_CC_SENSOR_NOT_FOUND;
+				return true;
+			}
+			get_sel_record(drv, id - 1, &rec);
+			next = (id == drv->sel_entries) ? 0xFFFF : id + 1;
+			memcpy(rs->data, &next, 2);
+			memcpy(rs->data + 2, &rec, sizeof(rec));
+			rs->data_len = 2 + sizeof(rec);
+			return true;
+		}
+		case (NETFN_SE << 8) | 0x2D:		// Get Sensor Reading
+		case (NETFN_SE << 8) | 0x27:		// Get Sensor Thresholds
+		case (NETFN_SE << 8) | 0x23:		// Get Sensor Reading Factors
+			if (n < 1) {
+				rs->ccode = 0xC7;
+				return true;
+			}
+			req_target(req, &target);
+			s = find_sensor(drv, &target, d[0]);
+			if (s == NULL) {
+				rs->ccode = SDR_CC_SENSOR_NOT_FOUND;
+				return true;
+			}
+			if (req->msg.cmd == 0x27) {
+				memcpy(rs->data, &(s->thresholds), sizeof(sdr_thresholds_t));
+				rs->data_len = sizeof(sdr_thresholds_t);
+			} else if (req->msg.cmd == 0x23) {
+				rs->data[0] = 0;		// next reading: none
+				memcpy(rs->data + 1, ((uint8_t *) &(s->sdr.factors)) + 1,
+					sizeof(sdr_factors_t) - 1);
+				rs->data_len = sizeof(sdr_factors_t);
+			} else if (s->fail == SIM_HANG) {
+				return false;
+			} else if (s->fail != 0) {
+				rs->ccode = s->fail;
+			} else {
+				sdr_reading_t *r = (sdr_reading_t *) rs->data;
+				memset(r, 0, sizeof(sdr_reading_t));
+				r->value = s->raw;
+				r->events_enabled = r->scanning_enabled = 1;
+				rs->data_len = sizeof(sdr_reading_t);
+			}
+			return true;
+		case (NETFN_DCGRP << 8) | 0x02:		// DCMI Get Power Reading
+			if (!drv->has_power) {
+				rs->ccode = SDR_CC_INVALID_CMD;
+				return true;
+			}
+			drv->power.timestamp = time(NULL);
+			memcpy(rs->data, &(drv->power), sizeof(sdr_power_t));
+			rs->data_len = sizeof(sdr_power_t);
+			return true;
+	}
+	rs->ccode = SDR_CC_INVALID_CMD;
+	return true;
+}
+
+static int
+ipmi_drv_send(ipmi_drv_t *drv, struct ipmi_rq *req, long msgid,
+	long timeout)
+{
+	vdrv_rsp_t *r;
+	sim_bridge_t *b;
+	long now = now_ms();
+
+	(void) timeout;		// answers get due by the simulated latency
+	if (drv == NULL)
+		return -2;
+	reload(drv);
+	r = malloc(sizeof(vdrv_rsp_t));
+	if (r == NULL)
+		return -3;
+	r->msgid = msgid;
+	if (!answer(drv, req, &(r->rs))) {
+		free(r);
+		return 0;
+	}
+	// one request after another like a real BMC
+	if ((b = find_bridge(drv, req)) != NULL) {
+		if (b->busy < now)
+			b->busy = now;
+		b->busy += jittered(drv, b->ms, b->jitter);
+		r->due = b->busy;
+	} else {
+		if (drv->busy < now)
+			drv->busy = now;
+		drv->busy += latency(drv, req);
+		r->due = drv->busy;
+	}
+	vdrv_queue(&(drv->pending), r);
+	return 0;
+}
+
+static int
+ipmi_drv_recv(ipmi_drv_t *drv, struct ipmi_rs *rsp, long *msgid, long timeout)
+{
+	if (drv == NULL)
+		return -2;
+	return vdrv_recv(&(drv->pending), rsp, msgid, timeout);
+}
+
+const ipmi_drv_ops_t ipmi_drv_sim = {
+	.prefix = "sim:",
+	.open = ipmi_drv_open,
+	.close = ipmi_drv_close,
+	.send = ipmi_drv_send,
+	.recv = ipmi_drv_recv,
+	.fd = vdrv_fd
+};